@@ -12,10 +12,6 @@
 
 APU::APU(shared_ptr<Console> console)
 {
-	_nesModel = NesModel::Auto;
-	_apuEnabled = true;
-	_needToRun = false;
-
 	_console = console;
 	_mixer = _console->GetSoundMixer();
 	_settings = _console->GetSettings();
@@ -27,6 +23,15 @@ APU::APU(shared_ptr<Console> console)
 	_deltaModulationChannel.reset(new DeltaModulationChannel(AudioChannel::DMC, _console, _mixer.get()));
 	_frameCounter.reset(new ApuFrameCounter(_console));
 
+	PowerOn();
+}
+
+void APU::PowerOn()
+{
+	_nesModel = NesModel::Auto;
+	_apuEnabled = true;
+	_needToRun = false;
+
 	_console->GetMemoryManager()->RegisterIODevice(_squareChannel[0].get());
 	_console->GetMemoryManager()->RegisterIODevice(_squareChannel[1].get());
 	_console->GetMemoryManager()->RegisterIODevice(_frameCounter.get());
@@ -51,6 +51,8 @@ class APU : public Snapshotable, public IMemoryHandler
 		APU(std::shared_ptr<Console> console);
 		~APU();
 
+		//Registers the channels with the memory manager and restores their power-on state (used when power cycling)
+		void PowerOn();
 		void Reset(bool softReset);
 		void SetNesModel(NesModel model, bool forceInit = false);
 
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include "../Utilities/IpsPatcher.h"
 #include "BaseMapper.h"
+#include "SharedRomCache.h"
 #include "Console.h"
 #include "CheatManager.h"
 #include "MemoryManager.h"
@@ -506,22 +507,36 @@ void BaseMapper::Initialize(RomData &romData)
 	}
 
 	_allowRegisterRead = AllowRegisterRead();
+	_hasVramAddressHook = EnableVramAddressHook();
+	_hasCustomVramRead = EnableCustomVramRead();
 
-	memset(_isReadRegisterAddr, 0, sizeof(_isReadRegisterAddr));
-	memset(_isWriteRegisterAddr, 0, sizeof(_isWriteRegisterAddr));
+	_isReadRegisterAddr.reset();
+	_isWriteRegisterAddr.reset();
 	AddRegisterRange(RegisterStartAddress(), RegisterEndAddress(), MemoryOperation::Any);
 
-	_prgSize = (uint32_t)romData.PrgRom.size();
-	_chrRomSize = (uint32_t)romData.ChrRom.size();
-	_originalPrgRom = romData.PrgRom;
-	_originalChrRom = romData.ChrRom;
-
-	_prgRom = new uint8_t[_prgSize];
-	_chrRom = new uint8_t[_chrRomSize];
+	_prgSize = (uint32_t)romData.GetPrgRomSize();
+	_chrRomSize = (uint32_t)romData.GetChrRomSize();
+	if(_prgSize > 0) {
+		//The images are only looked up in the cache once, power cycles get them from the console's cached RomData
+		if(!romData.SharedPrgRom) {
+			romData.SharedPrgRom = SharedRomCache::GetImage(romData.PrgRom);
+		}
+		_sharedPrgRom = romData.SharedPrgRom;
+		_prgRom = _sharedPrgRom->data();
+		_prgRomShared = true;
+	} else {
+		_prgRom = new uint8_t[0];
+	}
 
-	memcpy(_prgRom, romData.PrgRom.data(), _prgSize);
 	if(_chrRomSize > 0) {
-		memcpy(_chrRom, romData.ChrRom.data(), _chrRomSize);
+		if(!romData.SharedChrRom) {
+			romData.SharedChrRom = SharedRomCache::GetImage(romData.ChrRom);
+		}
+		_sharedChrRom = romData.SharedChrRom;
+		_chrRom = _sharedChrRom->data();
+		_chrRomShared = true;
+	} else {
+		_chrRom = new uint8_t[0];
 	}
 
 	_hasChrBattery = romData.SaveChrRamSize > 0 || ForceChrBattery();
@@ -597,8 +612,12 @@ void BaseMapper::Initialize(RomData &romData)
 BaseMapper::~BaseMapper()
 {
 	delete[] _chrRam;
-	delete[] _chrRom;
-	delete[] _prgRom;
+	if(!_chrRomShared) {
+		delete[] _chrRom;
+	}
+	if(!_prgRomShared) {
+		delete[] _prgRom;
+	}
 	delete[] _saveRam;
 	delete[] _workRam;
 	delete[] _nametableRam;
@@ -744,6 +763,10 @@ void BaseMapper::DebugWriteRAM(uint16_t addr, uint8_t value)
 void BaseMapper::WritePrgRam(uint16_t addr, uint8_t value)
 {
 	if(_prgMemoryAccess[addr >> 8] & MemoryAccessType::Write) {
+		if(_prgRomShared && IsSharedPrgRom(_prgPages[addr >> 8])) {
+			//First write to PRG ROM, the mapper needs its own copy
+			MakePrgRomWritable();
+		}
 		_prgPages[addr >> 8][(uint8_t)addr] = value;
 	}
 }
@@ -754,16 +777,6 @@ void BaseMapper::NotifyVRAMAddressChange(uint16_t addr)
 	//Used by MMC3/MMC5/etc
 }
 
-uint8_t BaseMapper::InternalReadVRAM(uint16_t addr)
-{
-	if(_chrMemoryAccess[addr >> 8] & MemoryAccessType::Read) {
-		return _chrPages[addr >> 8][(uint8_t)addr];
-	}
-
-	//Open bus - "When CHR is disabled, the pattern tables are open bus. Theoretically, this should return the LSB of the address read, but real-world behavior varies."
-	return _vramOpenBusValue >= 0 ? _vramOpenBusValue : addr;
-}
-
 uint8_t BaseMapper::DebugReadVRAM(uint16_t addr, bool disableSideEffects)
 {
 	addr &= 0x3FFF;
@@ -784,12 +797,12 @@ void BaseMapper::DebugWriteVRAM(uint16_t addr, uint8_t value, bool disableSideEf
 	if(disableSideEffects) {
 		if(_chrPages[addr >> 8]) {
 			//Always allow writes when side-effects are disabled
-			_chrPages[addr >> 8][(uint8_t)addr] = value;
+			WriteChrPage(addr, value);
 		}
 	} else {
 		NotifyVRAMAddressChange(addr);
 		if(_chrMemoryAccess[addr >> 8] & MemoryAccessType::Write) {
-			_chrPages[addr >> 8][(uint8_t)addr] = value;
+			WriteChrPage(addr, value);
 		}
 	}
 }
@@ -797,10 +810,19 @@ void BaseMapper::DebugWriteVRAM(uint16_t addr, uint8_t value, bool disableSideEf
 void BaseMapper::WriteVRAM(uint16_t addr, uint8_t value)
 {
 	if(_chrMemoryAccess[addr >> 8] & MemoryAccessType::Write) {
-		_chrPages[addr >> 8][(uint8_t)addr] = value;
+		WriteChrPage(addr, value);
 	}
 }
 
+void BaseMapper::WriteChrPage(uint16_t addr, uint8_t value)
+{
+	if(_chrRomShared && IsSharedChrRom(_chrPages[addr >> 8])) {
+		//First write to CHR ROM, the mapper needs its own copy
+		MakeChrRomWritable();
+	}
+	_chrPages[addr >> 8][(uint8_t)addr] = value;
+}
+
 bool BaseMapper::IsNes20()
 {
 	return _romInfo.NesHeader.GetRomHeaderVersion() == RomHeaderVersion::Nes2_0;
@@ -902,10 +924,10 @@ void BaseMapper::SetMemoryValue(DebugMemoryType memoryType, uint32_t address, ui
 
 		switch(memoryType) {
 			default: break;
-			case DebugMemoryType::ChrRom: _chrRom[address] = value; break;
+			case DebugMemoryType::ChrRom: MakeChrRomWritable(); _chrRom[address] = value; break;
 			case DebugMemoryType::ChrRam: _chrRam[address] = value; break;
 			case DebugMemoryType::SaveRam: _saveRam[address] = value; break;
-			case DebugMemoryType::PrgRom: _prgRom[address] = value; break;
+			case DebugMemoryType::PrgRom: MakePrgRomWritable(); _prgRom[address] = value; break;
 			case DebugMemoryType::WorkRam: _workRam[address] = value; break;
 			case DebugMemoryType::NametableRam: _nametableRam[address] = value; break;
 		}
@@ -1166,27 +1188,30 @@ vector<uint8_t> BaseMapper::GetPrgChrCopy()
 
 void BaseMapper::RestorePrgChrBackup(vector<uint8_t> &backupData)
 {
+	MakePrgRomWritable();
+	MakeChrRomWritable();
 	memcpy(_prgRom, backupData.data(), _prgSize);
 	memcpy(_chrRom, backupData.data() + _prgSize, _chrRomSize);
 }
 
 void BaseMapper::RevertPrgChrChanges()
 {
-	memcpy(_prgRom, _originalPrgRom.data(), _originalPrgRom.size());
-	if(_chrRom) {
-		memcpy(_chrRom, _originalChrRom.data(), _originalChrRom.size());
+	//The shared images always contain the original ROM
+	if(!_prgRomShared && _sharedPrgRom) {
+		memcpy(_prgRom, _sharedPrgRom->data(), _prgSize);
+	}
+	if(!_chrRomShared && _sharedChrRom) {
+		memcpy(_chrRom, _sharedChrRom->data(), _chrRomSize);
 	}
 }
 
 bool BaseMapper::HasPrgChrChanges()
 {
-	if(memcmp(_prgRom, _originalPrgRom.data(), _originalPrgRom.size()) != 0) {
+	if(!_prgRomShared && _sharedPrgRom && memcmp(_prgRom, _sharedPrgRom->data(), _prgSize) != 0) {
 		return true;
 	}
-	if(_chrRom) {
-		if(memcmp(_chrRom, _originalChrRom.data(), _originalChrRom.size()) != 0) {
-			return true;
-		}
+	if(!_chrRomShared && _sharedChrRom && memcmp(_chrRom, _sharedChrRom->data(), _chrRomSize) != 0) {
+		return true;
 	}
 	return false;
 }
@@ -1194,7 +1219,61 @@ bool BaseMapper::HasPrgChrChanges()
 void BaseMapper::CopyPrgChrRom(shared_ptr<BaseMapper> mapper)
 {
 	if(_prgSize == mapper->_prgSize && _chrRomSize == mapper->_chrRomSize) {
-		memcpy(_prgRom, mapper->_prgRom, _prgSize);
-		memcpy(_chrRom, mapper->_chrRom, _chrRomSize);
+		//Only ROMs that were written to need to be copied, the others still point to the same shared image
+		if(!mapper->_prgRomShared) {
+			MakePrgRomWritable();
+			memcpy(_prgRom, mapper->_prgRom, _prgSize);
+		}
+		if(!mapper->_chrRomShared) {
+			MakeChrRomWritable();
+			memcpy(_chrRom, mapper->_chrRom, _chrRomSize);
+		}
+	}
+}
+
+bool BaseMapper::IsSharedPrgRom(uint8_t* ptr)
+{
+	return _prgRomShared && ptr >= _prgRom && ptr < _prgRom + _prgSize;
+}
+
+bool BaseMapper::IsSharedChrRom(uint8_t* ptr)
+{
+	return _chrRomShared && ptr >= _chrRom && ptr < _chrRom + _chrRomSize;
+}
+
+void BaseMapper::MakePrgRomWritable()
+{
+	if(!_prgRomShared) {
+		return;
+	}
+
+	uint8_t* sharedRom = _prgRom;
+	_prgRom = new uint8_t[_prgSize];
+	memcpy(_prgRom, sharedRom, _prgSize);
+	_prgRomShared = false;
+
+	//Move the pages that are currently mapped to the shared image to the new copy
+	for(int i = 0; i < 0x100; i++) {
+		if(_prgPages[i] >= sharedRom && _prgPages[i] < sharedRom + _prgSize) {
+			_prgPages[i] = _prgRom + (_prgPages[i] - sharedRom);
+		}
+	}
+}
+
+void BaseMapper::MakeChrRomWritable()
+{
+	if(!_chrRomShared) {
+		return;
+	}
+
+	uint8_t* sharedRom = _chrRom;
+	_chrRom = new uint8_t[_chrRomSize];
+	memcpy(_chrRom, sharedRom, _chrRomSize);
+	_chrRomShared = false;
+
+	for(int i = 0; i < 0x100; i++) {
+		if(_chrPages[i] >= sharedRom && _chrPages[i] < sharedRom + _chrRomSize) {
+			_chrPages[i] = _chrRom + (_chrPages[i] - sharedRom);
+		}
 	}
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "stdafx.h"
+#include <bitset>
 #include "Snapshotable.h"
 #include "IMemoryHandler.h"
 #include "DebuggerTypes.h"
@@ -29,8 +30,10 @@ private:
 	bool _hasBusConflicts = false;
 	
 	bool _allowRegisterRead = false;
-	bool _isReadRegisterAddr[0x10000];
-	bool _isWriteRegisterAddr[0x10000];
+	bool _hasVramAddressHook = false;
+	bool _hasCustomVramRead = false;
+	std::bitset<0x10000> _isReadRegisterAddr;
+	std::bitset<0x10000> _isWriteRegisterAddr;
 
 	MemoryAccessType _prgMemoryAccess[0x100];
 	uint8_t* _prgPages[0x100];
@@ -44,8 +47,16 @@ private:
 	int32_t _chrMemoryOffset[0x100];
 	ChrMemoryType _chrMemoryType[0x100];
 
-	vector<uint8_t> _originalPrgRom;
-	vector<uint8_t> _originalChrRom;
+	//Read-only ROM images shared with the other consoles running the same game
+	//_prgRom/_chrRom point to them until the ROM is written to, at which point a private copy is made
+	std::shared_ptr<vector<uint8_t>> _sharedPrgRom;
+	std::shared_ptr<vector<uint8_t>> _sharedChrRom;
+	bool _prgRomShared = false;
+	bool _chrRomShared = false;
+
+	bool IsSharedPrgRom(uint8_t* ptr);
+	bool IsSharedChrRom(uint8_t* ptr);
+	void WriteChrPage(uint16_t addr, uint8_t value);
 
 protected:
 	RomInfo _romInfo;
@@ -101,6 +112,11 @@ protected:
 	
 	virtual bool HasBusConflicts() { return false; }
 
+	//Mappers that need to see every PPU bus address change (e.g A12-based IRQs), or that override MapperReadVRAM, must enable these
+	//Otherwise the PPU skips the NotifyVRAMAddressChange calls and reads CHR memory directly
+	virtual bool EnableVramAddressHook() { return false; }
+	virtual bool EnableCustomVramRead() { return false; }
+
 	uint8_t InternalReadRam(uint16_t addr);
 
 	virtual void WriteRegister(uint16_t addr, uint8_t value);
@@ -150,7 +166,15 @@ protected:
 	void SetMirroringType(MirroringType type);
 	MirroringType GetMirroringType();
 
-	uint8_t InternalReadVRAM(uint16_t addr);
+	__forceinline uint8_t InternalReadVRAM(uint16_t addr)
+	{
+		if(_chrMemoryAccess[addr >> 8] & MemoryAccessType::Read) {
+			return _chrPages[addr >> 8][(uint8_t)addr];
+		}
+
+		//Open bus - "When CHR is disabled, the pattern tables are open bus. Theoretically, this should return the LSB of the address read, but real-world behavior varies."
+		return _vramOpenBusValue >= 0 ? _vramOpenBusValue : addr;
+	}
 
 public:
 	static constexpr uint32_t NametableCount = 0x10;
@@ -189,7 +213,17 @@ public:
 	
 	__forceinline uint8_t ReadVRAM(uint16_t addr, MemoryOperationType type = MemoryOperationType::PpuRenderingRead)
 	{
-		return MapperReadVRAM(addr, type);
+		if(_hasCustomVramRead) {
+			return MapperReadVRAM(addr, type);
+		}
+		return InternalReadVRAM(addr);
+	}
+
+	__forceinline void ProcessVramAddressChange(uint16_t addr)
+	{
+		if(_hasVramAddressHook) {
+			NotifyVRAMAddressChange(addr);
+		}
 	}
 
 	void DebugWriteVRAM(uint16_t addr, uint8_t value, bool disableSideEffects = true);
@@ -199,6 +233,9 @@ public:
 
 	void CopyChrTile(uint32_t address, uint8_t *dest);
 
+	void MakePrgRomWritable();
+	void MakeChrRomWritable();
+
 	//Debugger Helper Functions
 	bool HasChrRam();
 	bool HasChrRom();
@@ -20,7 +20,7 @@ BaseVideoFilter::~BaseVideoFilter()
 	}
 }
 
-void BaseVideoFilter::UpdateBufferSize()
+bool BaseVideoFilter::UpdateBufferSize()
 {
 	uint32_t newBufferSize = GetFrameInfo().Width*GetFrameInfo().Height;
 	if(_bufferSize != newBufferSize) {
@@ -32,7 +32,9 @@ void BaseVideoFilter::UpdateBufferSize()
 		_bufferSize = newBufferSize;
 		_outputBuffer = new uint32_t[newBufferSize];
 		_frameLock.Release();
+		return true;
 	}
+	return false;
 }
 
 OverscanDimensions BaseVideoFilter::GetOverscan()
@@ -49,18 +51,54 @@ bool BaseVideoFilter::IsOddFrame()
 	return _isOddFrame;
 }
 
-void BaseVideoFilter::SendFrame(uint16_t *ppuOutputBuffer, uint32_t frameNumber)
+bool BaseVideoFilter::IsRowChanged(uint32_t scanline)
+{
+	return _changedRows == nullptr || _changedRows[scanline];
+}
+
+void BaseVideoFilter::InvalidateOutput()
+{
+	//Called by filters when their settings change - every row of the current frame will be processed again
+	_changedRows = nullptr;
+}
+
+const uint8_t* BaseVideoFilter::GetChangedRows()
+{
+	//Changed rows, relative to the top of the visible picture (only meaningful for filters that output 1 row per scanline)
+	return _changedRows ? _changedRows + _overscan.Top : nullptr;
+}
+
+void BaseVideoFilter::SendFrame(uint16_t *ppuOutputBuffer, uint32_t frameNumber, const uint8_t *changedRows)
 {
 	_frameLock.Acquire();
-	_overscan = _console->GetSettings()->GetOverscanDimensions();
+	OverscanDimensions overscan = _console->GetSettings()->GetOverscanDimensions();
+	bool overscanChanged = overscan.Left != _overscan.Left || overscan.Right != _overscan.Right || overscan.Top != _overscan.Top || overscan.Bottom != _overscan.Bottom;
+	_overscan = overscan;
 	_isOddFrame = frameNumber % 2;
-	UpdateBufferSize();
+	bool bufferChanged = UpdateBufferSize();
+
+	//Unchanged rows can only be skipped when the output buffer still contains the previous frame
+	bool canSkipRows = changedRows && _outputValid && frameNumber == _lastFrameNumber + 1 && !overscanChanged && !bufferChanged;
+	_changedRows = canSkipRows ? changedRows : nullptr;
+
 	OnBeforeApplyFilter();
 	ApplyFilter(ppuOutputBuffer);
 
+	_outputValid = true;
+	_lastFrameNumber = frameNumber;
 	_frameLock.Release();
 }
 
+void BaseVideoFilter::StartDirectFrame(uint32_t frameNumber)
+{
+	//Used when the frame is decoded scanline by scanline into a buffer owned by the frontend (the filter's own output buffer is not used)
+	_overscan = _console->GetSettings()->GetOverscanDimensions();
+	_isOddFrame = frameNumber % 2;
+	_outputValid = false;
+	_changedRows = nullptr;
+	OnBeforeApplyFilter();
+}
+
 uint32_t* BaseVideoFilter::GetOutputBuffer()
 {
 	return _outputBuffer;
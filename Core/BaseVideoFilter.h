@@ -15,7 +15,12 @@ private:
 	OverscanDimensions _overscan;
 	bool _isOddFrame;
 
-	void UpdateBufferSize();
+	//Rows that changed since the previous frame (nullptr when the whole frame must be processed)
+	const uint8_t* _changedRows = nullptr;
+	bool _outputValid = false;
+	uint32_t _lastFrameNumber = 0;
+
+	bool UpdateBufferSize();
 
 protected:
 	shared_ptr<Console> _console;
@@ -23,13 +28,18 @@ protected:
 	virtual void ApplyFilter(uint16_t *ppuOutputBuffer) = 0;
 	virtual void OnBeforeApplyFilter();
 	bool IsOddFrame();
+	bool IsRowChanged(uint32_t scanline);
+	void InvalidateOutput();
 
 public:
 	BaseVideoFilter(shared_ptr<Console> console);
 	virtual ~BaseVideoFilter();
 
 	uint32_t* GetOutputBuffer();
-	void SendFrame(uint16_t *ppuOutputBuffer, uint32_t frameNumber);
+	void SendFrame(uint16_t *ppuOutputBuffer, uint32_t frameNumber, const uint8_t *changedRows = nullptr);
+	void StartDirectFrame(uint32_t frameNumber);
+
+	const uint8_t* GetChangedRows();
 
 	virtual OverscanDimensions GetOverscan();
 	virtual FrameInfo GetFrameInfo() = 0;
@@ -71,6 +71,10 @@ void BisqwitNtscFilter::ApplyFilter(uint16_t *ppuOutputBuffer)
 	_waitWork.Signal();
 	DecodeFrame(GetOverscan().Top, 120, ppuOutputBuffer, GetOutputBuffer(), (IsOddFrame() ? 8 : 0) + GetOverscan().Top*341*8);
 	while(!_workDone) {}
+
+	//Both threads blend across the middle of the picture, so the effect can only be applied once they are both done
+	FrameInfo frameInfo = GetFrameInfo();
+	_scanlineFilter.ApplyToFrame(GetOutputBuffer(), frameInfo.Width, frameInfo.Height);
 }
 
 FrameInfo BisqwitNtscFilter::GetFrameInfo()
@@ -90,6 +94,14 @@ void BisqwitNtscFilter::OnBeforeApplyFilter()
 
 	_keepVerticalRes = ntscSettings.KeepVerticalResolution;
 
+	//Scanlines darken the 2nd row at 2x, rows 2-3 at 4x and rows 2-3 & 6-7 at 8x (only the CRT mask is applied when the vertical resolution is kept)
+	switch(_keepVerticalRes ? 0 : _resDivider) {
+		case 4: _scanlineFilter.UpdateSettings(pictureSettings, 0x02, 2); break;
+		case 2: _scanlineFilter.UpdateSettings(pictureSettings, 0x0C, 4); break;
+		case 1: _scanlineFilter.UpdateSettings(pictureSettings, 0xCC, 8); break;
+		default: _scanlineFilter.UpdateSettings(pictureSettings, 0); break;
+	}
+
 	const double pi = std::atan(1.0) * 4;
 	int contrast = (int)((pictureSettings.Contrast + 1.0) * (pictureSettings.Contrast + 1.0) * 167941);
 	int saturation = (int)((pictureSettings.Saturation + 1.0) * (pictureSettings.Saturation + 1.0) * 144044);
@@ -118,36 +130,12 @@ void BisqwitNtscFilter::RecursiveBlend(int iterationCount, uint64_t *output, uin
 	//Blend 2 pixels at once
 	uint32_t width = GetOverscan().GetScreenWidth() * pixelsPerCycle / 2;
 
-	double scanlineIntensity = 1.0 - _console->GetSettings()->GetPictureSettings().ScanlineIntensity;
-	if(scanlineIntensity < 1.0 && (iterationCount == 2 || _resDivider == 4)) {
-		//Most likely extremely inefficient scanlines, but works
+	if(verticalBlend) {
 		for(uint32_t x = 0; x < width; x++) {
-			uint64_t mixed;
-			if(verticalBlend) {
-				mixed = ((((currentLine[x] ^ nextLine[x]) & 0xfefefefefefefefeL) >> 1) + (currentLine[x] & nextLine[x]));
-			} else {
-				mixed = currentLine[x];
-			}
-			
-			uint8_t r = (mixed >> 16) & 0xFF, g = (mixed >> 8) & 0xFF, b = mixed & 0xFF;
-			uint8_t r2 = (mixed >> 48) & 0xFF, g2 = (mixed >> 40) & 0xFF, b2 = (mixed >> 32) & 0xFF;
-			r = (uint8_t)(r * scanlineIntensity);
-			g = (uint8_t)(g * scanlineIntensity);
-			b = (uint8_t)(b * scanlineIntensity);
-			r2 = (uint8_t)(r2 * scanlineIntensity);
-			g2 = (uint8_t)(g2 * scanlineIntensity);
-			b2 = (uint8_t)(b2 * scanlineIntensity);
-
-			output[x] = ((uint64_t)r2 << 48) | ((uint64_t)g2 << 40) | ((uint64_t)b2 << 32) | (r << 16) | (g << 8) | b;
+			output[x] = ((((currentLine[x] ^ nextLine[x]) & 0xfefefefefefefefeL) >> 1) + (currentLine[x] & nextLine[x]));
 		}
 	} else {
-		if(verticalBlend) {
-			for(uint32_t x = 0; x < width; x++) {
-				output[x] = ((((currentLine[x] ^ nextLine[x]) & 0xfefefefefefefefeL) >> 1) + (currentLine[x] & nextLine[x]));
-			}
-		} else {
-			memcpy(output, currentLine, width * sizeof(uint64_t));
-		}
+		memcpy(output, currentLine, width * sizeof(uint64_t));
 	}
 
 	iterationCount /= 2;
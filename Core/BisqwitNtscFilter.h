@@ -4,6 +4,7 @@
 #pragma once
 #include "stdafx.h"
 #include "BaseVideoFilter.h"
+#include "ScanlineFilter.h"
 #include "../Utilities/AutoResetEvent.h"
 
 class BisqwitNtscFilter : public BaseVideoFilter
@@ -23,6 +24,7 @@ private:
 
 	int _resDivider = 1;
 	uint16_t *_ppuOutputBuffer = nullptr;
+	ScanlineFilter _scanlineFilter;
 	
 	/* Ywidth, Iwidth and Qwidth are the filter widths for Y,I,Q respectively.
 	* All widths at 12 produce the best signal quality.
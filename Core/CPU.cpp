@@ -14,7 +14,8 @@ CPU::CPU(shared_ptr<Console> console)
 	_console = console;
 	_memoryManager = _console->GetMemoryManager();
 
-	Func opTable[] = { 
+	//The opcode tables never change, so they are shared by all CPU instances
+	static const Func opTable[] = { 
 	//	0				1				2				3				4				5				6						7				8				9				A						B				C						D				E						F
 		&CPU::BRK,	&CPU::ORA,	&CPU::HLT,	&CPU::SLO,	&CPU::NOP,	&CPU::ORA,	&CPU::ASL_Memory,	&CPU::SLO,	&CPU::PHP,	&CPU::ORA,	&CPU::ASL_Acc,		&CPU::AAC,	&CPU::NOP,			&CPU::ORA,	&CPU::ASL_Memory,	&CPU::SLO, //0
 		&CPU::BPL,	&CPU::ORA,	&CPU::HLT,	&CPU::SLO,	&CPU::NOP,	&CPU::ORA,	&CPU::ASL_Memory,	&CPU::SLO,	&CPU::CLC,	&CPU::ORA,	&CPU::NOP,			&CPU::SLO,	&CPU::NOP,			&CPU::ORA,	&CPU::ASL_Memory,	&CPU::SLO, //1
@@ -35,7 +36,7 @@ CPU::CPU(shared_ptr<Console> console)
 	};
 
 	typedef AddrMode M;
-	AddrMode addrMode[] = {
+	static const AddrMode addrMode[] = {
 	//	0			1				2			3				4				5				6				7				8			9			A			B			C			D			E			F
 		M::Imp,	M::IndX,		M::None,	M::IndX,		M::Zero,		M::Zero,		M::Zero,		M::Zero,		M::Imp,	M::Imm,	M::Acc,	M::Imm,	M::Abs,	M::Abs,	M::Abs,	M::Abs,	//0
 		M::Rel,	M::IndY,		M::None,	M::IndYW,	M::ZeroX,	M::ZeroX,	M::ZeroX,	M::ZeroX,	M::Imp,	M::AbsY,	M::Imp,	M::AbsYW,M::AbsX,	M::AbsX,	M::AbsXW,M::AbsXW,//1
@@ -55,9 +56,14 @@ CPU::CPU(shared_ptr<Console> console)
 		M::Rel,	M::IndY,		M::None,	M::IndYW,	M::ZeroX,	M::ZeroX,	M::ZeroX,	M::ZeroX,	M::Imp,	M::AbsY,	M::Imp,	M::AbsYW,M::AbsX,	M::AbsX,	M::AbsXW,M::AbsXW,//F
 	};
 	
-	memcpy(_opTable, opTable, sizeof(opTable));
-	memcpy(_addrMode, addrMode, sizeof(addrMode));
+	_opTable = opTable;
+	_addrMode = addrMode;
 
+	PowerOn();
+}
+
+void CPU::PowerOn()
+{
 	_instAddrMode = AddrMode::None;
 	_state = {};
 	_cycleCount = 0;
@@ -65,6 +71,7 @@ CPU::CPU(shared_ptr<Console> console)
 	_spriteDmaTransfer = false;
 	_spriteDmaOffset = 0;
 	_needHalt = false;
+	_needDummyRead = false;
 	_ppuOffset = 0;
 	_startClockCount = 6;
 	_endClockCount = 6;
@@ -72,9 +79,12 @@ CPU::CPU(shared_ptr<Console> console)
 	_dmcDmaRunning = false;
 	_cpuWrite = false;
 	_irqMask = 0;
-	_state = {};
 	_prevRunIrq = false;
 	_runIrq = false;
+	_prevNmiFlag = false;
+	_prevNeedNmi = false;
+	_needNmi = false;
+	_lastCrashWarning = 0;
 }
 
 void CPU::Reset(bool softReset, NesModel model)
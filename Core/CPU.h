@@ -39,8 +39,8 @@ private:
 	uint8_t _endClockCount;
 	uint16_t _operand;
 
-	Func _opTable[256];
-	AddrMode _addrMode[256];
+	const Func* _opTable;
+	const AddrMode* _addrMode;
 	AddrMode _instAddrMode;
 
 	bool _needHalt = false;
@@ -788,6 +788,9 @@ protected:
 
 public:
 	CPU(std::shared_ptr<Console> console);
+
+	//Restores the state the CPU has after being constructed (used when power cycling)
+	void PowerOn();
 	
 	uint64_t GetCycleCount() { return _cycleCount; }
 	void SetMasterClockDivider(NesModel region);
@@ -26,6 +26,8 @@ protected:
 		AddRegisterRange(0x7000, 0x7FFF, MemoryOperation::Any);
 		AddRegisterRange(0x8000, 0xFFFF, MemoryOperation::Any);
 
+		//The flash chip writes directly to PRG ROM
+		MakePrgRomWritable();
 		_flash.reset(new FlashSST39SF040(_prgRom, _prgSize));
 		
 		WriteRegister(0x5000, GetPowerOnByte());
@@ -7,10 +7,6 @@
 CheatManager::CheatManager(std::shared_ptr<Console> console)
 {
 	_console = console;
-
-	for(int i = 0; i <= 0xFFFF; i++) {
-		_relativeCheatCodes.push_back(nullptr);
-	}
 }
 
 uint32_t CheatManager::DecodeValue(uint32_t code, uint32_t* bitIndexes, uint32_t bitCount)
@@ -90,6 +86,10 @@ void CheatManager::AddCode(CodeInfo &code)
 			return;
 		}
 
+		if(_relativeCheatCodes.empty()) {
+			//The address table is only allocated once a code needs it, to keep consoles without cheats small
+			_relativeCheatCodes.resize(0x10000);
+		}
 		if(_relativeCheatCodes[code.Address] == nullptr) {
 			_relativeCheatCodes[code.Address].reset(new vector<CodeInfo>());
 		}
@@ -125,16 +125,7 @@ void CheatManager::AddCustomCode(uint32_t address, uint8_t value, int32_t compar
 
 void CheatManager::ClearCodes()
 {
-	bool cheatRemoved = false;
-
-	for(int i = 0; i <= 0xFFFF; i++) {
-		if(!_relativeCheatCodes[i]) {
-			cheatRemoved = true;
-		}
-		_relativeCheatCodes[i].reset();
-	}
-
-	cheatRemoved |= _absoluteCheatCodes.size() > 0;
+	vector<std::unique_ptr<vector<CodeInfo>>>().swap(_relativeCheatCodes);
 	_absoluteCheatCodes.clear();
 	_hasCode = false;
 }
@@ -144,7 +135,7 @@ void CheatManager::ApplyCodes(uint16_t addr, uint8_t &value)
 	if(!_hasCode)
 		return;
 
-	if(_relativeCheatCodes[addr] != nullptr) {
+	if(!_relativeCheatCodes.empty() && _relativeCheatCodes[addr] != nullptr) {
 		for(uint32_t i = 0, len = i < _relativeCheatCodes[addr]->size(); i < len; i++) {
 			CodeInfo code = _relativeCheatCodes[addr]->at(i);
 			if(code.CompareValue == -1 || code.CompareValue == value) {
@@ -220,14 +220,23 @@ bool Console::Initialize(VirtualFile &romFile, VirtualFile &patchFile, bool forP
 		}
 
 		shared_ptr<HdPackData> originalHdPackData = _hdData;
-		LoadHdPack(romFile, patchFile);
-		if(patchFile.IsValid())
-			romFile.ApplyPatch(patchFile);
+		RomData romData;
+		shared_ptr<BaseMapper> mapper;
+		bool powerCycleSameGame = forPowerCycle && _romData && _romFilepath == (string)romFile && _patchFilename == (string)patchFile;
+		if(powerCycleSameGame) {
+			//Power cycling the same game - keep the HD pack and reuse the parsed ROM data instead of reading, patching and hashing the file again
+			romData = *_romData;
+			mapper = MapperFactory::InitializeFromRomData(shared_from_this(), romData);
+		} else {
+			LoadHdPack(romFile, patchFile);
+			if(patchFile.IsValid())
+				romFile.ApplyPatch(patchFile);
 
-		_batteryManager->Initialize(FolderUtilities::GetFilename(romFile.GetFileName(), false));
+			_batteryManager->Initialize(FolderUtilities::GetFilename(romFile.GetFileName(), false));
+
+			mapper = MapperFactory::InitializeFromFile(shared_from_this(), romFile, romData);
+		}
 
-		RomData romData;
-		shared_ptr<BaseMapper> mapper = MapperFactory::InitializeFromFile(shared_from_this(), romFile, romData);
 		if(mapper) {
 			bool isDifferentGame = _romFilepath != (string)romFile || _patchFilename != (string)patchFile;
 
@@ -242,12 +251,32 @@ bool Console::Initialize(VirtualFile &romFile, VirtualFile &patchFile, bool forP
 
 			shared_ptr<BaseMapper> previousMapper = _mapper;
 			_mapper = mapper;
-			_memoryManager.reset(new MemoryManager(shared_from_this()));
-			_cpu.reset(new CPU(shared_from_this()));
-			_apu.reset(new APU(shared_from_this()));
+			if(powerCycleSameGame) {
+				//Reset the existing components to their power-on state instead of allocating new ones
+				_memoryManager->PowerOn();
+				_cpu->PowerOn();
+				_apu->PowerOn();
+			} else {
+				_memoryManager.reset(new MemoryManager(shared_from_this()));
+				_cpu.reset(new CPU(shared_from_this()));
+				_apu.reset(new APU(shared_from_this()));
+			}
 
 			_mapper->SetConsole(shared_from_this());
 			_mapper->Initialize(romData);
+			if(!powerCycleSameGame) {
+				//Keep the parsed ROM data for power cycles - the PRG/CHR ROM is kept as the shared images the mapper uses
+				romData.PrgRom.clear();
+				romData.PrgRom.shrink_to_fit();
+				romData.ChrRom.clear();
+				romData.ChrRom.shrink_to_fit();
+				if(romData.Info.System != GameSystem::FDS) {
+					//Only the FDS mapper needs the original file's content
+					romData.RawData.clear();
+					romData.RawData.shrink_to_fit();
+				}
+				_romData.reset(new RomData(romData));
+			}
 			if(!isDifferentGame && forPowerCycle) {
 				_mapper->CopyPrgChrRom(previousMapper);
 			}
@@ -290,7 +319,9 @@ bool Console::Initialize(VirtualFile &romFile, VirtualFile &patchFile, bool forP
 				pollCounter = _controlManager->GetPollCounter();
 			}
 
-			if(romInfo.System == GameSystem::VsSystem) {
+			if(powerCycleSameGame) {
+				_controlManager->PowerOn(_systemActionManager, _mapper->GetMapperControlDevice());
+			} else if(romInfo.System == GameSystem::VsSystem) {
 				_controlManager.reset(new VsControlManager(shared_from_this(), _systemActionManager, _mapper->GetMapperControlDevice()));
 			} else {
 				_controlManager.reset(new ControlManager(shared_from_this(), _systemActionManager, _mapper->GetMapperControlDevice()));
@@ -301,7 +332,9 @@ bool Console::Initialize(VirtualFile &romFile, VirtualFile &patchFile, bool forP
 			//Re-enable battery saves
 			_batteryManager->SetSaveEnabled(true);
 			
-			if(_hdData && (!_hdData->Tiles.empty() || !_hdData->Backgrounds.empty())) {
+			if(powerCycleSameGame) {
+				_ppu->PowerOn();
+			} else if(_hdData && (!_hdData->Tiles.empty() || !_hdData->Backgrounds.empty())) {
 				_ppu.reset(new HdPpu(shared_from_this(), _hdData.get()));
 			} else {
 				_ppu.reset(new PPU(shared_from_this()));
@@ -320,6 +353,8 @@ bool Console::Initialize(VirtualFile &romFile, VirtualFile &patchFile, bool forP
 				_hdAudioDevice.reset();
 			}
 
+			_memoryManager->ShareHandlerTables();
+
 			_model = NesModel::Auto;
 			UpdateNesModel(false);
 
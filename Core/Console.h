@@ -28,6 +28,7 @@ class BatteryManager;
 struct HdPackData;
 struct HashInfo;
 struct RomInfo;
+struct RomData;
 
 enum class MemoryOperationType;
 enum class NesModel;
@@ -71,6 +72,9 @@ private:
 	string _romFilepath;
 	string _patchFilename;
 
+	//ROM data parsed when the game was loaded, reused when power cycling
+	std::shared_ptr<RomData> _romData;
+
 	bool _disableOcNextFrame = false;
 
 	bool _initialized = false;
@@ -46,6 +46,16 @@ ControlManager::~ControlManager()
 {
 }
 
+void ControlManager::PowerOn(shared_ptr<BaseControlDevice> systemActionManager, shared_ptr<BaseControlDevice> mapperControlDevice)
+{
+	//The system action manager and mapper are re-created when power cycling, the registered input providers/recorders are kept
+	_systemActionManager = systemActionManager;
+	_mapperControlDevice = mapperControlDevice;
+	_pollCounter = 0;
+	_lagCounter = 0;
+	_isLagging = false;
+}
+
 void ControlManager::RegisterInputProvider(IInputProvider* provider)
 {
 	_inputProviders.push_back(provider);
@@ -205,6 +215,17 @@ bool ControlManager::HasKeyboard()
 	return expDevice && expDevice->IsKeyboard();
 }
 
+bool ControlManager::HasLightGun()
+{
+	//Light guns read the pixels drawn by the PPU
+	for(shared_ptr<BaseControlDevice> &device : _controlDevices) {
+		if(std::dynamic_pointer_cast<Zapper>(device) || std::dynamic_pointer_cast<BandaiHyperShot>(device)) {
+			return true;
+		}
+	}
+	return false;
+}
+
 uint8_t ControlManager::GetOpenBusMask(uint8_t port)
 {
 	//"In the NES and Famicom, the top three (or five) bits are not driven, and so retain the bits of the previous byte on the bus. 
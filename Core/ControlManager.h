@@ -46,6 +46,7 @@ public:
 
 	virtual uint8_t GetOpenBusMask(uint8_t port);
 
+	virtual void PowerOn(std::shared_ptr<BaseControlDevice> systemActionManager, std::shared_ptr<BaseControlDevice> mapperControlDevice);
 	virtual void UpdateControlDevices();
 	void UpdateInputState();
 
@@ -65,6 +66,7 @@ public:
 	std::shared_ptr<BaseControlDevice> GetControlDevice(uint8_t port);
 	vector<std::shared_ptr<BaseControlDevice>> GetControlDevices();
 	bool HasKeyboard();
+	bool HasLightGun();
 	
 	static std::shared_ptr<BaseControlDevice> CreateControllerDevice(ControllerType type, uint8_t port, std::shared_ptr<Console> console);
 	static std::shared_ptr<BaseControlDevice> CreateExpansionDevice(ExpansionPortDevice type, std::shared_ptr<Console> console);
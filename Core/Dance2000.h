@@ -14,6 +14,7 @@ protected:
 	bool AllowRegisterRead() override { return true; }
 	uint16_t GetPRGPageSize() override { return 0x4000; }
 	uint16_t GetCHRPageSize() override { return 0x1000; }
+	bool EnableVramAddressHook() override { return true; }
 
 	void InitMapper() override
 	{
@@ -48,6 +48,13 @@ void DefaultVideoFilter::OnBeforeApplyFilter()
 		InitConversionMatrix(currentSettings.Hue, currentSettings.Saturation);
 	}
 	_pictureSettings = currentSettings;
+
+	//Scanlines are applied to even rows (relative to the top of the visible picture)
+	bool outputChanged = _scanlineFilter.UpdateSettings(_pictureSettings, 0x01);
+
+	uint32_t previousPalette[512];
+	memcpy(previousPalette, _calculatedPalette, sizeof(_calculatedPalette));
+
 	_needToProcess = _pictureSettings.Hue != 0 || _pictureSettings.Saturation != 0 || _pictureSettings.Brightness || _pictureSettings.Contrast;
 
 	if(_needToProcess) {
@@ -75,25 +82,36 @@ void DefaultVideoFilter::OnBeforeApplyFilter()
 	} else {
 		memcpy(_calculatedPalette, _console->GetSettings()->GetRgbPalette(), sizeof(_calculatedPalette));
 	}
+
+	if(outputChanged || memcmp(previousPalette, _calculatedPalette, sizeof(_calculatedPalette)) != 0) {
+		InvalidateOutput();
+	}
 }
 
 void DefaultVideoFilter::DecodePpuBuffer(uint16_t *ppuOutputBuffer, uint32_t* outputBuffer, bool displayScanlines)
 {
 	uint32_t* out = outputBuffer;
 	OverscanDimensions overscan = GetOverscan();
-	uint8_t scanlineIntensity = (uint8_t)((1.0 - _console->GetSettings()->GetPictureSettings().ScanlineIntensity) * 255);
 	for(uint32_t i = overscan.Top, iMax = 240 - overscan.Bottom; i < iMax; i++) {
-		if(displayScanlines && (i + overscan.Top) % 2 == 0) {
-			for(uint32_t j = overscan.Left, jMax = 256 - overscan.Right; j < jMax; j++) {
-				*out = ApplyScanlineEffect(ppuOutputBuffer[i * 256 + j], scanlineIntensity);
-				out++;
-			}
-		} else {
-			for(uint32_t j = overscan.Left, jMax = 256 - overscan.Right; j < jMax; j++) {
-				*out = _calculatedPalette[ppuOutputBuffer[i * 256 + j]];
-				out++;
-			}
+		if(IsRowChanged(i)) {
+			DecodeScanline(ppuOutputBuffer, i, out, displayScanlines);
 		}
+		out += overscan.GetScreenWidth();
+	}
+}
+
+void DefaultVideoFilter::DecodeScanline(uint16_t *ppuOutputBuffer, uint32_t scanline, uint32_t* out, bool displayScanlines)
+{
+	OverscanDimensions overscan = GetOverscan();
+	uint16_t* in = ppuOutputBuffer + scanline * 256;
+	uint32_t* row = out;
+	for(uint32_t j = overscan.Left, jMax = 256 - overscan.Right; j < jMax; j++) {
+		*out = _calculatedPalette[in[j]];
+		out++;
+	}
+
+	if(displayScanlines) {
+		_scanlineFilter.ApplyToRow(row, overscan.GetScreenWidth(), scanline - overscan.Top);
 	}
 }
 
@@ -115,14 +133,3 @@ void DefaultVideoFilter::YiqToRgb(double y, double i, double q, double &r, doubl
 	g = std::max(0.0, std::min(1.0, (y + _yiqToRgbMatrix[2] * i + _yiqToRgbMatrix[3] * q)));
 	b = std::max(0.0, std::min(1.0, (y + _yiqToRgbMatrix[4] * i + _yiqToRgbMatrix[5] * q)));
 }
-
-uint32_t DefaultVideoFilter::ApplyScanlineEffect(uint16_t ppuPixel, uint8_t scanlineIntensity)
-{
-	uint32_t pixelOutput = _calculatedPalette[ppuPixel];
-
-	uint8_t r = ((pixelOutput & 0xFF0000) >> 16) * scanlineIntensity / 255;
-	uint8_t g = ((pixelOutput & 0xFF00) >> 8) * scanlineIntensity / 255;
-	uint8_t b = (pixelOutput & 0xFF) * scanlineIntensity / 255;
-
-	return 0xFF000000 | (r << 16) | (g << 8) | b;
-}
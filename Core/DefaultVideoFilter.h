@@ -2,14 +2,16 @@
 
 #include "stdafx.h"
 #include "BaseVideoFilter.h"
+#include "ScanlineFilter.h"
 
 class DefaultVideoFilter : public BaseVideoFilter
 {
 private:
 	double _yiqToRgbMatrix[6];
-	uint32_t _calculatedPalette[512];
+	uint32_t _calculatedPalette[512] = {};
 	PictureSettings _pictureSettings;
 	bool _needToProcess = false;
+	ScanlineFilter _scanlineFilter;
 
 	void InitConversionMatrix(double hueShift, double saturationShift);
 
@@ -18,11 +20,11 @@ private:
 
 protected:
 	void DecodePpuBuffer(uint16_t *ppuOutputBuffer, uint32_t* outputBuffer, bool displayScanlines);
-	uint32_t ApplyScanlineEffect(uint16_t ppuPixel, uint8_t scanlineIntensity);
 	void OnBeforeApplyFilter();
 
 public:
 	DefaultVideoFilter(shared_ptr<Console> console);
 	void ApplyFilter(uint16_t *ppuOutputBuffer);
+	void DecodeScanline(uint16_t *ppuOutputBuffer, uint32_t scanline, uint32_t* out, bool displayScanlines);
 	FrameInfo GetFrameInfo();
 };
\ No newline at end of file
@@ -18,6 +18,7 @@ void DeltaModulationChannel::Reset(bool softReset)
 		//Resetting does not reset their value
 		_sampleAddr = 0xC000;
 		_sampleLength = 1;
+		_needInit = 0;
 	}
 
 	_outputLevel = 0;
@@ -92,6 +92,8 @@ enum EmulationFlags : uint64_t
 	VsDualMuteSlave = 0x400000000000000,
 	
 	RandomizeCpuPpuAlignment = 0x800000000000000,
+
+	UseScanlineRenderer = 0x1000000000000000,
 	
 	ForceMaxSpeed = 0x4000000000000000,	
 	ConsoleMode = 0x8000000000000000,
@@ -162,6 +164,14 @@ enum class VideoFilterType
 	HdPack = 999
 };
 
+enum class PalettedOutputFormat
+{
+	Disabled = 0,
+	Raw = 1,		//9-bit values (6-bit palette index + 3-bit emphasis), 2 bytes per pixel
+	Index = 2,		//6-bit palette index, 1 byte per pixel
+	Grayscale = 3,	//6-bit palette index with the PPU's grayscale mask applied (index & 0x30), 1 byte per pixel
+};
+
 enum class VideoAspectRatio
 {
 	NoStretching = 0,
@@ -198,6 +208,13 @@ struct OverscanDimensions
 	}
 };
 
+enum class CrtMaskType
+{
+	None = 0,
+	ApertureGrille = 1,
+	ShadowMask = 2,
+};
+
 struct PictureSettings
 {
 	double Brightness = 0;
@@ -205,6 +222,8 @@ struct PictureSettings
 	double Saturation = 0;
 	double Hue = 0;
 	double ScanlineIntensity = 0;
+	CrtMaskType CrtMask = CrtMaskType::None;
+	double CrtMaskIntensity = 0;
 };
 
 struct NtscFilterSettings
@@ -477,6 +496,9 @@ private:
 	bool _backgroundEnabled = true;
 	bool _spritesEnabled = true;
 	uint32_t _screenRotation = 0;
+	PalettedOutputFormat _palettedOutputFormat = PalettedOutputFormat::Disabled;
+	uint32_t _palettedOutputDownscale = 1;
+	uint32_t _ppuOutputInterval = 1;
 
 	ConsoleType _consoleType = ConsoleType::Nes;
 	ExpansionPortDevice _expansionDevice = ExpansionPortDevice::None;
@@ -834,6 +856,12 @@ public:
 		_pictureSettings.ScanlineIntensity = scanlineIntensity;
 	}
 
+	void SetCrtMask(CrtMaskType mask, double intensity)
+	{
+		_pictureSettings.CrtMask = mask;
+		_pictureSettings.CrtMaskIntensity = intensity;
+	}
+
 	PictureSettings GetPictureSettings()
 	{
 		return _pictureSettings;
@@ -887,6 +915,33 @@ public:
 		return _screenRotation;
 	}
 
+	void SetPalettedOutput(PalettedOutputFormat format, uint32_t downscale)
+	{
+		_palettedOutputFormat = format;
+		_palettedOutputDownscale = downscale;
+	}
+
+	PalettedOutputFormat GetPalettedOutputFormat()
+	{
+		return _palettedOutputFormat;
+	}
+
+	uint32_t GetPalettedOutputDownscale()
+	{
+		return _palettedOutputDownscale;
+	}
+
+	//The PPU only draws 1 frame out of every N frames (0 = never), the others only produce the CPU-visible side effects
+	void SetPpuOutputInterval(uint32_t interval)
+	{
+		_ppuOutputInterval = interval;
+	}
+
+	uint32_t GetPpuOutputInterval()
+	{
+		return _ppuOutputInterval;
+	}
+
 	void SetExpansionDevice(ExpansionPortDevice expansionDevice)
 	{
 		_expansionDevice = expansionDevice;
@@ -45,6 +45,7 @@ private:
 protected:
 	virtual uint16_t GetPRGPageSize() override { return 0x2000; }
 	virtual uint16_t GetCHRPageSize() override { return 0x0400; }
+	virtual bool EnableVramAddressHook() override { return true; }
 
 	virtual uint32_t GetChrRamSize() override {
 		if(!_romInfo.IsNes20Header && !_romInfo.IsInDatabase) {
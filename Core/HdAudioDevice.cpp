@@ -15,6 +15,16 @@ HdAudioDevice::HdAudioDevice(shared_ptr<Console> console, HdPackData* hdData)
 	_oggMixer = console->GetSoundMixer()->GetOggMixer();
 	_oggMixer->SetBgmVolume(_bgmVolume);
 	_oggMixer->SetSfxVolume(_sfxVolume);
+
+	//Read and validate the pack's tracks in the background, so starting a track doesn't need to access the disk
+	vector<string> files;
+	for(auto &bgm : _hdData->BgmFilesById) {
+		files.push_back(bgm.second);
+	}
+	for(auto &sfx : _hdData->SfxFilesById) {
+		files.push_back(sfx.second);
+	}
+	_oggMixer->PreloadFiles(files);
 }
 
 void HdAudioDevice::StreamState(bool saving)
@@ -98,7 +98,7 @@ protected:
 				_needChrHash = true;
 			}
 		}
-		PPU::WriteRAM(addr, value);
+		HdPpu::WriteRAM(addr, value);
 	}
 
 	void StreamState(bool saving)
@@ -120,6 +120,8 @@ public:
 
 	void SendFrame()
 	{
+		_hdPackBuilder->EndFrame();
+
 		if(_hdData) {
 			HdPpu::SendFrame();
 		} else {
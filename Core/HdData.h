@@ -1,7 +1,8 @@
 #pragma once
 #include "stdafx.h"
-#include <unordered_set>
 #include "PPU.h"
+#include "TileDecoder.h"
+#include "HdPackTileCache.h"
 #include "../Utilities/HexUtilities.h"
 
 struct HdTileKey
@@ -24,41 +25,67 @@ struct HdTileKey
 		}
 	}
 
-	uint32_t GetHashCode() const
+	//Hash of the tile's content (its CHR RAM data or its index), without its palette
+	//Captured tiles compute it once and keep it in TileHash, so lookups only need to combine it with the palette
+	uint32_t TileHash = 0;
+
+	uint32_t CalculateTileHash() const
 	{
 		if(IsChrRamTile) {
-			return CalculateHash((uint8_t*)&PaletteColors, 20);
+			uint64_t low, high;
+			memcpy(&low, TileData, sizeof(low));
+			memcpy(&high, TileData + 8, sizeof(high));
+			return (uint32_t)MixHash(low ^ MixHash(high ^ 0x9E3779B97F4A7C15ULL));
 		} else {
-			uint64_t key = TileIndex | ((uint64_t)PaletteColors << 32);
-			return CalculateHash((uint8_t*)&key, sizeof(key));
+			return (uint32_t)MixHash((uint32_t)TileIndex);
 		}
 	}
 
+	void UpdateTileHash()
+	{
+		TileHash = CalculateTileHash();
+	}
+
+	static uint32_t CombineHash(uint32_t tileHash, uint32_t paletteColors)
+	{
+		return (uint32_t)MixHash(((uint64_t)paletteColors << 32) | tileHash);
+	}
+
+	static uint64_t MixHash(uint64_t value)
+	{
+		//MurmurHash3's 64-bit finalizer
+		value ^= value >> 33;
+		value *= 0xFF51AFD7ED558CCDULL;
+		value ^= value >> 33;
+		value *= 0xC4CEB9FE1A85EC53ULL;
+		value ^= value >> 33;
+		return value;
+	}
+
+	uint32_t GetHashCode() const
+	{
+		return CombineHash(CalculateTileHash(), PaletteColors);
+	}
+
 	size_t operator() (const HdTileKey &tile) const {
 		return tile.GetHashCode();
 	}
 
 	bool operator==(const HdTileKey &other) const
 	{
-		if(IsChrRamTile) {
-			return memcmp((uint8_t*)&PaletteColors, (uint8_t*)&other.PaletteColors, 20) == 0;
-		} else {
-			return TileIndex == other.TileIndex && PaletteColors == other.PaletteColors;
-		}
+		return Matches(other, other.PaletteColors);
 	}
 
-	uint32_t CalculateHash(const uint8_t* key, size_t len) const
+	//Compares with a tile as if its palette was the given one (used to look up default tiles without copying the key)
+	bool Matches(const HdTileKey &other, uint32_t paletteColors) const
 	{
-		uint32_t result = 0;
-		for(size_t i = 0; i < len; i += 4) {
-			uint32_t chunk;
-			memcpy(&chunk, key, sizeof(uint32_t));
-
-			result += chunk;
-			result = (result << 2) | (result >> 30);
-			key += 4;
+		if(PaletteColors != paletteColors) {
+			return false;
+		} else if(IsChrRamTile) {
+			return memcmp(TileData, other.TileData, sizeof(TileData)) == 0;
+		} else {
+			return TileIndex == other.TileIndex;
 		}
-		return result;
 	}
 
 	bool IsSpriteTile()
@@ -92,52 +119,120 @@ struct HdPpuTileInfo : public HdTileKey
 	uint8_t PpuBackgroundColor;
 };
 
-struct HdPpuPixelInfo
+//Background tile shown by consecutive pixels of a scanline: normally the 8 pixels of a tile, unless the PPU's state changed mid-tile
+struct HdPpuBgSpan
+{
+	HdPpuTileInfo Tile; //OffsetX is the offset of the span's first pixel in the tile
+	uint8_t Colors[4];
+	uint8_t LowByte;
+	uint8_t HighByte;
+	uint8_t StartX;
+	bool SpritesVisible;
+
+	uint8_t GetColorIndex(uint8_t offsetX)
+	{
+		return ((LowByte << offsetX) & 0x80) >> 7 | ((HighByte << offsetX) & 0x80) >> 6;
+	}
+};
+
+//Sprite shown on a scanline, captured once for pixels StartX to EndX (the rest of the scanline, unless the PPU's state changed)
+struct HdPpuSpriteSpan
 {
 	HdPpuTileInfo Tile;
-	vector<HdPpuTileInfo> Sprite;
-	int SpriteCount;
-	
-	uint16_t TmpVideoRamAddr;
-	uint8_t XScroll;
-	uint8_t EmphasisBits;
-	bool Grayscale;
+	uint8_t Colors[4];
+	uint8_t LowByte;
+	uint8_t HighByte;
+	uint8_t SpriteX;
+	uint16_t StartX;
+	uint16_t EndX;
+
+	bool IsVisible(uint32_t x)
+	{
+		return x >= StartX && x < EndX && x >= SpriteX && x < SpriteX + 8u;
+	}
 
-	HdPpuPixelInfo()
+	uint8_t GetColorIndex(uint8_t shift)
 	{
-		for(int i = 0; i < 4; i++) {
-			Sprite.push_back(HdPpuTileInfo());
-		}		
+		if(Tile.HorizontalMirroring) {
+			return ((LowByte >> shift) & 0x01) | ((HighByte >> shift) & 0x01) << 1;
+		} else {
+			return ((LowByte << shift) & 0x80) >> 7 | ((HighByte << shift) & 0x80) >> 6;
+		}
 	}
 };
 
-struct HdScreenInfo
+struct HdPpuScanlineInfo
 {
-	HdPpuPixelInfo* ScreenTiles;
-	std::unordered_map<uint32_t, uint8_t> WatchedAddressValues;
-	uint32_t FrameNumber;
+	vector<HdPpuBgSpan> BgSpans;
+	vector<HdPpuSpriteSpan> Sprites;
 
-	HdScreenInfo(const HdScreenInfo& that) = delete;
+	uint16_t TmpVideoRamAddr = 0;
+	uint8_t XScroll = 0;
+	uint8_t EmphasisBits = 0;
+	bool Grayscale = false;
 
-	HdScreenInfo(bool isChrRamGame)
+	HdPpuBgSpan* GetBgSpan(uint32_t x)
 	{
-		ScreenTiles = new HdPpuPixelInfo[PPU::PixelCount];
+		if(BgSpans.empty() || x < BgSpans[0].StartX) {
+			return nullptr;
+		}
 
-		for(int i = 0; i < PPU::PixelCount; i++) {
-			ScreenTiles[i].Tile.BackgroundPriority = false;
-			ScreenTiles[i].Tile.IsChrRamTile = isChrRamGame;
-			ScreenTiles[i].Tile.HorizontalMirroring = false;
-			ScreenTiles[i].Tile.VerticalMirroring = false;
+		//Spans are sorted by position, find the last one that starts at or before x
+		size_t low = 0;
+		size_t high = BgSpans.size();
+		while(high - low > 1) {
+			size_t mid = (low + high) / 2;
+			if(BgSpans[mid].StartX <= x) {
+				low = mid;
+			} else {
+				high = mid;
+			}
+		}
+		return &BgSpans[low];
+	}
 
-			for(int j = 0; j < 4; j++) {
-				ScreenTiles[i].Sprite[j].IsChrRamTile = isChrRamGame;
+	//Returns the sprites (up to 4, in OAM order) that cover pixel x, whether or not sprites are visible at that pixel
+	uint32_t GetSprites(uint32_t x, HdPpuSpriteSpan* sprites[4])
+	{
+		uint32_t count = 0;
+		for(size_t i = 0, len = Sprites.size(); i < len && count < 4; i++) {
+			if(Sprites[i].IsVisible(x)) {
+				sprites[count++] = &Sprites[i];
 			}
 		}
+		return count;
 	}
+};
 
-	~HdScreenInfo()
+struct HdScreenInfo
+{
+	HdPpuScanlineInfo Scanlines[PPU::ScreenHeight];
+	vector<uint8_t> WatchedAddressValues; //Indexed like HdPackData::WatchedMemoryAddresses
+	uint32_t FrameNumber;
+
+	HdScreenInfo() { }
+	HdScreenInfo(const HdScreenInfo& that) = delete;
+
+	HdPpuTileInfo* GetBgTile(int32_t pixelIndex)
 	{
-		delete[] ScreenTiles;
+		if(pixelIndex < 0 || pixelIndex >= PPU::PixelCount) {
+			return nullptr;
+		}
+		HdPpuBgSpan* span = Scanlines[pixelIndex >> 8].GetBgSpan(pixelIndex & 0xFF);
+		return span ? &span->Tile : nullptr;
+	}
+
+	uint32_t GetSprites(int32_t pixelIndex, HdPpuSpriteSpan* sprites[4])
+	{
+		if(pixelIndex < 0 || pixelIndex >= PPU::PixelCount) {
+			return 0;
+		}
+		HdPpuScanlineInfo& scanline = Scanlines[pixelIndex >> 8];
+		HdPpuBgSpan* span = scanline.GetBgSpan(pixelIndex & 0xFF);
+		if(!span || !span->SpritesVisible) {
+			return 0;
+		}
+		return scanline.GetSprites(pixelIndex & 0xFF, sprites);
 	}
 };
 
@@ -149,35 +244,58 @@ struct HdPackCondition
 	virtual bool IsExcludedFromFile() { return Name.size() > 0 && Name[0] == '!'; }
 	virtual string ToString() = 0;
 
+	//Index of the condition's result in the frame's results, for conditions that don't depend on the tile being drawn (-1 otherwise)
+	int32_t FrameResultIndex = -1;
+
 	virtual ~HdPackCondition() { }
 
-	void ClearCache()
+	//Returns true when the result is the same for every tile of a frame (memory checks, frame range, tile/sprite at a fixed position)
+	virtual bool IsFrameCondition() { return false; }
+
+	bool CheckCondition(HdScreenInfo *screenInfo, int x, int y, HdPpuTileInfo* tile)
 	{
-		_resultCache = -1;
+		bool result = InternalCheckCondition(screenInfo, x, y, tile);
+		return Name[0] == '!' ? !result : result;
 	}
 
-	bool CheckCondition(HdScreenInfo *screenInfo, int x, int y, HdPpuTileInfo* tile)
+protected:
+	virtual bool InternalCheckCondition(HdScreenInfo *screenInfo, int x, int y, HdPpuTileInfo* tile) = 0;
+};
+
+//A tile or background's conditions, split when the pack is loaded
+//The frame-level conditions are evaluated once per frame (into a bitmask), only the others need to be checked for each tile
+struct HdPackConditionProgram
+{
+	vector<uint32_t> FrameResultIndexes;
+	vector<HdPackCondition*> TileConditions;
+
+	void Compile(vector<HdPackCondition*> &conditions)
 	{
-		if(_resultCache == -1) {
-			bool result = InternalCheckCondition(screenInfo, x, y, tile);
-			if(Name[0] == '!') {
-				result = !result;
+		FrameResultIndexes.clear();
+		TileConditions.clear();
+		for(HdPackCondition* condition : conditions) {
+			if(condition->FrameResultIndex >= 0) {
+				FrameResultIndexes.push_back((uint32_t)condition->FrameResultIndex);
+			} else {
+				TileConditions.push_back(condition);
 			}
+		}
+	}
 
-			if(_useCache) {
-				_resultCache = result ? 1 : 0;
+	bool Matches(const uint64_t* frameResults, HdScreenInfo *hdScreenInfo, int x, int y, HdPpuTileInfo* tile)
+	{
+		for(uint32_t index : FrameResultIndexes) {
+			if(!(frameResults[index >> 6] & ((uint64_t)1 << (index & 0x3F)))) {
+				return false;
 			}
-			return result;
-		} else {
-			return (bool)_resultCache;
 		}
+		for(HdPackCondition* condition : TileConditions) {
+			if(!condition->CheckCondition(hdScreenInfo, x, y, tile)) {
+				return false;
+			}
+		}
+		return true;
 	}
-
-protected:
-	int8_t _resultCache = -1;
-	bool _useCache = false;
-
-	virtual bool InternalCheckCondition(HdScreenInfo *screenInfo, int x, int y, HdPpuTileInfo* tile) = 0;
 };
 
 struct HdPackTileInfo : public HdTileKey
@@ -195,36 +313,31 @@ struct HdPackTileInfo : public HdTileKey
 	uint32_t ChrBankId;
 
 	vector<HdPackCondition*> Conditions;
+	HdPackConditionProgram ConditionProgram;
 	bool ForceDisableCache;
 
-	bool MatchesCondition(HdScreenInfo *hdScreenInfo, int x, int y, HdPpuTileInfo* tile)
+	bool MatchesCondition(const uint64_t* frameResults, HdScreenInfo *hdScreenInfo, int x, int y, HdPpuTileInfo* tile)
 	{
-		for(HdPackCondition* condition : Conditions) {
-			if(!condition->CheckCondition(hdScreenInfo, x, y, tile)) {
-				return false;
-			}
-		}
-		return true;
+		return ConditionProgram.Matches(frameResults, hdScreenInfo, x, y, tile);
 	}
 
-	vector<uint32_t> ToRgb(uint32_t* palette)
+	vector<uint32_t> ToRgb(uint32_t* palette, bool transparencyRequired)
 	{
-		vector<uint32_t> rgbBuffer;
-		for(uint8_t i = 0; i < 8; i++) {
-			uint8_t lowByte = TileData[i];
-			uint8_t highByte = TileData[i + 8];
-			for(uint8_t j = 0; j < 8; j++) {
-				uint8_t color = ((lowByte >> (7 - j)) & 0x01) | (((highByte >> (7 - j)) & 0x01) << 1);
-				uint32_t rgbColor;
-				if(IsSpriteTile() || TransparencyRequired) {
-					rgbColor = color == 0 ? 0x00FFFFFF : palette[(PaletteColors >> ((3 - color) * 8)) & 0x3F];
-				} else {
-					rgbColor = palette[(PaletteColors >> ((3 - color) * 8)) & 0x3F];
-				}
-				rgbBuffer.push_back(rgbColor);
-			}
+		uint32_t colors[4];
+		for(int i = 0; i < 4; i++) {
+			colors[i] = palette[(PaletteColors >> ((3 - i) * 8)) & 0x3F];
 		}
+		if(IsSpriteTile() || transparencyRequired) {
+			colors[0] = 0x00FFFFFF;
+		}
+
+		uint8_t pixels[64];
+		TileDecoder::DecodeTile(TileData, pixels);
 
+		vector<uint32_t> rgbBuffer(64);
+		for(int i = 0; i < 64; i++) {
+			rgbBuffer[i] = colors[pixels[i]];
+		}
 		return rgbBuffer;
 	}
 
@@ -290,11 +403,143 @@ struct HdPackTileInfo : public HdTileKey
 	}
 };
 
-struct HdPackBitmapInfo
+//Open addressing hash table of the pack's tiles, built once when the pack is loaded
+//The candidate tiles of each key are stored contiguously, in the order they are defined in the pack
+class HdTileIndex
 {
-	vector<uint32_t> PixelData;
-	uint32_t Width;
-	uint32_t Height;
+private:
+	struct Entry
+	{
+		HdTileKey Key;
+		uint32_t Hash;
+		uint32_t Start;
+		uint32_t Count;
+	};
+
+	vector<Entry> _entries;
+	vector<HdPackTileInfo*> _tiles;
+	uint32_t _mask = 0;
+
+public:
+	void Build(vector<unique_ptr<HdPackTileInfo>> &tiles)
+	{
+		//Group the tiles by key (their own palette, and the default palette for default tiles)
+		std::unordered_map<HdTileKey, vector<HdPackTileInfo*>> tilesByKey;
+		vector<HdTileKey> keys;
+		for(unique_ptr<HdPackTileInfo> &tileInfo : tiles) {
+			for(int i = 0; i < (tileInfo->DefaultTile ? 2 : 1); i++) {
+				HdTileKey key = tileInfo->GetKey(i == 1);
+				vector<HdPackTileInfo*> &list = tilesByKey[key];
+				if(list.empty()) {
+					keys.push_back(key);
+				}
+				list.push_back(tileInfo.get());
+			}
+		}
+
+		uint32_t size = 16;
+		while(size < keys.size() * 2) {
+			size <<= 1;
+		}
+		_mask = size - 1;
+		_entries.clear();
+		_entries.resize(size);
+		_tiles.clear();
+
+		for(HdTileKey &key : keys) {
+			vector<HdPackTileInfo*> &list = tilesByKey[key];
+			uint32_t hash = key.GetHashCode();
+			uint32_t index = hash & _mask;
+			while(_entries[index].Count > 0) {
+				index = (index + 1) & _mask;
+			}
+
+			Entry &entry = _entries[index];
+			entry.Key = key;
+			entry.Hash = hash;
+			entry.Start = (uint32_t)_tiles.size();
+			entry.Count = (uint32_t)list.size();
+			_tiles.insert(_tiles.end(), list.begin(), list.end());
+		}
+	}
+
+	//Returns the candidate tiles for the tile with the given palette (and sets count), or nullptr when there are none
+	HdPackTileInfo** Find(const HdTileKey &tile, uint32_t paletteColors, uint32_t &count)
+	{
+		if(_entries.empty()) {
+			return nullptr;
+		}
+
+		uint32_t hash = HdTileKey::CombineHash(tile.TileHash, paletteColors);
+		for(uint32_t index = hash & _mask; _entries[index].Count > 0; index = (index + 1) & _mask) {
+			Entry &entry = _entries[index];
+			if(entry.Hash == hash && entry.Key.Matches(tile, paletteColors)) {
+				count = entry.Count;
+				return _tiles.data() + entry.Start;
+			}
+		}
+		return nullptr;
+	}
+
+	//Writes the index to the HD pack's cache file, the tiles are written as their position in the pack's tile list
+	void Save(std::ostream &out, std::unordered_map<HdPackTileInfo*, uint32_t> &tileIndexes)
+	{
+		uint32_t entryCount = (uint32_t)_entries.size();
+		uint32_t tileCount = (uint32_t)_tiles.size();
+		out.write((char*)&entryCount, sizeof(entryCount));
+		out.write((char*)_entries.data(), entryCount * sizeof(Entry));
+		out.write((char*)&tileCount, sizeof(tileCount));
+		for(HdPackTileInfo* tile : _tiles) {
+			uint32_t tileIndex = tileIndexes[tile];
+			out.write((char*)&tileIndex, sizeof(tileIndex));
+		}
+	}
+
+	//Reads an index written by Save, returns false (and leaves the index empty) if the data is invalid
+	bool Load(std::istream &in, vector<unique_ptr<HdPackTileInfo>> &tiles)
+	{
+		uint32_t entryCount = 0;
+		in.read((char*)&entryCount, sizeof(entryCount));
+		if(!in || entryCount < 16 || (entryCount & (entryCount - 1)) != 0 || entryCount > tiles.size() * 8 + 16) {
+			return false;
+		}
+
+		vector<Entry> entries(entryCount);
+		in.read((char*)entries.data(), entryCount * sizeof(Entry));
+		uint32_t tileCount = 0;
+		in.read((char*)&tileCount, sizeof(tileCount));
+		if(!in || tileCount > tiles.size() * 2) {
+			return false;
+		}
+
+		vector<HdPackTileInfo*> tileList(tileCount);
+		for(uint32_t i = 0; i < tileCount; i++) {
+			uint32_t tileIndex = 0;
+			in.read((char*)&tileIndex, sizeof(tileIndex));
+			if(!in || tileIndex >= tiles.size()) {
+				return false;
+			}
+			tileList[i] = tiles[tileIndex].get();
+		}
+
+		bool hasEmptyEntry = false;
+		for(Entry &entry : entries) {
+			if(entry.Count == 0) {
+				hasEmptyEntry = true;
+			} else if((uint64_t)entry.Start + entry.Count > tileCount) {
+				return false;
+			}
+		}
+		if(!hasEmptyEntry) {
+			//Find() stops at the first empty entry
+			return false;
+		}
+
+		_mask = entryCount - 1;
+		_entries.swap(entries);
+		_tiles.swap(tileList);
+		return true;
+	}
 };
 
 struct HdBackgroundFileData
@@ -303,7 +548,13 @@ struct HdBackgroundFileData
 	uint32_t Width;
 	uint32_t Height;
 
+	vector<uint8_t> FileData; //PNG file, decoded into PixelData the first time the background is used
+	uint64_t FileKey;
 	vector<uint32_t> PixelData;
+	bool HasTransparentPixels = true;
+
+	//Copies of PixelData with the brightness of the backgrounds that use this file already applied, by brightness
+	std::unordered_map<int, vector<uint32_t>> AdjustedPixelData;
 };
 
 struct HdBackgroundInfo
@@ -311,6 +562,7 @@ struct HdBackgroundInfo
 	HdBackgroundFileData* Data;
 	int Brightness;
 	vector<HdPackCondition*> Conditions;
+	HdPackConditionProgram ConditionProgram;
 	float HorizontalScrollRatio;
 	float VerticalScrollRatio;
 	uint8_t Priority;
@@ -352,8 +604,10 @@ struct HdPackData
 	vector<unique_ptr<HdBackgroundFileData>> BackgroundFileData;
 	vector<unique_ptr<HdPackTileInfo>> Tiles;
 	vector<unique_ptr<HdPackCondition>> Conditions;
-	std::unordered_set<uint32_t> WatchedMemoryAddresses;
-	std::unordered_map<HdTileKey, vector<HdPackTileInfo*>> TileByKey;
+	vector<HdPackCondition*> FrameConditions; //Indexed by HdPackCondition::FrameResultIndex
+	vector<uint32_t> WatchedMemoryAddresses;
+	HdTileIndex TileByKey;
+	HdPackTileCache TileCache; //Declared after the tiles/backgrounds, so its thread is stopped before they are destroyed
 	std::unordered_map<string, string> PatchesByHash;
 	std::unordered_map<int, string> BgmFilesById;
 	std::unordered_map<int, string> SfxFilesById;
@@ -5,14 +5,54 @@
 #include "EmulationSettings.h"
 #include "HdPackLoader.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define HD_PACK_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define HD_PACK_NEON
+#endif
+
 HdNesPack::HdNesPack(shared_ptr<HdPackData> hdData, EmulationSettings* settings)
 {
 	_hdData = hdData;
 	_settings = settings;
+	_lineBgConfig.resize(PPU::ScreenHeight * HdNesPack::BgConfigsPerLine);
+
+	_stopWorkers = false;
+	_pendingBands = 0;
+
+	uint32_t bandCount = std::thread::hardware_concurrency();
+	if(bandCount > HdNesPack::MaxBandCount) {
+		bandCount = HdNesPack::MaxBandCount;
+	}
+
+	//All the signals are created before the threads start, the threads can't access _workerSignals while it's being resized
+	for(uint32_t i = 1; i < bandCount; i++) {
+		_workerSignals.push_back(unique_ptr<AutoResetEvent>(new AutoResetEvent()));
+	}
+	for(uint32_t i = 1; i < bandCount; i++) {
+		AutoResetEvent* signal = _workerSignals[i - 1].get();
+		_workerThreads.push_back(std::thread([=]() {
+			while(true) {
+				signal->Wait();
+				if(_stopWorkers) {
+					break;
+				}
+				DrawBand(i);
+				_pendingBands--;
+			}
+		}));
+	}
 }
 
 HdNesPack::~HdNesPack()
 {
+	_stopWorkers = true;
+	for(size_t i = 0; i < _workerThreads.size(); i++) {
+		_workerSignals[i]->Signal();
+		_workerThreads[i].join();
+	}
 }
 
 void HdNesPack::BlendColors(uint8_t output[4], uint8_t input[4])
@@ -34,6 +74,122 @@ uint32_t HdNesPack::AdjustBrightness(uint8_t input[4], int brightness)
 	);
 }
 
+void HdNesPack::DrawPixels(uint32_t* outputBuffer, uint32_t* pixels, int32_t pixelInc, uint32_t count, int brightness, bool hasTransparentPixels)
+{
+	//Draws a row of HD pixels (pixelInc is -1 for horizontally mirrored tiles), same result as calling AdjustBrightness/BlendColors on each pixel
+	uint32_t i = 0;
+	bool adjustBrightness = brightness != 255;
+
+#if defined(HD_PACK_SSE2)
+	if(brightness >= 0 && brightness <= 255) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i one = _mm_set1_epi16(1);
+		const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+		const __m128i lowByteMask = _mm_set1_epi16(0xFF);
+		const __m128i brightness16 = _mm_set1_epi16((int16_t)brightness);
+		for(; i + 4 <= count; i += 4) {
+			__m128i src;
+			if(pixelInc > 0) {
+				src = _mm_loadu_si128((__m128i*)pixels);
+			} else {
+				src = _mm_shuffle_epi32(_mm_loadu_si128((__m128i*)(pixels - 3)), _MM_SHUFFLE(0, 1, 2, 3));
+			}
+			pixels += pixelInc * 4;
+
+			__m128i color = src;
+			if(adjustBrightness) {
+				//(brightness * (channel + 1)) >> 8 fits in 16 bits and can't exceed 255 when brightness < 256
+				__m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_add_epi16(_mm_unpacklo_epi8(src, zero), one), brightness16), 8);
+				__m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_add_epi16(_mm_unpackhi_epi8(src, zero), one), brightness16), 8);
+				color = _mm_or_si128(_mm_andnot_si128(alphaMask, _mm_packus_epi16(lo, hi)), _mm_and_si128(src, alphaMask));
+			}
+
+			if(!hasTransparentPixels) {
+				_mm_storeu_si128((__m128i*)(outputBuffer + i), color);
+				continue;
+			}
+
+			__m128i alpha = _mm_and_si128(src, alphaMask);
+			__m128i opaque = _mm_cmpeq_epi32(alpha, alphaMask);
+			if(_mm_movemask_epi8(opaque) == 0xFFFF) {
+				_mm_storeu_si128((__m128i*)(outputBuffer + i), color);
+				continue;
+			}
+
+			__m128i transparent = _mm_cmpeq_epi32(alpha, zero);
+			__m128i out = _mm_loadu_si128((__m128i*)(outputBuffer + i));
+			__m128i colorLo = _mm_unpacklo_epi8(color, zero);
+			__m128i colorHi = _mm_unpackhi_epi8(color, zero);
+			__m128i invAlphaLo = _mm_sub_epi16(_mm_set1_epi16(256), _mm_shufflehi_epi16(_mm_shufflelo_epi16(colorLo, 0xFF), 0xFF));
+			__m128i invAlphaHi = _mm_sub_epi16(_mm_set1_epi16(256), _mm_shufflehi_epi16(_mm_shufflelo_epi16(colorHi, 0xFF), 0xFF));
+			__m128i blendLo = _mm_and_si128(_mm_add_epi16(colorLo, _mm_srli_epi16(_mm_mullo_epi16(invAlphaLo, _mm_unpacklo_epi8(out, zero)), 8)), lowByteMask);
+			__m128i blendHi = _mm_and_si128(_mm_add_epi16(colorHi, _mm_srli_epi16(_mm_mullo_epi16(invAlphaHi, _mm_unpackhi_epi8(out, zero)), 8)), lowByteMask);
+			__m128i blended = _mm_or_si128(_mm_packus_epi16(blendLo, blendHi), alphaMask);
+
+			__m128i result = _mm_or_si128(_mm_and_si128(transparent, out), _mm_andnot_si128(transparent, blended));
+			result = _mm_or_si128(_mm_and_si128(opaque, color), _mm_andnot_si128(opaque, result));
+			_mm_storeu_si128((__m128i*)(outputBuffer + i), result);
+		}
+	}
+#elif defined(HD_PACK_NEON)
+	if(brightness >= 0 && brightness <= 255) {
+		const uint32x4_t alphaMask = vdupq_n_u32(0xFF000000);
+		const uint16x8_t one = vdupq_n_u16(1);
+		const uint16x8_t maxAlpha = vdupq_n_u16(256);
+		const uint16x8_t brightness16 = vdupq_n_u16((uint16_t)brightness);
+		for(; i + 4 <= count; i += 4) {
+			uint32x4_t src;
+			if(pixelInc > 0) {
+				src = vld1q_u32(pixels);
+			} else {
+				src = vrev64q_u32(vld1q_u32(pixels - 3));
+				src = vcombine_u32(vget_high_u32(src), vget_low_u32(src));
+			}
+			pixels += pixelInc * 4;
+
+			uint32x4_t color = src;
+			if(adjustBrightness) {
+				uint8x16_t src8 = vreinterpretq_u8_u32(src);
+				uint16x8_t lo = vshrq_n_u16(vmulq_u16(vaddw_u8(one, vget_low_u8(src8)), brightness16), 8);
+				uint16x8_t hi = vshrq_n_u16(vmulq_u16(vaddw_u8(one, vget_high_u8(src8)), brightness16), 8);
+				color = vbslq_u32(alphaMask, src, vreinterpretq_u32_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi))));
+			}
+
+			if(!hasTransparentPixels) {
+				vst1q_u32(outputBuffer + i, color);
+				continue;
+			}
+
+			uint32x4_t alpha = vandq_u32(src, alphaMask);
+			uint32x4_t opaque = vceqq_u32(alpha, alphaMask);
+			uint32x4_t transparent = vceqq_u32(alpha, vdupq_n_u32(0));
+			uint32x4_t out = vld1q_u32(outputBuffer + i);
+
+			uint8x16_t color8 = vreinterpretq_u8_u32(color);
+			uint8x16_t out8 = vreinterpretq_u8_u32(out);
+			uint8x16_t alpha8 = vreinterpretq_u8_u32(vmulq_n_u32(vshrq_n_u32(color, 24), 0x01010101));
+			uint16x8_t invAlphaLo = vsubq_u16(maxAlpha, vmovl_u8(vget_low_u8(alpha8)));
+			uint16x8_t invAlphaHi = vsubq_u16(maxAlpha, vmovl_u8(vget_high_u8(alpha8)));
+			uint16x8_t blendLo = vaddq_u16(vmovl_u8(vget_low_u8(color8)), vshrq_n_u16(vmulq_u16(invAlphaLo, vmovl_u8(vget_low_u8(out8))), 8));
+			uint16x8_t blendHi = vaddq_u16(vmovl_u8(vget_high_u8(color8)), vshrq_n_u16(vmulq_u16(invAlphaHi, vmovl_u8(vget_high_u8(out8))), 8));
+			uint32x4_t blended = vorrq_u32(vreinterpretq_u32_u8(vcombine_u8(vmovn_u16(blendLo), vmovn_u16(blendHi))), alphaMask);
+
+			vst1q_u32(outputBuffer + i, vbslq_u32(opaque, color, vbslq_u32(transparent, out, blended)));
+		}
+	}
+#endif
+
+	for(; i < count; i++) {
+		uint32_t rgbValue = adjustBrightness ? AdjustBrightness((uint8_t*)pixels, brightness) : *pixels;
+		if(!hasTransparentPixels || (*pixels & 0xFF000000) == 0xFF000000) {
+			outputBuffer[i] = rgbValue;
+		} else if(*pixels & 0xFF000000) {
+			BlendColors((uint8_t*)(outputBuffer + i), (uint8_t*)&rgbValue);
+		}
+		pixels += pixelInc;
+	}
+}
+
 void HdNesPack::DrawColor(uint32_t color, uint32_t *outputBuffer, uint32_t scale, uint32_t screenWidth)
 {
 	if(scale == 1) {
@@ -46,39 +202,27 @@ void HdNesPack::DrawColor(uint32_t color, uint32_t *outputBuffer, uint32_t scale
 	}
 }
 
-void HdNesPack::DrawCustomBackground(HdBackgroundInfo& bgInfo, uint32_t *outputBuffer, uint32_t x, uint32_t y, uint32_t scale, uint32_t screenWidth)
+uint32_t* HdNesPack::GetBackgroundPixels(HdBackgroundInfo &bgInfo)
 {
-	int brightness = bgInfo.Brightness;
-	uint32_t left = bgInfo.Left;
-	uint32_t top = bgInfo.Top;
-	uint32_t width = bgInfo.Data->Width;
-	uint32_t *pngData = bgInfo.data() + ((top + y) * _hdData->Scale * width) + ((left + x) * _hdData->Scale);
-	uint32_t pixelColor;
-
-	for(uint32_t i = 0; i < scale; i++) {
-		for(uint32_t j = 0; j < scale; j++) {
-			if(brightness == 255) {
-				pixelColor = *pngData;
-			} else {
-				pixelColor = AdjustBrightness((uint8_t*)pngData, brightness);
-			}
-
-			if(((uint8_t*)pngData)[3] == 0xFF) {
-				*outputBuffer = pixelColor;
-			} else if(((uint8_t*)pngData)[3]) {
-				BlendColors((uint8_t*)outputBuffer, (uint8_t*)(&pixelColor));
-			}
+	HdBackgroundFileData &bgData = *bgInfo.Data;
+	if(bgInfo.Brightness == 255) {
+		return bgData.PixelData.data();
+	}
 
-			outputBuffer++;
-			pngData++;
+	//Backgrounds always use the same brightness, apply it once rather than every time the background is drawn
+	vector<uint32_t> &pixels = bgData.AdjustedPixelData[bgInfo.Brightness];
+	if(pixels.size() != bgData.PixelData.size()) {
+		pixels.resize(bgData.PixelData.size());
+		for(size_t i = 0; i < pixels.size(); i++) {
+			pixels[i] = AdjustBrightness((uint8_t*)&bgData.PixelData[i], bgInfo.Brightness);
 		}
-		outputBuffer += screenWidth - scale;
-		pngData += width - scale;
 	}
+	return pixels.data();
 }
 
 void HdNesPack::DrawTile(HdPpuTileInfo &tileInfo, HdPackTileInfo &hdPackTileInfo, uint32_t *outputBuffer, uint32_t screenWidth)
 {
+	_hdData->TileCache.LoadTile(hdPackTileInfo.BitmapIndex);
 	if(hdPackTileInfo.IsFullyTransparent) {
 		return;
 	}
@@ -100,38 +244,17 @@ void HdNesPack::DrawTile(HdPpuTileInfo &tileInfo, HdPackTileInfo &hdPackTileInfo
 		bitmapLargeInc = (tileInfo.HorizontalMirroring ? (int32_t)scale : -(int32_t)scale) - (int32_t)tileWidth;
 	}
 
-	uint32_t rgbValue;
-	if(hdPackTileInfo.HasTransparentPixels || hdPackTileInfo.Brightness != 255) {
+	if(hdPackTileInfo.HasTransparentPixels || hdPackTileInfo.Brightness != 255 || bitmapSmallInc < 0) {
 		for(uint32_t y = 0; y < scale; y++) {
-			for(uint32_t x = 0; x < scale; x++) {
-				if(hdPackTileInfo.Brightness == 255) {
-					rgbValue = *(bitmapData + bitmapOffset);
-				} else {
-					rgbValue = AdjustBrightness((uint8_t*)(bitmapData + bitmapOffset), hdPackTileInfo.Brightness);
-				}
-
-				if(!hdPackTileInfo.HasTransparentPixels || (bitmapData[bitmapOffset] & 0xFF000000) == 0xFF000000) {
-					*outputBuffer = rgbValue;
-				} else {
-					if(bitmapData[bitmapOffset] & 0xFF000000) {
-						BlendColors((uint8_t*)outputBuffer, (uint8_t*)&rgbValue);
-					}
-				}
-				outputBuffer++;
-				bitmapOffset += bitmapSmallInc;
-			}
-			bitmapOffset += bitmapLargeInc;
-			outputBuffer += screenWidth - scale;
+			DrawPixels(outputBuffer, bitmapData + bitmapOffset, bitmapSmallInc, scale, hdPackTileInfo.Brightness, hdPackTileInfo.HasTransparentPixels);
+			bitmapOffset += bitmapSmallInc * (int32_t)scale + bitmapLargeInc;
+			outputBuffer += screenWidth;
 		}
 	} else {
 		for(uint32_t y = 0; y < scale; y++) {
-			for(uint32_t x = 0; x < scale; x++) {
-				*outputBuffer = *(bitmapData + bitmapOffset);
-				outputBuffer++;
-				bitmapOffset += bitmapSmallInc;
-			}
-			bitmapOffset += bitmapLargeInc;
-			outputBuffer += screenWidth - scale;
+			memcpy(outputBuffer, bitmapData + bitmapOffset, scale * sizeof(uint32_t));
+			bitmapOffset += scale + bitmapLargeInc;
+			outputBuffer += screenWidth;
 		}
 	}
 }
@@ -141,19 +264,30 @@ uint32_t HdNesPack::GetScale()
 	return _hdData->Scale;
 }
 
-void HdNesPack::OnLineStart(HdPpuPixelInfo &lineFirstPixel, uint8_t y)
+void HdNesPack::OnLineStart(HdPpuScanlineInfo &scanline, uint8_t y)
 {
-	_scrollX = ((lineFirstPixel.TmpVideoRamAddr & 0x1F) << 3) | lineFirstPixel.XScroll | ((lineFirstPixel.TmpVideoRamAddr & 0x400) ? 0x100 : 0);
-	_useCachedTile = false;
-
-	int32_t scrollY = (((lineFirstPixel.TmpVideoRamAddr & 0x3E0) >> 2) | ((lineFirstPixel.TmpVideoRamAddr & 0x7000) >> 12)) + ((lineFirstPixel.TmpVideoRamAddr & 0x800) ? 240 : 0);
+	int32_t scrollX = ((scanline.TmpVideoRamAddr & 0x1F) << 3) | scanline.XScroll | ((scanline.TmpVideoRamAddr & 0x400) ? 0x100 : 0);
+	int32_t scrollY = (((scanline.TmpVideoRamAddr & 0x3E0) >> 2) | ((scanline.TmpVideoRamAddr & 0x7000) >> 12)) + ((scanline.TmpVideoRamAddr & 0x800) ? 240 : 0);
 	
+	//The scroll position rarely changes within a frame, reuse the previous line's parallax offsets when it doesn't
+	bool scrollChanged = scrollX != _lineScrollX || scrollY != _lineScrollY;
+	_lineScrollX = scrollX;
+	_lineScrollY = scrollY;
+
+	HdBgConfig* lineBgConfig = _lineBgConfig.data() + y * HdNesPack::BgConfigsPerLine;
 	for(int layer = 0; layer < 4; layer++) {
 		for(int i = 0; i < _activeBgCount[layer]; i++) {
-			HdBgConfig& cfg = _bgConfig[layer * HdNesPack::PriorityLevelsPerLayer + i];
+			HdBgConfig& cfg = lineBgConfig[layer * HdNesPack::PriorityLevelsPerLayer + i];
+			cfg = _bgConfig[layer * HdNesPack::PriorityLevelsPerLayer + i];
 			HdBackgroundInfo& bgInfo = _hdData->Backgrounds[cfg.BackgroundIndex];
-			cfg.BgScrollX = (int32_t)(_scrollX * bgInfo.HorizontalScrollRatio);
-			cfg.BgScrollY = (int32_t)(scrollY * bgInfo.VerticalScrollRatio);
+			if(scrollChanged) {
+				cfg.BgScrollX = (int32_t)(scrollX * bgInfo.HorizontalScrollRatio);
+				cfg.BgScrollY = (int32_t)(scrollY * bgInfo.VerticalScrollRatio);
+			} else {
+				HdBgConfig& prevCfg = lineBgConfig[layer * HdNesPack::PriorityLevelsPerLayer + i - HdNesPack::BgConfigsPerLine];
+				cfg.BgScrollX = prevCfg.BgScrollX;
+				cfg.BgScrollY = prevCfg.BgScrollY;
+			}
 			if(y >= -cfg.BgScrollY && (y + bgInfo.Top + cfg.BgScrollY + 1) * _hdData->Scale <= bgInfo.Data->Height) {
 				cfg.BgMinX = -cfg.BgScrollX;
 				cfg.BgMaxX = bgInfo.Data->Width / _hdData->Scale - bgInfo.Left - cfg.BgScrollX - 1;
@@ -172,15 +306,7 @@ int32_t HdNesPack::GetLayerIndex(uint8_t priority)
 			continue;
 		}
 
-		bool isMatch = true;
-		for(HdPackCondition* condition : _hdData->Backgrounds[i].Conditions) {
-			if(!condition->CheckCondition(_hdScreenInfo, 0, 0, nullptr)) {
-				isMatch = false;
-				break;
-			}
-		}
-
-		if(isMatch) {
+		if(_hdData->Backgrounds[i].ConditionProgram.Matches(_frameConditionResults.data(), _hdScreenInfo, 0, 0, nullptr)) {
 			return (int32_t)i;
 		}
 	}
@@ -191,181 +317,274 @@ void HdNesPack::OnBeforeApplyFilter()
 {
 	_palette = _hdData->Palette.size() == 0x40 ? _hdData->Palette.data() : _settings->GetRgbPalette();
 	_cacheEnabled = (_hdData->OptionFlags & (int)HdPackOptions::DisableCache) == 0;
+	_hdData->TileCache.StartFrame();
 
 	if(_hdData->OptionFlags & (int)HdPackOptions::NoSpriteLimit) {
 		_settings->SetFlags(EmulationFlags::RemoveSpriteLimit | EmulationFlags::AdaptiveSpriteLimit);
 	}
 
+	//Evaluate the conditions that don't depend on the tile once for the whole frame
+	vector<HdPackCondition*> &frameConditions = _hdData->FrameConditions;
+	_frameConditionResults.assign((frameConditions.size() + 63) / 64, 0);
+	for(size_t i = 0; i < frameConditions.size(); i++) {
+		if(frameConditions[i]->CheckCondition(_hdScreenInfo, 0, 0, nullptr)) {
+			_frameConditionResults[i >> 6] |= (uint64_t)1 << (i & 0x3F);
+		}
+	}
+
+	_lineScrollX = -1;
+	_lineScrollY = -1;
 	for(int layer = 0; layer < 4; layer++) {
 		uint32_t activeCount = 0;
 		for(int i = 0; i < HdNesPack::PriorityLevelsPerLayer; i++) {
 			int32_t index = GetLayerIndex(layer * HdNesPack::PriorityLevelsPerLayer + i);
 			if(index >= 0) {
-				_bgConfig[layer*10+activeCount].BackgroundIndex = index;
+				HdBackgroundInfo &bgInfo = _hdData->Backgrounds[index];
+				HdBgConfig &cfg = _bgConfig[layer*10+activeCount];
+				cfg.BackgroundIndex = index;
+				_hdData->TileCache.LoadBackground(*bgInfo.Data);
+				cfg.PixelData = GetBackgroundPixels(bgInfo);
+				cfg.HasTransparentPixels = bgInfo.Data->HasTransparentPixels;
 				activeCount++;
 			}
 		}
 		_activeBgCount[layer] = activeCount;
 	}
-
-	for(unique_ptr<HdPackCondition> &condition : _hdData->Conditions) {
-		condition->ClearCache();
-	}
 }
 
-HdPackTileInfo* HdNesPack::GetCachedMatchingTile(uint32_t x, uint32_t y, HdPpuTileInfo* tile)
+HdPackTileInfo* HdNesPack::GetMatchingTile(uint32_t x, uint32_t y, HdPpuTileInfo* tile, bool* disableCache)
 {
-	if(((_scrollX + x) & 0x07) == 0) {
-		_useCachedTile = false;
+	uint32_t count = 0;
+	HdPackTileInfo** candidates = _hdData->TileByKey.Find(*tile, tile->PaletteColors, count);
+	if(!candidates) {
+		//Look for a default tile (matches any palette)
+		candidates = _hdData->TileByKey.Find(*tile, 0xFFFFFFFF, count);
 	}
 
-	bool disableCache = false;
-	HdPackTileInfo* hdPackTileInfo;
-	if(_useCachedTile) {
-		hdPackTileInfo = _cachedTile;
-	} else {
-		hdPackTileInfo = GetMatchingTile(x, y, tile, &disableCache);
+	for(uint32_t i = 0; i < count; i++) {
+		HdPackTileInfo* hdPackTile = candidates[i];
+		if(disableCache != nullptr && hdPackTile->ForceDisableCache) {
+			*disableCache = true;
+		}
 
-		if(!disableCache && _cacheEnabled) {
-			//Use this tile for the next 8 horizontal pixels
-			//Disable cache if a sprite condition is used, because sprites are not on a 8x8 grid
-			_cachedTile = hdPackTileInfo;
-			_useCachedTile = true;
+		if(hdPackTile->MatchesCondition(_frameConditionResults.data(), _hdScreenInfo, x, y, tile)) {
+			return hdPackTile;
 		}
 	}
-	return hdPackTileInfo;
+
+	return nullptr;
 }
 
-HdPackTileInfo* HdNesPack::GetMatchingTile(uint32_t x, uint32_t y, HdPpuTileInfo* tile, bool* disableCache)
+void HdNesPack::DrawBackgroundStrip(HdBgConfig &bgConfig, uint32_t y, uint32_t left, uint32_t right, uint32_t* outputBuffer, uint32_t screenWidth)
 {
-	auto hdTile = _hdData->TileByKey.find(*tile);
-	if(hdTile == _hdData->TileByKey.end()) {
-		hdTile = _hdData->TileByKey.find(tile->GetKey(true));
+	int32_t start = std::max<int32_t>(left, bgConfig.BgMinX);
+	int32_t end = std::min<int32_t>(right - 1, bgConfig.BgMaxX);
+	if(start > end) {
+		return;
 	}
 
-	if(hdTile != _hdData->TileByKey.end()) {
-		for(HdPackTileInfo* hdPackTile : hdTile->second) {
-			if(disableCache != nullptr && hdPackTile->ForceDisableCache) {
-				*disableCache = true;
-			}
+	HdBackgroundInfo& bgInfo = _hdData->Backgrounds[bgConfig.BackgroundIndex];
+	uint32_t scale = _hdData->Scale;
+	uint32_t width = bgInfo.Data->Width;
+	uint32_t *pngData = bgConfig.PixelData + ((bgInfo.Top + y + bgConfig.BgScrollY) * scale * width) + ((bgInfo.Left + start + bgConfig.BgScrollX) * scale);
+	uint32_t count = (end - start + 1) * scale;
+	outputBuffer += (start - left) * scale;
 
-			if(hdPackTile->MatchesCondition(_hdScreenInfo, x, y, tile)) {
-				return hdPackTile;
-			}
+	for(uint32_t i = 0; i < scale; i++) {
+		if(bgConfig.HasTransparentPixels) {
+			DrawPixels(outputBuffer, pngData, 1, count, 255, true);
+		} else {
+			memcpy(outputBuffer, pngData, count * sizeof(uint32_t));
 		}
+		outputBuffer += screenWidth;
+		pngData += width;
 	}
-
-	return nullptr;
 }
 
-bool HdNesPack::DrawBackgroundLayer(uint8_t priority, uint32_t x, uint32_t y, uint32_t* outputBuffer, uint32_t screenWidth)
+bool HdNesPack::HasBackground(HdBgConfig *bgConfig, uint32_t x)
 {
-	HdBgConfig bgConfig = _bgConfig[(int)priority];
-	if((int32_t)x >= bgConfig.BgMinX && (int32_t)x <= bgConfig.BgMaxX) {
-		HdBackgroundInfo& bgInfo = _hdData->Backgrounds[bgConfig.BackgroundIndex];
-		DrawCustomBackground(bgInfo, outputBuffer, x + bgConfig.BgScrollX, y + bgConfig.BgScrollY, _hdData->Scale, screenWidth);
-		return true;
+	for(int layer = 0; layer < 2; layer++) {
+		for(int i = 0; i < _activeBgCount[layer]; i++) {
+			HdBgConfig &cfg = bgConfig[layer * HdNesPack::PriorityLevelsPerLayer + i];
+			if((int32_t)x >= cfg.BgMinX && (int32_t)x <= cfg.BgMaxX) {
+				return true;
+			}
+		}
 	}
 	return false;
 }
 
-void HdNesPack::GetPixels(uint32_t x, uint32_t y, HdPpuPixelInfo &pixelInfo, uint32_t *outputBuffer, uint32_t screenWidth)
+void HdNesPack::GetPixels(uint32_t x, uint32_t y, HdPpuTileInfo &tile, HdPackTileInfo *hdPackTileInfo, HdPpuTileInfo *sprites, uint32_t spriteCount, HdBgConfig *bgConfig, uint32_t firstStage, uint32_t lastStage, uint32_t *outputBuffer, uint32_t screenWidth)
 {
-	HdPackTileInfo *hdPackTileInfo = nullptr;
+	//Stages: 0 = backdrop, 1 = sprites behind the background, 2 = background tile, 3 = foreground sprites
 	HdPackTileInfo *hdPackSpriteInfo = nullptr;
 
-	bool hasSprite = pixelInfo.SpriteCount > 0;
-	bool renderOriginalTiles = ((_hdData->OptionFlags & (int)HdPackOptions::DontRenderOriginalTiles) == 0);
-	if(pixelInfo.Tile.TileIndex != HdPpuTileInfo::NoTile) {
-		hdPackTileInfo = GetCachedMatchingTile(x, y, &pixelInfo.Tile);
+	if(firstStage == 0) {
+		DrawColor(_palette[tile.PpuBackgroundColor], outputBuffer, _hdData->Scale, screenWidth);
 	}
 
-	int lowestBgSprite = 999;
-	
-	DrawColor(_palette[pixelInfo.Tile.PpuBackgroundColor], outputBuffer, _hdData->Scale, screenWidth);
+	if(firstStage <= 1 && lastStage >= 1) {
+		for(int k = (int)spriteCount - 1; k >= 0; k--) {
+			if(sprites[k].BackgroundPriority) {
+				hdPackSpriteInfo = GetMatchingTile(x, y, &sprites[k]);
+				if(hdPackSpriteInfo) {
+					DrawTile(sprites[k], *hdPackSpriteInfo, outputBuffer, screenWidth);
+				} else if(sprites[k].SpriteColorIndex != 0) {
+					DrawColor(_palette[sprites[k].SpriteColor], outputBuffer, _hdData->Scale, screenWidth);
+				}
+			}
+		}
+	}
 
-	bool hasBackground = false;
-	for(int i = 0; i < _activeBgCount[0]; i++) {
-		hasBackground |= DrawBackgroundLayer(HdNesPack::BehindBgSpritesPriority+i, x, y, outputBuffer, screenWidth);
+	if(firstStage <= 2 && lastStage >= 2) {
+		if(hdPackTileInfo) {
+			DrawTile(tile, *hdPackTileInfo, outputBuffer, screenWidth);
+		} else if((_hdData->OptionFlags & (int)HdPackOptions::DontRenderOriginalTiles) == 0) {
+			//Draw regular SD background tile
+			if(tile.BgColorIndex != 0 || !HasBackground(bgConfig, x)) {
+				DrawColor(_palette[tile.BgColor], outputBuffer, _hdData->Scale, screenWidth);
+			}
+		}
 	}
 
-	if(hasSprite) {
-		for(int k = pixelInfo.SpriteCount - 1; k >= 0; k--) {
-			if(pixelInfo.Sprite[k].BackgroundPriority) {
-				if(pixelInfo.Sprite[k].SpriteColorIndex != 0) {
-					lowestBgSprite = k;
-				}
+	if(lastStage == 3) {
+		uint32_t lowestBgSprite = 0;
+		while(lowestBgSprite < spriteCount && (!sprites[lowestBgSprite].BackgroundPriority || sprites[lowestBgSprite].SpriteColorIndex == 0)) {
+			lowestBgSprite++;
+		}
 
-				hdPackSpriteInfo = GetMatchingTile(x, y, &pixelInfo.Sprite[k]);
+		for(int k = (int)std::min(spriteCount, lowestBgSprite) - 1; k >= 0; k--) {
+			if(!sprites[k].BackgroundPriority) {
+				hdPackSpriteInfo = GetMatchingTile(x, y, &sprites[k]);
 				if(hdPackSpriteInfo) {
-					DrawTile(pixelInfo.Sprite[k], *hdPackSpriteInfo, outputBuffer, screenWidth);
-				} else if(pixelInfo.Sprite[k].SpriteColorIndex != 0) {
-					DrawColor(_palette[pixelInfo.Sprite[k].SpriteColor], outputBuffer, _hdData->Scale, screenWidth);
+					DrawTile(sprites[k], *hdPackSpriteInfo, outputBuffer, screenWidth);
+				} else if(sprites[k].SpriteColorIndex != 0) {
+					DrawColor(_palette[sprites[k].SpriteColor], outputBuffer, _hdData->Scale, screenWidth);
 				}
 			}
 		}
 	}
-	
-	for(int i = 0; i < _activeBgCount[1]; i++) {
-		hasBackground |= DrawBackgroundLayer(HdNesPack::BehindBgPriority+i, x, y, outputBuffer, screenWidth);
+}
+
+void HdNesPack::DrawScanline(HdPpuScanlineInfo &scanline, uint32_t y, uint32_t left, uint32_t right, uint32_t *outputBuffer, uint32_t screenWidth)
+{
+	if(scanline.BgSpans.empty()) {
+		return;
 	}
-	
-	if(hdPackTileInfo) {
-		DrawTile(pixelInfo.Tile, *hdPackTileInfo, outputBuffer, screenWidth);
-	} else if(renderOriginalTiles) {
-		//Draw regular SD background tile
-		if(!hasBackground || pixelInfo.Tile.BgColorIndex != 0) {
-			DrawColor(_palette[pixelInfo.Tile.BgColor], outputBuffer, _hdData->Scale, screenWidth);
+
+	//Each background layer is blitted as one strip per output line after the pixels of the stage it's drawn on top of,
+	//consecutive stages with no background between them are drawn in a single pass
+	HdBgConfig* bgConfig = _lineBgConfig.data() + y * HdNesPack::BgConfigsPerLine;
+	uint32_t firstStage = 0;
+	for(uint32_t stage = 0; stage < 4; stage++) {
+		if(_activeBgCount[stage] == 0 && stage < 3) {
+			continue;
 		}
-	}
 
-	for(int i = 0; i < _activeBgCount[2]; i++) {
-		DrawBackgroundLayer(HdNesPack::BehindFgSpritesPriority+i, x, y, outputBuffer, screenWidth);
+		DrawScanlineStages(scanline, y, left, right, firstStage, stage, outputBuffer, screenWidth);
+		for(int i = 0; i < _activeBgCount[stage]; i++) {
+			DrawBackgroundStrip(bgConfig[stage * HdNesPack::PriorityLevelsPerLayer + i], y, left, right, outputBuffer, screenWidth);
+		}
+		firstStage = stage + 1;
 	}
+}
 
-	if(hasSprite) {
-		for(int k = pixelInfo.SpriteCount - 1; k >= 0; k--) {
-			if(!pixelInfo.Sprite[k].BackgroundPriority && lowestBgSprite > k) {
-				hdPackSpriteInfo = GetMatchingTile(x, y, &pixelInfo.Sprite[k]);
-				if(hdPackSpriteInfo) {
-					DrawTile(pixelInfo.Sprite[k], *hdPackSpriteInfo, outputBuffer, screenWidth);
-				} else if(pixelInfo.Sprite[k].SpriteColorIndex != 0) {
-					DrawColor(_palette[pixelInfo.Sprite[k].SpriteColor], outputBuffer, _hdData->Scale, screenWidth);
+void HdNesPack::DrawScanlineStages(HdPpuScanlineInfo &scanline, uint32_t y, uint32_t left, uint32_t right, uint32_t firstStage, uint32_t lastStage, uint32_t *outputBuffer, uint32_t screenWidth)
+{
+	uint32_t scale = GetScale();
+	HdBgConfig* bgConfig = _lineBgConfig.data() + y * HdNesPack::BgConfigsPerLine;
+	bool drawTiles = firstStage <= 2 && lastStage >= 2;
+	bool drawSprites = (firstStage <= 1 && lastStage >= 1) || lastStage == 3;
+	uint32_t x = left;
+	for(size_t i = 0, len = scanline.BgSpans.size(); i < len && x < right; i++) {
+		HdPpuBgSpan &span = scanline.BgSpans[i];
+		uint32_t spanEnd = std::min<uint32_t>(i + 1 < len ? scanline.BgSpans[i + 1].StartX : PPU::ScreenWidth, right);
+		if(spanEnd <= x) {
+			continue;
+		}
+
+		//The tile is matched once for the whole span, unless the pack's conditions need to be checked for each pixel
+		uint32_t firstX = x;
+		HdPpuTileInfo tile = span.Tile;
+		tile.OffsetX = span.Tile.OffsetX + (x - span.StartX);
+		HdPackTileInfo *hdPackTileInfo = nullptr;
+		bool matchEachPixel = false;
+		if(drawTiles && tile.TileIndex != HdPpuTileInfo::NoTile) {
+			bool disableCache = false;
+			hdPackTileInfo = GetMatchingTile(x, y, &tile, &disableCache);
+			matchEachPixel = disableCache || !_cacheEnabled;
+		}
+
+		for(; x < spanEnd; x++) {
+			tile.OffsetX = span.Tile.OffsetX + (x - span.StartX);
+			tile.BgColorIndex = span.GetColorIndex(tile.OffsetX);
+			tile.BgColor = span.Colors[tile.BgColorIndex];
+			if(matchEachPixel && x != firstX) {
+				hdPackTileInfo = GetMatchingTile(x, y, &tile);
+			}
+
+			HdPpuTileInfo sprites[4];
+			uint32_t spriteCount = 0;
+			if(drawSprites && span.SpritesVisible) {
+				HdPpuSpriteSpan* spriteSpans[4];
+				spriteCount = scanline.GetSprites(x, spriteSpans);
+				for(uint32_t k = 0; k < spriteCount; k++) {
+					HdPpuSpriteSpan &sprite = *spriteSpans[k];
+					sprites[k] = sprite.Tile;
+					sprites[k].OffsetX = x - sprite.SpriteX;
+					sprites[k].SpriteColorIndex = sprite.GetColorIndex(sprites[k].OffsetX);
+					sprites[k].SpriteColor = sprite.Colors[sprites[k].SpriteColorIndex];
 				}
 			}
-		}
-	}
 
-	for(int i = 0; i < _activeBgCount[3]; i++) {
-		DrawBackgroundLayer(HdNesPack::ForegroundPriority+i, x, y, outputBuffer, screenWidth);
+			GetPixels(x, y, tile, hdPackTileInfo, sprites, spriteCount, bgConfig, firstStage, lastStage, outputBuffer, screenWidth);
+			outputBuffer += scale;
+		}
 	}
 }
 
 void HdNesPack::Process(HdScreenInfo *hdScreenInfo, uint32_t* outputBuffer, OverscanDimensions &overscan)
 {
 	_hdScreenInfo = hdScreenInfo;
-	uint32_t hdScale = GetScale();
-	uint32_t screenWidth = overscan.GetScreenWidth() * hdScale;
+	_outputBuffer = outputBuffer;
+	_overscan = overscan;
+	_screenWidth = overscan.GetScreenWidth() * GetScale();
 
 	OnBeforeApplyFilter();
 	for(uint32_t i = overscan.Top, iMax = 240 - overscan.Bottom; i < iMax; i++) {
-		OnLineStart(hdScreenInfo->ScreenTiles[i << 8], i);
-		uint32_t bufferIndex = (i - overscan.Top) * screenWidth * hdScale;
-		uint32_t lineStartIndex = bufferIndex;
-		for(uint32_t j = overscan.Left, jMax = 256 - overscan.Right; j < jMax; j++) {
-			GetPixels(j, i, hdScreenInfo->ScreenTiles[i * 256 + j], outputBuffer + bufferIndex, screenWidth);
-			bufferIndex += hdScale;
-		}
+		OnLineStart(hdScreenInfo->Scanlines[i], i);
+	}
+
+	_pendingBands = (uint32_t)_workerThreads.size();
+	for(unique_ptr<AutoResetEvent> &signal : _workerSignals) {
+		signal->Signal();
+	}
+	DrawBand(0);
+	while(_pendingBands > 0) {
+		std::this_thread::yield();
+	}
+}
+
+void HdNesPack::DrawBand(uint32_t band)
+{
+	uint32_t bandCount = (uint32_t)_workerThreads.size() + 1;
+	uint32_t top = _overscan.Top;
+	uint32_t lineCount = 240 - _overscan.Bottom - top;
+	uint32_t hdScale = GetScale();
 
-		ProcessGrayscaleAndEmphasis(hdScreenInfo->ScreenTiles[i * 256], outputBuffer + lineStartIndex, screenWidth);
+	for(uint32_t i = top + lineCount * band / bandCount, iMax = top + lineCount * (band + 1) / bandCount; i < iMax; i++) {
+		HdPpuScanlineInfo &scanline = _hdScreenInfo->Scanlines[i];
+		uint32_t lineStartIndex = (i - top) * _screenWidth * hdScale;
+		DrawScanline(scanline, i, _overscan.Left, 256 - _overscan.Right, _outputBuffer + lineStartIndex, _screenWidth);
+		ProcessGrayscaleAndEmphasis(scanline, _outputBuffer + lineStartIndex, _screenWidth);
 	}
 }
 
-void HdNesPack::ProcessGrayscaleAndEmphasis(HdPpuPixelInfo &pixelInfo, uint32_t* outputBuffer, uint32_t hdScreenWidth)
+void HdNesPack::ProcessGrayscaleAndEmphasis(HdPpuScanlineInfo &scanline, uint32_t* outputBuffer, uint32_t hdScreenWidth)
 {
 	//Apply grayscale/emphasis bits on a scanline level (less accurate, but shouldn't cause issues and simpler to implement)
 	uint32_t scale = GetScale();
-	if(pixelInfo.Grayscale) {
+	if(scanline.Grayscale) {
 		uint32_t* out = outputBuffer;
 		for(uint32_t y = 0; y < scale; y++) {
 			for(uint32_t x = 0; x < hdScreenWidth; x++) {
@@ -377,8 +596,8 @@ void HdNesPack::ProcessGrayscaleAndEmphasis(HdPpuPixelInfo &pixelInfo, uint32_t*
 		}
 	}
 
-	if(pixelInfo.EmphasisBits) {
-		uint8_t emphasisBits = pixelInfo.EmphasisBits;
+	if(scanline.EmphasisBits) {
+		uint8_t emphasisBits = scanline.EmphasisBits;
 		double red = 1.0, green = 1.0, blue = 1.0;
 		if(emphasisBits & 0x01) {
 			//Intensify red
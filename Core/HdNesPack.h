@@ -1,6 +1,8 @@
 #pragma once
 #include "stdafx.h"
+#include <thread>
 #include "HdData.h"
+#include "../Utilities/AutoResetEvent.h"
 
 class EmulationSettings;
 
@@ -14,6 +16,8 @@ private:
 		int32_t BgScrollY = 0;
 		int16_t BgMinX = -1;
 		int16_t BgMaxX = -1;
+		uint32_t* PixelData = nullptr; //Background's pixels, with its brightness already applied
+		bool HasTransparentPixels = true;
 	};
 
 	shared_ptr<HdPackData> _hdData;
@@ -24,33 +28,51 @@ private:
 	static constexpr uint8_t BehindBgPriority = 1 * PriorityLevelsPerLayer;
 	static constexpr uint8_t BehindFgSpritesPriority = 2 * PriorityLevelsPerLayer;
 	static constexpr uint8_t ForegroundPriority = 3 * PriorityLevelsPerLayer;
+	static constexpr uint8_t BgConfigsPerLine = 4 * PriorityLevelsPerLayer;
+	static constexpr uint32_t MaxBandCount = 4;
 
 	uint8_t _activeBgCount[4] = {};
-	HdBgConfig _bgConfig[40] = {};
+	HdBgConfig _bgConfig[BgConfigsPerLine] = {};
+
+	//Background scrolling for each scanline, calculated before the frame is split between threads
+	vector<HdBgConfig> _lineBgConfig;
+	int32_t _lineScrollX = -1;
+	int32_t _lineScrollY = -1;
 
 	HdScreenInfo *_hdScreenInfo = nullptr;
 	uint32_t* _palette = nullptr;
-	HdPackTileInfo* _cachedTile = nullptr;
 	bool _cacheEnabled = false;
-	bool _useCachedTile = false;
-	int32_t _scrollX = 0;
+	vector<uint64_t> _frameConditionResults;
+
+	//The frame is drawn in horizontal bands, the first one by the calling thread and the others by the worker threads
+	vector<std::thread> _workerThreads;
+	vector<unique_ptr<AutoResetEvent>> _workerSignals;
+	atomic<bool> _stopWorkers;
+	atomic<uint32_t> _pendingBands;
+	uint32_t* _outputBuffer = nullptr;
+	OverscanDimensions _overscan;
+	uint32_t _screenWidth = 0;
 
 	__forceinline void BlendColors(uint8_t output[4], uint8_t input[4]);
 	__forceinline uint32_t AdjustBrightness(uint8_t input[4], int brightness);
+	__forceinline void DrawPixels(uint32_t* outputBuffer, uint32_t* pixels, int32_t pixelInc, uint32_t count, int brightness, bool hasTransparentPixels);
 	__forceinline void DrawColor(uint32_t color, uint32_t* outputBuffer, uint32_t scale, uint32_t screenWidth);
 	__forceinline void DrawTile(HdPpuTileInfo &tileInfo, HdPackTileInfo &hdPackTileInfo, uint32_t* outputBuffer, uint32_t screenWidth);
 	
-	__forceinline HdPackTileInfo* GetCachedMatchingTile(uint32_t x, uint32_t y, HdPpuTileInfo* tile);
 	__forceinline HdPackTileInfo* GetMatchingTile(uint32_t x, uint32_t y, HdPpuTileInfo* tile, bool* disableCache = nullptr);
 
-	__forceinline bool DrawBackgroundLayer(uint8_t priority, uint32_t x, uint32_t y, uint32_t* outputBuffer, uint32_t screenWidth);
-	__forceinline void DrawCustomBackground(HdBackgroundInfo& bgInfo, uint32_t *outputBuffer, uint32_t x, uint32_t y, uint32_t scale, uint32_t screenWidth);
+	uint32_t* GetBackgroundPixels(HdBackgroundInfo &bgInfo);
+	__forceinline void DrawBackgroundStrip(HdBgConfig &bgConfig, uint32_t y, uint32_t left, uint32_t right, uint32_t* outputBuffer, uint32_t screenWidth);
+	__forceinline bool HasBackground(HdBgConfig *bgConfig, uint32_t x);
 
-	void OnLineStart(HdPpuPixelInfo &lineFirstPixel, uint8_t y);
+	void OnLineStart(HdPpuScanlineInfo &scanline, uint8_t y);
 	int32_t GetLayerIndex(uint8_t priority);
 	void OnBeforeApplyFilter();
-	__forceinline void GetPixels(uint32_t x, uint32_t y, HdPpuPixelInfo &pixelInfo, uint32_t *outputBuffer, uint32_t screenWidth);
-	__forceinline void ProcessGrayscaleAndEmphasis(HdPpuPixelInfo &pixelInfo, uint32_t* outputBuffer, uint32_t hdScreenWidth);
+	void DrawBand(uint32_t band);
+	void DrawScanline(HdPpuScanlineInfo &scanline, uint32_t y, uint32_t left, uint32_t right, uint32_t *outputBuffer, uint32_t screenWidth);
+	__forceinline void DrawScanlineStages(HdPpuScanlineInfo &scanline, uint32_t y, uint32_t left, uint32_t right, uint32_t firstStage, uint32_t lastStage, uint32_t *outputBuffer, uint32_t screenWidth);
+	__forceinline void GetPixels(uint32_t x, uint32_t y, HdPpuTileInfo &tile, HdPackTileInfo *hdPackTileInfo, HdPpuTileInfo *sprites, uint32_t spriteCount, HdBgConfig *bgConfig, uint32_t firstStage, uint32_t lastStage, uint32_t *outputBuffer, uint32_t screenWidth);
+	__forceinline void ProcessGrayscaleAndEmphasis(HdPpuScanlineInfo &scanline, uint32_t* outputBuffer, uint32_t hdScreenWidth);
 
 public:
 	static constexpr uint32_t CurrentVersion = 106;
@@ -4,6 +4,7 @@
 #include "HdPackBuilder.h"
 #include "HdNesPack.h"
 #include "Console.h"
+#include "../Utilities/CRC32.h"
 
 HdPackBuilder* HdPackBuilder::_instance = nullptr;
 
@@ -28,6 +29,9 @@ HdPackBuilder::HdPackBuilder(shared_ptr<Console> console, string saveFolder, Sca
 	string existingPackDefinition = FolderUtilities::CombinePath(saveFolder, "hires.txt");
 	if(ifstream(existingPackDefinition)) {
 		HdPackLoader::LoadHdNesPack(existingPackDefinition, _hdData);
+
+		//The existing tiles are written back to the new PNG files, so they all need to be decoded
+		_hdData.TileCache.LoadAll();
 		for(unique_ptr<HdPackTileInfo> &tile : _hdData.Tiles) {
 			//Mark the tiles in the first PNGs as higher usage (preserves order when adding new tiles to an existing set)
 			AddTile(tile.get(), 0xFFFFFFFF - tile->BitmapIndex);
@@ -42,11 +46,26 @@ HdPackBuilder::HdPackBuilder(shared_ptr<Console> console, string saveFolder, Sca
 
 	_romName = FolderUtilities::GetFilename(_console->GetRomInfo().RomName, false);
 	_instance = this;
+
+	_recordQueue.resize(RecordQueueSize);
+	_queueReadPos = 0;
+	_queueWritePos = 0;
+	_stopBuilder = false;
+	_saveInProgress = false;
+	_builderThread = std::thread(&HdPackBuilder::ProcessRecordQueue, this);
 }
 
 HdPackBuilder::~HdPackBuilder()
 {
+	EndFrame();
+	_stopBuilder = true;
+	_builderSignal.Signal();
+	_builderThread.join();
+
+	//Only the tiles recorded since the last autosave need to be upscaled here
 	SaveHdPack();
+	WaitForSave();
+
 	if(_instance == this) {
 		_instance = nullptr;
 	}
@@ -104,47 +123,131 @@ void HdPackBuilder::ProcessTile(uint32_t x, uint32_t y, uint16_t tileAddr, HdPpu
 		}
 	}
 
-	auto result = _tileUsageCount.find(tile.GetKey(false));
+	//The same tile is usually shown by several consecutive pixels, only queue it once along with its pixel count
+	int slot = tile.IsSpriteTile() ? 1 : 0;
+	RecordedTile &pendingTile = _pendingTiles[slot];
+	if(_hasPendingTile[slot]) {
+		if(pendingTile.TransparencyRequired == transparencyRequired && pendingTile.Count < 0x7FFFFFFF && pendingTile.Key.Matches(tile, tile.PaletteColors)) {
+			pendingTile.Count++;
+			return;
+		}
+		QueueTile(pendingTile);
+	}
+
+	pendingTile.Key = tile;
+	pendingTile.ChrBankId = _isChrRam ? chrBankHash : (tileAddr / 16 / 256);
+	pendingTile.Count = 1;
+	pendingTile.TransparencyRequired = transparencyRequired;
+	_hasPendingTile[slot] = true;
+}
+
+void HdPackBuilder::EndFrame()
+{
+	for(int i = 0; i < 2; i++) {
+		if(_hasPendingTile[i]) {
+			QueueTile(_pendingTiles[i]);
+			_hasPendingTile[i] = false;
+		}
+	}
+	_builderSignal.Signal();
+}
+
+void HdPackBuilder::QueueTile(RecordedTile &tile)
+{
+	uint32_t writePos = _queueWritePos;
+	while(writePos - _queueReadPos >= RecordQueueSize) {
+		//Queue is full, wait for the builder thread to catch up (tiles are never dropped)
+		_builderSignal.Signal();
+		std::this_thread::yield();
+	}
+	_recordQueue[writePos & (RecordQueueSize - 1)] = tile;
+	_queueWritePos = writePos + 1;
+}
+
+void HdPackBuilder::ProcessRecordQueue()
+{
+	auto lastSave = std::chrono::steady_clock::now();
+	while(true) {
+		_builderSignal.Wait();
+
+		//Read the flag before draining the queue, to process all the tiles that were queued before the builder was stopped
+		bool stop = _stopBuilder;
+		{
+			std::lock_guard<std::mutex> lock(_tileLock);
+			uint32_t readPos = _queueReadPos;
+			while(readPos != _queueWritePos) {
+				RecordTile(_recordQueue[readPos & (RecordQueueSize - 1)]);
+				readPos++;
+				_queueReadPos = readPos;
+			}
+		}
+
+		if(stop) {
+			break;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if(_newTilesRecorded && !_saveInProgress && std::chrono::duration_cast<std::chrono::seconds>(now - lastSave).count() >= AutoSaveDelay) {
+			//Save the pack periodically, so only the tiles and pages that changed since then need to be processed when recording stops
+			//The queue keeps being drained while the save thread upscales the tiles and writes the files
+			SaveHdPack();
+			_newTilesRecorded = false;
+			lastSave = now;
+		}
+	}
+}
+
+void HdPackBuilder::RecordTile(RecordedTile &tile)
+{
+	auto result = _tileUsageCount.find(tile.Key.GetKey(false));
 	if(result == _tileUsageCount.end()) {
 		//Check to see if a default tile matches
-		result = _tileUsageCount.find(tile.GetKey(true));
+		result = _tileUsageCount.find(tile.Key.GetKey(true));
 	}
 
+	uint32_t count = tile.Count;
 	if(result == _tileUsageCount.end()) {
 		//First time seeing this tile/palette combination, store it
 		HdPackTileInfo* hdTile = new HdPackTileInfo();
-		hdTile->PaletteColors = tile.PaletteColors;
-		hdTile->TileIndex = tile.TileIndex;
+		hdTile->PaletteColors = tile.Key.PaletteColors;
+		hdTile->TileIndex = tile.Key.TileIndex;
 		hdTile->DefaultTile = false;
 		hdTile->IsChrRamTile = _isChrRam;
 		hdTile->Brightness = 255;
-		hdTile->ChrBankId = _isChrRam ? chrBankHash : (tileAddr / 16 / 256);
-		hdTile->TransparencyRequired = transparencyRequired;
+		hdTile->ChrBankId = tile.ChrBankId;
+		hdTile->TransparencyRequired = tile.TransparencyRequired;
 
-		memcpy(hdTile->TileData, tile.TileData, 16);
+		memcpy(hdTile->TileData, tile.Key.TileData, 16);
 
 		_hdData.Tiles.push_back(unique_ptr<HdPackTileInfo>(hdTile));
 		AddTile(hdTile, 1);
-	} else {
-		if(transparencyRequired) {
-			auto existingTile = _tilesByKey.find(tile.GetKey(false));
-			if(existingTile != _tilesByKey.end()) {
-				existingTile->second->TransparencyRequired = true;
-			}
+		_newTilesRecorded = true;
+
+		count--;
+		if(count == 0) {
+			return;
 		}
-		
-		if(result->second < 0x7FFFFFFF) {
-			//Increase usage count
-			result->second++;
+		result = _tileUsageCount.find(tile.Key.GetKey(false));
+	}
+
+	if(tile.TransparencyRequired) {
+		auto existingTile = _tilesByKey.find(tile.Key.GetKey(false));
+		if(existingTile != _tilesByKey.end()) {
+			existingTile->second->TransparencyRequired = true;
 		}
 	}
+
+	if(result->second < 0x7FFFFFFF) {
+		//Increase usage count
+		result->second = (uint32_t)std::min<uint64_t>((uint64_t)result->second + count, 0x7FFFFFFF);
+	}
 }
 
-void HdPackBuilder::GenerateHdTile(HdPackTileInfo *tile)
+vector<uint32_t> HdPackBuilder::GenerateHdTile(HdPackTileInfo *tile, bool transparencyRequired, uint32_t* palette)
 {
 	uint32_t hdScale = _hdData.Scale;
 
-	vector<uint32_t> originalTile = tile->ToRgb(_console->GetSettings()->GetRgbPalette());
+	vector<uint32_t> originalTile = tile->ToRgb(palette, transparencyRequired);
 	vector<uint32_t> hdTile(8 * 8 * hdScale*hdScale, 0);
 
 	switch(_filterType) {
@@ -182,16 +285,11 @@ void HdPackBuilder::GenerateHdTile(HdPackTileInfo *tile)
 			break;
 	}
 
-	tile->HdTileData = hdTile;
+	return hdTile;
 }
 
-void HdPackBuilder::DrawTile(HdPackTileInfo *tile, int tileNumber, uint32_t *pngBuffer, int pageNumber, bool containsSpritesOnly)
+void HdPackBuilder::GetTilePosition(int tileNumber, int pageNumber, bool containsSpritesOnly, uint32_t &x, uint32_t &y)
 {
-	if(tile->HdTileData.empty()) {
-		GenerateHdTile(tile);
-		tile->UpdateFlags();
-	}
-
 	if(containsSpritesOnly && (_flags & HdPackRecordFlags::UseLargeSprites)) {
 		int row = tileNumber / 16;
 		int column = tileNumber % 16;
@@ -205,18 +303,19 @@ void HdPackBuilder::DrawTile(HdPackTileInfo *tile, int tileNumber, uint32_t *png
 	tileNumber += pageNumber * (256 / (0x1000 / _chrRamBankSize));
 
 	int tileDimension = 8 * _hdData.Scale;
-	int x = tileNumber % 16 * tileDimension;
-	int y = tileNumber / 16 * tileDimension;
-
-	tile->X = x;
-	tile->Y = y;
+	x = tileNumber % 16 * tileDimension;
+	y = tileNumber / 16 * tileDimension;
+}
 
+void HdPackBuilder::DrawTile(uint32_t *hdTileData, uint32_t x, uint32_t y, uint32_t *pngBuffer)
+{
+	int tileDimension = 8 * _hdData.Scale;
 	int pngWidth = 128 * _hdData.Scale;
 	int pngPos = y * pngWidth + x;
 	int tilePos = 0;
 	for(uint8_t i = 0; i < tileDimension; i++) {
 		for(uint8_t j = 0; j < tileDimension; j++) {
-			pngBuffer[pngPos] = tile->HdTileData[tilePos++];
+			pngBuffer[pngPos] = hdTileData[tilePos++];
 			pngPos++;
 		}
 		pngPos += pngWidth - tileDimension;
@@ -225,7 +324,13 @@ void HdPackBuilder::DrawTile(HdPackTileInfo *tile, int tileNumber, uint32_t *png
 
 void HdPackBuilder::SaveHdPack()
 {
+	//Wait for the previous save to be done writing its files before reusing its buffers
+	WaitForSave();
+
+	std::lock_guard<std::mutex> lock(_tileLock);
+
 	FolderUtilities::CreateFolder(_saveFolder);
+	memcpy(_savePalette, _console->GetSettings()->GetRgbPalette(), sizeof(_savePalette));
 
 	stringstream pngRows;
 	stringstream tileRows;
@@ -239,22 +344,13 @@ void HdPackBuilder::SaveHdPack()
 		ss << "<overscan>" << overscan.Top << "," << overscan.Right << "," << overscan.Bottom << "," << overscan.Left << std::endl;
 	}
 
-	int tileDimension = 8 * _hdData.Scale;
-	int pngDimension = 16 * tileDimension;
-	int pngBufferSize = pngDimension * pngDimension;
-	uint32_t* pngBuffer = new uint32_t[pngBufferSize];
-
 	int maxPageNumber = 0x1000 / _chrRamBankSize;
 	int pageNumber = 0;
-	bool pngEmpty = true;
 	int pngNumber = 0;
+	PngFile png = {};
 
-	for(int i = 0; i < pngBufferSize; i++) {
-		pngBuffer[i] = 0xFFFF00FF;
-	}
-
-	auto savePng = [&tileRows, &pngRows, &ss, &pngBuffer, &pngDimension, &pngIndex, &pngBufferSize, &pngEmpty, &pngNumber, this](uint32_t chrBankId) {
-		if(!pngEmpty) {
+	auto savePng = [&tileRows, &pngRows, &ss, &pngIndex, &pngNumber, &png, this](uint32_t chrBankId) {
+		if(!png.Tiles.empty()) {
 			string pngName;
 			if(_isChrRam) {
 				pngName = "Chr_" + std::to_string(pngNumber) + ".png";
@@ -267,18 +363,18 @@ void HdPackBuilder::SaveHdPack()
 			pngRows = stringstream();
 
 			ss << "<img>" << pngName << std::endl;
-			PNGHelper::WritePNG(FolderUtilities::CombinePath(_saveFolder, pngName), pngBuffer, pngDimension, pngDimension, 32);
+
+			png.Name = pngName;
+			_pngFiles.push_back(std::move(png));
+			png = {};
 			pngNumber++;
 			pngIndex++;
-
-			for(int i = 0; i < pngBufferSize; i++) {
-				pngBuffer[i] = 0xFFFF00FF;
-			}
-			pngEmpty = true;
 		}
 	};
 
-	for(std::pair<const uint32_t, std::map<uint32_t, vector<HdPackTileInfo*>>> &kvp : _tilesByChrBankByPalette) {
+	//Sort a copy of the pages, the recorded tiles keep their original slots while the recording goes on
+	std::map<uint32_t, std::map<uint32_t, vector<HdPackTileInfo*>>> tilesByChrBankByPalette = _tilesByChrBankByPalette;
+	for(std::pair<const uint32_t, std::map<uint32_t, vector<HdPackTileInfo*>>> &kvp : tilesByChrBankByPalette) {
 		if(_flags & HdPackRecordFlags::SortByUsageFrequency) {
 			for(int i = 0; i < 256; i++) {
 				vector<std::pair<uint32_t, HdPackTileInfo*>> tiles;
@@ -319,12 +415,12 @@ void HdPackBuilder::SaveHdPack()
 			for(int i = 0; i < 256; i++) {
 				HdPackTileInfo* tileInfo = tileKvp.second[i];
 				if(tileInfo) {
-					DrawTile(tileInfo, i, pngBuffer, pageNumber, spritesOnly);
+					GetTilePosition(i, pageNumber, spritesOnly, tileInfo->X, tileInfo->Y);
+					png.Tiles.push_back({ tileInfo, tileInfo->TransparencyRequired, tileInfo->X, tileInfo->Y });
 
 					pngRows << tileInfo->ToString(pngIndex) << std::endl;
 
 					pageEmpty = false;
-					pngEmpty = false;
 				}
 			}
 
@@ -376,16 +472,111 @@ void HdPackBuilder::SaveHdPack()
 	}
 
 	ss << tileRows.str();
+	_hiresFileContent = ss.str();
+
+	_saveInProgress = true;
+	_saveThread = std::thread(&HdPackBuilder::WritePackFiles, this);
+}
+
+void HdPackBuilder::RunOnThreads(size_t itemCount, const std::function<void(size_t)> &processItem)
+{
+	uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+	atomic<size_t> nextItem(0);
+	auto processItems = [&nextItem, itemCount, &processItem]() {
+		size_t i;
+		while((i = nextItem++) < itemCount) {
+			processItem(i);
+		}
+	};
+
+	vector<std::thread> threads;
+	for(uint32_t i = 1; i < threadCount && i < itemCount; i++) {
+		threads.push_back(std::thread(processItems));
+	}
+	processItems();
+	for(std::thread &thread : threads) {
+		thread.join();
+	}
+}
 
+void HdPackBuilder::WritePackFiles()
+{
+	//Upscale the tiles that were recorded (or whose transparency changed) since the last save
+	if(memcmp(_generatedTilesPalette, _savePalette, sizeof(_savePalette)) != 0) {
+		_generatedTiles.clear();
+		memcpy(_generatedTilesPalette, _savePalette, sizeof(_savePalette));
+	}
+
+	vector<SavedTile*> newTiles;
+	for(PngFile &png : _pngFiles) {
+		for(SavedTile &tile : png.Tiles) {
+			if(tile.Tile->HdTileData.empty()) {
+				auto result = _generatedTiles.find(tile.Tile);
+				if(result == _generatedTiles.end() || result->second.TransparencyRequired != tile.TransparencyRequired) {
+					newTiles.push_back(&tile);
+				}
+			}
+		}
+	}
+
+	vector<vector<uint32_t>> newTileData(newTiles.size());
+	RunOnThreads(newTiles.size(), [this, &newTiles, &newTileData](size_t i) {
+		newTileData[i] = GenerateHdTile(newTiles[i]->Tile, newTiles[i]->TransparencyRequired, _savePalette);
+	});
+	for(size_t i = 0; i < newTiles.size(); i++) {
+		_generatedTiles[newTiles[i]->Tile] = { newTiles[i]->TransparencyRequired, std::move(newTileData[i]) };
+	}
+
+	//Draw each PNG file, the ones whose content didn't change since the last save are not written again
+	uint32_t pngDimension = 128 * _hdData.Scale;
+	RunOnThreads(_pngFiles.size(), [this, pngDimension](size_t i) {
+		PngFile &png = _pngFiles[i];
+		png.Pixels.assign(pngDimension * pngDimension, 0xFFFF00FF);
+		for(SavedTile &tile : png.Tiles) {
+			uint32_t* hdTileData = tile.Tile->HdTileData.empty() ? _generatedTiles.at(tile.Tile).Pixels.data() : tile.Tile->HdTileData.data();
+			DrawTile(hdTileData, tile.X, tile.Y, png.Pixels.data());
+		}
+		png.Crc = CRC32::GetCRC((uint8_t*)png.Pixels.data(), png.Pixels.size() * sizeof(uint32_t));
+	});
+
+	vector<PngFile*> changedFiles;
+	for(PngFile &png : _pngFiles) {
+		auto savedCrc = _savedPngCrcs.find(png.Name);
+		if(savedCrc == _savedPngCrcs.end() || savedCrc->second != png.Crc) {
+			_savedPngCrcs[png.Name] = png.Crc;
+			changedFiles.push_back(&png);
+		} else {
+			vector<uint32_t>().swap(png.Pixels);
+		}
+	}
+
+	//Compress the PNG files in parallel, when there are fewer files than threads each file's rows are also split between several threads
+	uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+	uint32_t threadsPerFile = changedFiles.empty() ? 1 : std::max(1u, threadCount / (uint32_t)changedFiles.size());
+	RunOnThreads(changedFiles.size(), [this, &changedFiles, pngDimension, threadsPerFile](size_t i) {
+		PngFile &png = *changedFiles[i];
+		PNGHelper::WritePNG(FolderUtilities::CombinePath(_saveFolder, png.Name), png.Pixels.data(), pngDimension, pngDimension, 32, PNGHelper::FastCompression, threadsPerFile);
+	});
+	_pngFiles.clear();
+
+	//hires.txt is written last, once all the images it refers to exist
 	ofstream hiresFile(FolderUtilities::CombinePath(_saveFolder, "hires.txt"), ios::out);
-	hiresFile << ss.str();
+	hiresFile << _hiresFileContent;
 	hiresFile.close();
 
-	delete[] pngBuffer;
+	_saveInProgress = false;
+}
+
+void HdPackBuilder::WaitForSave()
+{
+	if(_saveThread.joinable()) {
+		_saveThread.join();
+	}
 }
 
 void HdPackBuilder::GetChrBankList(uint32_t *banks)
 {
+	std::lock_guard<std::mutex> lock(_instance->_tileLock);
 	for(std::pair<const uint32_t, std::map<uint32_t, vector<HdPackTileInfo*>>> &kvp : _instance->_tilesByChrBankByPalette) {
 		*banks = kvp.first;
 		banks++;
@@ -395,6 +586,7 @@ void HdPackBuilder::GetChrBankList(uint32_t *banks)
 
 void HdPackBuilder::GetBankPreview(uint32_t bankNumber, uint32_t pageNumber, uint32_t *rgbBuffer)
 {
+	std::lock_guard<std::mutex> lock(_instance->_tileLock);
 	for(uint32_t i = 0; i < 128 * 128 * _instance->_hdData.Scale*_instance->_hdData.Scale; i++) {
 		rgbBuffer[i] = 0xFF666666;
 	}
@@ -438,7 +630,13 @@ void HdPackBuilder::GetBankPreview(uint32_t bankNumber, uint32_t pageNumber, uin
 		for(int i = 0; i < 256; i++) {
 			HdPackTileInfo* tileInfo = (*bankData.begin()).second[i];
 			if(tileInfo) {
-				_instance->DrawTile(tileInfo, i, (uint32_t*)rgbBuffer, 0, spritesOnly);
+				uint32_t x, y;
+				_instance->GetTilePosition(i, 0, spritesOnly, x, y);
+				vector<uint32_t> hdTileData = tileInfo->HdTileData;
+				if(hdTileData.empty()) {
+					hdTileData = _instance->GenerateHdTile(tileInfo, tileInfo->TransparencyRequired, _instance->_console->GetSettings()->GetRgbPalette());
+				}
+				_instance->DrawTile(hdTileData.data(), x, y, (uint32_t*)rgbBuffer);
 			}
 		}
 	}
@@ -7,17 +7,56 @@
 #include "../Utilities/FolderUtilities.h"
 #include "../Utilities/PNGHelper.h"
 #include "../Utilities/HexUtilities.h"
+#include "../Utilities/AutoResetEvent.h"
 #include "Console.h"
 #include "HdPackLoader.h"
 #include "HdNesPack.h"
 #include "BaseMapper.h"
 #include "Types.h"
 #include <map>
+#include <thread>
+#include <mutex>
+#include <functional>
 
 class HdPackBuilder
 {
 private:
 	static HdPackBuilder* _instance;
+
+	static constexpr uint32_t RecordQueueSize = 0x10000; //Must be a power of 2
+	static constexpr int AutoSaveDelay = 60; //Seconds between saves of the pack while recording
+
+	//Tile shown by the PPU, queued by the emulation thread and added to the pack by the builder thread
+	struct RecordedTile
+	{
+		HdTileKey Key;
+		uint32_t ChrBankId;
+		uint32_t Count; //Number of consecutive pixels that showed the tile
+		bool TransparencyRequired;
+	};
+
+	//Tile placed in one of the pack's PNG files when the save started, the save thread only reads the tile's fields that can't change while recording
+	struct SavedTile
+	{
+		HdPackTileInfo* Tile;
+		bool TransparencyRequired;
+		uint32_t X;
+		uint32_t Y;
+	};
+
+	struct PngFile
+	{
+		string Name;
+		vector<SavedTile> Tiles;
+		vector<uint32_t> Pixels;
+		uint32_t Crc;
+	};
+
+	struct GeneratedTile
+	{
+		bool TransparencyRequired;
+		vector<uint32_t> Pixels;
+	};
 	
 	shared_ptr<Console> _console;
 
@@ -36,15 +75,47 @@ private:
 	uint32_t _blankTileIndex = 0;
 	int _blankTilePalette = 0;
 
+	//Single producer (emulation thread), single consumer (builder thread) ring buffer
+	vector<RecordedTile> _recordQueue;
+	atomic<uint32_t> _queueReadPos;
+	atomic<uint32_t> _queueWritePos;
+	RecordedTile _pendingTiles[2]; //Last background and sprite tiles, merged with the following pixels until a different tile is shown
+	bool _hasPendingTile[2] = { false, false };
+
+	std::thread _builderThread;
+	AutoResetEvent _builderSignal;
+	atomic<bool> _stopBuilder;
+	std::mutex _tileLock;
+	bool _newTilesRecorded = false;
+
+	//SaveHdPack only takes a snapshot of the pack's layout, the HD tiles are generated and the files written by the save thread.
+	//The upscaled tiles are kept between saves, and PNG files whose content did not change since the last save are skipped.
+	std::thread _saveThread;
+	atomic<bool> _saveInProgress;
+	vector<PngFile> _pngFiles;
+	string _hiresFileContent;
+	uint32_t _savePalette[64];
+	std::unordered_map<string, uint32_t> _savedPngCrcs;
+	std::unordered_map<HdPackTileInfo*, GeneratedTile> _generatedTiles;
+	uint32_t _generatedTilesPalette[64] = {};
+
 	void AddTile(HdPackTileInfo *tile, uint32_t usageCount);
-	void GenerateHdTile(HdPackTileInfo *tile);
-	void DrawTile(HdPackTileInfo *tile, int tileIndex, uint32_t* pngBuffer, int pageNumber, bool containsSpritesOnly);
+	void QueueTile(RecordedTile &tile);
+	void RecordTile(RecordedTile &tile);
+	void ProcessRecordQueue();
+	void WritePackFiles();
+	void WaitForSave();
+	void RunOnThreads(size_t itemCount, const std::function<void(size_t)> &processItem);
+	vector<uint32_t> GenerateHdTile(HdPackTileInfo *tile, bool transparencyRequired, uint32_t* palette);
+	void GetTilePosition(int tileNumber, int pageNumber, bool containsSpritesOnly, uint32_t &x, uint32_t &y);
+	void DrawTile(uint32_t* hdTileData, uint32_t x, uint32_t y, uint32_t* pngBuffer);
 
 public:
 	HdPackBuilder(shared_ptr<Console> console, string saveFolder, ScaleFilterType filterType, uint32_t scale, uint32_t flags, uint32_t chrRamBankSize, bool isChrRam);
 	~HdPackBuilder();
 
 	void ProcessTile(uint32_t x, uint32_t y, uint16_t tileAddr, HdPpuTileInfo& tile, BaseMapper* mapper, bool isSprite, uint32_t chrBankHash, bool transparencyRequired);
+	void EndFrame();
 	void SaveHdPack();
 	
 	static void GetChrBankList(uint32_t *banks);
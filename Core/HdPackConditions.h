@@ -64,6 +64,10 @@ struct HdPackBaseMemoryCondition : public HdPackCondition
 	uint32_t OperandB;
 	uint8_t Mask;
 
+	//Indexes of the operands in the frame's watched address values
+	uint32_t OperandAIndex = 0;
+	uint32_t OperandBIndex = 0;
+
 	void Initialize(uint32_t operandA, HdPackConditionOperator op, uint32_t operandB, uint8_t mask)
 	{
 		OperandA = operandA;
@@ -137,13 +141,13 @@ struct HdPackBgPriorityCondition : public HdPackCondition
 
 struct HdPackMemoryCheckCondition : public HdPackBaseMemoryCondition
 {
-	HdPackMemoryCheckCondition() { _useCache = true; }
+	bool IsFrameCondition() override { return true; }
 	string GetConditionName() override { return IsPpuCondition() ? "ppuMemoryCheck" : "memoryCheck"; }
 
 	bool InternalCheckCondition(HdScreenInfo *screenInfo, int x, int y, HdPpuTileInfo* tile) override
 	{
-		uint8_t a = (uint8_t)(screenInfo->WatchedAddressValues[OperandA] & Mask);
-		uint8_t b = (uint8_t)(screenInfo->WatchedAddressValues[OperandB] & Mask);
+		uint8_t a = (uint8_t)(screenInfo->WatchedAddressValues[OperandAIndex] & Mask);
+		uint8_t b = (uint8_t)(screenInfo->WatchedAddressValues[OperandBIndex] & Mask);
 
 		switch(Operator) {
 			case HdPackConditionOperator::Equal: return a == b;
@@ -159,12 +163,12 @@ struct HdPackMemoryCheckCondition : public HdPackBaseMemoryCondition
 
 struct HdPackMemoryCheckConstantCondition : public HdPackBaseMemoryCondition
 {
-	HdPackMemoryCheckConstantCondition() { _useCache = true; }
+	bool IsFrameCondition() override { return true; }
 	string GetConditionName() override { return IsPpuCondition() ? "ppuMemoryCheckConstant" : "memoryCheckConstant"; }
 
 	bool InternalCheckCondition(HdScreenInfo *screenInfo, int x, int y, HdPpuTileInfo* tile) override
 	{
-		uint8_t a = (uint8_t)(screenInfo->WatchedAddressValues[OperandA] & Mask);
+		uint8_t a = (uint8_t)(screenInfo->WatchedAddressValues[OperandAIndex] & Mask);
 		uint8_t b = OperandB;
 
 		switch(Operator) {
@@ -184,7 +188,7 @@ struct HdPackFrameRangeCondition : public HdPackCondition
 	uint32_t OperandA;
 	uint32_t OperandB;
 
-	HdPackFrameRangeCondition() { _useCache = true; }
+	bool IsFrameCondition() override { return true; }
 	string GetConditionName() override { return "frameRange"; }
 
 	void Initialize(uint32_t operandA, uint32_t operandB)
@@ -211,29 +215,32 @@ struct HdPackFrameRangeCondition : public HdPackCondition
 
 struct HdPackTileAtPositionCondition : public HdPackBaseTileCondition
 {
-	HdPackTileAtPositionCondition() { _useCache = true; }
+	bool IsFrameCondition() override { return true; }
 	string GetConditionName() override { return "tileAtPosition"; }
 
 	bool InternalCheckCondition(HdScreenInfo *screenInfo, int x, int y, HdPpuTileInfo* tile) override
 	{
-		HdPpuTileInfo &targetTile = screenInfo->ScreenTiles[PixelOffset].Tile;
-		if(TileIndex >= 0) {
-			return targetTile.PaletteColors == PaletteColors && targetTile.TileIndex == TileIndex;
+		HdPpuTileInfo* targetTile = screenInfo->GetBgTile(PixelOffset);
+		if(!targetTile) {
+			return false;
+		} else if(TileIndex >= 0) {
+			return targetTile->PaletteColors == PaletteColors && targetTile->TileIndex == TileIndex;
 		} else {
-			return memcmp(&targetTile.PaletteColors, &PaletteColors, sizeof(PaletteColors) + sizeof(TileData)) == 0;
+			return memcmp(&targetTile->PaletteColors, &PaletteColors, sizeof(PaletteColors) + sizeof(TileData)) == 0;
 		}
 	}
 };
 
 struct HdPackSpriteAtPositionCondition : public HdPackBaseTileCondition
 {
-	HdPackSpriteAtPositionCondition() { _useCache = true; }	
+	bool IsFrameCondition() override { return true; }
 	string GetConditionName() override { return "spriteAtPosition"; }
 
 	bool InternalCheckCondition(HdScreenInfo *screenInfo, int x, int y, HdPpuTileInfo* tile) override
 	{
-		for(int i = 0, len = screenInfo->ScreenTiles[PixelOffset].SpriteCount; i < len;  i++) {
-			HdPpuTileInfo &targetTile = screenInfo->ScreenTiles[PixelOffset].Sprite[i];
+		HdPpuSpriteSpan* sprites[4];
+		for(uint32_t i = 0, len = screenInfo->GetSprites(PixelOffset, sprites); i < len; i++) {
+			HdPpuTileInfo &targetTile = sprites[i]->Tile;
 			if(TileIndex >= 0) {
 				if(targetTile.PaletteColors == PaletteColors && targetTile.TileIndex == TileIndex) {
 					return true;
@@ -254,16 +261,13 @@ struct HdPackTileNearbyCondition : public HdPackBaseTileCondition
 
 	bool InternalCheckCondition(HdScreenInfo *screenInfo, int x, int y, HdPpuTileInfo* tile) override
 	{
-		int pixelIndex = PixelOffset + (y * 256) + x;
-		if(pixelIndex < 0 || pixelIndex > PPU::PixelCount) {
+		HdPpuTileInfo* targetTile = screenInfo->GetBgTile(PixelOffset + (y * 256) + x);
+		if(!targetTile) {
 			return false;
-		}
-
-		HdPpuTileInfo &targetTile = screenInfo->ScreenTiles[pixelIndex].Tile;
-		if(TileIndex >= 0) {
-			return targetTile.PaletteColors == PaletteColors && targetTile.TileIndex == TileIndex;
+		} else if(TileIndex >= 0) {
+			return targetTile->PaletteColors == PaletteColors && targetTile->TileIndex == TileIndex;
 		} else {
-			return memcmp(&targetTile.PaletteColors, &PaletteColors, sizeof(PaletteColors) + sizeof(TileData)) == 0;
+			return memcmp(&targetTile->PaletteColors, &PaletteColors, sizeof(PaletteColors) + sizeof(TileData)) == 0;
 		}
 	}
 };
@@ -278,12 +282,9 @@ struct HdPackSpriteNearbyCondition : public HdPackBaseTileCondition
 		int ySign = tile && tile->VerticalMirroring ? -1 : 1;
 		int pixelIndex = ((y + TileY * ySign) * 256) + x + (TileX * xSign);
 
-		if(pixelIndex < 0 || pixelIndex > PPU::PixelCount) {
-			return false;
-		}
-
-		for(int i = 0, len = screenInfo->ScreenTiles[pixelIndex].SpriteCount; i < len;  i++) {
-			HdPpuTileInfo &targetTile = screenInfo->ScreenTiles[pixelIndex].Sprite[i];
+		HdPpuSpriteSpan* sprites[4];
+		for(uint32_t i = 0, len = screenInfo->GetSprites(pixelIndex, sprites); i < len; i++) {
+			HdPpuTileInfo &targetTile = sprites[i]->Tile;
 			if(TileIndex >= 0) {
 				if(targetTile.PaletteColors == PaletteColors && targetTile.TileIndex == TileIndex) {
 					return true;
@@ -22,6 +22,33 @@ static const char unixSlash    = '/';
 #endif
 #define convertPathToNativeVector(vector, idx) if (vector.size() > idx) { convertPathToNative(vector[idx]); }
 
+template<typename T>
+static void WriteValue(std::ostream &out, T value)
+{
+	out.write((char*)&value, sizeof(T));
+}
+
+template<typename T>
+static T ReadValue(std::istream &in)
+{
+	T value = {};
+	in.read((char*)&value, sizeof(T));
+	return value;
+}
+
+static bool IsTileTag(const string &lineContent)
+{
+	size_t start = 0;
+	if(!lineContent.empty() && lineContent[0] == '[') {
+		start = lineContent.find_first_of(']', 1);
+		if(start == string::npos) {
+			return false;
+		}
+		start++;
+	}
+	return lineContent.compare(start, 6, "<tile>") == 0;
+}
+
 HdPackLoader::HdPackLoader()
 {
 }
@@ -140,6 +167,14 @@ bool HdPackLoader::LoadPack()
 			return false;
 		}
 
+		//The cache file is saved next to the pack's folder/archive
+		//When hires.txt hasn't changed since the cache file was written, the compiled tiles are read from it and the tile tags are skipped
+		string cacheFile = _loadFromZip ? (_hdPackFolder + ".cache") : FolderUtilities::CombinePath(_hdPackFolder, "hires.cache");
+		_data->TileCache.OpenCacheFile(cacheFile, HdPackTileCache::GetFileKey(hdDefinition));
+		vector<uint8_t> packIndex;
+		bool skipTileTags = _data->TileCache.ReadPackIndex(packIndex);
+		vector<SkippedTileTag> skippedTileTags;
+
 		InitializeGlobalConditions();
 
 		for(string lineContent : StringUtilities::Split(string(hdDefinition.data(), hdDefinition.data() + hdDefinition.size()), '\n')) {
@@ -150,12 +185,17 @@ bool HdPackLoader::LoadPack()
 			if(lineContent[lineContent.size() - 1] == '\r') {
 				lineContent = lineContent.substr(0, lineContent.size() - 1);
 			}
+
+			if(skipTileTags && IsTileTag(lineContent)) {
+				skippedTileTags.push_back({ std::move(lineContent), _data->Conditions.size(), _data->Version });
+				continue;
+			}
 			currentLine = lineContent;			
 
 			vector<HdPackCondition*> conditions;
 			if(lineContent.substr(0, 1) == "[") {
 				size_t endOfCondition = lineContent.find_first_of(']', 1);
-				conditions = ParseConditionString(lineContent.substr(1, endOfCondition - 1), _data->Conditions);
+				conditions = ParseConditionString(lineContent.substr(1, endOfCondition - 1), _data->Conditions, _data->Conditions.size());
 				lineContent = lineContent.substr(endOfCondition + 1);
 			}
 
@@ -206,7 +246,7 @@ bool HdPackLoader::LoadPack()
 		}
 
 		LoadCustomPalette();
-		InitializeHdPack();
+		InitializeHdPack(skipTileTags, packIndex, skippedTileTags);
 
 		return true;
 	} catch(std::exception &ex) {
@@ -216,33 +256,17 @@ bool HdPackLoader::LoadPack()
 
 bool HdPackLoader::ProcessImgTag(string src)
 {
-	HdPackBitmapInfo bitmapInfo;
+	//Only the PNG's header is read here, the image is decoded by the tile cache when one of its tiles is first drawn
 	vector<uint8_t> fileData;
-	vector<uint8_t> pixelData;
+	uint32_t width, height;
 	LoadFile(src, fileData);
-	if(PNGHelper::ReadPNG(fileData, pixelData, bitmapInfo.Width, bitmapInfo.Height)) {
-		bitmapInfo.PixelData.resize(pixelData.size() / 4);
-		memcpy(bitmapInfo.PixelData.data(), pixelData.data(), bitmapInfo.PixelData.size() * sizeof(bitmapInfo.PixelData[0]));
-		PremultiplyAlpha(bitmapInfo.PixelData);
-		_hdNesBitmaps.push_back(bitmapInfo);
+	if(PNGHelper::ReadPNGHeader(fileData, width, height)) {
+		_data->TileCache.AddImage(fileData, width, height);
 		return true;
 	}
 	return false;
 }
 
-void HdPackLoader::PremultiplyAlpha(vector<uint32_t> &pixelData)
-{
-	for(size_t i = 0; i < pixelData.size(); i++) {
-		if(pixelData[i] < 0xFF000000) {
-			uint8_t* output = (uint8_t*)(pixelData.data() + i);
-			uint8_t alpha = output[3] + 1;
-			output[0] = (uint8_t)((alpha * output[0]) >> 8);
-			output[1] = (uint8_t)((alpha * output[1]) >> 8);
-			output[2] = (uint8_t)((alpha * output[2]) >> 8);
-		}
-	}
-}
-
 void HdPackLoader::InitializeGlobalConditions()
 {
 	HdPackCondition* hmirror = new HdPackHorizontalMirroringCondition();
@@ -300,7 +324,7 @@ void HdPackLoader::ProcessPatchTag(vector<string> &tokens)
 
 void HdPackLoader::ProcessTileTag(vector<string> &tokens, vector<HdPackCondition*> conditions)
 {
-	HdPackTileInfo *tileInfo = new HdPackTileInfo();
+	unique_ptr<HdPackTileInfo> tileInfo(new HdPackTileInfo());
 	size_t index = 0;
 	if(_data->Version < 100) {
 		tileInfo->TileIndex = std::stoi(tokens[index++]);
@@ -375,21 +399,34 @@ void HdPackLoader::ProcessTileTag(vector<string> &tokens, vector<HdPackCondition
 		}
 	}
 
-	checkConstraint(tileInfo->BitmapIndex < _hdNesBitmaps.size(), "[HDPack] Invalid bitmap index: " + std::to_string(tileInfo->BitmapIndex));
+	checkConstraint(tileInfo->BitmapIndex < _data->TileCache.GetImageCount(), "[HDPack] Invalid bitmap index: " + std::to_string(tileInfo->BitmapIndex));
 
-	HdPackBitmapInfo &bitmapInfo = _hdNesBitmaps[tileInfo->BitmapIndex];
-	uint32_t bitmapOffset = tileInfo->Y * bitmapInfo.Width + tileInfo->X;
-	uint32_t* pngData = (uint32_t*)bitmapInfo.PixelData.data();
-	
-	tileInfo->HdTileData.resize(64 * _data->Scale * _data->Scale);
-	for(uint32_t y = 0; y < 8 * _data->Scale; y++) {
-		memcpy(tileInfo->HdTileData.data() + (y * 8 * _data->Scale), pngData + bitmapOffset, 8 * _data->Scale * sizeof(uint32_t));
-		bitmapOffset += bitmapInfo.Width;
+	if(!_data->TileCache.AddTile(tileInfo.get(), _data->Scale)) {
+		//The tile is outside of its bitmap, ignore it
+		return;
 	}
 
-	tileInfo->UpdateFlags();
+	_data->Tiles.push_back(std::move(tileInfo));
+}
 
-	_data->Tiles.push_back(unique_ptr<HdPackTileInfo>(tileInfo));
+void HdPackLoader::ProcessSkippedTileTags(vector<SkippedTileTag> &tileTags)
+{
+	uint32_t version = _data->Version;
+	for(SkippedTileTag &tileTag : tileTags) {
+		string lineContent = tileTag.Line;
+		vector<HdPackCondition*> conditions;
+		if(lineContent.substr(0, 1) == "[") {
+			size_t endOfCondition = lineContent.find_first_of(']', 1);
+			conditions = ParseConditionString(lineContent.substr(1, endOfCondition - 1), _data->Conditions, tileTag.ConditionCount);
+			lineContent = lineContent.substr(endOfCondition + 1);
+		}
+
+		//Parse the tag as if it was processed in its original position in the file
+		_data->Version = tileTag.Version;
+		vector<string> tokens = StringUtilities::Split(lineContent.substr(6), ',');
+		ProcessTileTag(tokens, conditions);
+	}
+	_data->Version = version;
 }
 
 void HdPackLoader::ProcessOptionTag(vector<string> &tokens)
@@ -507,11 +544,11 @@ void HdPackLoader::ProcessConditionTag(vector<string> &tokens, bool createInvert
 			} else {
 				checkConstraint(operandB <= 0xFFFF, "[HDPack] Out of range memoryCheck operand");
 			}
-			_data->WatchedMemoryAddresses.emplace(operandB);
+			((HdPackBaseMemoryCondition*)condition.get())->OperandBIndex = GetWatchedAddressIndex(operandB);
 		} else if(dynamic_cast<HdPackMemoryCheckConstantCondition*>(condition.get())) {
 			checkConstraint(operandB <= 0xFF, "[HDPack] Out of range memoryCheckConstant operand");
 		}
-		_data->WatchedMemoryAddresses.emplace(operandA);
+		((HdPackBaseMemoryCondition*)condition.get())->OperandAIndex = GetWatchedAddressIndex(operandA);
 		((HdPackBaseMemoryCondition*)condition.get())->Initialize(operandA, op, operandB, (uint8_t)mask);
 	} else if(dynamic_cast<HdPackFrameRangeCondition*>(condition.get())) {
 		checkConstraint(_data->Version >= 101, "[HDPack] This feature requires version 101+ of HD Packs");
@@ -550,20 +587,18 @@ void HdPackLoader::ProcessBackgroundTag(vector<string> &tokens, vector<HdPackCon
 	}
 
 	if(!bgFileData) {
-		vector<uint8_t> pixelData;
 		uint32_t width, height;
 		vector<uint8_t> fileContent;
 		if(LoadFile(tokens[0], fileContent)) {
-			if(PNGHelper::ReadPNG(fileContent, pixelData, width, height)) {
+			if(PNGHelper::ReadPNGHeader(fileContent, width, height)) {
 				_data->BackgroundFileData.push_back(unique_ptr<HdBackgroundFileData>(new HdBackgroundFileData()));
 				bgFileData = _data->BackgroundFileData.back().get();
-				bgFileData->PixelData.resize(pixelData.size() / 4);
-				memcpy(bgFileData->PixelData.data(), pixelData.data(), bgFileData->PixelData.size() * sizeof(bgFileData->PixelData[0]));
-				PremultiplyAlpha(bgFileData->PixelData);
+				bgFileData->FileData = std::move(fileContent);
 
 				bgFileData->Width = width;
 				bgFileData->Height = height;
 				bgFileData->PngName = tokens[0];
+				_data->TileCache.AddBackground(bgFileData);
 			}
 		}
 	}
@@ -664,7 +699,7 @@ void HdPackLoader::ProcessSfxTag(vector<string> &tokens)
 	}
 }
 
-vector<HdPackCondition*> HdPackLoader::ParseConditionString(string conditionString, vector<unique_ptr<HdPackCondition>> &conditions)
+vector<HdPackCondition*> HdPackLoader::ParseConditionString(string conditionString, vector<unique_ptr<HdPackCondition>> &conditions, size_t conditionCount)
 {
 	vector<string> conditionNames = StringUtilities::Split(conditionString, '&');
 
@@ -672,9 +707,10 @@ vector<HdPackCondition*> HdPackLoader::ParseConditionString(string conditionStri
 	for(string conditionName : conditionNames) {
 		conditionName.erase(conditionName.find_last_not_of(" \n\r\t") + 1);
 
-		for(unique_ptr<HdPackCondition> &condition : conditions) {
-			if(conditionName == condition->Name) {
-				result.push_back(condition.get());
+		//Only the conditions defined before the tag can be used (conditionCount)
+		for(size_t i = 0; i < conditionCount; i++) {
+			if(conditionName == conditions[i]->Name) {
+				result.push_back(conditions[i].get());
 				break;
 			}
 		}
@@ -699,21 +735,195 @@ void HdPackLoader::LoadCustomPalette()
 	}
 }
 
-void HdPackLoader::InitializeHdPack()
+uint32_t HdPackLoader::GetWatchedAddressIndex(uint32_t address)
+{
+	auto result = _watchedAddressIndexes.find(address);
+	if(result != _watchedAddressIndexes.end()) {
+		return result->second;
+	}
+
+	uint32_t index = (uint32_t)_data->WatchedMemoryAddresses.size();
+	_data->WatchedMemoryAddresses.push_back(address);
+	_watchedAddressIndexes[address] = index;
+	return index;
+}
+
+void HdPackLoader::InitializeHdPack(bool tileTagsSkipped, vector<uint8_t> &packIndex, vector<SkippedTileTag> &skippedTileTags)
+{
+	//Conditions that give the same result for the whole frame are evaluated once per frame, each one gets a bit in the frame's results
+	for(unique_ptr<HdPackCondition> &condition : _data->Conditions) {
+		if(condition->IsFrameCondition()) {
+			condition->FrameResultIndex = (int32_t)_data->FrameConditions.size();
+			_data->FrameConditions.push_back(condition.get());
+		}
+	}
+
+	bool tilesLoaded = tileTagsSkipped && LoadPackIndex(packIndex);
+	if(tileTagsSkipped && !tilesLoaded) {
+		//The cached tiles don't match the pack's images, parse the tile tags instead
+		ProcessSkippedTileTags(skippedTileTags);
+	}
+
+	if(!tilesLoaded) {
+		for(unique_ptr<HdPackTileInfo> &tileInfo : _data->Tiles) {
+			tileInfo->ConditionProgram.Compile(tileInfo->Conditions);
+		}
+		_data->TileByKey.Build(_data->Tiles);
+	}
+	for(HdBackgroundInfo &bgInfo : _data->Backgrounds) {
+		bgInfo.ConditionProgram.Compile(bgInfo.Conditions);
+	}
+
+	_data->TileCache.Initialize(_data->Scale);
+
+	if(!_data->Tiles.empty() && (!tilesLoaded || !_data->TileCache.HasPackIndex())) {
+		vector<uint8_t> packIndex = SavePackIndex();
+		_data->TileCache.WritePackIndex(packIndex);
+	}
+}
+
+vector<uint8_t> HdPackLoader::SavePackIndex()
+{
+	std::unordered_map<HdPackCondition*, uint32_t> conditionIndexes;
+	for(size_t i = 0; i < _data->Conditions.size(); i++) {
+		conditionIndexes[_data->Conditions[i].get()] = (uint32_t)i;
+	}
+
+	stringstream out;
+	auto writeConditions = [&](vector<HdPackCondition*> &conditions) {
+		WriteValue(out, (uint32_t)conditions.size());
+		for(HdPackCondition* condition : conditions) {
+			WriteValue(out, conditionIndexes[condition]);
+		}
+	};
+
+	WriteValue(out, (uint32_t)_data->Conditions.size());
+	WriteValue(out, (uint32_t)_data->FrameConditions.size());
+
+	//Sizes of the images the tiles were validated against
+	WriteValue(out, _data->TileCache.GetImageCount());
+	for(uint32_t i = 0; i < _data->TileCache.GetImageCount(); i++) {
+		uint32_t width, height;
+		_data->TileCache.GetImageSize(i, width, height);
+		WriteValue(out, width);
+		WriteValue(out, height);
+	}
+
+	std::unordered_map<HdPackTileInfo*, uint32_t> tileIndexes;
+	WriteValue(out, (uint32_t)_data->Tiles.size());
+	for(size_t i = 0; i < _data->Tiles.size(); i++) {
+		HdPackTileInfo* tileInfo = _data->Tiles[i].get();
+		tileIndexes[tileInfo] = (uint32_t)i;
+
+		WriteValue(out, (HdTileKey)*tileInfo);
+		WriteValue(out, tileInfo->X);
+		WriteValue(out, tileInfo->Y);
+		WriteValue(out, tileInfo->BitmapIndex);
+		WriteValue(out, tileInfo->Brightness);
+		WriteValue(out, tileInfo->DefaultTile);
+		WriteValue(out, tileInfo->ChrBankId);
+		WriteValue(out, tileInfo->ForceDisableCache);
+		writeConditions(tileInfo->Conditions);
+
+		WriteValue(out, (uint32_t)tileInfo->ConditionProgram.FrameResultIndexes.size());
+		for(uint32_t frameResultIndex : tileInfo->ConditionProgram.FrameResultIndexes) {
+			WriteValue(out, frameResultIndex);
+		}
+		writeConditions(tileInfo->ConditionProgram.TileConditions);
+	}
+
+	_data->TileByKey.Save(out, tileIndexes);
+
+	string data = out.str();
+	return vector<uint8_t>(data.begin(), data.end());
+}
+
+bool HdPackLoader::LoadPackIndex(vector<uint8_t> &data)
 {
-	for(unique_ptr<HdPackTileInfo> &tileInfo : _data->Tiles) {
-		auto tiles = _data->TileByKey.find(tileInfo->GetKey(false));
-		if(tiles == _data->TileByKey.end()) {
-			_data->TileByKey[tileInfo->GetKey(false)] = vector<HdPackTileInfo*>();
+	stringstream in(string(data.begin(), data.end()));
+
+	auto readConditions = [&](vector<HdPackCondition*> &conditions) {
+		uint32_t count = ReadValue<uint32_t>(in);
+		if(!in || count > _data->Conditions.size()) {
+			return false;
 		}
-		_data->TileByKey[tileInfo->GetKey(false)].push_back(tileInfo.get());
+		for(uint32_t i = 0; i < count; i++) {
+			uint32_t conditionIndex = ReadValue<uint32_t>(in);
+			if(!in || conditionIndex >= _data->Conditions.size()) {
+				return false;
+			}
+			conditions.push_back(_data->Conditions[conditionIndex].get());
+		}
+		return true;
+	};
+
+	uint32_t conditionCount = ReadValue<uint32_t>(in);
+	uint32_t frameConditionCount = ReadValue<uint32_t>(in);
+	if(!in || conditionCount != _data->Conditions.size() || frameConditionCount != _data->FrameConditions.size()) {
+		return false;
+	}
 
-		if(tileInfo->DefaultTile) {
-			auto tiles = _data->TileByKey.find(tileInfo->GetKey(true));
-			if(tiles == _data->TileByKey.end()) {
-				_data->TileByKey[tileInfo->GetKey(true)] = vector<HdPackTileInfo*>();
+	//The tiles were only checked against the images' sizes when the cache was written, make sure they're still the same
+	uint32_t imageCount = ReadValue<uint32_t>(in);
+	if(!in || imageCount != _data->TileCache.GetImageCount()) {
+		return false;
+	}
+	for(uint32_t i = 0; i < imageCount; i++) {
+		uint32_t width, height;
+		_data->TileCache.GetImageSize(i, width, height);
+		uint32_t cachedWidth = ReadValue<uint32_t>(in);
+		uint32_t cachedHeight = ReadValue<uint32_t>(in);
+		if(!in || cachedWidth != width || cachedHeight != height) {
+			return false;
+		}
+	}
+
+	uint32_t tileCount = ReadValue<uint32_t>(in);
+	if(!in || tileCount > data.size()) {
+		return false;
+	}
+
+	vector<unique_ptr<HdPackTileInfo>> tiles;
+	tiles.reserve(tileCount);
+	for(uint32_t i = 0; i < tileCount; i++) {
+		unique_ptr<HdPackTileInfo> tileInfo(new HdPackTileInfo());
+		(HdTileKey&)*tileInfo = ReadValue<HdTileKey>(in);
+		tileInfo->X = ReadValue<uint32_t>(in);
+		tileInfo->Y = ReadValue<uint32_t>(in);
+		tileInfo->BitmapIndex = ReadValue<uint32_t>(in);
+		tileInfo->Brightness = ReadValue<int>(in);
+		tileInfo->DefaultTile = ReadValue<bool>(in);
+		tileInfo->ChrBankId = ReadValue<uint32_t>(in);
+		tileInfo->ForceDisableCache = ReadValue<bool>(in);
+		if(!in || tileInfo->BitmapIndex >= imageCount || !readConditions(tileInfo->Conditions)) {
+			return false;
+		}
+
+		uint32_t frameResultCount = ReadValue<uint32_t>(in);
+		if(!in || frameResultCount > frameConditionCount) {
+			return false;
+		}
+		for(uint32_t j = 0; j < frameResultCount; j++) {
+			uint32_t frameResultIndex = ReadValue<uint32_t>(in);
+			if(!in || frameResultIndex >= frameConditionCount) {
+				return false;
 			}
-			_data->TileByKey[tileInfo->GetKey(true)].push_back(tileInfo.get());
+			tileInfo->ConditionProgram.FrameResultIndexes.push_back(frameResultIndex);
 		}
+		if(!readConditions(tileInfo->ConditionProgram.TileConditions)) {
+			return false;
+		}
+
+		tiles.push_back(std::move(tileInfo));
+	}
+
+	if(!_data->TileByKey.Load(in, tiles)) {
+		return false;
+	}
+
+	for(unique_ptr<HdPackTileInfo> &tileInfo : tiles) {
+		_data->TileCache.AddTile(tileInfo.get(), _data->Scale);
+		_data->Tiles.push_back(std::move(tileInfo));
 	}
+	return true;
 }
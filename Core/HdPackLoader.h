@@ -16,7 +16,15 @@ private:
 	ZipReader _reader;
 	string _hdPackDefinitionFile;
 	string _hdPackFolder;
-	vector<HdPackBitmapInfo> _hdNesBitmaps;
+	std::unordered_map<uint32_t, uint32_t> _watchedAddressIndexes;
+
+	//Tile tag that was skipped because the pack's compiled tiles were expected to be in the cache file
+	struct SkippedTileTag
+	{
+		string Line;
+		size_t ConditionCount; //Number of conditions defined before the tag
+		uint32_t Version;
+	};
 
 	HdPackLoader();
 
@@ -25,18 +33,21 @@ private:
 	bool CheckFile(string filename);
 
 	bool LoadPack();
-	void InitializeHdPack();
+	void InitializeHdPack(bool tileTagsSkipped, vector<uint8_t> &packIndex, vector<SkippedTileTag> &skippedTileTags);
+	bool LoadPackIndex(vector<uint8_t> &data);
+	vector<uint8_t> SavePackIndex();
+	uint32_t GetWatchedAddressIndex(uint32_t address);
 	void LoadCustomPalette();
 
 	void InitializeGlobalConditions();
 
 	//Video
 	bool ProcessImgTag(string src);
-	void PremultiplyAlpha(vector<uint32_t>& pixelData);
 	void ProcessPatchTag(vector<string> &tokens);
 	void ProcessOverscanTag(vector<string> &tokens);
 	void ProcessConditionTag(vector<string> &tokens, bool createInvertedCondition);
 	void ProcessTileTag(vector<string> &tokens, vector<HdPackCondition*> conditions);
+	void ProcessSkippedTileTags(vector<SkippedTileTag> &tileTags);
 	void ProcessBackgroundTag(vector<string> &tokens, vector<HdPackCondition*> conditions);
 	void ProcessOptionTag(vector<string>& tokens);
 
@@ -45,5 +56,5 @@ private:
 	void ProcessBgmTag(vector<string> &tokens);
 	void ProcessSfxTag(vector<string> &tokens);
 
-	vector<HdPackCondition*> ParseConditionString(string conditionString, vector<unique_ptr<HdPackCondition>> &conditions);
+	vector<HdPackCondition*> ParseConditionString(string conditionString, vector<unique_ptr<HdPackCondition>> &conditions, size_t conditionCount);
 };
\ No newline at end of file
@@ -0,0 +1,461 @@
+#include "stdafx.h"
+#include "HdPackTileCache.h"
+#include "HdData.h"
+#include "../Utilities/PNGHelper.h"
+#include "../Utilities/CRC32.h"
+#include "../Utilities/miniz.h"
+
+HdPackTileCache::HdPackTileCache()
+{
+	_frameNumber = 0;
+	_loadedSize = 0;
+	_stopPrefetch = false;
+}
+
+HdPackTileCache::~HdPackTileCache()
+{
+	if(_prefetchThread.joinable()) {
+		_stopPrefetch = true;
+		_prefetchSignal.Signal();
+		_prefetchThread.join();
+	}
+}
+
+void HdPackTileCache::PremultiplyAlpha(vector<uint32_t> &pixelData)
+{
+	for(size_t i = 0; i < pixelData.size(); i++) {
+		if(pixelData[i] < 0xFF000000) {
+			uint8_t* output = (uint8_t*)(pixelData.data() + i);
+			uint8_t alpha = output[3] + 1;
+			output[0] = (uint8_t)((alpha * output[0]) >> 8);
+			output[1] = (uint8_t)((alpha * output[1]) >> 8);
+			output[2] = (uint8_t)((alpha * output[2]) >> 8);
+		}
+	}
+}
+
+uint64_t HdPackTileCache::GetFileKey(vector<uint8_t> &fileData)
+{
+	return ((uint64_t)CRC32::GetCRC(fileData.data(), fileData.size()) << 32) | (uint32_t)fileData.size();
+}
+
+bool HdPackTileCache::DecodeImage(vector<uint8_t> &fileData, uint64_t fileKey, uint32_t width, uint32_t height, vector<uint32_t> &pixels)
+{
+	if(ReadCachedImage(fileKey, width, height, pixels)) {
+		//Already decoded by a previous session
+		return true;
+	}
+
+	vector<uint8_t> pngData;
+	uint32_t pngWidth, pngHeight;
+	if(PNGHelper::ReadPNG(fileData, pngData, pngWidth, pngHeight) && pngWidth == width && pngHeight == height) {
+		pixels.resize(pngData.size() / 4);
+		memcpy(pixels.data(), pngData.data(), pixels.size() * sizeof(pixels[0]));
+		PremultiplyAlpha(pixels);
+		WriteCachedImage(fileKey, width, height, pixels);
+		return true;
+	}
+
+	//The file is corrupted past its header, draw it as a transparent image
+	pixels.assign(width * height, 0);
+	return false;
+}
+
+void HdPackTileCache::AddBackground(HdBackgroundFileData *bgData)
+{
+	bgData->FileKey = GetFileKey(bgData->FileData);
+	_backgrounds.push_back(bgData);
+}
+
+void HdPackTileCache::LoadBackground(HdBackgroundFileData &bgData)
+{
+	if(!bgData.PixelData.empty()) {
+		return;
+	}
+
+	DecodeImage(bgData.FileData, bgData.FileKey, bgData.Width, bgData.Height, bgData.PixelData);
+	bgData.HasTransparentPixels = false;
+	for(uint32_t pixel : bgData.PixelData) {
+		if((pixel & 0xFF000000) != 0xFF000000) {
+			bgData.HasTransparentPixels = true;
+			break;
+		}
+	}
+
+	//Backgrounds are kept in memory once they've been decoded
+	vector<uint8_t>().swap(bgData.FileData);
+}
+
+uint32_t HdPackTileCache::AddImage(vector<uint8_t> &fileData, uint32_t width, uint32_t height)
+{
+	HdPackImage* image = new HdPackImage();
+	image->FileKey = GetFileKey(fileData);
+	image->FileData = std::move(fileData);
+	image->Width = width;
+	image->Height = height;
+	_images.push_back(unique_ptr<HdPackImage>(image));
+	return (uint32_t)_images.size() - 1;
+}
+
+bool HdPackTileCache::AddTile(HdPackTileInfo *tile, uint32_t scale)
+{
+	if(tile->BitmapIndex >= _images.size()) {
+		return false;
+	}
+
+	HdPackImage &image = *_images[tile->BitmapIndex];
+	uint32_t tileSize = 8 * scale;
+	if(tile->X + tileSize > image.Width || tile->Y + tileSize > image.Height) {
+		return false;
+	}
+
+	image.Tiles.push_back(tile);
+	if(!tile->IsChrRamTile && std::find(image.ChrBanks.begin(), image.ChrBanks.end(), tile->ChrBankId) == image.ChrBanks.end()) {
+		image.ChrBanks.push_back(tile->ChrBankId);
+		_imagesByChrBank[tile->ChrBankId].push_back(tile->BitmapIndex);
+	}
+	return true;
+}
+
+void HdPackTileCache::OpenCacheFile(string cacheFile, uint64_t packKey)
+{
+	_cacheFile = cacheFile;
+	_packKey = packKey;
+	LoadCacheFile();
+}
+
+void HdPackTileCache::Initialize(uint32_t scale)
+{
+	_scale = scale;
+	ValidateCachedImages();
+
+	if(!_images.empty()) {
+		//Decode the images in the order they appear in the pack until the memory budget is reached
+		for(uint32_t i = 0; i < _images.size(); i++) {
+			_prefetchQueue.push_back(i);
+		}
+
+		_prefetchThread = std::thread([=]() {
+			while(!_stopPrefetch) {
+				_prefetchSignal.Wait();
+				if(_stopPrefetch) {
+					break;
+				}
+				ProcessPrefetchQueue();
+			}
+		});
+		_prefetchSignal.Signal();
+	}
+}
+
+void HdPackTileCache::ProcessPrefetchQueue()
+{
+	while(!_stopPrefetch) {
+		uint32_t imageIndex;
+		{
+			std::lock_guard<std::mutex> lock(_prefetchLock);
+			if(_prefetchQueue.empty()) {
+				return;
+			}
+			imageIndex = _prefetchQueue.front();
+			_prefetchQueue.pop_front();
+		}
+
+		if(!_images[imageIndex]->Loaded && _loadedSize < HdPackTileCache::MaxLoadedSize) {
+			LoadImage(imageIndex, false);
+		}
+	}
+}
+
+void HdPackTileCache::PrefetchChrBanks(HdPackImage &image)
+{
+	bool queued = false;
+	{
+		std::lock_guard<std::mutex> lock(_prefetchLock);
+		for(uint32_t chrBankId : image.ChrBanks) {
+			for(uint32_t imageIndex : _imagesByChrBank[chrBankId]) {
+				if(!_images[imageIndex]->Loaded) {
+					_prefetchQueue.push_front(imageIndex);
+					queued = true;
+				}
+			}
+		}
+	}
+
+	if(queued) {
+		_prefetchSignal.Signal();
+	}
+}
+
+void HdPackTileCache::LoadCacheFile()
+{
+	//The file is rewritten from scratch if it's missing, invalid or contains images (or tiles from a hires.txt file) the pack no longer uses
+	_resetCacheFile = true;
+
+	ifstream file(_cacheFile, ios::in | ios::binary);
+	if(!file) {
+		return;
+	}
+
+	file.seekg(0, ios::end);
+	std::streamoff fileSize = file.tellg();
+	file.seekg(0, ios::beg);
+
+	uint32_t header[2] = {};
+	file.read((char*)header, sizeof(header));
+	if(!file || header[0] != HdPackTileCache::CacheFileMagic || header[1] != HdPackTileCache::CacheFileVersion) {
+		return;
+	}
+
+	std::streamoff offset = file.tellg();
+	while(offset + (std::streamoff)sizeof(CachedImageHeader) <= fileSize) {
+		CachedImage entry;
+		file.read((char*)&entry.Header, sizeof(CachedImageHeader));
+		entry.Offset = offset + sizeof(CachedImageHeader);
+		offset = entry.Offset + entry.Header.DataSize;
+		if(!file || offset > fileSize) {
+			//Truncated entry (e.g the previous session was closed while writing it), discard the file
+			_cachedImages.clear();
+			_hasPackIndex = false;
+			return;
+		}
+
+		uint64_t key = ((uint64_t)entry.Header.FileCrc << 32) | entry.Header.FileSize;
+		if(entry.Header.Width == 0) {
+			if(key != _packKey) {
+				//hires.txt was modified since the file was written
+				_cachedImages.clear();
+				_hasPackIndex = false;
+				return;
+			}
+			_packIndex = entry;
+			_hasPackIndex = true;
+		} else {
+			_cachedImages[key] = entry;
+		}
+		file.seekg(offset, ios::beg);
+	}
+
+	_resetCacheFile = false;
+}
+
+void HdPackTileCache::ValidateCachedImages()
+{
+	//Called once the pack's images are known, before any image is decoded
+	std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> imageSizes;
+	for(unique_ptr<HdPackImage> &image : _images) {
+		imageSizes[image->FileKey] = std::make_pair(image->Width, image->Height);
+	}
+	for(HdBackgroundFileData* bgData : _backgrounds) {
+		imageSizes[bgData->FileKey] = std::make_pair(bgData->Width, bgData->Height);
+	}
+
+	for(auto &cachedImage : _cachedImages) {
+		auto result = imageSizes.find(cachedImage.first);
+		if(result == imageSizes.end() || result->second != std::make_pair(cachedImage.second.Header.Width, cachedImage.second.Header.Height)) {
+			_cachedImages.clear();
+			_hasPackIndex = false;
+			_resetCacheFile = true;
+			return;
+		}
+	}
+}
+
+bool HdPackTileCache::ReadPackIndex(vector<uint8_t> &data)
+{
+	if(!_hasPackIndex) {
+		return false;
+	}
+
+	data.resize(_packIndex.Header.Height);
+	return ReadCacheEntry(_packIndex, data.data(), data.size());
+}
+
+void HdPackTileCache::WritePackIndex(vector<uint8_t> &data)
+{
+	CachedImageHeader header;
+	header.FileCrc = (uint32_t)(_packKey >> 32);
+	header.FileSize = (uint32_t)_packKey;
+	header.Width = 0;
+	header.Height = (uint32_t)data.size();
+	WriteCacheEntry(header, data.data(), data.size());
+}
+
+bool HdPackTileCache::ReadCachedImage(uint64_t fileKey, uint32_t width, uint32_t height, vector<uint32_t> &pixels)
+{
+	CachedImage entry;
+	{
+		std::lock_guard<std::mutex> lock(_cacheLock);
+		auto result = _cachedImages.find(fileKey);
+		if(result == _cachedImages.end()) {
+			return false;
+		}
+		entry = result->second;
+	}
+
+	pixels.resize(width * height);
+	return ReadCacheEntry(entry, (uint8_t*)pixels.data(), pixels.size() * sizeof(uint32_t));
+}
+
+bool HdPackTileCache::ReadCacheEntry(CachedImage &entry, uint8_t* output, size_t size)
+{
+	string cacheFile;
+	{
+		std::lock_guard<std::mutex> lock(_cacheLock);
+		if(_cacheFile.empty()) {
+			return false;
+		}
+		cacheFile = _cacheFile;
+	}
+
+	ifstream file(cacheFile, ios::in | ios::binary);
+	if(!file) {
+		return false;
+	}
+
+	vector<uint8_t> compressedData(entry.Header.DataSize);
+	file.seekg(entry.Offset, ios::beg);
+	file.read((char*)compressedData.data(), compressedData.size());
+	if(!file) {
+		return false;
+	}
+
+	mz_ulong outputSize = (mz_ulong)size;
+	return mz_uncompress(output, &outputSize, compressedData.data(), (mz_ulong)compressedData.size()) == MZ_OK && outputSize == size;
+}
+
+void HdPackTileCache::WriteCachedImage(uint64_t fileKey, uint32_t width, uint32_t height, vector<uint32_t> &pixels)
+{
+	CachedImageHeader header;
+	header.FileCrc = (uint32_t)(fileKey >> 32);
+	header.FileSize = (uint32_t)fileKey;
+	header.Width = width;
+	header.Height = height;
+	WriteCacheEntry(header, (uint8_t*)pixels.data(), pixels.size() * sizeof(uint32_t));
+}
+
+void HdPackTileCache::WriteCacheEntry(CachedImageHeader header, uint8_t* data, size_t size)
+{
+	mz_ulong compressedSize = mz_compressBound((mz_ulong)size);
+	vector<uint8_t> compressedData(compressedSize);
+	if(mz_compress2(compressedData.data(), &compressedSize, data, (mz_ulong)size, MZ_BEST_SPEED) != MZ_OK) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(_cacheLock);
+	if(_cacheFile.empty()) {
+		return;
+	}
+
+	ofstream file;
+	if(_resetCacheFile) {
+		file.open(_cacheFile, ios::out | ios::binary | ios::trunc);
+		uint32_t header[2] = { HdPackTileCache::CacheFileMagic, HdPackTileCache::CacheFileVersion };
+		file.write((char*)header, sizeof(header));
+		_cachedImages.clear();
+		_hasPackIndex = false;
+		_resetCacheFile = false;
+	} else {
+		file.open(_cacheFile, ios::out | ios::binary | ios::app);
+	}
+
+	if(!file) {
+		//The pack's folder isn't writable, keep decoding the PNG files
+		_cacheFile.clear();
+		return;
+	}
+
+	CachedImage entry;
+	entry.Header = header;
+	entry.Header.DataSize = (uint32_t)compressedSize;
+	file.write((char*)&entry.Header, sizeof(CachedImageHeader));
+	entry.Offset = file.tellp();
+	file.write((char*)compressedData.data(), compressedSize);
+
+	if(file) {
+		if(header.Width == 0) {
+			_packIndex = entry;
+			_hasPackIndex = true;
+		} else {
+			_cachedImages[((uint64_t)header.FileCrc << 32) | header.FileSize] = entry;
+		}
+	}
+}
+
+void HdPackTileCache::LoadImage(uint32_t imageIndex, bool prefetchChrBanks)
+{
+	HdPackImage &image = *_images[imageIndex];
+	{
+		std::lock_guard<std::mutex> lock(image.LoadLock);
+		if(image.Loaded) {
+			return;
+		}
+
+		vector<uint32_t> pixels;
+		DecodeImage(image.FileData, image.FileKey, image.Width, image.Height, pixels);
+
+		uint32_t tileSize = 8 * _scale;
+		size_t loadedSize = 0;
+		for(HdPackTileInfo* tile : image.Tiles) {
+			tile->HdTileData.resize(tileSize * tileSize);
+			uint32_t bitmapOffset = tile->Y * image.Width + tile->X;
+			for(uint32_t y = 0; y < tileSize; y++) {
+				memcpy(tile->HdTileData.data() + (y * tileSize), pixels.data() + bitmapOffset, tileSize * sizeof(uint32_t));
+				bitmapOffset += image.Width;
+			}
+			tile->UpdateFlags();
+			loadedSize += tile->HdTileData.size() * sizeof(uint32_t);
+		}
+
+		image.LoadedSize = loadedSize;
+		image.LastUsedFrame = _frameNumber.load();
+		_loadedSize += loadedSize;
+		image.Loaded = true;
+	}
+
+	if(prefetchChrBanks) {
+		PrefetchChrBanks(image);
+	}
+}
+
+void HdPackTileCache::UnloadImage(HdPackImage &image)
+{
+	std::lock_guard<std::mutex> lock(image.LoadLock);
+	if(!image.Loaded) {
+		return;
+	}
+
+	image.Loaded = false;
+	for(HdPackTileInfo* tile : image.Tiles) {
+		vector<uint32_t>().swap(tile->HdTileData);
+	}
+	_loadedSize -= image.LoadedSize;
+	image.LoadedSize = 0;
+}
+
+void HdPackTileCache::LoadAll()
+{
+	for(uint32_t i = 0; i < _images.size(); i++) {
+		LoadImage(i, false);
+	}
+}
+
+void HdPackTileCache::StartFrame()
+{
+	//Called before the frame is drawn, tiles can't be unloaded while the frame's tiles are being drawn
+	uint32_t frameNumber = ++_frameNumber;
+	while(_loadedSize > HdPackTileCache::MaxLoadedSize) {
+		HdPackImage* oldestImage = nullptr;
+		for(unique_ptr<HdPackImage> &image : _images) {
+			if(image->Loaded && image->LastUsedFrame + 1 < frameNumber && (!oldestImage || image->LastUsedFrame < oldestImage->LastUsedFrame)) {
+				oldestImage = image.get();
+			}
+		}
+
+		if(!oldestImage) {
+			//Everything that's loaded was used by the previous frame
+			break;
+		}
+		UnloadImage(*oldestImage);
+	}
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include "stdafx.h"
+#include <thread>
+#include <mutex>
+#include "../Utilities/AutoResetEvent.h"
+
+struct HdPackTileInfo;
+struct HdBackgroundFileData;
+
+//Decodes the HD pack's images on demand: an image's tiles are extracted the first time one of them is drawn.
+//When the decoded tiles take more than MaxLoadedSize bytes, the images that were used the longest time ago are unloaded.
+//Decoded images are also saved to a cache file next to the pack, so the PNG files don't need to be decoded again on the next load.
+//The cache file also holds the pack's compiled tiles (built by HdPackLoader), so hires.txt's tiles don't need to be parsed again either.
+class HdPackTileCache
+{
+private:
+	static constexpr size_t MaxLoadedSize = 256 * 1024 * 1024;
+	static constexpr uint32_t CacheFileMagic = 0x43504448; //"HDPC"
+	static constexpr uint32_t CacheFileVersion = 3; //Increase when the PNG decoder output or the compiled tile format changes, so older cache files are ignored
+
+	struct HdPackImage
+	{
+		vector<uint8_t> FileData;
+		uint64_t FileKey; //CRC32 and size of the PNG file, identifies the image in the cache file
+		uint32_t Width;
+		uint32_t Height;
+		vector<HdPackTileInfo*> Tiles;
+		vector<uint32_t> ChrBanks;
+
+		std::mutex LoadLock;
+		atomic<bool> Loaded;
+		atomic<uint32_t> LastUsedFrame;
+		size_t LoadedSize;
+
+		HdPackImage()
+		{
+			Loaded = false;
+			LastUsedFrame = 0;
+			LoadedSize = 0;
+		}
+	};
+
+	vector<unique_ptr<HdPackImage>> _images;
+	std::unordered_map<uint32_t, vector<uint32_t>> _imagesByChrBank;
+	vector<HdBackgroundFileData*> _backgrounds;
+
+	//Each entry of the cache file is a CachedImageHeader followed by the image's premultiplied ARGB pixels, compressed with deflate
+	//The pack's compiled tiles are stored the same way: FileCrc/FileSize are those of hires.txt, Width is 0 and Height is the data's uncompressed size
+	struct CachedImageHeader
+	{
+		uint32_t FileCrc;
+		uint32_t FileSize;
+		uint32_t Width;
+		uint32_t Height;
+		uint32_t DataSize;
+	};
+
+	struct CachedImage
+	{
+		CachedImageHeader Header;
+		std::streamoff Offset;
+	};
+
+	string _cacheFile;
+	std::mutex _cacheLock;
+	std::unordered_map<uint64_t, CachedImage> _cachedImages;
+	uint64_t _packKey = 0;
+	CachedImage _packIndex;
+	bool _hasPackIndex = false;
+	bool _resetCacheFile = false;
+	uint32_t _scale = 1;
+	atomic<uint32_t> _frameNumber;
+	atomic<size_t> _loadedSize;
+
+	//Images are decoded ahead of time by a worker thread, starting with the ones that share a CHR bank with a tile that was just drawn
+	std::thread _prefetchThread;
+	AutoResetEvent _prefetchSignal;
+	std::mutex _prefetchLock;
+	std::deque<uint32_t> _prefetchQueue;
+	atomic<bool> _stopPrefetch;
+
+	void LoadCacheFile();
+	void ValidateCachedImages();
+	bool ReadCacheEntry(CachedImage &entry, uint8_t* output, size_t size);
+	void WriteCacheEntry(CachedImageHeader header, uint8_t* data, size_t size);
+	bool ReadCachedImage(uint64_t fileKey, uint32_t width, uint32_t height, vector<uint32_t> &pixels);
+	void WriteCachedImage(uint64_t fileKey, uint32_t width, uint32_t height, vector<uint32_t> &pixels);
+	bool DecodeImage(vector<uint8_t> &fileData, uint64_t fileKey, uint32_t width, uint32_t height, vector<uint32_t> &pixels);
+
+	void LoadImage(uint32_t imageIndex, bool prefetchChrBanks);
+	void UnloadImage(HdPackImage &image);
+	void PrefetchChrBanks(HdPackImage &image);
+	void ProcessPrefetchQueue();
+
+public:
+	HdPackTileCache();
+	~HdPackTileCache();
+
+	HdPackTileCache(const HdPackTileCache&) = delete;
+	HdPackTileCache& operator=(const HdPackTileCache&) = delete;
+
+	static void PremultiplyAlpha(vector<uint32_t> &pixelData);
+	static uint64_t GetFileKey(vector<uint8_t> &fileData);
+
+	uint32_t AddImage(vector<uint8_t> &fileData, uint32_t width, uint32_t height);
+	bool AddTile(HdPackTileInfo *tile, uint32_t scale);
+	uint32_t GetImageCount() { return (uint32_t)_images.size(); }
+	void GetImageSize(uint32_t imageIndex, uint32_t &width, uint32_t &height) { width = _images[imageIndex]->Width; height = _images[imageIndex]->Height; }
+	void AddBackground(HdBackgroundFileData *bgData);
+	void LoadBackground(HdBackgroundFileData &bgData);
+
+	//Must be called before the pack is parsed, packKey is the file key of the pack's hires.txt
+	void OpenCacheFile(string cacheFile, uint64_t packKey);
+	bool ReadPackIndex(vector<uint8_t> &data);
+	void WritePackIndex(vector<uint8_t> &data);
+	bool HasPackIndex() { std::lock_guard<std::mutex> lock(_cacheLock); return _hasPackIndex; }
+
+	void Initialize(uint32_t scale);
+
+	void LoadAll();
+	void StartFrame();
+
+	//Must be called before the tile's HdTileData/flags are used
+	__forceinline void LoadTile(uint32_t imageIndex)
+	{
+		HdPackImage &image = *_images[imageIndex];
+		uint32_t frameNumber = _frameNumber;
+		if(image.LastUsedFrame != frameNumber) {
+			image.LastUsedFrame = frameNumber;
+		}
+		if(!image.Loaded) {
+			LoadImage(imageIndex, true);
+		}
+	}
+};
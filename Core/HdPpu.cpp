@@ -14,120 +14,172 @@ void HdPpu::DrawPixel()
 	uint16_t &pixel = _currentOutputBuffer[bufferOffset];
 	_lastSprite = nullptr;
 
-	if(IsRenderingEnabled() || ((_state.VideoRamAddr & 0x3F00) != 0x3F00)) {
-		bool isChrRam = !_console->GetMapper()->HasChrRom();
-		BaseMapper *mapper = _console->GetMapper();
+	uint8_t x = _cycle - 1;
+	HdPpuScanlineInfo &scanline = _info->Scanlines[_scanline];
+	if(x == 0) {
+		scanline.BgSpans.clear();
+		scanline.Sprites.clear();
+		scanline.Grayscale = _paletteRamMask == 0x30;
+		scanline.EmphasisBits = _intensifyColorBits >> 6;
+		scanline.XScroll = _state.XScroll;
+		scanline.TmpVideoRamAddr = _state.TmpVideoRamAddr;
+		_startNewSpan = true;
+		_spritesCaptured = false;
+		_firstCapturedSprite = 0;
+	}
 
+	if(IsRenderingEnabled() || ((_state.VideoRamAddr & 0x3F00) != 0x3F00)) {
 		uint32_t color = GetPixelColor();
 		pixel = (_paletteRAM[color & 0x03 ? color : 0] & _paletteRamMask) | _intensifyColorBits;
 
-		TileInfo* lastTile = &((_state.XScroll + ((_cycle - 1) & 0x07) < 8) ? _previousTile : _currentTile);
-		uint32_t backgroundColor = 0;
-		if(_flags.BackgroundEnabled && _cycle > _minimumDrawBgCycle) {
-			backgroundColor = (((_state.LowBitShift << _state.XScroll) & 0x8000) >> 15) | (((_state.HighBitShift << _state.XScroll) & 0x8000) >> 14);
+		//The tile data is captured once per tile (or when the state changes), the pixels of the span are derived from it when rendering
+		uint8_t offsetX = (_state.XScroll + (x & 0x07)) & 0x07;
+		if(_startNewSpan || !_spanRendering || offsetX == 0 || x == _minimumDrawBgCycle || x == _minimumDrawSpriteCycle) {
+			StartBgSpan(scanline, x, offsetX, !_console->GetMapper()->HasChrRom());
 		}
+	} else {
+		//"If the current VRAM address points in the range $3F00-$3FFF during forced blanking, the color indicated by this palette location will be shown on screen instead of the backdrop color."
+		uint8_t color = ReadPaletteRAM(_state.VideoRamAddr);
+		pixel = color | _intensifyColorBits;
+		if(_startNewSpan || _spanRendering || color != _spanColor) {
+			StartForcedBlankSpan(scanline, x, color);
+		}
+	}
+}
 
-		HdPpuPixelInfo &tileInfo = _info->ScreenTiles[bufferOffset];
-
-		tileInfo.Grayscale = _paletteRamMask == 0x30;
-		tileInfo.EmphasisBits = _intensifyColorBits >> 6;
-		tileInfo.Tile.PpuBackgroundColor = ReadPaletteRAM(0);
-		tileInfo.Tile.BgColorIndex = backgroundColor;
-		if(backgroundColor == 0) {
-			tileInfo.Tile.BgColor = tileInfo.Tile.PpuBackgroundColor;
+void HdPpu::StartBgSpan(HdPpuScanlineInfo &scanline, uint8_t x, uint8_t offsetX, bool isChrRam)
+{
+	scanline.BgSpans.emplace_back();
+	HdPpuBgSpan &span = scanline.BgSpans.back();
+	span.StartX = x;
+	span.SpritesVisible = _flags.SpritesEnabled && _cycle > _minimumDrawSpriteCycle;
+
+	HdPpuTileInfo &tile = span.Tile;
+	tile.IsChrRamTile = isChrRam;
+	tile.HorizontalMirroring = false;
+	tile.VerticalMirroring = false;
+	tile.BackgroundPriority = false;
+	tile.PpuBackgroundColor = ReadPaletteRAM(0);
+	span.Colors[0] = tile.PpuBackgroundColor;
+
+	if(_flags.BackgroundEnabled && _cycle > _minimumDrawBgCycle) {
+		TileInfo* lastTile = &((_state.XScroll + (x & 0x07) < 8) ? _previousTile : _currentTile);
+		tile.TileIndex = lastTile->AbsoluteTileAddr / 16;
+		if(isChrRam) {
+			_console->GetMapper()->CopyChrTile(lastTile->AbsoluteTileAddr & 0xFFFFFFF0, tile.TileData);
+		}
+		if(_version >= 100) {
+			tile.PaletteColors = _paletteRAM[lastTile->PaletteOffset + 3] | (_paletteRAM[lastTile->PaletteOffset + 2] << 8) | (_paletteRAM[lastTile->PaletteOffset + 1] << 16) | (_paletteRAM[0] << 24);
 		} else {
-			tileInfo.Tile.BgColor = ReadPaletteRAM(lastTile->PaletteOffset + backgroundColor);
+			tile.PaletteColors = _paletteRAM[lastTile->PaletteOffset + 3] | (_paletteRAM[lastTile->PaletteOffset + 2] << 8) | (_paletteRAM[lastTile->PaletteOffset + 1] << 16);
+		}
+		tile.UpdateTileHash();
+		tile.OffsetY = lastTile->OffsetY;
+		tile.OffsetX = offsetX;
+		span.LowByte = lastTile->LowByte;
+		span.HighByte = lastTile->HighByte;
+		for(int i = 1; i < 4; i++) {
+			span.Colors[i] = ReadPaletteRAM(lastTile->PaletteOffset + i);
 		}
+	} else {
+		tile.TileIndex = HdPpuTileInfo::NoTile;
+		span.LowByte = 0;
+		span.HighByte = 0;
+	}
 
-		tileInfo.XScroll = _state.XScroll;
-		tileInfo.TmpVideoRamAddr = _state.TmpVideoRamAddr;
-
-		if(_lastSprite && _flags.SpritesEnabled) {
-			int j = 0;
-			for(uint8_t i = 0; i < _spriteCount; i++) {
-				int32_t shift = (int32_t)_cycle - _spriteTiles[i].SpriteX - 1;
-				SpriteInfo& sprite = _spriteTiles[i];
-				if(shift >= 0 && shift < 8) {
-					tileInfo.Sprite[j].TileIndex = sprite.AbsoluteTileAddr / 16;
-					if(isChrRam) {
-						mapper->CopyChrTile(sprite.AbsoluteTileAddr & 0xFFFFFFF0, tileInfo.Sprite[j].TileData);
-					}
-					if(_version >= 100) {
-						tileInfo.Sprite[j].PaletteColors = 0xFF000000 | _paletteRAM[sprite.PaletteOffset + 3] | (_paletteRAM[sprite.PaletteOffset + 2] << 8) | (_paletteRAM[sprite.PaletteOffset + 1] << 16);
-					} else {
-						tileInfo.Sprite[j].PaletteColors = _paletteRAM[sprite.PaletteOffset + 3] | (_paletteRAM[sprite.PaletteOffset + 2] << 8) | (_paletteRAM[sprite.PaletteOffset + 1] << 16);
-					}
-					if(sprite.OffsetY >= 8) {
-						tileInfo.Sprite[j].OffsetY = sprite.OffsetY - 8;
-					} else {
-						tileInfo.Sprite[j].OffsetY = sprite.OffsetY;
-					}
-
-					tileInfo.Sprite[j].OffsetX = shift;
-					tileInfo.Sprite[j].HorizontalMirroring = sprite.HorizontalMirror;
-					tileInfo.Sprite[j].VerticalMirroring = sprite.VerticalMirror;
-					tileInfo.Sprite[j].BackgroundPriority = sprite.BackgroundPriority;
-
-					int32_t shift = (int32_t)_cycle - sprite.SpriteX - 1;
-					if(sprite.HorizontalMirror) {
-						tileInfo.Sprite[j].SpriteColorIndex = ((sprite.LowByte >> shift) & 0x01) | ((sprite.HighByte >> shift) & 0x01) << 1;
-					} else {
-						tileInfo.Sprite[j].SpriteColorIndex = ((sprite.LowByte << shift) & 0x80) >> 7 | ((sprite.HighByte << shift) & 0x80) >> 6;
-					}
-
-					if(tileInfo.Sprite[j].SpriteColorIndex == 0) {
-						tileInfo.Sprite[j].SpriteColor = ReadPaletteRAM(0);
-					} else {
-						tileInfo.Sprite[j].SpriteColor = ReadPaletteRAM(sprite.PaletteOffset + tileInfo.Sprite[j].SpriteColorIndex);
-					}
-
-					tileInfo.Sprite[j].PpuBackgroundColor = tileInfo.Tile.PpuBackgroundColor;
-					tileInfo.Sprite[j].BgColorIndex = tileInfo.Tile.BgColorIndex;
-
-					j++;
-					if(j >= 4) {
-						break;
-					}
-				}
-			}
-			tileInfo.SpriteCount = j;
-		} else {
-			tileInfo.SpriteCount = 0;
+	if(span.SpritesVisible && !_spritesCaptured) {
+		CaptureSprites(scanline, x, isChrRam);
+	}
+
+	_startNewSpan = false;
+	_spanRendering = true;
+}
+
+void HdPpu::StartForcedBlankSpan(HdPpuScanlineInfo &scanline, uint8_t x, uint8_t color)
+{
+	scanline.BgSpans.emplace_back();
+	HdPpuBgSpan &span = scanline.BgSpans.back();
+	span.StartX = x;
+	span.SpritesVisible = false;
+	span.Tile.TileIndex = HdPpuTileInfo::NoTile;
+	span.Tile.PpuBackgroundColor = color;
+	span.Colors[0] = color;
+	span.LowByte = 0;
+	span.HighByte = 0;
+
+	_startNewSpan = false;
+	_spanRendering = false;
+	_spanColor = color;
+}
+
+void HdPpu::CaptureSprites(HdPpuScanlineInfo &scanline, uint8_t x, bool isChrRam)
+{
+	//The sprites captured before the state changed no longer apply from this pixel onward
+	for(size_t i = _firstCapturedSprite; i < scanline.Sprites.size(); i++) {
+		scanline.Sprites[i].EndX = x;
+	}
+	_firstCapturedSprite = scanline.Sprites.size();
+
+	for(uint8_t i = 0; i < _spriteCount; i++) {
+		SpriteInfo& sprite = _spriteTiles[i];
+		scanline.Sprites.emplace_back();
+		HdPpuSpriteSpan &span = scanline.Sprites.back();
+		span.StartX = x;
+		span.EndX = PPU::ScreenWidth;
+		span.SpriteX = sprite.SpriteX;
+		span.LowByte = sprite.LowByte;
+		span.HighByte = sprite.HighByte;
+		span.Colors[0] = ReadPaletteRAM(0);
+		for(int j = 1; j < 4; j++) {
+			span.Colors[j] = ReadPaletteRAM(sprite.PaletteOffset + j);
 		}
 
-		if(_flags.BackgroundEnabled && _cycle > _minimumDrawBgCycle) {
-			tileInfo.Tile.TileIndex = lastTile->AbsoluteTileAddr / 16;
-			if(isChrRam) {
-				mapper->CopyChrTile(lastTile->AbsoluteTileAddr & 0xFFFFFFF0, tileInfo.Tile.TileData);
-			}
-			if(_version >= 100) {
-				tileInfo.Tile.PaletteColors = _paletteRAM[lastTile->PaletteOffset + 3] | (_paletteRAM[lastTile->PaletteOffset + 2] << 8) | (_paletteRAM[lastTile->PaletteOffset + 1] << 16) | (_paletteRAM[0] << 24);
-			} else {
-				tileInfo.Tile.PaletteColors = _paletteRAM[lastTile->PaletteOffset + 3] | (_paletteRAM[lastTile->PaletteOffset + 2] << 8) | (_paletteRAM[lastTile->PaletteOffset + 1] << 16);
-			}
-			tileInfo.Tile.OffsetY = lastTile->OffsetY;
-			tileInfo.Tile.OffsetX = (_state.XScroll + ((_cycle - 1) & 0x07)) & 0x07;
+		HdPpuTileInfo &tile = span.Tile;
+		tile.IsChrRamTile = isChrRam;
+		tile.TileIndex = sprite.AbsoluteTileAddr / 16;
+		if(isChrRam) {
+			_console->GetMapper()->CopyChrTile(sprite.AbsoluteTileAddr & 0xFFFFFFF0, tile.TileData);
+		}
+		if(_version >= 100) {
+			tile.PaletteColors = 0xFF000000 | _paletteRAM[sprite.PaletteOffset + 3] | (_paletteRAM[sprite.PaletteOffset + 2] << 8) | (_paletteRAM[sprite.PaletteOffset + 1] << 16);
 		} else {
-			tileInfo.Tile.TileIndex = HdPpuTileInfo::NoTile;
+			tile.PaletteColors = _paletteRAM[sprite.PaletteOffset + 3] | (_paletteRAM[sprite.PaletteOffset + 2] << 8) | (_paletteRAM[sprite.PaletteOffset + 1] << 16);
 		}
-	} else {
-		//"If the current VRAM address points in the range $3F00-$3FFF during forced blanking, the color indicated by this palette location will be shown on screen instead of the backdrop color."
-		pixel = ReadPaletteRAM(_state.VideoRamAddr) | _intensifyColorBits;
-		_info->ScreenTiles[bufferOffset].Tile.TileIndex = HdPpuTileInfo::NoTile;
-		_info->ScreenTiles[bufferOffset].SpriteCount = 0;
+		tile.UpdateTileHash();
+		if(sprite.OffsetY >= 8) {
+			tile.OffsetY = sprite.OffsetY - 8;
+		} else {
+			tile.OffsetY = sprite.OffsetY;
+		}
+		tile.OffsetX = 0;
+		tile.HorizontalMirroring = sprite.HorizontalMirror;
+		tile.VerticalMirroring = sprite.VerticalMirror;
+		tile.BackgroundPriority = sprite.BackgroundPriority;
 	}
+	_spritesCaptured = true;
+}
+
+void HdPpu::WriteRAM(uint16_t addr, uint8_t value)
+{
+	PPU::WriteRAM(addr, value);
+
+	//Scroll, palette, mask and VRAM writes can all change what the rest of the tile looks like
+	_startNewSpan = true;
+	_spritesCaptured = false;
 }
 
 HdPpu::HdPpu(shared_ptr<Console> console, HdPackData * hdData) : PPU(console)
 {
 	_hdData = hdData;
 
+	//DrawPixel needs to be called for every pixel to capture the tile information
+	_scanlineRendererSupported = false;
+
 	if(_hdData) {
 		_version = _hdData->Version;
 
-		bool isChrRamGame = !console->GetMapper()->HasChrRom();
-		_screenInfo[0] = new HdScreenInfo(isChrRamGame);
-		_screenInfo[1] = new HdScreenInfo(isChrRamGame);
+		_screenInfo[0] = new HdScreenInfo();
+		_screenInfo[1] = new HdScreenInfo();
 		_info = _screenInfo[0];
 	}
 }
@@ -143,16 +195,17 @@ HdPpu::~HdPpu()
 void HdPpu::SendFrame()
 {
 	_info->FrameNumber = _frameCount;
-	_info->WatchedAddressValues.clear();
-	for(uint32_t address : _hdData->WatchedMemoryAddresses) {
+	_info->WatchedAddressValues.resize(_hdData->WatchedMemoryAddresses.size());
+	for(size_t i = 0; i < _hdData->WatchedMemoryAddresses.size(); i++) {
+		uint32_t address = _hdData->WatchedMemoryAddresses[i];
 		if(address & HdPackBaseMemoryCondition::PpuMemoryMarker) {
 			if((address & 0x3FFF) >= 0x3F00) {
-				_info->WatchedAddressValues[address] = ReadPaletteRAM(address);
+				_info->WatchedAddressValues[i] = ReadPaletteRAM(address);
 			} else {
-				_info->WatchedAddressValues[address] = _console->GetMapper()->DebugReadVRAM(address & 0x3FFF, true);
+				_info->WatchedAddressValues[i] = _console->GetMapper()->DebugReadVRAM(address & 0x3FFF, true);
 			}
 		} else {
-			_info->WatchedAddressValues[address] = _console->GetMemoryManager()->DebugRead(address);
+			_info->WatchedAddressValues[i] = _console->GetMemoryManager()->DebugRead(address);
 		}
 	}
 
@@ -4,6 +4,7 @@
 #include "PPU.h"
 
 struct HdScreenInfo;
+struct HdPpuScanlineInfo;
 struct HdPackData;
 class ControlManager;
 class Console;
@@ -15,6 +16,17 @@ private:
 	HdScreenInfo *_info;
 	uint32_t _version;
 
+	//Set when a register write may have changed what the next pixels show, to start new spans on the current scanline
+	bool _startNewSpan = true;
+	bool _spritesCaptured = false;
+	bool _spanRendering = false;
+	uint8_t _spanColor = 0;
+	size_t _firstCapturedSprite = 0;
+
+	void StartBgSpan(HdPpuScanlineInfo &scanline, uint8_t x, uint8_t offsetX, bool isChrRam);
+	void StartForcedBlankSpan(HdPpuScanlineInfo &scanline, uint8_t x, uint8_t color);
+	void CaptureSprites(HdPpuScanlineInfo &scanline, uint8_t x, bool isChrRam);
+
 protected:
 	HdPackData *_hdData = nullptr;
 
@@ -24,5 +36,6 @@ public:
 	HdPpu(std::shared_ptr<Console> console, HdPackData* hdData);
 	virtual ~HdPpu();
 
+	void WriteRAM(uint16_t addr, uint8_t value) override;
 	void SendFrame() override;
 };
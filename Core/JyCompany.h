@@ -62,6 +62,8 @@ protected:
 	virtual uint32_t GetDipSwitchCount() override { return 2; }
 	virtual uint16_t GetPRGPageSize() override { return 0x2000; }
 	virtual uint16_t GetCHRPageSize() override { return 0x0400; }
+	virtual bool EnableVramAddressHook() override { return true; }
+	virtual bool EnableCustomVramRead() override { return true; }
 	virtual bool AllowRegisterRead() override { return true; }
 
 	void InitMapper() override
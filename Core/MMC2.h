@@ -24,6 +24,7 @@ class MMC2 : public BaseMapper
 
 		virtual uint16_t GetPRGPageSize() override { return 0x2000; }
 		virtual uint16_t GetCHRPageSize() override {	return 0x1000; }
+		virtual bool EnableVramAddressHook() override { return true; }
 
 		virtual void InitMapper() override 
 		{
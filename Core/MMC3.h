@@ -195,6 +195,7 @@ class MMC3 : public BaseMapper
 
 		virtual uint16_t GetPRGPageSize() override { return 0x2000; }
 		virtual uint16_t GetCHRPageSize() override {	return 0x0400; }
+		virtual bool EnableVramAddressHook() override { return true; }
 		virtual uint32_t GetSaveRamPageSize() override { return _romInfo.SubMapperID == 1 ? 0x200 : 0x2000; }
 		virtual uint32_t GetSaveRamSize() override { return _romInfo.SubMapperID == 1 ? 0x400 : 0x2000; }
 
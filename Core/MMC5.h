@@ -299,6 +299,7 @@ private:
 protected:
 	virtual uint16_t GetPRGPageSize() override { return 0x2000; }
 	virtual uint16_t GetCHRPageSize() override { return 0x400; }
+	virtual bool EnableCustomVramRead() override { return true; }
 	virtual uint16_t RegisterStartAddress() override { return 0x5000; }
 	virtual uint16_t RegisterEndAddress() override { return 0x5206; }
 	virtual uint32_t GetSaveRamPageSize() override { return 0x2000; }
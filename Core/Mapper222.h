@@ -13,6 +13,7 @@ private:
 protected:
 	virtual uint16_t GetPRGPageSize() override { return 0x2000; }
 	virtual uint16_t GetCHRPageSize() override { return 0x400; }
+	virtual bool EnableVramAddressHook() override { return true; }
 
 	void InitMapper() override
 	{
@@ -7,6 +7,7 @@ class Mapper359 : public BaseMapper
 protected:
 	virtual uint16_t GetPRGPageSize() override { return 0x2000; }
 	virtual uint16_t GetCHRPageSize() override { return 0x0400; }
+	virtual bool EnableVramAddressHook() override { return true; }
 
 	// $8000 - $8003
 	uint8_t _prgBanks[4];
@@ -27,6 +27,7 @@ class Mapper398 : public BaseMapper
 	protected:
 		uint16_t GetPRGPageSize() override { return 0x2000; }
 		uint16_t GetCHRPageSize() override { return 0x0400; }
+		bool EnableCustomVramRead() override { return true; }
 
 		void InitMapper() override
 		{
@@ -455,7 +455,7 @@ BaseMapper* MapperFactory::GetMapperFromID(RomData &romData)
 		case 33: return new TaitoTc0190();
 		case 34: 
 			switch(romData.Info.SubMapperID) {
-				case 0: return (romData.ChrRom.size() > 0) ? (BaseMapper*)new Nina01() : (BaseMapper*)new BnRom(); //BnROM uses CHR RAM (so no CHR rom in the .NES file)
+				case 0: return (romData.GetChrRomSize() > 0) ? (BaseMapper*)new Nina01() : (BaseMapper*)new BnRom(); //BnROM uses CHR RAM (so no CHR rom in the .NES file)
 				case 1: return new Nina01();
 				case 2: return new BnRom();
 			}
@@ -472,9 +472,9 @@ BaseMapper* MapperFactory::GetMapperFromID(RomData &romData)
 			if(romData.Info.SubMapperID == 2) {
 				return new Ac08();
 			}
-			if((romData.ChrRom.size() == 0) && (
-				(romData.PrgRom.size() == (160 * 1024)) ||
-				(romData.PrgRom.size() == (256 * 1024)))) {
+			if((romData.GetChrRomSize() == 0) && (
+				(romData.GetPrgRomSize() == (160 * 1024)) ||
+				(romData.GetPrgRomSize() == (256 * 1024)))) {
 				return new Ac08();	
 			}
 			return new Mapper42();
@@ -541,7 +541,7 @@ BaseMapper* MapperFactory::GetMapperFromID(RomData &romData)
 		case 107: return new Mapper107();
 		case 108: return new Bb();
 		case 111:
-			if(romData.ChrRom.size()) {
+			if(romData.GetChrRomSize()) {
 				return new MMC1_111();
 			}
 			return new Cheapocabra();
@@ -697,7 +697,7 @@ BaseMapper* MapperFactory::GetMapperFromID(RomData &romData)
 			}
 			return new MMC3_Coolboy();
 		case 269:
-			if(romData.ChrRom.size() == 0) {
+			if(romData.GetChrRomSize() == 0) {
 				for(uint32_t i = 0; i < romData.PrgRom.size(); i++) {
 					// Decrypt CHR pattern
 					uint8_t value = romData.PrgRom.data()[i];
@@ -933,18 +933,20 @@ std::shared_ptr<BaseMapper> MapperFactory::InitializeFromFile(std::shared_ptr<Co
 
 	if(loader.LoadFile(romFile)) {
 		romData = loader.GetRomData();
+		return InitializeFromRomData(console, romData);
+	}
+	return nullptr;
+}
 
-		if((romData.Info.IsInDatabase || romData.Info.IsNes20Header) && romData.Info.InputType != GameInputType::Unspecified) {
-			//If in DB or a NES 2.0 file, auto-configure the inputs
-			if(console->GetSettings()->CheckFlag(EmulationFlags::AutoConfigureInput)) {
-				console->GetSettings()->InitializeInputDevices(romData.Info.InputType, romData.Info.System, false);
-			}
+std::shared_ptr<BaseMapper> MapperFactory::InitializeFromRomData(std::shared_ptr<Console> console, RomData &romData)
+{
+	if((romData.Info.IsInDatabase || romData.Info.IsNes20Header) && romData.Info.InputType != GameInputType::Unspecified) {
+		//If in DB or a NES 2.0 file, auto-configure the inputs
+		if(console->GetSettings()->CheckFlag(EmulationFlags::AutoConfigureInput)) {
+			console->GetSettings()->InitializeInputDevices(romData.Info.InputType, romData.Info.System, false);
 		}
-
-		std::shared_ptr<BaseMapper> mapper(GetMapperFromID(romData));
-		if(mapper)
-			return mapper;
 	}
-	return nullptr;
+
+	return std::shared_ptr<BaseMapper>(GetMapperFromID(romData));
 }
 
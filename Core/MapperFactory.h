@@ -18,4 +18,5 @@ class MapperFactory
 		static constexpr uint16_t StudyBoxMapperID = 65533;
 
 		static std::shared_ptr<BaseMapper> InitializeFromFile(std::shared_ptr<Console> console, VirtualFile &romFile, RomData &outRomData);
+		static std::shared_ptr<BaseMapper> InitializeFromRomData(std::shared_ptr<Console> console, RomData &romData);
 };
@@ -4,6 +4,7 @@
 #include "BaseMapper.h"
 #include "CheatManager.h"
 #include "Console.h"
+#include "SharedRomCache.h"
 
 MemoryManager::MemoryManager(std::shared_ptr<Console> console)
 {
@@ -11,23 +12,55 @@ MemoryManager::MemoryManager(std::shared_ptr<Console> console)
 	_internalRAM = new uint8_t[InternalRAMSize];
 	_internalRamHandler.SetInternalRam(_internalRAM);
 
-	_ramReadHandlers = new IMemoryHandler*[RAMSize];
-	_ramWriteHandlers = new IMemoryHandler*[RAMSize];
+	SetHandlerTables(std::shared_ptr<vector<uint8_t>>(new vector<uint8_t>(RAMSize * 2)), false);
 
-	for(int i = 0; i < RAMSize; i++) {
-		_ramReadHandlers[i] = &_openBusHandler;
-		_ramWriteHandlers[i] = &_openBusHandler;
+	PowerOn();
+}
+
+void MemoryManager::PowerOn()
+{
+	//Unregister all devices, they are registered again by the console after power cycling
+	memset(_memoryHandlers, 0, sizeof(_memoryHandlers));
+	_memoryHandlers[0] = &_openBusHandler;
+
+	if(_handlerTablesShared) {
+		SetHandlerTables(std::shared_ptr<vector<uint8_t>>(new vector<uint8_t>(RAMSize * 2)), false);
+	} else {
+		memset(_handlerTables->data(), 0, _handlerTables->size());
 	}
 
-	RegisterIODevice(&_internalRamHandler);	
+	_openBusHandler.SetOpenBus(0);
+
+	RegisterIODevice(&_internalRamHandler);
 }
 
 MemoryManager::~MemoryManager()
 {
 	delete[] _internalRAM;
+}
+
+void MemoryManager::SetHandlerTables(std::shared_ptr<vector<uint8_t>> tables, bool shared)
+{
+	_handlerTables = tables;
+	_handlerTablesShared = shared;
+	_ramReadHandlers = _handlerTables->data();
+	_ramWriteHandlers = _handlerTables->data() + RAMSize;
+}
+
+void MemoryManager::ShareHandlerTables()
+{
+	//Called once all devices are registered - consoles running the same game end up using a single copy of the tables
+	if(!_handlerTablesShared) {
+		SetHandlerTables(SharedRomCache::GetImage(*_handlerTables), true);
+	}
+}
 
-	delete[] _ramReadHandlers;
-	delete[] _ramWriteHandlers;
+void MemoryManager::UnshareHandlerTables()
+{
+	//Devices registered after the tables were shared (e.g when recording a HD pack) need a copy of the tables that only this console uses
+	if(_handlerTablesShared) {
+		SetHandlerTables(std::shared_ptr<vector<uint8_t>>(new vector<uint8_t>(*_handlerTables)), false);
+	}
 }
 
 void MemoryManager::SetMapper(std::shared_ptr<BaseMapper> mapper)
@@ -44,13 +77,32 @@ void MemoryManager::Reset(bool softReset)
 	_mapper->Reset(softReset);
 }
 
-void MemoryManager::InitializeMemoryHandlers(IMemoryHandler** memoryHandlers, IMemoryHandler* handler, vector<uint16_t> *addresses, bool allowOverride)
+uint8_t MemoryManager::GetHandlerIndex(IMemoryHandler* handler)
+{
+	int freeIndex = -1;
+	for(int i = 0; i < MaxHandlerCount; i++) {
+		if(_memoryHandlers[i] == handler) {
+			return (uint8_t)i;
+		} else if(!_memoryHandlers[i] && freeIndex < 0) {
+			freeIndex = i;
+		}
+	}
+
+	if(freeIndex < 0) {
+		throw std::runtime_error("Too many memory handlers");
+	}
+	_memoryHandlers[freeIndex] = handler;
+	return (uint8_t)freeIndex;
+}
+
+void MemoryManager::InitializeMemoryHandlers(uint8_t* memoryHandlers, IMemoryHandler* handler, vector<uint16_t> *addresses, bool allowOverride)
 {
+	uint8_t index = GetHandlerIndex(handler);
 	for(uint16_t address : *addresses) {
-		if(!allowOverride && memoryHandlers[address] != &_openBusHandler && memoryHandlers[address] != handler) {
+		if(!allowOverride && memoryHandlers[address] != 0 && memoryHandlers[address] != index) {
 			throw std::runtime_error("Not supported");
 		}
-		memoryHandlers[address] = handler;
+		memoryHandlers[address] = index;
 	}
 }
 
@@ -59,14 +111,18 @@ void MemoryManager::RegisterIODevice(IMemoryHandler *handler)
 	MemoryRanges ranges;
 	handler->GetMemoryRanges(ranges);
 
+	UnshareHandlerTables();
+
 	InitializeMemoryHandlers(_ramReadHandlers, handler, ranges.GetRAMReadAddresses(), ranges.GetAllowOverride());
 	InitializeMemoryHandlers(_ramWriteHandlers, handler, ranges.GetRAMWriteAddresses(), ranges.GetAllowOverride());
 }
 
 void MemoryManager::RegisterWriteHandler(IMemoryHandler* handler, uint32_t start, uint32_t end)
 {
+	UnshareHandlerTables();
+	uint8_t index = GetHandlerIndex(handler);
 	for(uint32_t i = start; i < end; i++) {
-		_ramWriteHandlers[i] = handler;
+		_ramWriteHandlers[i] = index;
 	}
 }
 
@@ -75,12 +131,21 @@ void MemoryManager::UnregisterIODevice(IMemoryHandler *handler)
 	MemoryRanges ranges;
 	handler->GetMemoryRanges(ranges);
 
+	UnshareHandlerTables();
+
 	for(uint16_t address : *ranges.GetRAMReadAddresses()) {
-		_ramReadHandlers[address] = &_openBusHandler;
+		_ramReadHandlers[address] = 0;
 	}
 
 	for(uint16_t address : *ranges.GetRAMWriteAddresses()) {
-		_ramWriteHandlers[address] = &_openBusHandler;
+		_ramWriteHandlers[address] = 0;
+	}
+
+	//Free the handler's slot so it can be reused by the next device that gets registered
+	for(int i = 1; i < MaxHandlerCount; i++) {
+		if(_memoryHandlers[i] == handler) {
+			_memoryHandlers[i] = nullptr;
+		}
 	}
 }
 
@@ -93,9 +158,9 @@ uint8_t MemoryManager::DebugRead(uint16_t addr, bool disableSideEffects)
 {
 	uint8_t value = 0x00;
 	if(addr <= 0x1FFF) {
-		value = _ramReadHandlers[addr]->ReadRAM(addr);
+		value = _memoryHandlers[_ramReadHandlers[addr]]->ReadRAM(addr);
 	} else {
-		IMemoryHandler* handler = _ramReadHandlers[addr];
+		IMemoryHandler* handler = _memoryHandlers[_ramReadHandlers[addr]];
 		if(handler) {
 			if(disableSideEffects) {
 				value = handler->PeekRAM(addr);
@@ -120,7 +185,7 @@ uint16_t MemoryManager::DebugReadWord(uint16_t addr)
 
 uint8_t MemoryManager::Read(uint16_t addr, MemoryOperationType operationType)
 {
-	uint8_t value = _ramReadHandlers[addr]->ReadRAM(addr);
+	uint8_t value = _memoryHandlers[_ramReadHandlers[addr]]->ReadRAM(addr);
 	_console->GetCheatManager()->ApplyCodes(addr, value);
 
 	_openBusHandler.SetOpenBus(value);
@@ -130,16 +195,16 @@ uint8_t MemoryManager::Read(uint16_t addr, MemoryOperationType operationType)
 
 void MemoryManager::Write(uint16_t addr, uint8_t value, MemoryOperationType operationType)
 {
-	_ramWriteHandlers[addr]->WriteRAM(addr, value);
+	_memoryHandlers[_ramWriteHandlers[addr]]->WriteRAM(addr, value);
 	_openBusHandler.SetOpenBus(value);
 }
 
 void MemoryManager::DebugWrite(uint16_t addr, uint8_t value, bool disableSideEffects)
 {
 	if(addr <= 0x1FFF) {
-		_ramWriteHandlers[addr]->WriteRAM(addr, value);
+		_memoryHandlers[_ramWriteHandlers[addr]]->WriteRAM(addr, value);
 	} else {
-		IMemoryHandler* handler = _ramReadHandlers[addr];
+		IMemoryHandler* handler = _memoryHandlers[_ramReadHandlers[addr]];
 		if(handler) {
 			if(disableSideEffects) {
 				if(handler == _mapper.get()) {
@@ -15,6 +15,7 @@ class MemoryManager : public Snapshotable
 	private:
 		static constexpr int RAMSize = 0x10000;
 		static constexpr int VRAMSize = 0x4000;
+		static constexpr int MaxHandlerCount = 0x100;
 		
 		std::shared_ptr<Console> _console;
 		std::shared_ptr<BaseMapper> _mapper;
@@ -23,10 +24,20 @@ class MemoryManager : public Snapshotable
 
 		OpenBusHandler _openBusHandler;
 		InternalRamHandler<0x7FF> _internalRamHandler;
-		IMemoryHandler** _ramReadHandlers;
-		IMemoryHandler** _ramWriteHandlers;
 
-		void InitializeMemoryHandlers(IMemoryHandler** memoryHandlers, IMemoryHandler* handler, vector<uint16_t> *addresses, bool allowOverride);
+		//The address tables contain indexes into _memoryHandlers (1 byte per address instead of a pointer), index 0 is the open bus handler
+		IMemoryHandler* _memoryHandlers[MaxHandlerCount];
+		uint8_t* _ramReadHandlers;
+		uint8_t* _ramWriteHandlers;
+
+		//Storage for both address tables - once shared, it is read-only and used by every console that registered the same devices
+		std::shared_ptr<vector<uint8_t>> _handlerTables;
+		bool _handlerTablesShared = false;
+
+		void SetHandlerTables(std::shared_ptr<vector<uint8_t>> tables, bool shared);
+		void UnshareHandlerTables();
+		uint8_t GetHandlerIndex(IMemoryHandler* handler);
+		void InitializeMemoryHandlers(uint8_t* memoryHandlers, IMemoryHandler* handler, vector<uint16_t> *addresses, bool allowOverride);
 
 	protected:
 		void StreamState(bool saving) override;
@@ -39,6 +50,8 @@ class MemoryManager : public Snapshotable
 
 		void SetMapper(std::shared_ptr<BaseMapper> mapper);
 		
+		void PowerOn();
+		void ShareHandlerTables();
 		void Reset(bool softReset);
 		void RegisterIODevice(IMemoryHandler *handler);
 		void RegisterWriteHandler(IMemoryHandler* handler, uint32_t start, uint32_t end);
@@ -22,6 +22,7 @@ private:
 protected:
 	virtual uint16_t GetPRGPageSize() override { return 0x8000; }
 	virtual uint16_t GetCHRPageSize() override {	return 0x1000; }
+	virtual bool EnableVramAddressHook() override { return true; }
 	virtual bool AllowRegisterRead() override { return true; }
 
 	virtual void StreamState(bool saving) override
@@ -9,7 +9,9 @@ NtscFilter::NtscFilter(shared_ptr<Console> console) : BaseVideoFilter(console)
 	memset(_palette, 0, sizeof(_palette));
 	memset(&_ntscData, 0, sizeof(_ntscData));
 	_ntscSetup = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-	_ntscBuffer = new uint32_t[NES_NTSC_OUT_WIDTH(256) * 240];
+	_ntscBuffers[0] = new uint32_t[NES_NTSC_OUT_WIDTH(256) * 240];
+	_ntscBuffers[1] = new uint32_t[NES_NTSC_OUT_WIDTH(256) * 240];
+	memset(_previousChangedRows, 1, sizeof(_previousChangedRows));
 }
 
 FrameInfo NtscFilter::GetFrameInfo()
@@ -60,6 +62,9 @@ void NtscFilter::OnBeforeApplyFilter()
 
 	_keepVerticalRes = ntscSettings.KeepVerticalResolution;
 
+	//Scanlines are only applied to the interpolated rows (only the CRT mask is applied when the vertical resolution is kept)
+	_scanlineFilter.UpdateSettings(pictureSettings, _keepVerticalRes ? 0 : 0x02);
+
 	if(paletteChanged || _ntscSetup.hue != pictureSettings.Hue || _ntscSetup.saturation != pictureSettings.Saturation || _ntscSetup.brightness != pictureSettings.Brightness || _ntscSetup.contrast != pictureSettings.Contrast ||
 		_ntscSetup.artifacts != ntscSettings.Artifacts || _ntscSetup.bleed != ntscSettings.Bleed || _ntscSetup.fringing != ntscSettings.Fringing || _ntscSetup.gamma != ntscSettings.Gamma ||
 		(_ntscSetup.merge_fields == 1) != ntscSettings.MergeFields || _ntscSetup.resolution != ntscSettings.Resolution || _ntscSetup.sharpness != ntscSettings.Sharpness) {
@@ -85,13 +90,39 @@ void NtscFilter::OnBeforeApplyFilter()
 		}
 
 		nes_ntsc_init(&_ntscData, &_ntscSetup);
+		InvalidateOutput();
 	}
 }
 
 void NtscFilter::ApplyFilter(uint16_t *ppuOutputBuffer)
 {
-	nes_ntsc_blit(&_ntscData, ppuOutputBuffer, PPU::ScreenWidth, IsOddFrame() ? 0 : 1, PPU::ScreenWidth, 240, _ntscBuffer, NES_NTSC_OUT_WIDTH(PPU::ScreenWidth)*4);
-	GenerateArgbFrame(_ntscBuffer);
+	//The burst phase alternates between even and odd frames, so each field type has its own buffer and a
+	//row only needs to be blitted again if it changed at some point since the frame before last
+	int burstPhase = IsOddFrame() ? 0 : 1;
+	uint32_t* ntscBuffer = _ntscBuffers[burstPhase];
+	int rowWidth = NES_NTSC_OUT_WIDTH(PPU::ScreenWidth);
+
+	uint8_t dirtyRows[PPU::ScreenHeight];
+	for(int y = 0; y < PPU::ScreenHeight; y++) {
+		uint8_t changed = IsRowChanged(y) ? 1 : 0;
+		dirtyRows[y] = changed | _previousChangedRows[y];
+		_previousChangedRows[y] = changed;
+	}
+
+	for(int y = 0; y < PPU::ScreenHeight;) {
+		if(!dirtyRows[y]) {
+			y++;
+			continue;
+		}
+
+		int start = y;
+		while(y < PPU::ScreenHeight && dirtyRows[y]) {
+			y++;
+		}
+		nes_ntsc_blit(&_ntscData, ppuOutputBuffer + start * PPU::ScreenWidth, PPU::ScreenWidth, (burstPhase + start) % 3, PPU::ScreenWidth, y - start, ntscBuffer + start * rowWidth, rowWidth * 4);
+	}
+
+	GenerateArgbFrame(ntscBuffer);
 }
 
 void NtscFilter::GenerateArgbFrame(uint32_t *ntscBuffer)
@@ -107,43 +138,26 @@ void NtscFilter::GenerateArgbFrame(uint32_t *ntscBuffer)
 		ntscBuffer += rowWidth * overscan.Top + overscanLeft;
 		for(uint32_t i = 0, len = overscan.GetScreenHeight(); i < len; i++) {
 			memcpy(outputBuffer, ntscBuffer, rowWidthOverscan * sizeof(uint32_t));
+			_scanlineFilter.ApplyToRow(outputBuffer, rowWidthOverscan, i);
 			outputBuffer += rowWidthOverscan;
 			ntscBuffer += rowWidth;
 		}
 	} else {
-		double scanlineIntensity = 1.0 - _console->GetSettings()->GetPictureSettings().ScanlineIntensity;
 		bool verticalBlend = _console->GetSettings()->GetNtscFilterSettings().VerticalBlend;
 
 		for(int y = PPU::ScreenHeight - 1 - overscan.Bottom; y >= (int)overscan.Top; y--) {
 			uint32_t const* in = ntscBuffer + y * rowWidth;
 			uint32_t* out = outputBuffer + (y - overscan.Top) * 2 * rowWidthOverscan;
 
-			if(verticalBlend || scanlineIntensity < 1.0) {
+			if(verticalBlend) {
 				for(int x = 0; x < rowWidthOverscan; x++) {
-					uint32_t prev = in[overscanLeft];
-					uint32_t next = y < 239 ? in[overscanLeft + rowWidth] : 0;
+					uint32_t prev = in[overscanLeft + x];
+					uint32_t next = y < 239 ? in[overscanLeft + x + rowWidth] : 0;
 
-					*out = 0xFF000000 | prev;
+					out[x] = 0xFF000000 | prev;
 
 					/* mix 24-bit rgb without losing low bits */
-					uint32_t mixed;
-					if(verticalBlend) {
-						mixed = (prev + next + ((prev ^ next) & 0x030303)) >> 1;
-					} else {
-						mixed = prev;
-					}
-
-					if(scanlineIntensity < 1.0) {
-						uint8_t r = (mixed >> 16) & 0xFF, g = (mixed >> 8) & 0xFF, b = mixed & 0xFF;
-						r = (uint8_t)(r * scanlineIntensity);
-						g = (uint8_t)(g * scanlineIntensity);
-						b = (uint8_t)(b * scanlineIntensity);
-						*(out + rowWidthOverscan) = 0xFF000000 | (r << 16) | (g << 8) | b;
-					} else {
-						*(out + rowWidthOverscan) = 0xFF000000 | mixed;
-					}
-					in++;
-					out++;
+					out[x + rowWidthOverscan] = 0xFF000000 | ((prev + next + ((prev ^ next) & 0x030303)) >> 1);
 				}
 			} else {
 				for(int i = 0; i < rowWidthOverscan; i++) {
@@ -151,11 +165,17 @@ void NtscFilter::GenerateArgbFrame(uint32_t *ntscBuffer)
 				}
 				memcpy(out + rowWidthOverscan, out, rowWidthOverscan * sizeof(uint32_t));
 			}
+
+			if(_scanlineFilter.IsEnabled()) {
+				_scanlineFilter.ApplyToRow(out, rowWidthOverscan, (y - overscan.Top) * 2);
+				_scanlineFilter.ApplyToRow(out + rowWidthOverscan, rowWidthOverscan, (y - overscan.Top) * 2 + 1);
+			}
 		}
 	}
 }
 
 NtscFilter::~NtscFilter()
 {
-	delete[] _ntscBuffer;
+	delete[] _ntscBuffers[0];
+	delete[] _ntscBuffers[1];
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include "stdafx.h"
 #include "BaseVideoFilter.h"
+#include "ScanlineFilter.h"
 #include "../Utilities/nes_ntsc.h"
 
 class Console;
@@ -12,7 +13,9 @@ private:
 	nes_ntsc_t _ntscData;
 	bool _keepVerticalRes = false;
 	uint8_t _palette[512 * 3];
-	uint32_t* _ntscBuffer;
+	uint32_t* _ntscBuffers[2];
+	uint8_t _previousChangedRows[240];
+	ScanlineFilter _scanlineFilter;
 
 	void GenerateArgbFrame(uint32_t *outputBuffer);
 
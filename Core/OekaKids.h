@@ -11,6 +11,7 @@ class OekaKids : public BaseMapper
 protected:
 	virtual uint16_t GetPRGPageSize() override { return 0x8000; }
 	virtual uint16_t GetCHRPageSize() override { return 0x1000; }
+	virtual bool EnableVramAddressHook() override { return true; }
 	virtual bool HasBusConflicts() override { return true; }
 
 	void InitMapper() override
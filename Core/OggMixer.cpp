@@ -2,6 +2,7 @@
 #include <algorithm>
 #include "OggReader.h"
 #include "OggMixer.h"
+#include "VirtualFile.h"
 
 enum class OggPlaybackOptions
 {
@@ -11,12 +12,45 @@ enum class OggPlaybackOptions
 
 OggMixer::OggMixer()
 {
+	_sampleRate = 0;
+	_bgmVolume = 128;
+	_sfxVolume = 128;
+	_options = 0;
+	_paused = false;
+	_stopLoader = false;
+	_clearFileCache = false;
+	_fileCacheSize = 0;
+	_fileCacheUseCounter = 0;
+	_nextRequestId = 1;
+	_pendingBgmId = 0;
+	_pendingBgmOffset = 0;
+	_firstSfxId = 1;
+	_pendingSfxCount = 0;
+
+	_loaderThread = std::thread(&OggMixer::RunLoader, this);
+}
+
+OggMixer::~OggMixer()
+{
+	_stopLoader = true;
+	_loaderSignal.Signal();
+	_loaderThread.join();
 }
 
 void OggMixer::Reset(uint32_t sampleRate)
 {
+	{
+		std::lock_guard<std::mutex> lock(_loaderLock);
+		_playRequests.clear();
+		_loadedTracks.clear();
+	}
+
 	_bgm.reset();
+	_fadingBgm.clear();
 	_sfx.clear();
+	_pendingBgmId = 0;
+	_firstSfxId = _nextRequestId;
+	_pendingSfxCount = 0;
 	_sfxVolume = 128;
 	_bgmVolume = 128;
 	_options = 0;
@@ -41,12 +75,20 @@ void OggMixer::SetPausedFlag(bool paused)
 
 void OggMixer::StopBgm()
 {
-	_bgm.reset();
+	_pendingBgmId = 0;
+	if(_bgm) {
+		_bgm->FadeOut(_sampleRate * OggMixer::CrossfadeDuration / 1000);
+		_fadingBgm.push_back(_bgm);
+		_bgm.reset();
+	}
 }
 
 void OggMixer::StopSfx()
 {
+	//Sound effects that are still being loaded are discarded once they're ready
 	_sfx.clear();
+	_firstSfxId = _nextRequestId;
+	_pendingSfxCount = 0;
 }
 
 void OggMixer::SetBgmVolume(uint8_t volume)
@@ -61,12 +103,12 @@ void OggMixer::SetSfxVolume(uint8_t volume)
 
 bool OggMixer::IsBgmPlaying()
 {
-	return !_paused && _bgm;
+	return !_paused && (_bgm || _pendingBgmId != 0);
 }
 
 bool OggMixer::IsSfxPlaying()
 {
-	return _sfx.size() > 0;
+	return _sfx.size() > 0 || _pendingSfxCount > 0;
 }
 
 void OggMixer::SetSampleRate(int sampleRate)
@@ -75,33 +117,202 @@ void OggMixer::SetSampleRate(int sampleRate)
 	if(_bgm) {
 		_bgm->SetSampleRate(sampleRate);
 	}
+	for(shared_ptr<OggReader> &bgm : _fadingBgm) {
+		bgm->SetSampleRate(sampleRate);
+	}
 	for(shared_ptr<OggReader> &sfx : _sfx) {
 		sfx->SetSampleRate(sampleRate);
 	}
 }
 
+void OggMixer::PreloadFiles(vector<string> &filenames)
+{
+	{
+		std::lock_guard<std::mutex> lock(_loaderLock);
+		_preloadFiles.assign(filenames.begin(), filenames.end());
+		_clearFileCache = true;
+		_invalidFiles.clear();
+	}
+	_loaderSignal.Signal();
+}
+
 bool OggMixer::Play(string filename, bool isSfx, uint32_t startOffset)
 {
-	shared_ptr<OggReader> reader(new OggReader());
-	bool loop = !isSfx && (_options & (int)OggPlaybackOptions::Loop) != 0;
-	if(reader->Init(filename, loop, _sampleRate, startOffset)) {
-		if(isSfx) {
-			_sfx.push_back(reader);
+	OggPlayRequest request;
+	request.Id = _nextRequestId++;
+	request.Filename = filename;
+	request.IsSfx = isSfx;
+	request.Loop = !isSfx && (_options & (int)OggPlaybackOptions::Loop) != 0;
+	request.StartOffset = startOffset;
+	request.SampleRate = _sampleRate;
+
+	{
+		std::lock_guard<std::mutex> lock(_loaderLock);
+		if(_invalidFiles.find(filename) != _invalidFiles.end()) {
+			return false;
+		}
+
+		if(!isSfx) {
+			//Only the last BGM track requested needs to be loaded
+			_playRequests.erase(std::remove_if(_playRequests.begin(), _playRequests.end(), [](const OggPlayRequest& r) { return !r.IsSfx; }), _playRequests.end());
+		}
+		_playRequests.push_back(request);
+	}
+	_loaderSignal.Signal();
+
+	if(isSfx) {
+		_pendingSfxCount++;
+	} else {
+		_pendingBgmId = request.Id;
+		_pendingBgmOffset = startOffset;
+	}
+	return true;
+}
+
+void OggMixer::RunLoader()
+{
+	while(!_stopLoader) {
+		_loaderSignal.Wait();
+
+		while(!_stopLoader) {
+			OggPlayRequest request;
+			string preloadFile;
+			bool hasRequest = false;
+			{
+				std::lock_guard<std::mutex> lock(_loaderLock);
+				if(_clearFileCache) {
+					_fileCache.clear();
+					_fileCacheSize = 0;
+					_clearFileCache = false;
+				}
+
+				//Play requests take priority over the files that are loaded ahead of time
+				if(!_playRequests.empty()) {
+					request = _playRequests.front();
+					_playRequests.pop_front();
+					hasRequest = true;
+				} else if(!_preloadFiles.empty()) {
+					preloadFile = _preloadFiles.front();
+					_preloadFiles.pop_front();
+				} else {
+					break;
+				}
+			}
+
+			if(hasRequest) {
+				OggLoadedTrack track;
+				track.Id = request.Id;
+				track.IsSfx = request.IsSfx;
+
+				shared_ptr<vector<uint8_t>> fileData = GetFileData(request.Filename, false);
+				if(fileData) {
+					shared_ptr<OggReader> reader(new OggReader());
+					if(reader->Init(fileData, request.Loop, request.SampleRate, request.StartOffset)) {
+						reader->Prefetch(request.SampleRate * OggMixer::PrefetchDuration / 1000);
+						track.Reader = reader;
+					}
+				}
+
+				std::lock_guard<std::mutex> lock(_loaderLock);
+				_loadedTracks.push_back(track);
+			} else {
+				GetFileData(preloadFile, true);
+			}
+		}
+	}
+}
+
+shared_ptr<vector<uint8_t>> OggMixer::GetFileData(string &filename, bool preload)
+{
+	auto result = _fileCache.find(filename);
+	if(result != _fileCache.end()) {
+		result->second.LastUse = ++_fileCacheUseCounter;
+		return result->second.Data;
+	}
+
+	shared_ptr<vector<uint8_t>> fileData(new vector<uint8_t>());
+	VirtualFile file = filename;
+	if(file.ReadFile(*fileData) && OggReader::IsValidFile(*fileData)) {
+		if(preload && _fileCacheSize + fileData->size() > OggMixer::MaxFileCacheSize) {
+			//The cache is full, the file was only validated and will be read again when it is played
+			return fileData;
+		}
+
+		//Remove the least recently used files until the new file fits (tracks that are playing keep their own reference to the data)
+		while(!_fileCache.empty() && _fileCacheSize + fileData->size() > OggMixer::MaxFileCacheSize) {
+			auto oldest = std::min_element(_fileCache.begin(), _fileCache.end(), [](const std::pair<const string, OggCachedFile> &a, const std::pair<const string, OggCachedFile> &b) { return a.second.LastUse < b.second.LastUse; });
+			_fileCacheSize -= oldest->second.Data->size();
+			_fileCache.erase(oldest);
+		}
+
+		_fileCache[filename] = { fileData, ++_fileCacheUseCounter };
+		_fileCacheSize += fileData->size();
+		return fileData;
+	}
+
+	std::lock_guard<std::mutex> lock(_loaderLock);
+	_invalidFiles.emplace(filename);
+	return nullptr;
+}
+
+void OggMixer::ProcessLoadedTracks()
+{
+	vector<OggLoadedTrack> tracks;
+	{
+		std::lock_guard<std::mutex> lock(_loaderLock);
+		if(_loadedTracks.empty()) {
+			return;
+		}
+		tracks.swap(_loadedTracks);
+	}
+
+	uint32_t crossfadeSamples = _sampleRate * OggMixer::CrossfadeDuration / 1000;
+	for(OggLoadedTrack &track : tracks) {
+		if(track.IsSfx) {
+			if(track.Id < _firstSfxId) {
+				//Stopped before it was ready
+				continue;
+			}
+			_pendingSfxCount--;
+			if(track.Reader) {
+				track.Reader->SetSampleRate(_sampleRate);
+				_sfx.push_back(track.Reader);
+			}
 		} else {
-			_bgm = reader;
+			if(track.Id != _pendingBgmId) {
+				//Stopped or replaced by another track before it was ready
+				continue;
+			}
+			_pendingBgmId = 0;
+			if(track.Reader) {
+				track.Reader->SetSampleRate(_sampleRate);
+				track.Reader->SetLoopFlag((_options & (int)OggPlaybackOptions::Loop) != 0);
+				if(_bgm) {
+					_bgm->FadeOut(crossfadeSamples);
+					_fadingBgm.push_back(_bgm);
+					track.Reader->FadeIn(crossfadeSamples);
+				}
+				_bgm = track.Reader;
+			}
 		}
-		return true;
 	}
-	return false;
 }
 
 void OggMixer::ApplySamples(int16_t * buffer, size_t sampleCount, double masterVolumne)
 {
-	if(_bgm && !_paused) {
-		_bgm->ApplySamples(buffer, sampleCount, _bgmVolume, masterVolumne);
-		if(_bgm->IsPlaybackOver()) {
-			_bgm.reset();
+	ProcessLoadedTracks();
+
+	if(!_paused) {
+		if(_bgm) {
+			_bgm->ApplySamples(buffer, sampleCount, _bgmVolume, masterVolumne);
+			if(_bgm->IsPlaybackOver()) {
+				_bgm.reset();
+			}
+		}
+		for(shared_ptr<OggReader> &bgm : _fadingBgm) {
+			bgm->ApplySamples(buffer, sampleCount, _bgmVolume, masterVolumne);
 		}
+		_fadingBgm.erase(std::remove_if(_fadingBgm.begin(), _fadingBgm.end(), [](const shared_ptr<OggReader>& o) { return o->IsPlaybackOver(); }), _fadingBgm.end());
 	}
 	for(shared_ptr<OggReader> &sfx : _sfx) {
 		sfx->ApplySamples(buffer, sampleCount, _sfxVolume, masterVolumne);
@@ -111,7 +322,10 @@ void OggMixer::ApplySamples(int16_t * buffer, size_t sampleCount, double masterV
 
 int OggMixer::GetBgmOffset()
 {
-	if(_bgm) {
+	if(_pendingBgmId != 0) {
+		//The track hasn't started playing yet
+		return _pendingBgmOffset;
+	} else if(_bgm) {
 		return _bgm->GetOffset();
 	} else {
 		return -1;
@@ -1,12 +1,43 @@
 #pragma once
 #include "stdafx.h"
+#include <thread>
+#include <unordered_set>
+#include "../Utilities/AutoResetEvent.h"
 
 class OggReader;
 
 class OggMixer
 {
 private:
+	static constexpr uint32_t CrossfadeDuration = 50; //ms, used when a BGM track replaces or stops another one
+	static constexpr uint32_t PrefetchDuration = 50; //ms of audio decoded by the loader thread before a track starts playing
+	static constexpr size_t MaxFileCacheSize = 32 * 1024 * 1024; //bytes of .ogg file content kept in memory by the loader thread
+
+	struct OggPlayRequest
+	{
+		uint32_t Id;
+		string Filename;
+		bool IsSfx;
+		bool Loop;
+		uint32_t StartOffset;
+		uint32_t SampleRate;
+	};
+
+	struct OggLoadedTrack
+	{
+		uint32_t Id;
+		bool IsSfx;
+		shared_ptr<OggReader> Reader; //null when the file could not be played
+	};
+
+	struct OggCachedFile
+	{
+		shared_ptr<vector<uint8_t>> Data;
+		uint32_t LastUse;
+	};
+
 	shared_ptr<OggReader> _bgm;
+	vector<shared_ptr<OggReader>> _fadingBgm;
 	vector<shared_ptr<OggReader>> _sfx;
 
 	uint32_t _sampleRate;
@@ -15,13 +46,42 @@ private:
 	uint8_t _options;
 	bool _paused;
 
+	//Tracks are opened (and the start of each track decoded) by the loader thread, Play() only queues a request
+	//and the track starts playing on the first ApplySamples() call after it is ready.
+	std::thread _loaderThread;
+	AutoResetEvent _loaderSignal;
+	atomic<bool> _stopLoader;
+	std::mutex _loaderLock;
+	deque<OggPlayRequest> _playRequests;
+	vector<OggLoadedTrack> _loadedTracks;
+	deque<string> _preloadFiles;
+	bool _clearFileCache;
+	std::unordered_set<string> _invalidFiles;
+
+	//Only used by the loader thread - the least recently used files are removed from the cache once it goes over MaxFileCacheSize
+	std::unordered_map<string, OggCachedFile> _fileCache;
+	size_t _fileCacheSize;
+	uint32_t _fileCacheUseCounter;
+
+	uint32_t _nextRequestId;
+	uint32_t _pendingBgmId;
+	uint32_t _pendingBgmOffset;
+	uint32_t _firstSfxId;
+	uint32_t _pendingSfxCount;
+
+	void RunLoader();
+	shared_ptr<vector<uint8_t>> GetFileData(string &filename, bool preload);
+	void ProcessLoadedTracks();
+
 public:
 	OggMixer();
+	~OggMixer();
 
 	void SetSampleRate(int sampleRate);
 	void ApplySamples(int16_t* buffer, size_t sampleCount, double masterVolumne);
 	
 	void Reset(uint32_t sampleRate);
+	void PreloadFiles(vector<string> &filenames);
 	bool Play(string filename, bool isSfx, uint32_t startOffset);
 	void SetPlaybackOptions(uint8_t options);
 	void SetPausedFlag(bool paused);
@@ -1,9 +1,26 @@
 #include "stdafx.h"
+#include <algorithm>
 #include "OggReader.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define OGG_MIXER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define OGG_MIXER_NEON
+#endif
+
 OggReader::OggReader()
 {
+	_vorbis = nullptr;
+	_loop = false;
 	_done = false;
+	_sampleRate = 0;
+	_oggSampleRate = 0;
+	_fadeVolume = 1.0;
+	_fadeStep = 0;
+	_fadeSamplesLeft = 0;
+	_fadingOut = false;
 	_blipLeft = blip_new(10000);
 	_blipRight = blip_new(10000);
 	_oggBuffer = new int16_t[OggReader::SamplesToRead * 2];
@@ -22,30 +39,49 @@ OggReader::~OggReader()
 	}
 }
 
-bool OggReader::Init(string filename, bool loop, uint32_t sampleRate, uint32_t startOffset)
+bool OggReader::IsValidFile(vector<uint8_t> &fileData)
+{
+	int error;
+	stb_vorbis* vorbis = stb_vorbis_open_memory(fileData.data(), (int)fileData.size(), &error, nullptr);
+	if(vorbis) {
+		stb_vorbis_close(vorbis);
+		return true;
+	}
+	return false;
+}
+
+bool OggReader::Init(shared_ptr<vector<uint8_t>> fileData, bool loop, uint32_t sampleRate, uint32_t startOffset)
 {
 	int error;
-	VirtualFile file = filename;
-	_fileData = vector<uint8_t>(100000);
-	if(file.ReadFile(_fileData)) {
-		_vorbis = stb_vorbis_open_memory(_fileData.data(), (int)_fileData.size(), &error, nullptr);
-		if(_vorbis) {
-			_loop = loop;
-			_oggSampleRate = stb_vorbis_get_info(_vorbis).sample_rate;
-			if(startOffset > 0) {
-				stb_vorbis_seek(_vorbis, startOffset);
-			}
-			blip_set_rates(_blipLeft, _oggSampleRate, sampleRate);
-			blip_set_rates(_blipRight, _oggSampleRate, sampleRate);
-			return true;
+	_fileData = fileData;
+	_vorbis = stb_vorbis_open_memory(_fileData->data(), (int)_fileData->size(), &error, nullptr);
+	if(_vorbis) {
+		_loop = loop;
+		_sampleRate = sampleRate;
+		_oggSampleRate = stb_vorbis_get_info(_vorbis).sample_rate;
+		if(startOffset > 0) {
+			stb_vorbis_seek(_vorbis, startOffset);
 		}
+		blip_set_rates(_blipLeft, _oggSampleRate, sampleRate);
+		blip_set_rates(_blipRight, _oggSampleRate, sampleRate);
+		return true;
 	}
 	return false;
 }
 
+void OggReader::Prefetch(uint32_t sampleCount)
+{
+	//Decode the start of the track ahead of time, so the first frames it plays don't need to decode anything
+	while(blip_samples_avail(_blipLeft) < (int)sampleCount) {
+		if(!LoadSamples()) {
+			break;
+		}
+	}
+}
+
 bool OggReader::IsPlaybackOver()
 {
-	return _done && blip_samples_avail(_blipLeft) == 0;
+	return (_fadingOut && _fadeSamplesLeft == 0) || (_done && blip_samples_avail(_blipLeft) == 0);
 }
 
 void OggReader::SetSampleRate(int sampleRate)
@@ -65,6 +101,21 @@ void OggReader::SetLoopFlag(bool loop)
 	_loop = loop;
 }
 
+void OggReader::FadeIn(uint32_t sampleCount)
+{
+	_fadingOut = false;
+	_fadeVolume = 0;
+	_fadeSamplesLeft = std::max<uint32_t>(sampleCount, 1);
+	_fadeStep = 1.0 / _fadeSamplesLeft;
+}
+
+void OggReader::FadeOut(uint32_t sampleCount)
+{
+	_fadingOut = true;
+	_fadeSamplesLeft = std::max<uint32_t>(sampleCount, 1);
+	_fadeStep = -_fadeVolume / _fadeSamplesLeft;
+}
+
 bool OggReader::LoadSamples()
 {
 	int samplesReturned = stb_vorbis_get_samples_short_interleaved(_vorbis, 2, _oggBuffer, OggReader::SamplesToRead * 2);
@@ -99,8 +150,64 @@ void OggReader::ApplySamples(int16_t * buffer, size_t sampleCount, uint8_t volum
 	int samplesRead = blip_read_samples(_blipLeft, _outputBuffer, (int)sampleCount, 1);
 	blip_read_samples(_blipRight, _outputBuffer + 1, (int)sampleCount, 1);
 
-	for(size_t i = 0, len = samplesRead * 2; i < len; i++) {
-		buffer[i] += (int16_t)(_outputBuffer[i] * (masterVolume * volume / 255 / 10));
+	double volumeRatio = masterVolume * volume / 255 / 10;
+	uint32_t position = 0;
+	if(_fadeSamplesLeft > 0) {
+		uint32_t fadeCount = std::min<uint32_t>(_fadeSamplesLeft, samplesRead);
+		MixSamples(buffer, _outputBuffer, fadeCount, (float)(volumeRatio * _fadeVolume), (float)(volumeRatio * _fadeStep));
+		_fadeSamplesLeft -= fadeCount;
+		_fadeVolume = _fadeSamplesLeft == 0 ? (_fadingOut ? 0.0 : 1.0) : _fadeVolume + _fadeStep * fadeCount;
+		position = fadeCount;
+	}
+
+	if(position < (uint32_t)samplesRead && _fadeVolume > 0) {
+		MixSamples(buffer + position * 2, _outputBuffer + position * 2, samplesRead - position, (float)(volumeRatio * _fadeVolume), 0);
+	}
+}
+
+void OggReader::MixSamples(int16_t* buffer, int16_t* samples, size_t sampleCount, float volume, float volumeStep)
+{
+	//Adds sampleCount stereo samples to the buffer, the volume changes by volumeStep after each sample
+	//Every path converts the same way: truncate to a 32-bit int, keep its low 16 bits and add with wraparound
+	size_t i = 0;
+
+#if defined(OGG_MIXER_SSE2)
+	const __m128i sampleOffsets = _mm_set_epi32(1, 1, 0, 0);
+	for(; i + 4 <= sampleCount; i += 4) {
+		__m128i input = _mm_loadu_si128((__m128i*)(samples + i * 2));
+		__m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(input, input), 16));
+		__m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(input, input), 16));
+
+		__m128 volumeLo = _mm_add_ps(_mm_set1_ps(volume), _mm_mul_ps(_mm_set1_ps(volumeStep), _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32((int)i), sampleOffsets))));
+		__m128 volumeHi = _mm_add_ps(_mm_set1_ps(volume), _mm_mul_ps(_mm_set1_ps(volumeStep), _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32((int)i + 2), sampleOffsets))));
+		__m128i mixedLo = _mm_cvttps_epi32(_mm_mul_ps(lo, volumeLo));
+		__m128i mixedHi = _mm_cvttps_epi32(_mm_mul_ps(hi, volumeHi));
+		//Sign-extend the low 16 bits first so the saturating pack can't clamp the values
+		__m128i mixed = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(mixedLo, 16), 16), _mm_srai_epi32(_mm_slli_epi32(mixedHi, 16), 16));
+
+		__m128i* out = (__m128i*)(buffer + i * 2);
+		_mm_storeu_si128(out, _mm_add_epi16(_mm_loadu_si128(out), mixed));
+	}
+#elif defined(OGG_MIXER_NEON)
+	const float offsets[4] = { 0, 0, 1, 1 };
+	const float32x4_t sampleOffsets = vld1q_f32(offsets);
+	for(; i + 4 <= sampleCount; i += 4) {
+		int16x8_t input = vld1q_s16(samples + i * 2);
+		float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(input)));
+		float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(input)));
+
+		float32x4_t volumeLo = vmlaq_n_f32(vdupq_n_f32(volume), vaddq_f32(vdupq_n_f32((float)i), sampleOffsets), volumeStep);
+		float32x4_t volumeHi = vmlaq_n_f32(vdupq_n_f32(volume), vaddq_f32(vdupq_n_f32((float)(i + 2)), sampleOffsets), volumeStep);
+		int16x8_t mixed = vcombine_s16(vmovn_s32(vcvtq_s32_f32(vmulq_f32(lo, volumeLo))), vmovn_s32(vcvtq_s32_f32(vmulq_f32(hi, volumeHi))));
+
+		vst1q_s16(buffer + i * 2, vaddq_s16(vld1q_s16(buffer + i * 2), mixed));
+	}
+#endif
+
+	for(; i < sampleCount; i++) {
+		float sampleVolume = volume + volumeStep * i;
+		buffer[i * 2] += (int16_t)(int32_t)(samples[i * 2] * sampleVolume);
+		buffer[i * 2 + 1] += (int16_t)(int32_t)(samples[i * 2 + 1] * sampleVolume);
 	}
 }
 
@@ -2,7 +2,6 @@
 #include "stdafx.h"
 #include "../Utilities/stb_vorbis.h"
 #include "../Utilities/blip_buf.h"
-#include "VirtualFile.h"
 
 class OggReader
 {
@@ -22,18 +21,31 @@ private:
 	int _sampleRate;
 	int _oggSampleRate;
 
-	vector<uint8_t> _fileData;
+	//The file's content is shared by all the readers playing the same file
+	shared_ptr<vector<uint8_t>> _fileData;
+
+	//Volume ramp used to crossfade tracks (0 = silent, 1 = normal volume)
+	double _fadeVolume;
+	double _fadeStep;
+	uint32_t _fadeSamplesLeft;
+	bool _fadingOut;
 	
 	bool LoadSamples();
+	void MixSamples(int16_t* buffer, int16_t* samples, size_t sampleCount, float volume, float volumeStep);
 
 public:
 	OggReader();
 	~OggReader();
 
-	bool Init(string filename, bool loop, uint32_t sampleRate, uint32_t startOffset = 0);
+	static bool IsValidFile(vector<uint8_t> &fileData);
+
+	bool Init(shared_ptr<vector<uint8_t>> fileData, bool loop, uint32_t sampleRate, uint32_t startOffset = 0);
+	void Prefetch(uint32_t sampleCount);
 	bool IsPlaybackOver();
 	void SetSampleRate(int sampleRate);
 	void SetLoopFlag(bool loop);
+	void FadeIn(uint32_t sampleCount);
+	void FadeOut(uint32_t sampleCount);
 	void ApplySamples(int16_t* buffer, size_t sampleCount, uint8_t volume, double masterVolume);
 	uint32_t GetOffset();
 };
@@ -5,21 +5,37 @@
 #include "APU.h"
 #include "EmulationSettings.h"
 #include "VideoDecoder.h"
+#include "VideoRenderer.h"
 #include "BaseMapper.h"
 #include "ControlManager.h"
 #include "MemoryManager.h"
 #include "Console.h"
+#include "TileDecoder.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define PPU_SSE2
+#endif
 
 PPU::PPU(std::shared_ptr<Console> console)
 {
 	_console = console;
-	_masterClock = 0;
-	_masterClockDivider = 4;
 	_settings = _console->GetSettings();
 
 	_outputBuffers[0] = new uint16_t[256 * 240];
 	_outputBuffers[1] = new uint16_t[256 * 240];
 
+	_scanlineRendererSupported = true;
+
+	PowerOn();
+}
+
+void PPU::PowerOn()
+{
+	_masterClock = 0;
+	_masterClockDivider = 4;
+	_mapper = _console->GetMapper();
+
 	_currentOutputBuffer = _outputBuffers[0];
 	memset(_outputBuffers[0], 0, 256 * 240 * sizeof(uint16_t));
 	memset(_outputBuffers[1], 0, 256 * 240 * sizeof(uint16_t));
@@ -46,6 +62,12 @@ PPU::PPU(std::shared_ptr<Console> console)
 
 	SetNesModel(NesModel::NTSC);
 
+	_useScanlineRenderer = false;
+	_colorMaskChangeCount = 0;
+	_skipOutput = false;
+	_previousOutputSkipped = false;
+	_scanlineRendering = false;
+
 	Reset();
 }
 
@@ -57,6 +79,9 @@ PPU::~PPU()
 
 void PPU::Reset()
 {
+	FinishScanlineRendering();
+	ApplyColorMaskChanges();
+
 	_masterClock = 0;
 	_preventVblFlag = false;
 
@@ -81,16 +106,24 @@ void PPU::Reset()
 	_paletteRamMask = 0x3F;
 	_lastUpdatedPixel = -1;
 	_lastSprite = nullptr;
+	_directOutput = false;
+	_skipOutput = false;
+	memset(_rowChanged, 1, sizeof(_rowChanged));
 	_oamCopybuffer = 0;
 	_spriteInRange = false;
 	_sprite0Added = false;
 	_spriteAddrH = 0;
 	_spriteAddrL = 0;
 	_oamCopyDone = false;
+	_deferredSpriteEvaluation = false;
+	_spriteEvaluationCycle = 0;
+	_spritesOnScanlineDirty = true;
+	_spritesOnScanlineLarge = false;
 
 	memset(_hasSprite, 0, sizeof(_hasSprite));
 	memset(_spriteTiles, 0, sizeof(_spriteTiles));
 	_spriteCount = 0;
+	UpdateSpritePixels();
 	_secondaryOAMAddr = 0;
 	_sprite0Visible = false;
 	_spriteIndex = 0;
@@ -187,6 +220,11 @@ void PPU::GetState(PPUDebugState &state)
 
 void PPU::SetState(PPUDebugState &state)
 {
+	FinishScanlineRendering();
+	RunPendingSpriteEvaluation();
+	_deferredSpriteEvaluation = false;
+	_spritesOnScanlineDirty = true;
+
 	_flags = state.ControlFlags;
 	_statusFlags = state.StatusFlags;
 	_state = state.State;
@@ -273,6 +311,8 @@ void PPU::ProcessStatusRegOpenBus(uint8_t &openBusMask, uint8_t &returnValue)
 uint8_t PPU::PeekRAM(uint16_t addr)
 {
 	//Used by debugger to get register values without side-effects (heavily edited copy of ReadRAM)
+	RunPendingSpriteEvaluation();
+
 	uint8_t openBusMask = 0xFF;
 	uint8_t returnValue = 0;
 	switch(GetRegisterID(addr)) {
@@ -322,6 +362,9 @@ uint8_t PPU::PeekRAM(uint16_t addr)
 
 uint8_t PPU::ReadRAM(uint16_t addr)
 {
+	DrawPendingPixels();
+	RunPendingSpriteEvaluation();
+
 	uint8_t openBusMask = 0xFF;
 	uint8_t returnValue = 0;
 	switch(GetRegisterID(addr)) {
@@ -385,6 +428,9 @@ uint8_t PPU::ReadRAM(uint16_t addr)
 
 void PPU::WriteRAM(uint16_t addr, uint8_t value)
 {
+	DrawPendingPixels();
+	RunPendingSpriteEvaluation();
+
 	if(addr != 0x4014) {
 		SetOpenBus(0xFF, value);
 	}
@@ -405,9 +451,11 @@ void PPU::WriteRAM(uint16_t addr, uint8_t value)
 			}
 			break;
 		case PPURegisters::SpriteAddr:
+			_deferredSpriteEvaluation = false;
 			_state.SpriteRamAddr = value;
 			break;
 		case PPURegisters::SpriteData:
+			_deferredSpriteEvaluation = false;
 			if((_scanline >= 240 && (_nesModel != NesModel::PAL || _scanline < _palSpriteEvalScanline)) || !IsRenderingEnabled()) {
 				if((_state.SpriteRamAddr & 0x03) == 0x02) {
 					//"The three unimplemented bits of each sprite's byte 2 do not exist in the PPU and always read back as 0 on PPU revisions that allow reading PPU OAM through OAMDATA ($2004)"
@@ -451,10 +499,10 @@ void PPU::WriteRAM(uint16_t addr, uint8_t value)
 				WritePaletteRAM(_ppuBusAddress, value);
 			} else {
 				if(_scanline >= 240 || !IsRenderingEnabled()) {
-					_console->GetMapper()->WriteVRAM(_ppuBusAddress & 0x3FFF, value);
+					_mapper->WriteVRAM(_ppuBusAddress & 0x3FFF, value);
 				} else {
 					//During rendering, the value written is ignored, and instead the address' LSB is used (not confirmed, based on Visual NES)
-					_console->GetMapper()->WriteVRAM(_ppuBusAddress & 0x3FFF, _ppuBusAddress & 0xFF);
+					_mapper->WriteVRAM(_ppuBusAddress & 0x3FFF, _ppuBusAddress & 0xFF);
 				}
 			}
 			_needStateUpdate = true;
@@ -645,19 +693,19 @@ uint16_t PPU::GetAttributeAddr()
 void PPU::SetBusAddress(uint16_t addr)
 {
 	_ppuBusAddress = addr;
-	_console->GetMapper()->NotifyVRAMAddressChange(addr);
+	_mapper->ProcessVramAddressChange(addr);
 }
 
 uint8_t PPU::ReadVram(uint16_t addr, MemoryOperationType type)
 {
 	SetBusAddress(addr);
-	return _console->GetMapper()->ReadVRAM(addr, type);
+	return _mapper->ReadVRAM(addr, type);
 }
 
 void PPU::WriteVram(uint16_t addr, uint8_t value)
 {
 	SetBusAddress(addr);
-	_console->GetMapper()->WriteVRAM(addr, value);
+	_mapper->WriteVRAM(addr, value);
 }
 
 void PPU::LoadTileInfo()
@@ -665,11 +713,16 @@ void PPU::LoadTileInfo()
 	if(IsRenderingEnabled()) {
 		switch(_cycle & 0x07) {
 			case 1: {
-				_previousTile = _currentTile;
-				_currentTile = _nextTile;
+				if(_scanlineRendering) {
+					//The tile is shifted in when the scanline gets drawn
+					_scanlineTiles[_scanlineTileCount++] = _nextTile;
+				} else {
+					_previousTile = _currentTile;
+					_currentTile = _nextTile;
 
-				_state.LowBitShift |= _nextTile.LowByte;
-				_state.HighBitShift |= _nextTile.HighByte;
+					_state.LowBitShift |= _nextTile.LowByte;
+					_state.HighBitShift |= _nextTile.HighByte;
+				}
 
 				uint8_t tileIndex = ReadVram(GetNameTableAddr());
 				_nextTile.TileAddr = (tileIndex << 4) | (_state.VideoRamAddr >> 12) | _flags.BackgroundPatternAddr;
@@ -685,7 +738,7 @@ void PPU::LoadTileInfo()
 
 			case 5:
 				_nextTile.LowByte = ReadVram(_nextTile.TileAddr);
-				_nextTile.AbsoluteTileAddr = _console->GetMapper()->ToAbsoluteChrAddress(_nextTile.TileAddr);
+				_nextTile.AbsoluteTileAddr = _mapper->ToAbsoluteChrAddress(_nextTile.TileAddr);
 				break;
 
 			case 7:
@@ -724,15 +777,15 @@ void PPU::LoadSprite(uint8_t spriteY, uint8_t tileIndex, uint8_t attributes, uin
 		info.PaletteOffset = ((attributes & 0x03) << 2) | 0x10;
 		if(extraSprite) {
 			//Use DebugReadVRAM for extra sprites to prevent side-effects.
-			info.LowByte = _console->GetMapper()->DebugReadVRAM(tileAddr);
-			info.HighByte = _console->GetMapper()->DebugReadVRAM(tileAddr + 8);
+			info.LowByte = _mapper->DebugReadVRAM(tileAddr);
+			info.HighByte = _mapper->DebugReadVRAM(tileAddr + 8);
 		} else {
 			fetchLastSprite = false;
 			info.LowByte = ReadVram(tileAddr);
 			info.HighByte = ReadVram(tileAddr + 8);
 		}
 		info.TileAddr = tileAddr;
-		info.AbsoluteTileAddr = _console->GetMapper()->ToAbsoluteChrAddress(tileAddr);
+		info.AbsoluteTileAddr = _mapper->ToAbsoluteChrAddress(tileAddr);
 		info.OffsetY = lineOffset;
 		info.SpriteX = spriteX;
 
@@ -813,6 +866,37 @@ void PPU::ShiftTileRegisters()
 	_state.HighBitShift <<= 1;
 }
 
+void PPU::UpdateSpritePixels()
+{
+	//Rasterizes the sprites fetched during the previous scanline, so GetPixelColor doesn't need to look for the sprites covering each pixel
+	//The first sprite (in OAM order) with a non-transparent pixel is the one shown
+	memset(_spritePixels, 0, sizeof(_spritePixels));
+	memset(_spritePixelIndexes, 0xFF, sizeof(_spritePixelIndexes));
+
+	for(uint32_t i = 0; i < _spriteCount; i++) {
+		SpriteInfo &sprite = _spriteTiles[i];
+		uint8_t flags = (sprite.BackgroundPriority ? 0x40 : 0) | (i == 0 ? 0x80 : 0);
+		for(uint32_t shift = 0; shift < 8 && sprite.SpriteX + shift < 256; shift++) {
+			uint32_t cycle = sprite.SpriteX + shift + 1;
+			if(!_hasSprite[cycle] || _spritePixels[cycle]) {
+				continue;
+			}
+
+			uint8_t spriteColor;
+			if(sprite.HorizontalMirror) {
+				spriteColor = ((sprite.LowByte >> shift) & 0x01) | ((sprite.HighByte >> shift) & 0x01) << 1;
+			} else {
+				spriteColor = ((sprite.LowByte << shift) & 0x80) >> 7 | ((sprite.HighByte << shift) & 0x80) >> 6;
+			}
+
+			_spritePixelIndexes[cycle] = (uint8_t)i;
+			if(spriteColor != 0) {
+				_spritePixels[cycle] = (sprite.PaletteOffset + spriteColor) | flags;
+			}
+		}
+	}
+}
+
 uint8_t PPU::GetPixelColor()
 {
 	uint8_t offset = _state.XScroll;
@@ -827,34 +911,25 @@ uint8_t PPU::GetPixelColor()
 		}
 	}
 
-	if(_hasSprite[_cycle] && _cycle > _minimumDrawSpriteCycle) {
+	if(_cycle > _minimumDrawSpriteCycle) {
 		//SpriteMask = true: Hide sprites in leftmost 8 pixels of screen
-		for(uint8_t i = 0; i < _spriteCount; i++) {
-			int32_t shift = (int32_t)_cycle - _spriteTiles[i].SpriteX - 1;
-			if(shift >= 0 && shift < 8) {
-				_lastSprite = &_spriteTiles[i];
-				uint8_t spriteColor;
-				if(_spriteTiles[i].HorizontalMirror) {
-					spriteColor = ((_lastSprite->LowByte >> shift) & 0x01) | ((_lastSprite->HighByte >> shift) & 0x01) << 1;
-				} else {
-					spriteColor = ((_lastSprite->LowByte << shift) & 0x80) >> 7 | ((_lastSprite->HighByte << shift) & 0x80) >> 6;
+		uint8_t spriteIndex = _spritePixelIndexes[_cycle];
+		if(spriteIndex != 0xFF) {
+			_lastSprite = &_spriteTiles[spriteIndex];
+
+			uint8_t spritePixel = _spritePixels[_cycle];
+			if(spritePixel) {
+				if((spritePixel & 0x80) && spriteBgColor != 0 && _sprite0Visible && _cycle != 256 && _flags.BackgroundEnabled && !_statusFlags.Sprite0Hit && _cycle > _minimumDrawSpriteStandardCycle) {
+					//"The hit condition is basically sprite zero is in range AND the first sprite output unit is outputting a non-zero pixel AND the background drawing unit is outputting a non-zero pixel."
+					//"Sprite zero hits do not register at x=255" (cycle 256)
+					//"... provided that background and sprite rendering are both enabled"
+					//"Should always miss when Y >= 239"
+					_statusFlags.Sprite0Hit = true;
 				}
 
-				if(spriteColor != 0) {
-					//First sprite without a 00 color, use it.
-					if(i == 0 && spriteBgColor != 0 && _sprite0Visible && _cycle != 256 && _flags.BackgroundEnabled && !_statusFlags.Sprite0Hit && _cycle > _minimumDrawSpriteStandardCycle) {
-						//"The hit condition is basically sprite zero is in range AND the first sprite output unit is outputting a non-zero pixel AND the background drawing unit is outputting a non-zero pixel."
-						//"Sprite zero hits do not register at x=255" (cycle 256)
-						//"... provided that background and sprite rendering are both enabled"
-						//"Should always miss when Y >= 239"
-						_statusFlags.Sprite0Hit = true;
-					}
-
-					if(_settings->GetSpritesEnabled() && (backgroundColor == 0 || !_spriteTiles[i].BackgroundPriority)) {
-						//Check sprite priority
-						return _lastSprite->PaletteOffset + spriteColor;
-					}
-					break;
+				if(_settings->GetSpritesEnabled() && (backgroundColor == 0 || !(spritePixel & 0x40))) {
+					//Check sprite priority
+					return spritePixel & 0x1F;
 				}
 			}
 		}
@@ -874,6 +949,124 @@ void PPU::DrawPixel()
 	}
 }
 
+void PPU::DrawPendingPixels()
+{
+	//Draws the pixels for the cycles executed since the last call - gives the same result as calling DrawPixel/ShiftTileRegisters
+	//(and shifting in the tiles loaded by LoadTileInfo) on each cycle, as long as rendering stays enabled for the entire scanline
+	uint32_t lastCycle = std::min<uint32_t>(_cycle, 256);
+	if(!_scanlineRendering || lastCycle <= _scanlineDrawnCycle) {
+		return;
+	}
+
+	bool checkSprite0Hit = _sprite0Visible && _flags.BackgroundEnabled && !_statusFlags.Sprite0Hit;
+	if(_skipOutput && !checkSprite0Hit) {
+		//The pixels aren't needed and can't trigger a sprite 0 hit
+		_scanlineDrawnCycle = lastCycle;
+		return;
+	}
+
+	//Decode the background tiles loaded so far: tile 0 is the one in the shift registers' upper byte, the others are the tiles loaded during the scanline
+	if(_scanlineDecodedTiles <= _scanlineTileCount) {
+		uint8_t lowBytes[33], highBytes[33], paletteOffsets[33];
+		uint32_t start = _scanlineDecodedTiles;
+		for(uint32_t i = start; i <= _scanlineTileCount; i++) {
+			if(i == 0) {
+				lowBytes[i] = _state.LowBitShift >> 8;
+				highBytes[i] = _state.HighBitShift >> 8;
+				paletteOffsets[i] = _currentTile.PaletteOffset;
+			} else {
+				lowBytes[i] = _scanlineTiles[i - 1].LowByte;
+				highBytes[i] = _scanlineTiles[i - 1].HighByte;
+				paletteOffsets[i] = _scanlineTiles[i - 1].PaletteOffset;
+				if(i == 1) {
+					lowBytes[i] |= _state.LowBitShift & 0xFF;
+					highBytes[i] |= _state.HighBitShift & 0xFF;
+				}
+			}
+		}
+		TileDecoder::DecodeRows(lowBytes + start, highBytes + start, paletteOffsets + start, _scanlineTileCount + 1 - start, _scanlineBackground + start * 8);
+		_scanlineDecodedTiles = _scanlineTileCount + 1;
+	}
+
+	//The scroll, mask and palette can only change between 2 calls, so they are constant for the pixels drawn here
+	uint8_t* bgPixels = _scanlineBackground + _state.XScroll;
+	if(_skipOutput) {
+		//Only check the pixels covered by sprite 0 for a sprite 0 hit
+		uint32_t spriteX = _spriteTiles[0].SpriteX;
+		uint32_t firstCycle = std::max(_scanlineDrawnCycle + 1, spriteX + 1);
+		uint32_t endCycle = std::min(lastCycle, spriteX + 8);
+		for(uint32_t cycle = firstCycle; cycle <= endCycle; cycle++) {
+			if((_spritePixels[cycle] & 0x80) && cycle > _minimumDrawSpriteCycle && cycle > _minimumDrawBgCycle && (bgPixels[cycle - 1] & 0x03) && cycle != 256 && cycle > _minimumDrawSpriteStandardCycle) {
+				_statusFlags.Sprite0Hit = true;
+				break;
+			}
+		}
+		_scanlineDrawnCycle = lastCycle;
+		return;
+	}
+
+	bool backgroundEnabled = _settings->GetBackgroundEnabled();
+	bool spritesEnabled = _settings->GetSpritesEnabled();
+	uint16_t* out = _currentOutputBuffer + (_scanline << 8);
+
+	for(uint32_t cycle = _scanlineDrawnCycle + 1; cycle <= lastCycle; cycle++) {
+		uint8_t bgPixel = bgPixels[cycle - 1];
+		uint8_t spriteBgColor = cycle > _minimumDrawBgCycle ? (bgPixel & 0x03) : 0;
+		uint8_t backgroundColor = backgroundEnabled ? spriteBgColor : 0;
+		uint8_t color = (bgPixel & 0x0C) | backgroundColor;
+
+		uint8_t spritePixel = _spritePixels[cycle];
+		if(spritePixel && cycle > _minimumDrawSpriteCycle) {
+			if((spritePixel & 0x80) && spriteBgColor != 0 && checkSprite0Hit && cycle != 256 && cycle > _minimumDrawSpriteStandardCycle) {
+				_statusFlags.Sprite0Hit = true;
+				checkSprite0Hit = false;
+			}
+
+			if(spritesEnabled && (backgroundColor == 0 || !(spritePixel & 0x40))) {
+				color = spritePixel & 0x1F;
+			}
+		}
+
+		out[cycle - 1] = _paletteRAM[color & 0x03 ? color : 0];
+	}
+	_scanlineDrawnCycle = lastCycle;
+}
+
+void PPU::FinishScanlineRendering()
+{
+	//Draws the remaining pixels and puts the tile registers in the state the cycle-based renderer would have left them in,
+	//then switches back to the cycle-based renderer until the next scanline
+	if(!_scanlineRendering) {
+		return;
+	}
+
+	DrawPendingPixels();
+	_scanlineRendering = false;
+
+	uint32_t cycle = _scanlineDrawnCycle;
+	if(cycle > 0) {
+		//The last tile was loaded at cycle 1 of the current 8-cycle group, the registers have been shifted once per cycle since then
+		uint32_t tileIndex = (cycle - 1) >> 3;
+		uint32_t shift = ((cycle - 1) & 0x07) + 1;
+		TileInfo &tile = _scanlineTiles[tileIndex];
+
+		uint16_t lowBits, highBits;
+		if(tileIndex == 0) {
+			lowBits = _state.LowBitShift | tile.LowByte;
+			highBits = _state.HighBitShift | tile.HighByte;
+			_previousTile = _currentTile;
+		} else {
+			TileInfo &previousTile = _scanlineTiles[tileIndex - 1];
+			lowBits = (previousTile.LowByte << 8) | tile.LowByte;
+			highBits = (previousTile.HighByte << 8) | tile.HighByte;
+			_previousTile = previousTile;
+		}
+		_currentTile = tile;
+		_state.LowBitShift = lowBits << shift;
+		_state.HighBitShift = highBits << shift;
+	}
+}
+
 uint16_t PPU::GetCurrentBgColor()
 {
 	uint16_t color;
@@ -911,17 +1104,49 @@ void PPU::UpdateGrayscaleAndIntensifyBits()
 	}
 
 	if(_lastUpdatedPixel < pixelNumber) {
-		uint16_t *out = _currentOutputBuffer + _lastUpdatedPixel + 1;
-		while(_lastUpdatedPixel < pixelNumber) {
-			*out = (*out & _paletteRamMask) | _intensifyColorBits;
-			out++;
-			_lastUpdatedPixel++;
+		if(_colorMaskChangeCount == PPU::MaxColorMaskChanges) {
+			ApplyColorMaskChanges();
+		}
+		_colorMaskChanges[_colorMaskChangeCount++] = { _lastUpdatedPixel + 1, pixelNumber, _paletteRamMask, _intensifyColorBits };
+		_lastUpdatedPixel = pixelNumber;
+
+		if(_scanline >= 240) {
+			//The frame has already been sent, update the buffer right away
+			ApplyColorMaskChanges();
 		}
 	}
 
 	UpdateColorBitMasks();
 }
 
+void PPU::ApplyColorMaskChanges()
+{
+	if(_skipOutput) {
+		_colorMaskChangeCount = 0;
+		return;
+	}
+
+	for(uint32_t i = 0; i < _colorMaskChangeCount; i++) {
+		ColorMaskChange &change = _colorMaskChanges[i];
+		uint16_t *out = _currentOutputBuffer + change.FirstPixel;
+		uint16_t *end = _currentOutputBuffer + change.LastPixel + 1;
+
+#ifdef PPU_SSE2
+		const __m128i mask = _mm_set1_epi16((int16_t)change.Mask);
+		const __m128i bits = _mm_set1_epi16((int16_t)change.Bits);
+		for(; out + 8 <= end; out += 8) {
+			__m128i pixels = _mm_loadu_si128((__m128i*)out);
+			_mm_storeu_si128((__m128i*)out, _mm_or_si128(_mm_and_si128(pixels, mask), bits));
+		}
+#endif
+
+		for(; out < end; out++) {
+			*out = (*out & change.Mask) | change.Bits;
+		}
+	}
+	_colorMaskChangeCount = 0;
+}
+
 void PPU::ProcessScanline()
 {
 	//Only called for cycle 1+
@@ -936,8 +1161,14 @@ void PPU::ProcessScanline()
 		}
 
 		if(_scanline >= 0) {
-			DrawPixel();
-			ShiftTileRegisters();
+			if(!_scanlineRendering) {
+				if(!_skipOutput || IsRenderingEnabled()) {
+					DrawPixel();
+				}
+				ShiftTileRegisters();
+			} else if(_cycle == 256) {
+				FinishScanlineRendering();
+			}
 
 			//"Secondary OAM clear and sprite evaluation do not occur on the pre-render line"
 			ProcessSpriteEvaluation();
@@ -1016,108 +1247,199 @@ void PPU::ProcessSpriteEvaluation()
 			_secondarySpriteRAM[(_cycle - 1) >> 1] = 0xFF;
 		} else {
 			if(_cycle == 65) {
-				_sprite0Added = false;
-				_spriteInRange = false;
-				_secondaryOAMAddr = 0;
-				
-				_overflowBugCounter = 0;
-
-				_oamCopyDone = false;
-				_spriteAddrH = (_state.SpriteRamAddr >> 2) & 0x3F;
-				_spriteAddrL = _state.SpriteRamAddr & 0x03;
-
-				_firstVisibleSpriteAddr = _spriteAddrH * 4;
-				_lastVisibleSpriteAddr = _firstVisibleSpriteAddr;
+				//The evaluation's state can only be seen or altered through register accesses (and OAM decay), so when it starts
+				//at the beginning of OAM, it can be run in batches - any $2003/$2004 write switches back to the cycle-based evaluation
+				_deferredSpriteEvaluation = !_enableOamDecay && _state.SpriteRamAddr == 0 && _scanline >= 0 && _scanline < 240 && IsRenderingEnabled();
+				_spriteEvaluationCycle = 64;
+			}
+
+			if(!_deferredSpriteEvaluation) {
+				ProcessSpriteEvaluationCycle(_cycle);
 			} else if(_cycle == 256) {
-				_sprite0Visible = _sprite0Added;
-				_spriteCount = (_secondaryOAMAddr >> 2);
+				RunPendingSpriteEvaluation();
+				_deferredSpriteEvaluation = false;
 			}
+		}
+	}
+}
 
-			if(_cycle & 0x01) {
-				//Read a byte from the primary OAM on odd cycles
-				_oamCopybuffer = ReadSpriteRam(_state.SpriteRamAddr);
-			} else {
-				if(_oamCopyDone) {
-					_spriteAddrH = (_spriteAddrH + 1) & 0x3F;
-					if(_secondaryOAMAddr >= 0x20) {
-						//"As seen above, a side effect of the OAM write disable signal is to turn writes to the secondary OAM into reads from it."
-						_oamCopybuffer = _secondarySpriteRAM[_secondaryOAMAddr & 0x1F];
+void PPU::RunPendingSpriteEvaluation()
+{
+	if(!_deferredSpriteEvaluation) {
+		return;
+	}
+
+	if(_spritesOnScanlineDirty || _spritesOnScanlineLarge != _flags.LargeSprites) {
+		UpdateSpritesOnScanline();
+	}
+	uint64_t spritesInRange = _spritesOnScanline[_scanline];
+
+	//Pairs of read/write cycles can be skipped in bulk, except for the last pair (255-256)
+	uint16_t lastCycle = std::min<uint16_t>(_cycle, 256);
+	uint16_t lastSkippedCycle = std::min<uint16_t>(lastCycle, 254);
+
+	uint16_t cycle = _spriteEvaluationCycle + 1;
+	while(cycle <= lastCycle) {
+		uint32_t pairCount = ((cycle & 0x01) && cycle > 65 && cycle < lastSkippedCycle) ? (lastSkippedCycle + 1 - cycle) >> 1 : 0;
+
+		if(pairCount > 0 && !_oamCopyDone && _secondaryOAMAddr < 0x20 && !_spriteInRange && _spriteAddrL == 0) {
+			//Looking for the next sprite in range - skip over the sprites that aren't
+			uint32_t skipCount = 0;
+			uint64_t sprites = spritesInRange >> _spriteAddrH;
+			while(skipCount < pairCount && _spriteAddrH + skipCount < 64 && !(sprites & 0x01)) {
+				sprites >>= 1;
+				skipCount++;
+			}
+
+			if(skipCount > 0) {
+				//The Y value of the last sprite that was checked is written to the current secondary OAM slot
+				_oamCopybuffer = _spriteRAM[(_spriteAddrH + skipCount - 1) << 2];
+				_secondarySpriteRAM[_secondaryOAMAddr] = _oamCopybuffer;
+				_spriteAddrH = (_spriteAddrH + skipCount) & 0x3F;
+				if(_spriteAddrH == 0) {
+					_oamCopyDone = true;
+				}
+				_state.SpriteRamAddr = _spriteAddrH << 2;
+				cycle += skipCount * 2;
+				continue;
+			}
+		} else if(pairCount > 0 && _oamCopyDone) {
+			//Evaluation is done, the address keeps being incremented until cycle 256
+			uint8_t lastReadAddr = (_spriteAddrL & 0x03) | (((_spriteAddrH + pairCount - 1) & 0x3F) << 2);
+			_spriteAddrH = (_spriteAddrH + pairCount) & 0x3F;
+			_oamCopybuffer = _secondaryOAMAddr >= 0x20 ? _secondarySpriteRAM[_secondaryOAMAddr & 0x1F] : _spriteRAM[lastReadAddr];
+			_state.SpriteRamAddr = (_spriteAddrL & 0x03) | (_spriteAddrH << 2);
+			cycle += pairCount * 2;
+			continue;
+		}
+
+		ProcessSpriteEvaluationCycle(cycle);
+		cycle++;
+	}
+
+	_spriteEvaluationCycle = lastCycle;
+}
+
+void PPU::UpdateSpritesOnScanline()
+{
+	memset(_spritesOnScanline, 0, sizeof(_spritesOnScanline));
+
+	uint32_t height = _flags.LargeSprites ? 16 : 8;
+	for(int i = 0; i < 64; i++) {
+		uint32_t spriteY = _spriteRAM[i << 2];
+		uint32_t lastScanline = std::min<uint32_t>(spriteY + height, 240);
+		for(uint32_t scanline = spriteY; scanline < lastScanline; scanline++) {
+			_spritesOnScanline[scanline] |= (uint64_t)1 << i;
+		}
+	}
+
+	_spritesOnScanlineLarge = _flags.LargeSprites;
+	_spritesOnScanlineDirty = false;
+}
+
+void PPU::ProcessSpriteEvaluationCycle(uint16_t cycle)
+{
+	if(cycle == 65) {
+		_sprite0Added = false;
+		_spriteInRange = false;
+		_secondaryOAMAddr = 0;
+		
+		_overflowBugCounter = 0;
+
+		_oamCopyDone = false;
+		_spriteAddrH = (_state.SpriteRamAddr >> 2) & 0x3F;
+		_spriteAddrL = _state.SpriteRamAddr & 0x03;
+
+		_firstVisibleSpriteAddr = _spriteAddrH * 4;
+		_lastVisibleSpriteAddr = _firstVisibleSpriteAddr;
+	} else if(cycle == 256) {
+		_sprite0Visible = _sprite0Added;
+		_spriteCount = (_secondaryOAMAddr >> 2);
+	}
+
+	if(cycle & 0x01) {
+		//Read a byte from the primary OAM on odd cycles
+		_oamCopybuffer = ReadSpriteRam(_state.SpriteRamAddr);
+	} else {
+		if(_oamCopyDone) {
+			_spriteAddrH = (_spriteAddrH + 1) & 0x3F;
+			if(_secondaryOAMAddr >= 0x20) {
+				//"As seen above, a side effect of the OAM write disable signal is to turn writes to the secondary OAM into reads from it."
+				_oamCopybuffer = _secondarySpriteRAM[_secondaryOAMAddr & 0x1F];
+			}
+		} else {
+			if(!_spriteInRange && _scanline >= _oamCopybuffer && _scanline < _oamCopybuffer + (_flags.LargeSprites ? 16 : 8)) {
+				_spriteInRange = true;
+			}
+
+			if(_secondaryOAMAddr < 0x20) {
+				//Copy 1 byte to secondary OAM
+				_secondarySpriteRAM[_secondaryOAMAddr] = _oamCopybuffer;
+
+				if(_spriteInRange) {
+					_spriteAddrL++;
+					_secondaryOAMAddr++;
+
+					if(_spriteAddrH == 0) {
+						_sprite0Added = true;
+					}
+
+					//Note: Using "(_secondaryOAMAddr & 0x03) == 0" instead of "_spriteAddrL == 0" is required
+					//to replicate a hardware bug noticed in oam_flicker_test_reenable when disabling & re-enabling
+					//rendering on a single scanline
+					if((_secondaryOAMAddr & 0x03) == 0) {
+						//Done copying all 4 bytes
+						_spriteInRange = false;
+						_spriteAddrL = 0;
+						_lastVisibleSpriteAddr = _spriteAddrH * 4;
+						_spriteAddrH = (_spriteAddrH + 1) & 0x3F;
+						if(_spriteAddrH == 0) {
+							_oamCopyDone = true;
+						}
 					}
 				} else {
-					if(!_spriteInRange && _scanline >= _oamCopybuffer && _scanline < _oamCopybuffer + (_flags.LargeSprites ? 16 : 8)) {
-						_spriteInRange = true;
+					//Nothing to copy, skip to next sprite
+					_spriteAddrH = (_spriteAddrH + 1) & 0x3F;
+					if(_spriteAddrH == 0) {
+						_oamCopyDone = true;
+					}
+				}
+			} else {
+				//"As seen above, a side effect of the OAM write disable signal is to turn writes to the secondary OAM into reads from it."
+				_oamCopybuffer = _secondarySpriteRAM[_secondaryOAMAddr & 0x1F];
+
+				//8 sprites have been found, check next sprite for overflow + emulate PPU bug
+				if(_spriteInRange) {
+					//Sprite is visible, consider this to be an overflow
+					_statusFlags.SpriteOverflow = true;
+					_spriteAddrL = (_spriteAddrL + 1);
+					if(_spriteAddrL == 4) {
+						_spriteAddrH = (_spriteAddrH + 1) & 0x3F;
+						_spriteAddrL = 0;
 					}
 
-					if(_secondaryOAMAddr < 0x20) {
-						//Copy 1 byte to secondary OAM
-						_secondarySpriteRAM[_secondaryOAMAddr] = _oamCopybuffer;
-
-						if(_spriteInRange) {
-							_spriteAddrL++;
-							_secondaryOAMAddr++;
-
-							if(_spriteAddrH == 0) {
-								_sprite0Added = true;
-							}
-
-							//Note: Using "(_secondaryOAMAddr & 0x03) == 0" instead of "_spriteAddrL == 0" is required
-							//to replicate a hardware bug noticed in oam_flicker_test_reenable when disabling & re-enabling
-							//rendering on a single scanline
-							if((_secondaryOAMAddr & 0x03) == 0) {
-								//Done copying all 4 bytes
-								_spriteInRange = false;
-								_spriteAddrL = 0;
-								_lastVisibleSpriteAddr = _spriteAddrH * 4;
-								_spriteAddrH = (_spriteAddrH + 1) & 0x3F;
-								if(_spriteAddrH == 0) {
-									_oamCopyDone = true;
-								}
-							}
-						} else {
-							//Nothing to copy, skip to next sprite
-							_spriteAddrH = (_spriteAddrH + 1) & 0x3F;
-							if(_spriteAddrH == 0) {
-								_oamCopyDone = true;
-							}
-						}
-					} else {
-						//"As seen above, a side effect of the OAM write disable signal is to turn writes to the secondary OAM into reads from it."
-						_oamCopybuffer = _secondarySpriteRAM[_secondaryOAMAddr & 0x1F];
-
-						//8 sprites have been found, check next sprite for overflow + emulate PPU bug
-						if(_spriteInRange) {
-							//Sprite is visible, consider this to be an overflow
-							_statusFlags.SpriteOverflow = true;
-							_spriteAddrL = (_spriteAddrL + 1);
-							if(_spriteAddrL == 4) {
-								_spriteAddrH = (_spriteAddrH + 1) & 0x3F;
-								_spriteAddrL = 0;
-							}
-
-							if(_overflowBugCounter == 0) {
-								_overflowBugCounter = 3;
-							} else if(_overflowBugCounter > 0) {
-								_overflowBugCounter--;
-								if(_overflowBugCounter == 0) {
-									//"After it finishes "fetching" this sprite(and setting the overflow flag), it realigns back at the beginning of this line and then continues here on the next sprite"
-									_oamCopyDone = true;
-									_spriteAddrL = 0;
-								}
-							}
-						} else {
-							//Sprite isn't on this scanline, trigger sprite evaluation bug - increment both H & L at the same time
-							_spriteAddrH = (_spriteAddrH + 1) & 0x3F;
-							_spriteAddrL = (_spriteAddrL + 1) & 0x03;
-
-							if(_spriteAddrH == 0) {
-								_oamCopyDone = true;
-							}
+					if(_overflowBugCounter == 0) {
+						_overflowBugCounter = 3;
+					} else if(_overflowBugCounter > 0) {
+						_overflowBugCounter--;
+						if(_overflowBugCounter == 0) {
+							//"After it finishes "fetching" this sprite(and setting the overflow flag), it realigns back at the beginning of this line and then continues here on the next sprite"
+							_oamCopyDone = true;
+							_spriteAddrL = 0;
 						}
 					}
+				} else {
+					//Sprite isn't on this scanline, trigger sprite evaluation bug - increment both H & L at the same time
+					_spriteAddrH = (_spriteAddrH + 1) & 0x3F;
+					_spriteAddrL = (_spriteAddrL + 1) & 0x03;
+
+					if(_spriteAddrH == 0) {
+						_oamCopyDone = true;
+					}
 				}
-				_state.SpriteRamAddr = (_spriteAddrL & 0x03) | (_spriteAddrH << 2);
 			}
 		}
+		_state.SpriteRamAddr = (_spriteAddrL & 0x03) | (_spriteAddrH << 2);
 	}
 }
 
@@ -1144,6 +1466,7 @@ uint8_t PPU::ReadSpriteRam(uint8_t addr)
 void PPU::WriteSpriteRam(uint8_t addr, uint8_t value)
 {
 	_spriteRAM[addr] = value;
+	_spritesOnScanlineDirty = true;
 	if(_enableOamDecay) {
 		_oamDecayCycles[addr >> 3] = _console->GetCpu()->GetCycleCount();
 	}
@@ -1154,9 +1477,34 @@ uint16_t* PPU::GetScreenBuffer(bool previousBuffer)
 	return previousBuffer ? ((_currentOutputBuffer == _outputBuffers[0]) ? _outputBuffers[1] : _outputBuffers[0]) : _currentOutputBuffer;
 }
 
+void PPU::UpdateRowChangedFlag(int32_t row)
+{
+	if(_skipOutput || _previousOutputSkipped) {
+		//The previous frame's buffer doesn't contain that frame's picture
+		_rowChanged[row] = 1;
+		return;
+	}
+
+	uint32_t offset = row * PPU::ScreenWidth;
+	uint16_t* previousBuffer = GetScreenBuffer(true);
+	_rowChanged[row] = memcmp(_currentOutputBuffer + offset, previousBuffer + offset, PPU::ScreenWidth * sizeof(uint16_t)) != 0;
+}
+
+uint8_t* PPU::GetChangedRows()
+{
+	return _rowChanged;
+}
+
 void PPU::SendFrame()
 {
 	UpdateGrayscaleAndIntensifyBits();
+	ApplyColorMaskChanges();
+	UpdateRowChangedFlag(PPU::ScreenHeight - 1);
+
+	if(_skipOutput) {
+		_console->GetVideoRenderer()->DupeFrame();
+		return;
+	}
 
 	_console->GetVideoDecoder()->UpdateFrameSync(_currentOutputBuffer);
 #if 0
@@ -1193,6 +1541,9 @@ void PPU::UpdateApuStatus()
 
 void PPU::DebugUpdateFrameBuffer(bool toGrayscale)
 {
+	FinishScanlineRendering();
+	ApplyColorMaskChanges();
+
 	//Clear output buffer for "Draw partial frame" feature
 	if(toGrayscale) {
 		for(int i = 0; i < PPU::PixelCount; i++) {
@@ -1240,6 +1591,7 @@ void PPU::ProcessOamCorruption()
 		if(_corruptOamRow[i]) {
 			if(i > 0) {
 				memcpy(_spriteRAM + i * 8, _spriteRAM, 8);
+				_spritesOnScanlineDirty = true;
 			}
 			_corruptOamRow[i] = false;
 		}
@@ -1312,12 +1664,43 @@ void PPU::ProcessScanlineFirstCycle()
 
 			//Switch to alternate output buffer (VideoDecoder may still be decoding the last frame buffer)
 			_currentOutputBuffer = (_currentOutputBuffer == _outputBuffers[0]) ? _outputBuffers[1] : _outputBuffers[0];
-		} else if(_prevRenderingEnabled) {
-			if(_scanline > 0 || (!(_frameCount & 0x01) || _nesModel != NesModel::NTSC || _settings->GetPpuModel() != PpuModel::Ppu2C02)) {
+
+			_useScanlineRenderer = _scanlineRendererSupported && _settings->CheckFlag(EmulationFlags::UseScanlineRenderer);
+
+			//Frames the frontend doesn't need are not drawn (light guns need the picture to detect light, though)
+			uint32_t outputInterval = _settings->GetPpuOutputInterval();
+			_previousOutputSkipped = _skipOutput;
+			_skipOutput = _scanlineRendererSupported && (
+				_console->GetVideoRenderer()->IsSkipMode() || outputInterval == 0 || (outputInterval > 1 && (_frameCount % outputInterval) != 0)
+			) && !_console->GetControlManager()->HasLightGun();
+
+			//When no video filter is active, scanlines are sent to the frontend's framebuffer as they are completed
+			_directOutput = !_skipOutput && _console->GetVideoDecoder()->StartDirectOutput();
+		} else {
+			if(_scanline > 0) {
+				//Apply any pending grayscale/emphasis changes to the previous scanline before it gets compared/converted
+				UpdateGrayscaleAndIntensifyBits();
+				ApplyColorMaskChanges();
+				UpdateRowChangedFlag(_scanline - 1);
+				if(_directOutput) {
+					_console->GetVideoDecoder()->DecodeScanline(_currentOutputBuffer, _scanline - 1);
+				}
+			}
+
+			if(_prevRenderingEnabled && (_scanline > 0 || (!(_frameCount & 0x01) || _nesModel != NesModel::NTSC || _settings->GetPpuModel() != PpuModel::Ppu2C02))) {
 				//Set bus address to the tile address calculated from the unused NT fetches at the end of the previous scanline
 				//This doesn't happen on scanline 0 if the last dot of the previous frame was skipped
 				SetBusAddress((_nextTile.TileAddr << 4) | (_state.VideoRamAddr >> 12) | _flags.BackgroundPatternAddr);
 			}
+
+			UpdateSpritePixels();
+
+			//Use the scanline renderer if rendering is enabled - register accesses draw the pending pixels first, and
+			//enabling/disabling rendering switches back to the cycle-based renderer for the rest of the scanline
+			_scanlineRendering = (_useScanlineRenderer || _skipOutput) && _renderingEnabled && _prevRenderingEnabled;
+			_scanlineTileCount = 0;
+			_scanlineDrawnCycle = 0;
+			_scanlineDecodedTiles = 0;
 		}
 	} else if(_scanline == 240) {
 		//At the start of vblank, the bus address is set back to VideoRamAddr.
@@ -1330,6 +1713,12 @@ void PPU::ProcessScanlineFirstCycle()
 
 void PPU::UpdateState()
 {
+	if(_prevRenderingEnabled != _renderingEnabled || _renderingEnabled != (_flags.BackgroundEnabled | _flags.SpritesEnabled)) {
+		//The scanline renderer and the deferred sprite evaluation can't handle rendering being enabled/disabled mid-scanline
+		FinishScanlineRendering();
+		RunPendingSpriteEvaluation();
+		_deferredSpriteEvaluation = false;
+	}
 	_needStateUpdate = false;
 
 	//Rendering enabled flag is apparently set with a 1 cycle delay (i.e setting it at cycle 5 will render cycle 6 like cycle 5 and then take the new settings for cycle 7)
@@ -1418,7 +1807,8 @@ void PPU::UpdateState()
 
 uint8_t* PPU::GetSpriteRam()
 {
-	//Used by debugger
+	//Used by debugger (which can also edit OAM)
+	_spritesOnScanlineDirty = true;
 	if(_enableOamDecay) {
 		for(int i = 0; i < 0x100; i++) {
 			//Apply OAM decay to sprite RAM before letting debugger access it
@@ -1432,6 +1822,9 @@ uint8_t* PPU::GetSpriteRam()
 
 uint32_t PPU::GetPixelBrightness(uint8_t x, uint8_t y)
 {
+	DrawPendingPixels();
+	ApplyColorMaskChanges();
+
 	//Used by Zapper, gives a rough approximation of the brightness level of the specific pixel
 	uint16_t pixelData = (_currentOutputBuffer[y << 8 | x] & _paletteRamMask) | _intensifyColorBits;
 	uint32_t argbColor = _settings->GetRgbPalette()[pixelData & 0x3F];
@@ -1440,6 +1833,12 @@ uint32_t PPU::GetPixelBrightness(uint8_t x, uint8_t y)
 
 void PPU::StreamState(bool saving)
 {
+	FinishScanlineRendering();
+	ApplyColorMaskChanges();
+	RunPendingSpriteEvaluation();
+	_deferredSpriteEvaluation = false;
+	_spritesOnScanlineDirty = true;
+
 	ArrayInfo<uint8_t> paletteRam = { _paletteRAM, 0x20 };
 	ArrayInfo<uint8_t> spriteRam = { _spriteRAM, 0x100 };
 	ArrayInfo<uint8_t> secondarySpriteRam = { _secondarySpriteRAM, 0x20 };
@@ -1484,13 +1883,18 @@ void PPU::StreamState(bool saving)
 		}
 
 		memset(_corruptOamRow, 0, sizeof(_corruptOamRow));
+		_spritesOnScanlineDirty = true;
 
 		for(int i = 0; i < 257; i++) {
 			_hasSprite[i] = true;
 		}
+		UpdateSpritePixels();
 
 		_lastUpdatedPixel = -1;
 
+		//The output buffers are not part of save states, so their rows can't be compared after loading one
+		memset(_rowChanged, 1, sizeof(_rowChanged));
+
 		UpdateApuStatus();
 	}
 }
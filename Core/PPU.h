@@ -26,11 +26,21 @@ enum PPURegisters
 	SpriteDMA = 0x4014,
 };
 
+//Range of pixels that were drawn while grayscale and/or color emphasis was enabled
+struct ColorMaskChange
+{
+	int32_t FirstPixel;
+	int32_t LastPixel;
+	uint16_t Mask;
+	uint16_t Bits;
+};
+
 class PPU : public IMemoryHandler, public Snapshotable
 {
 	protected:
 		std::shared_ptr<Console> _console;
 		EmulationSettings* _settings;
+		BaseMapper* _mapper;
 
 		PPUState _state;
 		int32_t _scanline;
@@ -46,8 +56,31 @@ class PPU : public IMemoryHandler, public Snapshotable
 		uint8_t _secondarySpriteRAM[0x20];
 		bool _hasSprite[257];
 
+		//Sprites fetched for the current scanline, indexed by cycle: palette offset + color (0 = transparent), 0x40 = behind background, 0x80 = sprite 0
+		uint8_t _spritePixels[257];
+		//Index of the sprite shown at each cycle (or of the last transparent one covering it), 0xFF when there is none
+		uint8_t _spritePixelIndexes[257];
+
 		uint16_t *_currentOutputBuffer;
 		uint16_t *_outputBuffers[2];
+		bool _directOutput;
+
+		//Set for each row whose content differs from the same row in the previous frame's buffer
+		uint8_t _rowChanged[240];
+
+		//Scanline renderer: pixels are drawn in batches (at cycle 256, or when a register access could affect them) instead of one per cycle
+		bool _scanlineRendererSupported;
+		bool _useScanlineRenderer;
+		bool _scanlineRendering;
+		TileInfo _scanlineTiles[32];
+		uint32_t _scanlineTileCount;
+		uint32_t _scanlineDrawnCycle;
+		uint8_t _scanlineBackground[33 * 8];
+		uint32_t _scanlineDecodedTiles;
+
+		//Output skipping: the frame's pixels aren't drawn, only sprite 0 hits are checked (uses the scanline renderer's deferred drawing)
+		bool _skipOutput;
+		bool _previousOutputSkipped;
 
 		NesModel _nesModel;
 		uint16_t _standardVblankEnd;
@@ -65,6 +98,11 @@ class PPU : public IMemoryHandler, public Snapshotable
 		uint8_t _paletteRamMask;
 		int32_t _lastUpdatedPixel;
 
+		//Grayscale/emphasis changes are recorded on $2001 writes and applied to the output buffer once the scanline is done
+		static constexpr uint32_t MaxColorMaskChanges = 16;
+		ColorMaskChange _colorMaskChanges[MaxColorMaskChanges];
+		uint32_t _colorMaskChangeCount;
+
 		SpriteInfo *_lastSprite; //used by HD ppu
 
 		uint16_t _ppuBusAddress;
@@ -93,6 +131,15 @@ class PPU : public IMemoryHandler, public Snapshotable
 		bool _oamCopyDone;
 		uint8_t _overflowBugCounter;
 
+		//Sprite evaluation is run in batches (on register accesses and at cycle 256) when nothing else can affect it mid-scanline
+		bool _deferredSpriteEvaluation;
+		uint16_t _spriteEvaluationCycle;
+
+		//1 bit per sprite that is in range of each scanline, rebuilt when OAM or the sprite size changes
+		uint64_t _spritesOnScanline[240];
+		bool _spritesOnScanlineDirty;
+		bool _spritesOnScanlineLarge;
+
 		bool _needStateUpdate;
 		bool _renderingEnabled;
 		bool _prevRenderingEnabled;
@@ -132,6 +179,9 @@ class PPU : public IMemoryHandler, public Snapshotable
 		void ProcessScanlineFirstCycle(); 
 		__forceinline void ProcessScanline();
 		__forceinline void ProcessSpriteEvaluation();
+		void ProcessSpriteEvaluationCycle(uint16_t cycle);
+		void RunPendingSpriteEvaluation();
+		void UpdateSpritesOnScanline();
 
 		void BeginVBlank();
 		void TriggerNmi();
@@ -150,9 +200,14 @@ class PPU : public IMemoryHandler, public Snapshotable
 
 		void UpdateMinimumDrawCycles();
 
+		void UpdateSpritePixels();
 		uint8_t GetPixelColor();
 		__forceinline virtual void DrawPixel();
+		void DrawPendingPixels();
+		void FinishScanlineRendering();
 		void UpdateGrayscaleAndIntensifyBits();
+		void ApplyColorMaskChanges();
+		void UpdateRowChangedFlag(int32_t row);
 		void UpdateColorBitMasks();
 		virtual void SendFrame();
 
@@ -184,9 +239,12 @@ class PPU : public IMemoryHandler, public Snapshotable
 		PPU(std::shared_ptr<Console> console);
 		virtual ~PPU();
 
+		//Restores the state the PPU has after being constructed (used when power cycling)
+		void PowerOn();
 		void Reset();
 
 		uint16_t* GetScreenBuffer(bool previousBuffer);
+		uint8_t* GetChangedRows();
 		void DebugUpdateFrameBuffer(bool toGrayscale);
 		void GetState(PPUDebugState &state);
 		void SetState(PPUDebugState &state);
@@ -0,0 +1,174 @@
+#include "stdafx.h"
+#include "PalettedVideoOutput.h"
+#include "Console.h"
+#include "PPU.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define PALETTED_OUTPUT_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define PALETTED_OUTPUT_NEON
+#endif
+
+PalettedVideoOutput::PalettedVideoOutput(std::shared_ptr<Console> console)
+{
+	_console = console;
+
+	//Allocated once for the largest possible frame, so the pointer given to the frontend stays valid
+	_buffer = new uint8_t[MaxBufferSize];
+	memset(_buffer, 0, MaxBufferSize);
+}
+
+PalettedVideoOutput::~PalettedVideoOutput()
+{
+	delete[] _buffer;
+}
+
+uint16_t PalettedVideoOutput::GetPixelMask()
+{
+	switch(_format) {
+		case PalettedOutputFormat::Index: return 0x3F;
+		case PalettedOutputFormat::Grayscale: return 0x30; //Same as the PPU's grayscale bit: keeps the brightness bits, so every color maps to the gray column
+		default: return 0x1FF;
+	}
+}
+
+#if defined(PALETTED_OUTPUT_SSE2)
+static __forceinline __m128i PackEvenWords(__m128i a, __m128i b)
+{
+	//Keeps words 0, 2, 4 and 6 of each input (values are at most 0x1FF, so the signed saturation never applies)
+	const __m128i lowWord = _mm_set1_epi32(0xFFFF);
+	return _mm_packs_epi32(_mm_and_si128(a, lowWord), _mm_and_si128(b, lowWord));
+}
+
+static __forceinline __m128i LoadPixels(uint16_t* in, uint32_t step)
+{
+	__m128i* src = (__m128i*)in;
+	switch(step) {
+		default: return _mm_loadu_si128(src);
+		case 2: return PackEvenWords(_mm_loadu_si128(src), _mm_loadu_si128(src + 1));
+		case 4: return PackEvenWords(
+			PackEvenWords(_mm_loadu_si128(src), _mm_loadu_si128(src + 1)),
+			PackEvenWords(_mm_loadu_si128(src + 2), _mm_loadu_si128(src + 3))
+		);
+	}
+}
+#elif defined(PALETTED_OUTPUT_NEON)
+static __forceinline uint16x8_t LoadPixels(uint16_t* in, uint32_t step)
+{
+	switch(step) {
+		default: return vld1q_u16(in);
+		case 2: return vld2q_u16(in).val[0];
+		case 4: return vld4q_u16(in).val[0];
+	}
+}
+#endif
+
+void PalettedVideoOutput::ConvertRow(uint16_t* in, uint8_t* out, uint32_t width, uint32_t step)
+{
+	//Cropping (in/width), downscaling (step) and the format's mask are all done in the same pass
+	uint16_t pixelMask = GetPixelMask();
+	bool wordOutput = _format == PalettedOutputFormat::Raw;
+	uint16_t* out16 = (uint16_t*)out;
+
+	uint32_t i = 0;
+	#if defined(PALETTED_OUTPUT_SSE2)
+		const __m128i mask = _mm_set1_epi16(pixelMask);
+		for(; i + 8 <= width; i += 8) {
+			__m128i pixels = _mm_and_si128(LoadPixels(in + i * step, step), mask);
+			if(wordOutput) {
+				_mm_storeu_si128((__m128i*)(out16 + i), pixels);
+			} else {
+				_mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(pixels, pixels));
+			}
+		}
+	#elif defined(PALETTED_OUTPUT_NEON)
+		const uint16x8_t mask = vdupq_n_u16(pixelMask);
+		for(; i + 8 <= width; i += 8) {
+			uint16x8_t pixels = vandq_u16(LoadPixels(in + i * step, step), mask);
+			if(wordOutput) {
+				vst1q_u16(out16 + i, pixels);
+			} else {
+				vst1_u8(out + i, vmovn_u16(pixels));
+			}
+		}
+	#endif
+
+	for(; i < width; i++) {
+		uint16_t pixel = in[i * step] & pixelMask;
+		if(wordOutput) {
+			out16[i] = pixel;
+		} else {
+			out[i] = (uint8_t)pixel;
+		}
+	}
+}
+
+void PalettedVideoOutput::UpdateFrame(uint16_t* ppuOutputBuffer, const uint8_t* changedRows, uint32_t frameNumber)
+{
+	EmulationSettings* settings = _console->GetSettings();
+	PalettedOutputFormat format = settings->GetPalettedOutputFormat();
+	if(format == PalettedOutputFormat::Disabled) {
+		_format = PalettedOutputFormat::Disabled;
+		return;
+	}
+
+	uint32_t downscale = settings->GetPalettedOutputDownscale();
+	if(downscale != 2 && downscale != 4) {
+		downscale = 1;
+	}
+
+	OverscanDimensions overscan = settings->GetOverscanDimensions();
+
+	//The PPU's changed rows can only be used when the previous frame was converted with the same settings
+	bool fullUpdate = (
+		format != _format || downscale != _downscale ||
+		overscan.Left != _overscan.Left || overscan.Right != _overscan.Right || overscan.Top != _overscan.Top || overscan.Bottom != _overscan.Bottom ||
+		!changedRows || frameNumber != _lastFrameNumber + 1
+	);
+
+	_format = format;
+	_downscale = downscale;
+	_overscan = overscan;
+	_lastFrameNumber = frameNumber;
+
+	uint32_t width = overscan.GetScreenWidth() / downscale;
+	uint32_t height = overscan.GetScreenHeight() / downscale;
+	uint32_t bytesPerPixel = format == PalettedOutputFormat::Raw ? 2 : 1;
+
+	PalettedFrameHeader* header = (PalettedFrameHeader*)_buffer;
+	header->FrameNumber = frameNumber;
+	header->Width = (uint16_t)width;
+	header->Height = (uint16_t)height;
+	header->Format = (uint8_t)format;
+	header->BytesPerPixel = (uint8_t)bytesPerPixel;
+	memset(header->DirtyRows, 0, sizeof(header->DirtyRows));
+
+	uint8_t* out = _buffer + sizeof(PalettedFrameHeader);
+	for(uint32_t y = 0; y < height; y++) {
+		uint32_t scanline = overscan.Top + y * downscale;
+		if(!fullUpdate && !changedRows[scanline]) {
+			continue;
+		}
+
+		uint32_t offset = scanline * PPU::ScreenWidth + overscan.Left;
+		header->DirtyRows[y >> 3] |= 1 << (y & 0x07);
+		ConvertRow(ppuOutputBuffer + offset, out + y * width * bytesPerPixel, width, downscale);
+	}
+}
+
+uint8_t* PalettedVideoOutput::GetBuffer()
+{
+	return _buffer;
+}
+
+uint32_t PalettedVideoOutput::GetBufferSize()
+{
+	if(_format == PalettedOutputFormat::Disabled) {
+		return 0;
+	}
+
+	PalettedFrameHeader* header = (PalettedFrameHeader*)_buffer;
+	return sizeof(PalettedFrameHeader) + header->Width * header->Height * header->BytesPerPixel;
+}
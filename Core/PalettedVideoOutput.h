@@ -0,0 +1,44 @@
+#pragma once
+#include "stdafx.h"
+#include "EmulationSettings.h"
+
+class Console;
+
+struct PalettedFrameHeader
+{
+	uint32_t FrameNumber;
+	uint16_t Width;
+	uint16_t Height;
+	uint8_t Format;
+	uint8_t BytesPerPixel;
+	uint16_t Reserved;
+
+	//1 bit per output row, set when the row's content changed since the previous frame
+	uint8_t DirtyRows[32];
+};
+
+class PalettedVideoOutput
+{
+private:
+	static constexpr uint32_t MaxBufferSize = sizeof(PalettedFrameHeader) + 256 * 240 * sizeof(uint16_t);
+
+	std::shared_ptr<Console> _console;
+	uint8_t* _buffer = nullptr;
+
+	PalettedOutputFormat _format = PalettedOutputFormat::Disabled;
+	uint32_t _downscale = 0;
+	OverscanDimensions _overscan;
+	uint32_t _lastFrameNumber = 0;
+
+	uint16_t GetPixelMask();
+	void ConvertRow(uint16_t* in, uint8_t* out, uint32_t width, uint32_t step);
+
+public:
+	PalettedVideoOutput(std::shared_ptr<Console> console);
+	~PalettedVideoOutput();
+
+	void UpdateFrame(uint16_t* ppuOutputBuffer, const uint8_t* changedRows, uint32_t frameNumber);
+
+	uint8_t* GetBuffer();
+	uint32_t GetBufferSize();
+};
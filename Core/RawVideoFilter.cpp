@@ -20,6 +20,10 @@ void RawVideoFilter::ApplyFilter(uint16_t * ppuOutputBuffer)
 	OverscanDimensions overscan = GetOverscan();
 	uint32_t* out = GetOutputBuffer();
 	for(uint32_t i = overscan.Top, iMax = 240 - overscan.Bottom; i < iMax; i++) {
+		if(!IsRowChanged(i)) {
+			out += overscan.GetScreenWidth();
+			continue;
+		}
 		for(uint32_t j = overscan.Left, jMax = 256 - overscan.Right; j < jMax; j++) {
 			*out = _rawPalette[ppuOutputBuffer[i * 256 + j]];
 			out++;
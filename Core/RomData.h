@@ -1,6 +1,7 @@
 #pragma once
 #include "stdafx.h"
 #include <cmath>
+#include <memory>
 #include "Types.h"
 #include "NESHeader.h"
 
@@ -100,6 +101,13 @@ struct RomData
 
 	vector<uint8_t> RawData;
 
+	//Images from the SharedRomCache - when set (e.g when power cycling), PrgRom/ChrRom can be empty
+	std::shared_ptr<vector<uint8_t>> SharedPrgRom;
+	std::shared_ptr<vector<uint8_t>> SharedChrRom;
+
 	bool Error = false;
 	bool BiosMissing = false;
+
+	size_t GetPrgRomSize() const { return SharedPrgRom ? SharedPrgRom->size() : PrgRom.size(); }
+	size_t GetChrRomSize() const { return SharedChrRom ? SharedChrRom->size() : ChrRom.size(); }
 };
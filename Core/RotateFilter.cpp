@@ -1,5 +1,11 @@
 #include "stdafx.h"
 #include "RotateFilter.h"
+#include "ScanlineFilter.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define ROTATE_FILTER_SSE2
+#endif
 
 RotateFilter::RotateFilter(uint32_t angle)
 {
@@ -31,32 +37,132 @@ uint32_t RotateFilter::GetAngle()
 	return _angle;
 }
 
-uint32_t * RotateFilter::ApplyFilter(uint32_t * inputArgbBuffer, uint32_t width, uint32_t height)
+void RotateFilter::TransposeBlock(uint32_t *input, uint32_t width, uint32_t height, uint32_t x0, uint32_t y0, uint32_t xMax, uint32_t yMax)
 {
-	UpdateOutputBuffer(width, height);
+	//90 degrees: (x, y) -> row x, column height-1-y
+	//270 degrees: (x, y) -> row width-1-x, column y
+	bool clockwise = _angle == 90;
+	uint32_t y = y0;
 
-	uint32_t *input = inputArgbBuffer;
-	if(_angle == 90) {
-		for(int i = (int)height - 1; i >= 0; i--) {
-			for(uint32_t j = 0; j < width; j++) {
-				_outputBuffer[j*height + i] = *input;
-				input++;
+#ifdef ROTATE_FILTER_SSE2
+	//Transpose 4x4 pixel blocks in registers
+	for(; y + 4 <= yMax; y += 4) {
+		uint32_t x = x0;
+		for(; x + 4 <= xMax; x += 4) {
+			__m128i a0, a1, a2, a3;
+			if(clockwise) {
+				a0 = _mm_loadu_si128((__m128i*)(input + (y + 3) * width + x));
+				a1 = _mm_loadu_si128((__m128i*)(input + (y + 2) * width + x));
+				a2 = _mm_loadu_si128((__m128i*)(input + (y + 1) * width + x));
+				a3 = _mm_loadu_si128((__m128i*)(input + y * width + x));
+			} else {
+				a0 = _mm_loadu_si128((__m128i*)(input + y * width + x));
+				a1 = _mm_loadu_si128((__m128i*)(input + (y + 1) * width + x));
+				a2 = _mm_loadu_si128((__m128i*)(input + (y + 2) * width + x));
+				a3 = _mm_loadu_si128((__m128i*)(input + (y + 3) * width + x));
+			}
+
+			__m128i t0 = _mm_unpacklo_epi32(a0, a1);
+			__m128i t1 = _mm_unpacklo_epi32(a2, a3);
+			__m128i t2 = _mm_unpackhi_epi32(a0, a1);
+			__m128i t3 = _mm_unpackhi_epi32(a2, a3);
+			__m128i rows[4] = {
+				_mm_unpacklo_epi64(t0, t1),
+				_mm_unpackhi_epi64(t0, t1),
+				_mm_unpacklo_epi64(t2, t3),
+				_mm_unpackhi_epi64(t2, t3)
+			};
+
+			for(uint32_t i = 0; i < 4; i++) {
+				uint32_t *out = clockwise ? (_outputBuffer + (x + i) * height + height - 4 - y) : (_outputBuffer + (width - 1 - x - i) * height + y);
+				_mm_storeu_si128((__m128i*)out, rows[i]);
+			}
+		}
+
+		for(uint32_t i = y; i < y + 4; i++) {
+			for(uint32_t j = x; j < xMax; j++) {
+				_outputBuffer[clockwise ? (j * height + height - 1 - i) : ((width - 1 - j) * height + i)] = input[i * width + j];
+			}
+		}
+	}
+#endif
+
+	for(; y < yMax; y++) {
+		for(uint32_t x = x0; x < xMax; x++) {
+			_outputBuffer[clockwise ? (x * height + height - 1 - y) : ((width - 1 - x) * height + y)] = input[y * width + x];
+		}
+	}
+}
+
+void RotateFilter::RotateAndScale(uint32_t *input, uint32_t width, uint32_t height, uint32_t scale, ScanlineFilter *scanlineFilter)
+{
+	//Nearest neighbor scaling done while rotating, to avoid an intermediate rotated buffer
+	uint32_t outWidth = (_angle % 180 ? height : width) * scale;
+	uint32_t outHeight = (_angle % 180 ? width : height) * scale;
+
+	for(uint32_t y0 = 0; y0 < height; y0 += BlockSize) {
+		for(uint32_t x0 = 0; x0 < width; x0 += BlockSize) {
+			for(uint32_t y = y0, yMax = std::min(y0 + BlockSize, height); y < yMax; y++) {
+				for(uint32_t x = x0, xMax = std::min(x0 + BlockSize, width); x < xMax; x++) {
+					uint32_t row, column;
+					if(_angle == 90) {
+						row = x;
+						column = height - 1 - y;
+					} else if(_angle == 180) {
+						row = height - 1 - y;
+						column = width - 1 - x;
+					} else {
+						row = width - 1 - x;
+						column = y;
+					}
+
+					uint32_t color = input[y * width + x];
+					uint32_t *out = _outputBuffer + row * scale * outWidth + column * scale;
+					for(uint32_t i = 0; i < scale; i++) {
+						out[i] = color;
+					}
+				}
+			}
+		}
+	}
+
+	for(uint32_t y = 0; y < outHeight; y += scale) {
+		for(uint32_t i = 1; i < scale; i++) {
+			memcpy(_outputBuffer + (y + i) * outWidth, _outputBuffer + y * outWidth, outWidth * sizeof(uint32_t));
+		}
+
+		if(scanlineFilter && scanlineFilter->IsEnabled()) {
+			for(uint32_t i = 0; i < scale; i++) {
+				scanlineFilter->ApplyToRow(_outputBuffer + (y + i) * outWidth, outWidth, y + i);
+			}
+		}
+	}
+}
+
+uint32_t * RotateFilter::ApplyFilter(uint32_t * inputArgbBuffer, uint32_t width, uint32_t height, uint32_t scale, ScanlineFilter *scanlineFilter)
+{
+	UpdateOutputBuffer(width * scale, height * scale);
+
+	if(scale > 1) {
+		RotateAndScale(inputArgbBuffer, width, height, scale, scanlineFilter);
+		return _outputBuffer;
+	}
+
+	if(_angle == 90 || _angle == 270) {
+		//Process the frame in square blocks to keep both the reads and the (strided) writes in cache
+		for(uint32_t y0 = 0; y0 < height; y0 += BlockSize) {
+			for(uint32_t x0 = 0; x0 < width; x0 += BlockSize) {
+				TransposeBlock(inputArgbBuffer, width, height, x0, y0, std::min(x0 + BlockSize, width), std::min(y0 + BlockSize, height));
 			}
 		}
 	} else if(_angle == 180) {
+		uint32_t *input = inputArgbBuffer;
 		for(int i = (int)height - 1; i >= 0; i--) {
 			for(int j = (int)width - 1; j >= 0; j--) {
 				_outputBuffer[i * width + j] = *input;
 				input++;
 			}
 		}
-	} else if(_angle == 270) {
-		for(uint32_t i = 0; i < height; i++) {
-			for(int j = (int)width - 1; j >= 0; j--) {
-				_outputBuffer[j*height + i] = *input;
-				input++;
-			}
-		}
 	}
 
 	return _outputBuffer;
@@ -2,21 +2,27 @@
 #include "stdafx.h"
 #include "DefaultVideoFilter.h"
 
+class ScanlineFilter;
+
 class RotateFilter
 {
 private:
+	static constexpr uint32_t BlockSize = 32;
+
 	uint32_t *_outputBuffer = nullptr;
 	uint32_t _angle = 0;
 	uint32_t _width = 0;
 	uint32_t _height = 0;
 
 	void UpdateOutputBuffer(uint32_t width, uint32_t height);
+	void TransposeBlock(uint32_t *input, uint32_t width, uint32_t height, uint32_t x0, uint32_t y0, uint32_t xMax, uint32_t yMax);
+	void RotateAndScale(uint32_t *input, uint32_t width, uint32_t height, uint32_t scale, ScanlineFilter *scanlineFilter);
 
 public:
 	RotateFilter(uint32_t angle);
 	~RotateFilter();
 
 	uint32_t GetAngle();
-	uint32_t* ApplyFilter(uint32_t *inputArgbBuffer, uint32_t width, uint32_t height);
+	uint32_t* ApplyFilter(uint32_t *inputArgbBuffer, uint32_t width, uint32_t height, uint32_t scale = 1, ScanlineFilter *scanlineFilter = nullptr);
 	FrameInfo GetFrameInfo(FrameInfo baseFrameInfo);
 };
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include "../Utilities/xBRZ/xbrz.h"
 #include "../Utilities/HQX/hqx.h"
 #include "../Utilities/Scale2x/scalebit.h"
+#include "../Utilities/Scale2x/scale2x.h"
+#include "../Utilities/Scale2x/scale3x.h"
 #include "../Utilities/KreedSaiEagle/SaiEagle.h"
 
 bool ScaleFilter::_hqxInitDone = false;
@@ -31,11 +33,24 @@ uint32_t ScaleFilter::GetScale()
 	return _filterScale;
 }
 
-void ScaleFilter::ApplyPrescaleFilter(uint32_t *inputArgbBuffer)
+ScaleFilterType ScaleFilter::GetScaleFilterType()
+{
+	return _scaleFilterType;
+}
+
+void ScaleFilter::ApplyPrescaleFilter(uint32_t *inputArgbBuffer, const uint8_t *changedRows)
 {
 	uint32_t* outputBuffer = _outputBuffer;
+	uint32_t outputWidth = _width*_filterScale;
 
 	for(uint32_t y = 0; y < _height; y++) {
+		if(changedRows && !changedRows[y]) {
+			inputArgbBuffer += _width;
+			outputBuffer += outputWidth * _filterScale;
+			continue;
+		}
+
+		uint32_t* firstRow = outputBuffer;
 		for(uint32_t x = 0; x < _width; x++) {
 			for(uint32_t i = 0; i < _filterScale; i++) {
 				*(outputBuffer++) = *inputArgbBuffer;
@@ -43,13 +58,45 @@ void ScaleFilter::ApplyPrescaleFilter(uint32_t *inputArgbBuffer)
 			inputArgbBuffer++;
 		}
 		for(uint32_t i = 1; i < _filterScale; i++) {
-			memcpy(outputBuffer, outputBuffer - _width*_filterScale, _width*_filterScale *4);
-			outputBuffer += _width*_filterScale;
+			memcpy(outputBuffer, firstRow, outputWidth *4);
+			outputBuffer += outputWidth;
+		}
+
+		if(_scanlineFilter.IsEnabled()) {
+			//Apply the scanline effect while the rows are still in the cache
+			for(uint32_t i = 0; i < _filterScale; i++) {
+				_scanlineFilter.ApplyToRow(firstRow + i * outputWidth, outputWidth, y * _filterScale + i);
+			}
 		}
 	}
 }
 
-void ScaleFilter::UpdateOutputBuffer(uint32_t width, uint32_t height)
+void ScaleFilter::ApplyScale2xFilter(uint32_t *inputArgbBuffer, const uint8_t *changedRows)
+{
+	//Same as scale() for 2x/3x, but row by row: each output row depends on the input row above and below it
+	uint32_t outputWidth = _width*_filterScale;
+	for(uint32_t y = 0; y < _height; y++) {
+		if(changedRows && !changedRows[y] && (y == 0 || !changedRows[y - 1]) && (y == _height - 1 || !changedRows[y + 1])) {
+			continue;
+		}
+
+		uint32_t* src0 = inputArgbBuffer + (y > 0 ? y - 1 : 0) * _width;
+		uint32_t* src1 = inputArgbBuffer + y * _width;
+		uint32_t* src2 = inputArgbBuffer + (y < _height - 1 ? y + 1 : y) * _width;
+		uint32_t* dst = _outputBuffer + y * _filterScale * outputWidth;
+		if(_filterScale == 2) {
+			scale2x_32_def(dst, dst + outputWidth, src0, src1, src2, _width);
+		} else {
+			scale3x_32_def(dst, dst + outputWidth, dst + outputWidth * 2, src0, src1, src2, _width);
+		}
+
+		for(uint32_t i = 0; i < _filterScale; i++) {
+			_scanlineFilter.ApplyToRow(dst + i * outputWidth, outputWidth, y * _filterScale + i);
+		}
+	}
+}
+
+bool ScaleFilter::UpdateOutputBuffer(uint32_t width, uint32_t height)
 {
 	if(!_outputBuffer || width != _width || height != _height) {
 		if(_outputBuffer) {
@@ -59,12 +106,31 @@ void ScaleFilter::UpdateOutputBuffer(uint32_t width, uint32_t height)
 		_width = width;
 		_height = height;
 		_outputBuffer = new uint32_t[_width*_height*_filterScale*_filterScale];
+		return true;
 	}
+	return false;
+}
+
+void ScaleFilter::InvalidateOutput()
+{
+	_outputValid = false;
 }
 
-uint32_t* ScaleFilter::ApplyFilter(uint32_t *inputArgbBuffer, uint32_t width, uint32_t height, double scanlineIntensity)
+uint32_t* ScaleFilter::ApplyFilter(uint32_t *inputArgbBuffer, uint32_t width, uint32_t height, PictureSettings pictureSettings, const uint8_t *changedRows)
 {
-	UpdateOutputBuffer(width, height);
+	bool bufferChanged = UpdateOutputBuffer(width, height);
+	bool scanlinesChanged = _scanlineFilter.UpdateSettings(pictureSettings);
+
+	//changedRows is only usable when the output buffer contains the (scaled) previous frame
+	if(!_outputValid || bufferChanged || scanlinesChanged) {
+		changedRows = nullptr;
+	}
+	_outputValid = true;
+
+	if(_scaleFilterType == ScaleFilterType::Scale2x && _filterScale <= 3) {
+		ApplyScale2xFilter(inputArgbBuffer, changedRows);
+		return _outputBuffer;
+	}
 
 	if(_scaleFilterType == ScaleFilterType::xBRZ) {
 		xbrz::scale(_filterScale, inputArgbBuffer, _outputBuffer, width, height, xbrz::ColorFormat::ARGB);
@@ -79,27 +145,22 @@ uint32_t* ScaleFilter::ApplyFilter(uint32_t *inputArgbBuffer, uint32_t width, ui
 	} else if(_scaleFilterType == ScaleFilterType::SuperEagle) {
 		supereagle_generic_xrgb8888(width, height, inputArgbBuffer, width, _outputBuffer, width * _filterScale);
 	} else if(_scaleFilterType == ScaleFilterType::Prescale) {
-		ApplyPrescaleFilter(inputArgbBuffer);
+		ApplyPrescaleFilter(inputArgbBuffer, changedRows);
 	}
 
-	scanlineIntensity = 1.0 - scanlineIntensity;
-
-	if(scanlineIntensity < 1.0) {
-		for(int y = 1, yMax = height * _filterScale; y < yMax; y += 2) {
-			for(int x = 0, xMax = width * _filterScale; x < xMax; x++) {
-				uint32_t &color = _outputBuffer[y*xMax + x];
-				uint8_t r = (color >> 16) & 0xFF, g = (color >> 8) & 0xFF, b = color & 0xFF;
-				r = (uint8_t)(r * scanlineIntensity);
-				g = (uint8_t)(g * scanlineIntensity);
-				b = (uint8_t)(b * scanlineIntensity);
-				color = 0xFF000000 | (r << 16) | (g << 8) | b;
-			}
-		}
+	if(_scaleFilterType != ScaleFilterType::Prescale) {
+		_scanlineFilter.ApplyToFrame(_outputBuffer, width * _filterScale, height * _filterScale);
 	}
 
 	return _outputBuffer;
 }
 
+ScanlineFilter* ScaleFilter::GetScanlineFilter(PictureSettings pictureSettings)
+{
+	_scanlineFilter.UpdateSettings(pictureSettings);
+	return &_scanlineFilter;
+}
+
 shared_ptr<ScaleFilter> ScaleFilter::GetScaleFilter(VideoFilterType filter)
 {
 	shared_ptr<ScaleFilter> scaleFilter;
@@ -2,6 +2,7 @@
 
 #include "stdafx.h"
 #include "DefaultVideoFilter.h"
+#include "ScanlineFilter.h"
 
 class ScaleFilter
 {
@@ -12,17 +13,24 @@ private:
 	uint32_t *_outputBuffer = nullptr;
 	uint32_t _width = 0;
 	uint32_t _height = 0;
+	ScanlineFilter _scanlineFilter;
+	bool _outputValid = false;
 
-	void ApplyPrescaleFilter(uint32_t *inputArgbBuffer);
-	void UpdateOutputBuffer(uint32_t width, uint32_t height);
+	void ApplyPrescaleFilter(uint32_t *inputArgbBuffer, const uint8_t *changedRows);
+	void ApplyScale2xFilter(uint32_t *inputArgbBuffer, const uint8_t *changedRows);
+	bool UpdateOutputBuffer(uint32_t width, uint32_t height);
 
 public:
 	ScaleFilter(ScaleFilterType scaleFilterType, uint32_t scale);
 	~ScaleFilter();
 
 	uint32_t GetScale();
-	uint32_t* ApplyFilter(uint32_t *inputArgbBuffer, uint32_t width, uint32_t height, double scanlineIntensity);
+	ScaleFilterType GetScaleFilterType();
+	uint32_t* ApplyFilter(uint32_t *inputArgbBuffer, uint32_t width, uint32_t height, PictureSettings pictureSettings, const uint8_t *changedRows = nullptr);
+	void InvalidateOutput();
 	FrameInfo GetFrameInfo(FrameInfo baseFrameInfo);
 
+	ScanlineFilter* GetScanlineFilter(PictureSettings pictureSettings);
+
 	static shared_ptr<ScaleFilter> GetScaleFilter(VideoFilterType filter);
 };
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "stdafx.h"
+#include <cmath>
+#include "ScanlineFilter.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define SCANLINE_FILTER_SSE2
+#endif
+
+bool ScanlineFilter::UpdateSettings(PictureSettings pictureSettings, uint32_t darkRows, uint32_t rowPeriod)
+{
+	uint16_t previousMultipliers[MaxRowPeriod][PatternWidth * 4];
+	memcpy(previousMultipliers, _multipliers, sizeof(_multipliers));
+	uint32_t previousRowPeriod = _rowPeriod;
+	bool wasEnabled = _enabled;
+
+	//darkRows is a bitmask of the rows (within each group of rowPeriod rows) that get the scanline effect
+	_rowPeriod = rowPeriod < 2 ? 2 : (rowPeriod > MaxRowPeriod ? MaxRowPeriod : rowPeriod);
+
+	uint32_t scanlineMultiplier = (uint32_t)std::round((1.0 - std::max(0.0, std::min(1.0, pictureSettings.ScanlineIntensity))) * 256);
+	uint32_t maskMultiplier = (uint32_t)std::round((1.0 - std::max(0.0, std::min(1.0, pictureSettings.CrtMaskIntensity))) * 256);
+	if(pictureSettings.CrtMask == CrtMaskType::None) {
+		maskMultiplier = 256;
+	}
+
+	_enabled = false;
+	for(uint32_t y = 0; y < _rowPeriod; y++) {
+		uint32_t rowMultiplier = (darkRows & (1 << y)) ? scanlineMultiplier : 256;
+
+		_rowEnabled[y] = false;
+		for(uint32_t x = 0; x < PatternWidth; x++) {
+			//Aperture grille: vertical R/G/B stripes, shadow mask: triads shifted on every other row
+			uint32_t litChannel = (pictureSettings.CrtMask == CrtMaskType::ShadowMask ? (x + (y & 0x01) * 2) : x) % 3;
+
+			for(uint32_t channel = 0; channel < 4; channel++) {
+				uint32_t multiplier = 256;
+				if(channel < 3) {
+					//Channels are stored as B, G, R, A
+					multiplier = rowMultiplier;
+					if(channel != 2 - litChannel) {
+						multiplier = multiplier * maskMultiplier >> 8;
+					}
+				}
+
+				_multipliers[y][x * 4 + channel] = (uint16_t)multiplier;
+				if(multiplier != 256) {
+					_rowEnabled[y] = true;
+					_enabled = true;
+				}
+			}
+		}
+	}
+
+	return (
+		_enabled != wasEnabled || _rowPeriod != previousRowPeriod ||
+		memcmp(previousMultipliers, _multipliers, _rowPeriod * sizeof(_multipliers[0])) != 0
+	);
+}
+
+bool ScanlineFilter::IsEnabled()
+{
+	return _enabled;
+}
+
+void ScanlineFilter::ApplyToRow(uint32_t *row, uint32_t width, uint32_t y)
+{
+	uint32_t rowIndex = y % _rowPeriod;
+	if(!_rowEnabled[rowIndex]) {
+		return;
+	}
+
+	uint16_t* multipliers = _multipliers[rowIndex];
+	uint32_t x = 0;
+
+#ifdef SCANLINE_FILTER_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	__m128i patternLow[3], patternHigh[3];
+	for(int i = 0; i < 3; i++) {
+		patternLow[i] = _mm_loadu_si128((__m128i*)(multipliers + i * 16));
+		patternHigh[i] = _mm_loadu_si128((__m128i*)(multipliers + i * 16 + 8));
+	}
+
+	for(uint32_t i = 0; x + 4 <= width; x += 4) {
+		__m128i pixels = _mm_loadu_si128((__m128i*)(row + x));
+		__m128i low = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), patternLow[i]), 8);
+		__m128i high = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), patternHigh[i]), 8);
+		_mm_storeu_si128((__m128i*)(row + x), _mm_packus_epi16(low, high));
+		i = i == 2 ? 0 : i + 1;
+	}
+#endif
+
+	for(; x < width; x++) {
+		uint8_t* pixel = (uint8_t*)(row + x);
+		uint16_t* pixelMultipliers = multipliers + (x % PatternWidth) * 4;
+		for(int channel = 0; channel < 4; channel++) {
+			pixel[channel] = (uint8_t)(pixel[channel] * pixelMultipliers[channel] >> 8);
+		}
+	}
+}
+
+void ScanlineFilter::ApplyToFrame(uint32_t *argbBuffer, uint32_t width, uint32_t height)
+{
+	if(_enabled) {
+		for(uint32_t y = 0; y < height; y++) {
+			ApplyToRow(argbBuffer + y * width, width, y);
+		}
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "stdafx.h"
+#include "EmulationSettings.h"
+
+//Scanline and CRT mask effects, applied by the video filters to each output row right after it is written
+class ScanlineFilter
+{
+private:
+	static constexpr uint32_t MaxRowPeriod = 8;
+
+	//The masks repeat every 3 pixels and the SIMD loop processes 4 pixels at a time
+	static constexpr uint32_t PatternWidth = 12;
+
+	//Per-channel multipliers (0-256, stored in B, G, R, A byte order like the pixels) for each row of the pattern
+	uint16_t _multipliers[MaxRowPeriod][PatternWidth * 4] = {};
+	bool _rowEnabled[MaxRowPeriod] = {};
+	uint32_t _rowPeriod = 2;
+	bool _enabled = false;
+
+public:
+	//Returns true when the effect's output changed (filters must then redraw every row)
+	bool UpdateSettings(PictureSettings pictureSettings, uint32_t darkRows = 0x02, uint32_t rowPeriod = 2);
+	bool IsEnabled();
+
+	void ApplyToRow(uint32_t *row, uint32_t width, uint32_t y);
+	void ApplyToFrame(uint32_t *argbBuffer, uint32_t width, uint32_t height);
+};
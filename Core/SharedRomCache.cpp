@@ -0,0 +1,28 @@
+#include "stdafx.h"
+#include "SharedRomCache.h"
+#include "../Utilities/CRC32.h"
+
+SimpleLock SharedRomCache::_lock;
+std::unordered_map<uint32_t, vector<std::weak_ptr<vector<uint8_t>>>> SharedRomCache::_images;
+
+std::shared_ptr<vector<uint8_t>> SharedRomCache::GetImage(const vector<uint8_t> &data)
+{
+	uint32_t crc = CRC32::GetCRC((uint8_t*)data.data(), data.size());
+
+	auto lock = _lock.AcquireSafe();
+	vector<std::weak_ptr<vector<uint8_t>>> &images = _images[crc];
+	for(size_t i = 0; i < images.size(); i++) {
+		std::shared_ptr<vector<uint8_t>> image = images[i].lock();
+		if(!image) {
+			//No console uses this image anymore
+			images.erase(images.begin() + i);
+			i--;
+		} else if(*image == data) {
+			return image;
+		}
+	}
+
+	std::shared_ptr<vector<uint8_t>> image(new vector<uint8_t>(data));
+	images.push_back(image);
+	return image;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "stdafx.h"
+#include <unordered_map>
+#include "../Utilities/SimpleLock.h"
+
+//Keeps a single read-only copy of each PRG/CHR ROM image in memory, shared by all the consoles (and power cycles) running the same game
+//Also used for other read-only per-game data, such as the memory manager's address tables
+class SharedRomCache
+{
+private:
+	static SimpleLock _lock;
+	static std::unordered_map<uint32_t, vector<std::weak_ptr<vector<uint8_t>>>> _images;
+
+public:
+	static std::shared_ptr<vector<uint8_t>> GetImage(const vector<uint8_t> &data);
+};
@@ -0,0 +1,81 @@
+#include "stdafx.h"
+#include "TileDecoder.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define TILE_DECODER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define TILE_DECODER_NEON
+#endif
+
+uint64_t TileDecoder::_bitplaneLut[256];
+
+static struct TileDecoderLutInitializer
+{
+	TileDecoderLutInitializer() { TileDecoder::InitializeLut(); }
+} _tileDecoderLutInitializer;
+
+void TileDecoder::InitializeLut()
+{
+	for(int i = 0; i < 256; i++) {
+		uint8_t pixels[8];
+		for(int j = 0; j < 8; j++) {
+			pixels[j] = (i >> (7 - j)) & 0x01;
+		}
+		memcpy(&_bitplaneLut[i], pixels, 8);
+	}
+}
+
+void TileDecoder::DecodeTile(const uint8_t* tileData, uint8_t* out)
+{
+	for(int i = 0; i < 8; i++) {
+		DecodeRow(tileData[i], tileData[i + 8], out + i * 8);
+	}
+}
+
+void TileDecoder::DecodeRows(const uint8_t* lowBytes, const uint8_t* highBytes, const uint8_t* paletteOffsets, uint32_t tileCount, uint8_t* out)
+{
+	uint32_t i = 0;
+
+#if defined(TILE_DECODER_SSE2)
+	//2 tiles per iteration: each byte is broadcast to the 8 pixels of its tile and tested against that pixel's bit
+	const __m128i bitMask = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128);
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i two = _mm_set1_epi8(2);
+	for(; i + 2 <= tileCount; i += 2) {
+		__m128i low = _mm_set_epi8(
+			lowBytes[i + 1], lowBytes[i + 1], lowBytes[i + 1], lowBytes[i + 1], lowBytes[i + 1], lowBytes[i + 1], lowBytes[i + 1], lowBytes[i + 1],
+			lowBytes[i], lowBytes[i], lowBytes[i], lowBytes[i], lowBytes[i], lowBytes[i], lowBytes[i], lowBytes[i]
+		);
+		__m128i high = _mm_set_epi8(
+			highBytes[i + 1], highBytes[i + 1], highBytes[i + 1], highBytes[i + 1], highBytes[i + 1], highBytes[i + 1], highBytes[i + 1], highBytes[i + 1],
+			highBytes[i], highBytes[i], highBytes[i], highBytes[i], highBytes[i], highBytes[i], highBytes[i], highBytes[i]
+		);
+		__m128i palette = _mm_unpacklo_epi64(_mm_set1_epi8(paletteOffsets[i]), _mm_set1_epi8(paletteOffsets[i + 1]));
+
+		__m128i lowBits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(low, bitMask), bitMask), one);
+		__m128i highBits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(high, bitMask), bitMask), two);
+		_mm_storeu_si128((__m128i*)(out + i * 8), _mm_or_si128(palette, _mm_or_si128(lowBits, highBits)));
+	}
+#elif defined(TILE_DECODER_NEON)
+	static const uint8_t bitMaskValues[16] = { 128, 64, 32, 16, 8, 4, 2, 1, 128, 64, 32, 16, 8, 4, 2, 1 };
+	const uint8x16_t bitMask = vld1q_u8(bitMaskValues);
+	const uint8x16_t one = vdupq_n_u8(1);
+	const uint8x16_t two = vdupq_n_u8(2);
+	for(; i + 2 <= tileCount; i += 2) {
+		uint8x16_t low = vcombine_u8(vdup_n_u8(lowBytes[i]), vdup_n_u8(lowBytes[i + 1]));
+		uint8x16_t high = vcombine_u8(vdup_n_u8(highBytes[i]), vdup_n_u8(highBytes[i + 1]));
+		uint8x16_t palette = vcombine_u8(vdup_n_u8(paletteOffsets[i]), vdup_n_u8(paletteOffsets[i + 1]));
+
+		uint8x16_t lowBits = vandq_u8(vtstq_u8(low, bitMask), one);
+		uint8x16_t highBits = vandq_u8(vtstq_u8(high, bitMask), two);
+		vst1q_u8(out + i * 8, vorrq_u8(palette, vorrq_u8(lowBits, highBits)));
+	}
+#endif
+
+	for(; i < tileCount; i++) {
+		uint64_t pixels = _bitplaneLut[lowBytes[i]] | (_bitplaneLut[highBytes[i]] << 1) | (paletteOffsets[i] * 0x0101010101010101ULL);
+		memcpy(out + i * 8, &pixels, 8);
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "stdafx.h"
+
+//Converts the 2 bitplanes of CHR tiles into 1 byte per pixel (color index 0-3), without extracting each pixel's bits one at a time
+class TileDecoder
+{
+private:
+	//Each entry expands a bitplane byte into 8 bytes (one per pixel, leftmost pixel first) that are set to 0 or 1
+	static uint64_t _bitplaneLut[256];
+
+public:
+	static void InitializeLut();
+
+	//Decodes a single row (8 pixels) of a tile
+	static __forceinline void DecodeRow(uint8_t lowByte, uint8_t highByte, uint8_t* out)
+	{
+		uint64_t pixels = _bitplaneLut[lowByte] | (_bitplaneLut[highByte] << 1);
+		memcpy(out, &pixels, 8);
+	}
+
+	//Decodes a 16-byte CHR tile into 64 pixels
+	static void DecodeTile(const uint8_t* tileData, uint8_t* out);
+
+	//Decodes one row of each of the given tiles (e.g all the tiles on a scanline), adding each tile's palette offset to its pixels
+	static void DecodeRows(const uint8_t* lowBytes, const uint8_t* highBytes, const uint8_t* paletteOffsets, uint32_t tileCount, uint8_t* out);
+};
@@ -25,6 +25,8 @@ protected:
 
 	void InitMapper() override
 	{
+		//The flash chip writes directly to PRG ROM
+		MakePrgRomWritable();
 		_flash.reset(new FlashSST39SF040(_prgRom, _prgSize));
 		SelectPRGPage(0, 0);
 		SelectPRGPage(1, -1);
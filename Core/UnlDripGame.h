@@ -19,6 +19,7 @@ protected:
 	uint32_t GetDipSwitchCount() override { return 1; }
 	uint16_t GetPRGPageSize() override { return 0x4000; }
 	uint16_t GetCHRPageSize() override { return 0x800; }
+	bool EnableCustomVramRead() override { return true; }
 	bool AllowRegisterRead() override { return true; }
 	uint16_t RegisterStartAddress() override { return 0x8000; }
 	uint16_t RegisterEndAddress() override { return 0xFFFF; }
@@ -13,11 +13,13 @@
 #include "HdData.h"
 #include "HdNesPack.h"
 #include "RotateFilter.h"
+#include "PalettedVideoOutput.h"
 
 VideoDecoder::VideoDecoder(shared_ptr<Console> console)
 {
 	_console = console;
 	_settings = _console->GetSettings();
+	_palettedOutput.reset(new PalettedVideoOutput(console));
 	UpdateVideoFilter();
 }
 
@@ -86,26 +88,104 @@ void VideoDecoder::UpdateVideoFilter()
 	}
 }
 
+bool VideoDecoder::CanUseDirectOutput()
+{
+	//Only the default filter (no NTSC/scale/rotate/HD filters) can write its output directly into the frontend's buffer
+	return _videoFilterType == VideoFilterType::None && !_hdFilterEnabled && !_scaleFilter && !_rotateFilter;
+}
+
+bool VideoDecoder::StartDirectOutput()
+{
+	//Called by the PPU at the start of each frame - when this returns true, each scanline is
+	//converted to ARGB into the frontend's framebuffer as soon as the PPU is done drawing it
+	_directOutputBuffer = nullptr;
+	_directOutputScanline = 0;
+
+	UpdateVideoFilter();
+	if(!CanUseDirectOutput()) {
+		return false;
+	}
+
+	_videoFilter->StartDirectFrame(_console->GetFrameCount());
+	FrameInfo frameInfo = _videoFilter->GetFrameInfo();
+	_directOutputBuffer = _console->GetVideoRenderer()->GetSoftwareFramebuffer(frameInfo.Width, frameInfo.Height, _directOutputPitch);
+	return _directOutputBuffer != nullptr;
+}
+
+void VideoDecoder::DecodeScanline(uint16_t *ppuOutputBuffer, int32_t scanline)
+{
+	if(!_directOutputBuffer) {
+		return;
+	}
+
+	if(scanline != _directOutputScanline) {
+		//A scanline was skipped (e.g reset in the middle of a frame), DecodeFrame will process the frame normally instead
+		_directOutputBuffer = nullptr;
+		return;
+	}
+
+	OverscanDimensions overscan = _videoFilter->GetOverscan();
+	if(scanline >= (int32_t)overscan.Top && scanline < PPU::ScreenHeight - (int32_t)overscan.Bottom) {
+		uint32_t* out = (uint32_t*)((uint8_t*)_directOutputBuffer + (scanline - overscan.Top) * _directOutputPitch);
+		((DefaultVideoFilter*)_videoFilter.get())->DecodeScanline(ppuOutputBuffer, scanline, out, true);
+	}
+	_directOutputScanline++;
+}
+
+const uint8_t* VideoDecoder::GetChangedRows()
+{
+	//The PPU compares each row against its previous buffer, which is only useful if that buffer is the last frame that was decoded
+	PPU* ppu = _console->GetPpu();
+	return ppu->GetScreenBuffer(true) == _lastPpuOutputBuffer ? ppu->GetChangedRows() : nullptr;
+}
+
 void VideoDecoder::DecodeFrame()
 {
 	UpdateVideoFilter();
 
+	const uint8_t* changedRows = GetChangedRows();
+	_lastPpuOutputBuffer = _ppuOutputBuffer;
+
+	_palettedOutput->UpdateFrame(_ppuOutputBuffer, changedRows, _frameNumber);
+
+	if(_directOutputBuffer && CanUseDirectOutput()) {
+		//All other scanlines have already been decoded by the PPU, only the last one remains
+		DecodeScanline(_ppuOutputBuffer, PPU::ScreenHeight - 1);
+		if(_directOutputBuffer) {
+			_lastFrameInfo = _videoFilter->GetFrameInfo();
+			_console->GetVideoRenderer()->UpdateFrame(_directOutputBuffer, _lastFrameInfo.Width, _lastFrameInfo.Height, _directOutputPitch);
+			_directOutputBuffer = nullptr;
+			return;
+		}
+	}
+	_directOutputBuffer = nullptr;
+
 	if(_hdFilterEnabled) {
 		((HdVideoFilter*)_videoFilter.get())->SetHdScreenTiles(_hdScreenInfo);
 	}
-	_videoFilter->SendFrame(_ppuOutputBuffer, _frameNumber);
+	_videoFilter->SendFrame(_ppuOutputBuffer, _frameNumber, changedRows);
 
 	uint32_t* outputBuffer = _videoFilter->GetOutputBuffer();
 	FrameInfo frameInfo = _videoFilter->GetFrameInfo();
 
-	if(_rotateFilter) {
-		outputBuffer = _rotateFilter->ApplyFilter(outputBuffer, frameInfo.Width, frameInfo.Height);
-		frameInfo = _rotateFilter->GetFrameInfo(frameInfo);
-	}
+	if(_rotateFilter && _scaleFilter && _scaleFilter->GetScaleFilterType() == ScaleFilterType::Prescale) {
+		//Prescale filters are nearest neighbor scaling, which the rotate filter can do in the same pass
+		ScanlineFilter* scanlineFilter = _scaleFilter->GetScanlineFilter(_console->GetSettings()->GetPictureSettings());
+		outputBuffer = _rotateFilter->ApplyFilter(outputBuffer, frameInfo.Width, frameInfo.Height, _scaleFilter->GetScale(), scanlineFilter);
+		frameInfo = _scaleFilter->GetFrameInfo(_rotateFilter->GetFrameInfo(frameInfo));
+		_scaleFilter->InvalidateOutput();
+	} else {
+		if(_rotateFilter) {
+			outputBuffer = _rotateFilter->ApplyFilter(outputBuffer, frameInfo.Width, frameInfo.Height);
+			frameInfo = _rotateFilter->GetFrameInfo(frameInfo);
+		}
 
-	if(_scaleFilter) {
-		outputBuffer = _scaleFilter->ApplyFilter(outputBuffer, frameInfo.Width, frameInfo.Height, _console->GetSettings()->GetPictureSettings().ScanlineIntensity);
-		frameInfo = _scaleFilter->GetFrameInfo(frameInfo);
+		if(_scaleFilter) {
+			//Rows can't be skipped once the picture has been rotated
+			const uint8_t* scaleChangedRows = _rotateFilter ? nullptr : _videoFilter->GetChangedRows();
+			outputBuffer = _scaleFilter->ApplyFilter(outputBuffer, frameInfo.Width, frameInfo.Height, _console->GetSettings()->GetPictureSettings(), scaleChangedRows);
+			frameInfo = _scaleFilter->GetFrameInfo(frameInfo);
+		}
 	}
 
 	ScreenSize screenSize;
@@ -121,6 +201,11 @@ uint32_t VideoDecoder::GetFrameCount()
 	return _frameCount;
 }
 
+PalettedVideoOutput* VideoDecoder::GetPalettedOutput()
+{
+	return _palettedOutput.get();
+}
+
 void VideoDecoder::UpdateFrameSync(void *ppuOutputBuffer, HdScreenInfo *hdScreenInfo)
 {
 	_frameNumber = _console->GetFrameCount();
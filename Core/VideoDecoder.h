@@ -7,6 +7,7 @@
 class BaseVideoFilter;
 class ScaleFilter;
 class RotateFilter;
+class PalettedVideoOutput;
 class IRenderingDevice;
 class Console;
 struct HdScreenInfo;
@@ -24,6 +25,7 @@ private:
 	std::shared_ptr<Console> _console;
 	EmulationSettings* _settings;
 	uint16_t *_ppuOutputBuffer = nullptr;
+	uint16_t *_lastPpuOutputBuffer = nullptr;
 	HdScreenInfo *_hdScreenInfo = nullptr;
 	bool _hdFilterEnabled = false;
 	uint32_t _frameNumber = 0;
@@ -36,15 +38,26 @@ private:
 	std::unique_ptr<BaseVideoFilter> _videoFilter;
 	std::shared_ptr<ScaleFilter> _scaleFilter;
 	std::shared_ptr<RotateFilter> _rotateFilter;
+	std::unique_ptr<PalettedVideoOutput> _palettedOutput;
+
+	uint32_t* _directOutputBuffer = nullptr;
+	uint32_t _directOutputPitch = 0;
+	int32_t _directOutputScanline = 0;
 
 	void UpdateVideoFilter();
+	bool CanUseDirectOutput();
+	const uint8_t* GetChangedRows();
 public:
 	VideoDecoder(std::shared_ptr<Console> console);
 	~VideoDecoder();
 
 	void DecodeFrame();
 
+	bool StartDirectOutput();
+	void DecodeScanline(uint16_t *ppuOutputBuffer, int32_t scanline);
+
 	uint32_t GetFrameCount();
+	PalettedVideoOutput* GetPalettedOutput();
 
 	FrameInfo GetFrameInfo();
 	void GetScreenSize(ScreenSize &size, bool ignoreScale);
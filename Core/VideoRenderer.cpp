@@ -2,24 +2,66 @@
 #include "VideoRenderer.h"
 #include "VideoDecoder.h"
 
-void VideoRenderer::UpdateFrame(void *frameBuffer, uint32_t width, uint32_t height)
+void VideoRenderer::UpdateResolution(uint32_t width, uint32_t height)
+{
+	//Use Blargg's NTSC filter's max size as a minimum resolution, to prevent changing resolution too often
+	int32_t newWidth = std::max<int32_t>(width, NES_NTSC_OUT_WIDTH(256));
+	int32_t newHeight = std::max<int32_t>(height, 240);
+	if(_retroEnv != nullptr && (_previousWidth != newWidth || _previousHeight != newHeight)) {
+		//Resolution change is needed
+		retro_system_av_info avInfo = {};
+		GetSystemAudioVideoInfo(avInfo, newWidth, newHeight);
+		_retroEnv(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &avInfo);
+
+		_previousWidth = newWidth;
+		_previousHeight = newHeight;
+	}
+}
+
+void VideoRenderer::UpdateFrame(void *frameBuffer, uint32_t width, uint32_t height, uint32_t pitch)
 {
 	if(!_skipMode && _sendFrame) {
-		//Use Blargg's NTSC filter's max size as a minimum resolution, to prevent changing resolution too often
-		int32_t newWidth = std::max<int32_t>(width, NES_NTSC_OUT_WIDTH(256));
-		int32_t newHeight = std::max<int32_t>(height, 240);
-		if(_retroEnv != nullptr && (_previousWidth != newWidth || _previousHeight != newHeight)) {
-			//Resolution change is needed
-			retro_system_av_info avInfo = {};
-			GetSystemAudioVideoInfo(avInfo, newWidth, newHeight);
-			_retroEnv(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &avInfo);
-
-			_previousWidth = newWidth;
-			_previousHeight = newHeight;
-		}
-
-		_sendFrame(frameBuffer, width, height, sizeof(uint32_t) * width);
+		UpdateResolution(width, height);
+		_lastFrameWidth = width;
+		_lastFrameHeight = height;
+		_lastFramePitch = pitch ? pitch : sizeof(uint32_t) * width;
+		_sendFrame(frameBuffer, width, height, _lastFramePitch);
+	}
+}
+
+void VideoRenderer::DupeFrame()
+{
+	//Used for frames the PPU didn't draw: the frontend shows the previous frame again, when it supports it
+	bool canDupe = false;
+	if(!_skipMode && _sendFrame && _lastFrameWidth > 0 && _retroEnv && _retroEnv(RETRO_ENVIRONMENT_GET_CAN_DUPE, &canDupe) && canDupe) {
+		_sendFrame(nullptr, _lastFrameWidth, _lastFrameHeight, _lastFramePitch);
+	}
+}
+
+uint32_t* VideoRenderer::GetSoftwareFramebuffer(uint32_t width, uint32_t height, uint32_t &pitch)
+{
+	if(_skipMode || !_sendFrame || !_retroEnv) {
+		return nullptr;
+	}
+
+	//The frontend's buffer is only valid for the current resolution, apply any pending change before requesting it
+	UpdateResolution(width, height);
+
+	retro_framebuffer fb = {};
+	fb.width = width;
+	fb.height = height;
+	fb.access_flags = RETRO_MEMORY_ACCESS_WRITE;
+	if(!_retroEnv(RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER, &fb) || !fb.data) {
+		return nullptr;
 	}
+
+	if(fb.format != RETRO_PIXEL_FORMAT_XRGB8888 || fb.width != width || fb.height != height || fb.pitch < width * sizeof(uint32_t) || (fb.pitch & 0x03)) {
+		//Frontend gave us a buffer we can't write ARGB pixels into, use the regular copy path
+		return nullptr;
+	}
+
+	pitch = (uint32_t)fb.pitch;
+	return (uint32_t*)fb.data;
 }
 
 void VideoRenderer::SetVideoCallback(retro_video_refresh_t sendFrame)
@@ -31,3 +73,8 @@ void VideoRenderer::SetSkipMode(bool skip)
 {
 	_skipMode = skip;
 }
+
+bool VideoRenderer::IsSkipMode()
+{
+	return _skipMode;
+}
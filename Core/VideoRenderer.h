@@ -18,6 +18,13 @@ private:
 	bool _skipMode = false;
 	int32_t _previousHeight = -1;
 	int32_t _previousWidth = -1;
+
+	//Size of the last frame sent to the frontend, used to dupe it
+	uint32_t _lastFrameWidth = 0;
+	uint32_t _lastFrameHeight = 0;
+	uint32_t _lastFramePitch = 0;
+
+	void UpdateResolution(uint32_t width, uint32_t height);
 public:
 	VideoRenderer(std::shared_ptr<Console> console, retro_environment_t retroEnv)
 	{
@@ -27,7 +34,9 @@ public:
 
 	~VideoRenderer() { }
 
-	void UpdateFrame(void *frameBuffer, uint32_t width, uint32_t height);
+	void UpdateFrame(void *frameBuffer, uint32_t width, uint32_t height, uint32_t pitch = 0);
+	uint32_t* GetSoftwareFramebuffer(uint32_t width, uint32_t height, uint32_t &pitch);
+	void DupeFrame();
 	
 	void GetSystemAudioVideoInfo(retro_system_av_info &info, int32_t maxWidth = 0, int32_t maxHeight = 0)
 	{
@@ -61,4 +70,5 @@ public:
 
 	void SetVideoCallback(retro_video_refresh_t sendFrame);
 	void SetSkipMode(bool skip);
+	bool IsSkipMode();
 };
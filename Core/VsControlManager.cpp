@@ -13,6 +13,15 @@ ControllerType VsControlManager::GetControllerType(uint8_t port)
 	return type;
 }
 
+void VsControlManager::PowerOn(std::shared_ptr<BaseControlDevice> systemActionManager, std::shared_ptr<BaseControlDevice> mapperControlDevice)
+{
+	ControlManager::PowerOn(systemActionManager, mapperControlDevice);
+	_prgChrSelectBit = 0;
+	_slaveMasterBit = 0;
+	_refreshState = false;
+	_protectionCounter = 0;
+}
+
 void VsControlManager::Reset(bool softReset)
 {
 	ControlManager::Reset(softReset);
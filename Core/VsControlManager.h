@@ -54,6 +54,7 @@ public:
 	~VsControlManager();
 
 	void StreamState(bool saving) override;
+	void PowerOn(std::shared_ptr<BaseControlDevice> systemActionManager, std::shared_ptr<BaseControlDevice> mapperControlDevice) override;
 	void Reset(bool softReset) override;
 
 	void GetMemoryRanges(MemoryRanges &ranges) override;
@@ -8,6 +8,7 @@
 #include "../Core/Console.h"
 #include "../Core/VideoDecoder.h"
 #include "../Core/VideoRenderer.h"
+#include "../Core/PalettedVideoOutput.h"
 #include "../Core/MemoryManager.h"
 #include "../Core/BaseMapper.h"
 #include "../Core/EmulationSettings.h"
@@ -80,6 +81,15 @@ static constexpr const char* MesenSwapDutyCycle = "mesen_swap_duty_cycle";
 static constexpr const char* MesenDisableNoiseModeFlag = "mesen_disable_noise_mode_flag";
 static constexpr const char* MesenShiftButtonsClockwise = "mesen_shift_buttons_clockwise";
 static constexpr const char* MesenAudioSampleRate = "mesen_audio_sample_rate";
+static constexpr const char* MesenScanlines = "mesen_scanlines";
+static constexpr const char* MesenCrtMask = "mesen_crt_mask";
+static constexpr const char* MesenPalettedOutput = "mesen_paletted_output";
+static constexpr const char* MesenPalettedOutputDownscale = "mesen_paletted_output_downscale";
+static constexpr const char* MesenScanlineRenderer = "mesen_scanline_renderer";
+static constexpr const char* MesenPpuOutput = "mesen_ppu_output";
+
+//Memory ID used to read the paletted frame output (PalettedFrameHeader followed by the pixel data)
+static constexpr unsigned MesenMemoryPalettedFrame = RETRO_MEMORY_VIDEO_RAM | (1 << 8);
 
 uint32_t defaultPalette[0x40] { 0xFF666666, 0xFF002A88, 0xFF1412A7, 0xFF3B00A4, 0xFF5C007E, 0xFF6E0040, 0xFF6C0600, 0xFF561D00, 0xFF333500, 0xFF0B4800, 0xFF005200, 0xFF004F08, 0xFF00404D, 0xFF000000, 0xFF000000, 0xFF000000, 0xFFADADAD, 0xFF155FD9, 0xFF4240FF, 0xFF7527FE, 0xFFA01ACC, 0xFFB71E7B, 0xFFB53120, 0xFF994E00, 0xFF6B6D00, 0xFF388700, 0xFF0C9300, 0xFF008F32, 0xFF007C8D, 0xFF000000, 0xFF000000, 0xFF000000, 0xFFFFFEFF, 0xFF64B0FF, 0xFF9290FF, 0xFFC676FF, 0xFFF36AFF, 0xFFFE6ECC, 0xFFFE8170, 0xFFEA9E22, 0xFFBCBE00, 0xFF88D800, 0xFF5CE430, 0xFF45E082, 0xFF48CDDE, 0xFF4F4F4F, 0xFF000000, 0xFF000000, 0xFFFFFEFF, 0xFFC0DFFF, 0xFFD3D2FF, 0xFFE8C8FF, 0xFFFBC2FF, 0xFFFEC4EA, 0xFFFECCC5, 0xFFF7D8A5, 0xFFE4E594, 0xFFCFEF96, 0xFFBDF4AB, 0xFFB3F3CC, 0xFFB5EBF2, 0xFFB8B8B8, 0xFF000000, 0xFF000000 };
 uint32_t unsaturatedPalette[0x40] { 0xFF6B6B6B, 0xFF001E87, 0xFF1F0B96, 0xFF3B0C87, 0xFF590D61, 0xFF5E0528, 0xFF551100, 0xFF461B00, 0xFF303200, 0xFF0A4800, 0xFF004E00, 0xFF004619, 0xFF003A58, 0xFF000000, 0xFF000000, 0xFF000000, 0xFFB2B2B2, 0xFF1A53D1, 0xFF4835EE, 0xFF7123EC, 0xFF9A1EB7, 0xFFA51E62, 0xFFA52D19, 0xFF874B00, 0xFF676900, 0xFF298400, 0xFF038B00, 0xFF008240, 0xFF007891, 0xFF000000, 0xFF000000, 0xFF000000, 0xFFFFFFFF, 0xFF63ADFD, 0xFF908AFE, 0xFFB977FC, 0xFFE771FE, 0xFFF76FC9, 0xFFF5836A, 0xFFDD9C29, 0xFFBDB807, 0xFF84D107, 0xFF5BDC3B, 0xFF48D77D, 0xFF48CCCE, 0xFF555555, 0xFF000000, 0xFF000000, 0xFFFFFFFF, 0xFFC4E3FE, 0xFFD7D5FE, 0xFFE6CDFE, 0xFFF9CAFE, 0xFFFEC9F0, 0xFFFED1C7, 0xFFF7DCAC, 0xFFE8E89C, 0xFFD1F29D, 0xFFBFF4B1, 0xFFB7F5CD, 0xFFB7F0EE, 0xFFBEBEBE, 0xFF000000, 0xFF000000 };
@@ -148,6 +158,8 @@ extern "C" {
 
 		static constexpr struct retro_variable vars[] = {
 			{ MesenNtscFilter, "NTSC filter; Disabled|Composite (Blargg)|S-Video (Blargg)|RGB (Blargg)|Monochrome (Blargg)|Bisqwit 2x|Bisqwit 4x|Bisqwit 8x" },
+			{ MesenScanlines, "Scanlines; disabled|25%|50%|75%" },
+			{ MesenCrtMask, "CRT mask; disabled|Aperture grille|Shadow mask" },
 			{ MesenPalette, "Palette; Default|Composite Direct (by FirebrandX)|Nes Classic|Nestopia (RGB)|Original Hardware (by FirebrandX)|PVM Style (by FirebrandX)|Sony CXA2025AS|Unsaturated v6 (by FirebrandX)|YUV v3 (by FirebrandX)|Wavebeam (by nakedarthur)|Custom|Raw" },
 			{ MesenOverclock, "Overclock; None|Low|Medium|High|Very High" },
 			{ MesenOverclockType, "Overclock Type; Before NMI (Recommended)|After NMI" },
@@ -161,6 +173,7 @@ extern "C" {
 			{ MesenShiftButtonsClockwise, u8"Shift A/B/X/Y clockwise; disabled|enabled" },
 			{ MesenHdPacks, "Enable HD Packs; enabled|disabled" },
 			{ MesenNoSpriteLimit, "Remove sprite limit; disabled|enabled" },
+			{ MesenScanlineRenderer, "Fast scanline renderer (falls back to cycle-accurate rendering when needed); disabled|enabled" },
 			{ MesenFakeStereo, u8"Enable fake stereo effect; disabled|enabled" },
 			{ MesenMuteTriangleUltrasonic, u8"Reduce popping on Triangle channel; enabled|disabled" },
 			{ MesenReduceDmcPopping, u8"Reduce popping on DMC channel; enabled|disabled" },
@@ -171,6 +184,9 @@ extern "C" {
 			{ MesenFdsAutoSelectDisk, "FDS: Automatically insert disks; disabled|enabled" },
 			{ MesenFdsFastForwardLoad, "FDS: Fast forward while loading; disabled|enabled" },
 			{ MesenAudioSampleRate, "Sound Output Sample Rate; 48000|96000|11025|22050|44100" },
+			{ MesenPalettedOutput, "Paletted frame output (memory 0x103); disabled|9-bit indexes|6-bit indexes|grayscale indexes" },
+			{ MesenPalettedOutputDownscale, "Paletted frame output downscale; 1x|2x|4x" },
+			{ MesenPpuOutput, "PPU picture output (for headless use, skipped frames are duped and the paletted output keeps the last drawn frame); every frame|every 2nd frame|every 4th frame|every 8th frame|never" },
 			{ NULL, NULL },
 		};
 
@@ -355,6 +371,7 @@ extern "C" {
 		_hdPacksEnabled = _console->GetSettings()->CheckFlag(EmulationFlags::UseHdPacks);
 
 		set_flag(MesenNoSpriteLimit, EmulationFlags::RemoveSpriteLimit | EmulationFlags::AdaptiveSpriteLimit);
+		set_flag(MesenScanlineRenderer, EmulationFlags::UseScanlineRenderer);
 		set_flag(MesenHdPacks, EmulationFlags::UseHdPacks);
 		set_flag(MesenMuteTriangleUltrasonic, EmulationFlags::SilenceTriangleHighFreq);
 		set_flag(MesenReduceDmcPopping, EmulationFlags::ReduceDmcPopping);
@@ -405,6 +422,33 @@ extern "C" {
 			}
 		}
 
+		if(readVariable(MesenScanlines, var)) {
+			string value = string(var.value);
+			double scanlineIntensity;
+			if(value == "25%") {
+				scanlineIntensity = 0.25;
+			} else if(value == "50%") {
+				scanlineIntensity = 0.5;
+			} else if(value == "75%") {
+				scanlineIntensity = 0.75;
+			} else {
+				scanlineIntensity = 0;
+			}
+
+			PictureSettings pictureSettings = _console->GetSettings()->GetPictureSettings();
+			_console->GetSettings()->SetPictureSettings(pictureSettings.Brightness, pictureSettings.Contrast, pictureSettings.Saturation, pictureSettings.Hue, scanlineIntensity);
+		}
+
+		_console->GetSettings()->SetCrtMask(CrtMaskType::None, 0);
+		if(readVariable(MesenCrtMask, var)) {
+			string value = string(var.value);
+			if(value == "Aperture grille") {
+				_console->GetSettings()->SetCrtMask(CrtMaskType::ApertureGrille, 0.3);
+			} else if(value == "Shadow mask") {
+				_console->GetSettings()->SetCrtMask(CrtMaskType::ShadowMask, 0.3);
+			}
+		}
+
 		if(readVariable(MesenPalette, var)) {
 			string value = string(var.value);
 			if(value == "Default") {
@@ -530,6 +574,43 @@ extern "C" {
 			}
 		}
 
+		PalettedOutputFormat palettedFormat = PalettedOutputFormat::Disabled;
+		uint32_t palettedDownscale = 1;
+		if(readVariable(MesenPalettedOutput, var)) {
+			string value = string(var.value);
+			if(value == "9-bit indexes") {
+				palettedFormat = PalettedOutputFormat::Raw;
+			} else if(value == "6-bit indexes") {
+				palettedFormat = PalettedOutputFormat::Index;
+			} else if(value == "grayscale indexes") {
+				palettedFormat = PalettedOutputFormat::Grayscale;
+			}
+		}
+		if(readVariable(MesenPalettedOutputDownscale, var)) {
+			string value = string(var.value);
+			if(value == "2x") {
+				palettedDownscale = 2;
+			} else if(value == "4x") {
+				palettedDownscale = 4;
+			}
+		}
+		_console->GetSettings()->SetPalettedOutput(palettedFormat, palettedDownscale);
+
+		uint32_t ppuOutputInterval = 1;
+		if(readVariable(MesenPpuOutput, var)) {
+			string value = string(var.value);
+			if(value == "every 2nd frame") {
+				ppuOutputInterval = 2;
+			} else if(value == "every 4th frame") {
+				ppuOutputInterval = 4;
+			} else if(value == "every 8th frame") {
+				ppuOutputInterval = 8;
+			} else if(value == "never") {
+				ppuOutputInterval = 0;
+			}
+		}
+		_console->GetSettings()->SetPpuOutputInterval(ppuOutputInterval);
+
 		int turboSpeed = 0;
 		bool turboEnabled = true;
 		if(readVariable(MesenControllerTurboSpeed, var)) {
@@ -695,8 +776,19 @@ extern "C" {
 			}
 		}
 
+		//The frontend can tell us it will not display this frame (e.g run-ahead, or a headless frontend)
+		int audioVideoEnable = 0;
+		bool skipVideo = env_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &audioVideoEnable) && !(audioVideoEnable & 0x01);
+		if(skipVideo) {
+			_console->GetVideoRenderer()->SetSkipMode(true);
+		}
+
 		_console->RunSingleFrame();
 
+		if(skipVideo) {
+			_console->GetVideoRenderer()->SetSkipMode(false);
+		}
+
 		if(updated) {
 			//Update geometry after running the frame, in case the console's region changed (affects "auto" aspect ratio)
 			retro_system_av_info avInfo = {};
@@ -1223,6 +1315,7 @@ extern "C" {
 		switch(id) {
 			case RETRO_MEMORY_SAVE_RAM: return mapper->GetSaveRam();
 			case RETRO_MEMORY_SYSTEM_RAM: return _console->GetMemoryManager()->GetInternalRAM();
+			case MesenMemoryPalettedFrame: return _console->GetVideoDecoder()->GetPalettedOutput()->GetBuffer();
 		}
 		return nullptr;
 	}
@@ -1233,6 +1326,7 @@ extern "C" {
 		switch(id) {
 			case RETRO_MEMORY_SAVE_RAM: return mapper->GetMemorySize(DebugMemoryType::SaveRam);
 			case RETRO_MEMORY_SYSTEM_RAM: return MemoryManager::InternalRAMSize;
+			case MesenMemoryPalettedFrame: return _console->GetVideoDecoder()->GetPalettedOutput()->GetBufferSize();
 		}
 		return 0;
 	}
@@ -0,0 +1,153 @@
+//Decodes and re-encodes every PNG of an HD pack and reports the throughput of the PNG code
+//Usage: pngbench [-n iterations] [-t threads] <HD pack folder or .png file>...
+//For a folder, the images listed in its hires.txt file (<img> tags) are used.
+//Decoding is measured with the scalar unfilter code ("old") and with the SIMD code ("new").
+//Encoding is measured with a single zlib stream at the default compression level ("old") and with the fast compression level split into parallel bands ("new").
+#include "stdafx.h"
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include "PNGHelper.h"
+
+struct BenchmarkImage
+{
+	string Filename;
+	vector<uint8_t> FileData;
+	vector<uint8_t> Pixels;
+	uint32_t Width;
+	uint32_t Height;
+};
+
+static vector<string> GetPackImages(string folder)
+{
+	vector<string> filenames;
+	ifstream hiresFile(folder + "/hires.txt", std::ios::in);
+	string line;
+	while(std::getline(hiresFile, line)) {
+		if(!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+		if(line.substr(0, 5) == "<img>") {
+			filenames.push_back(folder + "/" + line.substr(5));
+		}
+	}
+	return filenames;
+}
+
+static double GetElapsedSeconds(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+static void Report(const char* name, size_t byteCount, double seconds)
+{
+	printf("%-28s %10.1f MB/s  (%.3f s)\n", name, byteCount / seconds / 1000000, seconds);
+}
+
+static double BenchmarkDecode(vector<BenchmarkImage> &images, uint32_t iterations, bool useSimd, size_t &byteCount)
+{
+	PNGHelper::SetSimdUnfilterEnabled(useSimd);
+	byteCount = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for(uint32_t i = 0; i < iterations; i++) {
+		for(BenchmarkImage &image : images) {
+			vector<uint8_t> pixels;
+			uint32_t width, height;
+			PNGHelper::ReadPNG(image.FileData, pixels, width, height);
+			byteCount += pixels.size();
+		}
+	}
+	double seconds = GetElapsedSeconds(start);
+	PNGHelper::SetSimdUnfilterEnabled(true);
+	return seconds;
+}
+
+static double BenchmarkEncode(vector<BenchmarkImage> &images, uint32_t iterations, int compressionLevel, uint32_t threadCount, size_t &byteCount, size_t &outputSize, uint32_t &mismatchCount)
+{
+	byteCount = 0;
+	outputSize = 0;
+	mismatchCount = 0;
+	double seconds = 0;
+	for(uint32_t i = 0; i < iterations; i++) {
+		for(BenchmarkImage &image : images) {
+			std::stringstream stream;
+			auto start = std::chrono::high_resolution_clock::now();
+			PNGHelper::WritePNG(stream, (uint32_t*)image.Pixels.data(), image.Width, image.Height, 32, compressionLevel, threadCount);
+			seconds += GetElapsedSeconds(start);
+			byteCount += image.Pixels.size();
+
+			if(i == 0) {
+				//Check that the encoded image decodes back to the same pixels
+				string output = stream.str();
+				vector<uint8_t> encoded(output.begin(), output.end());
+				vector<uint8_t> pixels;
+				uint32_t width, height;
+				if(!PNGHelper::ReadPNG(encoded, pixels, width, height) || width != image.Width || height != image.Height || pixels != image.Pixels) {
+					mismatchCount++;
+				}
+				outputSize += encoded.size();
+			}
+		}
+	}
+	return seconds;
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t iterations = 5;
+	uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+	vector<string> filenames;
+	for(int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if(arg == "-n" && i + 1 < argc) {
+			iterations = std::max(1, atoi(argv[++i]));
+		} else if(arg == "-t" && i + 1 < argc) {
+			threadCount = std::max(1, atoi(argv[++i]));
+		} else if(arg.size() > 4 && arg.substr(arg.size() - 4) == ".png") {
+			filenames.push_back(arg);
+		} else {
+			vector<string> packImages = GetPackImages(arg);
+			filenames.insert(filenames.end(), packImages.begin(), packImages.end());
+		}
+	}
+
+	vector<BenchmarkImage> images;
+	size_t fileSize = 0;
+	for(string &filename : filenames) {
+		BenchmarkImage image;
+		image.Filename = filename;
+		if(PNGHelper::ReadPNG(filename, image.Pixels, image.Width, image.Height)) {
+			ifstream file(filename, std::ios::in | std::ios::binary);
+			image.FileData.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+			fileSize += image.FileData.size();
+			images.push_back(std::move(image));
+		} else {
+			printf("Could not decode %s\n", filename.c_str());
+		}
+	}
+
+	if(images.empty()) {
+		printf("Usage: pngbench [-n iterations] [-t threads] <HD pack folder or .png file>...\n");
+		return 1;
+	}
+
+	printf("%d images, %.1f MB of PNG files, %d iterations, %d encoding threads (MB/s of decoded RGBA pixels)\n", (int)images.size(), fileSize / 1000000.0, iterations, threadCount);
+
+	size_t byteCount;
+	double seconds = BenchmarkDecode(images, iterations, false, byteCount);
+	Report("Decode (old: scalar)", byteCount, seconds);
+	seconds = BenchmarkDecode(images, iterations, true, byteCount);
+	Report("Decode (new: SIMD)", byteCount, seconds);
+
+	size_t outputSize;
+	uint32_t mismatchCount;
+	seconds = BenchmarkEncode(images, iterations, PNGHelper::DefaultCompression, 1, byteCount, outputSize, mismatchCount);
+	Report("Encode (old: level 6, 1 band)", byteCount, seconds);
+	printf("  %.1f MB written, %d images did not decode back to the same pixels\n", outputSize / 1000000.0, mismatchCount);
+
+	seconds = BenchmarkEncode(images, iterations, PNGHelper::FastCompression, threadCount, byteCount, outputSize, mismatchCount);
+	Report("Encode (new: level 1, bands)", byteCount, seconds);
+	printf("  %.1f MB written, %d images did not decode back to the same pixels\n", outputSize / 1000000.0, mismatchCount);
+
+	return 0;
+}
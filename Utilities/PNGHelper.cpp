@@ -1,9 +1,19 @@
 #include "stdafx.h"
 #include <sstream>
+#include <algorithm>
+#include <thread>
 #include "PNGHelper.h"
 #include "miniz.h"
 
-bool PNGHelper::WritePNG(std::stringstream& stream, uint32_t* buffer, uint32_t xSize, uint32_t ySize, uint32_t bitsPerPixel)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define PNG_HELPER_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define PNG_HELPER_NEON
+#endif
+
+bool PNGHelper::WritePNG(std::stringstream& stream, uint32_t* buffer, uint32_t xSize, uint32_t ySize, uint32_t bitsPerPixel, int compressionLevel, uint32_t threadCount)
 {
 	size_t pngSize = 0;
 
@@ -28,7 +38,11 @@ bool PNGHelper::WritePNG(std::stringstream& stream, uint32_t* buffer, uint32_t x
 		return false;
 	}
 
-	void* pngData = tdefl_write_image_to_png_file_in_memory_ex(convertedData.data(), xSize, ySize, bitsPerPixel / 8, &pngSize, MZ_DEFAULT_LEVEL, MZ_FALSE);
+	if(threadCount > 1 && ySize >= threadCount * MinRowsPerBand) {
+		return WritePNGBands(stream, convertedData.data(), xSize, ySize, bitsPerPixel / 8, compressionLevel, threadCount);
+	}
+
+	void* pngData = tdefl_write_image_to_png_file_in_memory_ex(convertedData.data(), xSize, ySize, bitsPerPixel / 8, &pngSize, compressionLevel, MZ_FALSE);
 	if(!pngData) {
 		std::cout << "tdefl_write_image_to_png_file_in_memory_ex() failed!" << std::endl;
 		return false;
@@ -39,10 +53,109 @@ bool PNGHelper::WritePNG(std::stringstream& stream, uint32_t* buffer, uint32_t x
 	}
 }
 
-bool PNGHelper::WritePNG(string filename, uint32_t* buffer, uint32_t xSize, uint32_t ySize, uint32_t bitsPerPixel)
+bool PNGHelper::WritePNGBands(std::stringstream& stream, uint8_t* pixels, uint32_t xSize, uint32_t ySize, uint32_t bytesPerPixel, int compressionLevel, uint32_t bandCount)
+{
+	//Each band of rows is deflated on its own thread and written as a separate IDAT chunk
+	//All bands but the last end with a sync flush (byte-aligned, not marked as the final block), so they form a single deflate stream
+	uint32_t rowSize = xSize * bytesPerPixel;
+	mz_uint flags = tdefl_create_comp_flags_from_zip_params(compressionLevel, -15, MZ_DEFAULT_STRATEGY);
+	vector<vector<uint8_t>> bands(bandCount);
+	vector<uint8_t> results(bandCount, 0);
+
+	auto compressBand = [=, &bands, &results](uint32_t band) {
+		unique_ptr<tdefl_compressor> compressor(new tdefl_compressor);
+		tdefl_put_buf_func_ptr appendOutput = [](const void* data, int length, void* output) -> mz_bool {
+			((vector<uint8_t>*)output)->insert(((vector<uint8_t>*)output)->end(), (uint8_t*)data, (uint8_t*)data + length);
+			return MZ_TRUE;
+		};
+		tdefl_init(compressor.get(), appendOutput, &bands[band], flags);
+
+		uint8_t filterType = 0;
+		uint32_t endRow = (uint32_t)((uint64_t)ySize * (band + 1) / bandCount);
+		for(uint32_t y = (uint32_t)((uint64_t)ySize * band / bandCount); y < endRow; y++) {
+			tdefl_compress_buffer(compressor.get(), &filterType, 1, TDEFL_NO_FLUSH);
+			tdefl_compress_buffer(compressor.get(), pixels + y * rowSize, rowSize, TDEFL_NO_FLUSH);
+		}
+
+		bool lastBand = band == bandCount - 1;
+		tdefl_status status = tdefl_compress_buffer(compressor.get(), nullptr, 0, lastBand ? TDEFL_FINISH : TDEFL_SYNC_FLUSH);
+		results[band] = status == (lastBand ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY);
+	};
+
+	vector<std::thread> threads;
+	for(uint32_t i = 1; i < bandCount; i++) {
+		threads.push_back(std::thread(compressBand, i));
+	}
+	compressBand(0);
+
+	//The zlib stream's checksum covers the filter bytes and rows of the whole image
+	uint8_t filterType = 0;
+	mz_ulong adler = MZ_ADLER32_INIT;
+	for(uint32_t y = 0; y < ySize; y++) {
+		adler = mz_adler32(adler, &filterType, 1);
+		adler = mz_adler32(adler, pixels + y * rowSize, rowSize);
+	}
+
+	for(std::thread &thread : threads) {
+		thread.join();
+	}
+	if(std::find(results.begin(), results.end(), 0) != results.end()) {
+		std::cout << "PNG band compression failed!" << std::endl;
+		return false;
+	}
+
+	auto writeUint32 = [](uint8_t* out, uint32_t value) {
+		out[0] = value >> 24;
+		out[1] = (value >> 16) & 0xFF;
+		out[2] = (value >> 8) & 0xFF;
+		out[3] = value & 0xFF;
+	};
+
+	auto writeChunk = [&stream, &writeUint32](const char* type, const uint8_t* data, uint32_t size) {
+		uint8_t header[8];
+		writeUint32(header, size);
+		memcpy(header + 4, type, 4);
+		stream.write((char*)header, 8);
+		stream.write((char*)data, size);
+
+		//mz_crc32 returns the initial value when data is null, so empty chunks only hash their type
+		mz_ulong crc = mz_crc32(MZ_CRC32_INIT, (uint8_t*)type, 4);
+		if(size > 0) {
+			crc = mz_crc32(crc, data, size);
+		}
+		uint8_t crcBytes[4];
+		writeUint32(crcBytes, (uint32_t)crc);
+		stream.write((char*)crcBytes, 4);
+	};
+
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+	stream.write((char*)signature, 8);
+
+	uint8_t ihdr[13] = {};
+	writeUint32(ihdr, xSize);
+	writeUint32(ihdr + 4, ySize);
+	ihdr[8] = 8; //Bit depth
+	ihdr[9] = bytesPerPixel == 4 ? 6 : 2; //Color type (RGBA or RGB)
+	writeChunk("IHDR", ihdr, sizeof(ihdr));
+
+	//zlib header (deflate, 32KB window) before the first band, checksum after the last one
+	static const uint8_t zlibHeader[2] = { 0x78, 0x01 };
+	bands.front().insert(bands.front().begin(), zlibHeader, zlibHeader + 2);
+	uint8_t checksum[4];
+	writeUint32(checksum, (uint32_t)adler);
+	bands.back().insert(bands.back().end(), checksum, checksum + 4);
+
+	for(vector<uint8_t> &band : bands) {
+		writeChunk("IDAT", band.data(), (uint32_t)band.size());
+	}
+	writeChunk("IEND", nullptr, 0);
+	return true;
+}
+
+bool PNGHelper::WritePNG(string filename, uint32_t* buffer, uint32_t xSize, uint32_t ySize, uint32_t bitsPerPixel, int compressionLevel, uint32_t threadCount)
 {
 	std::stringstream stream;
-	if(WritePNG(stream, buffer, xSize, ySize, bitsPerPixel)) {
+	if(WritePNG(stream, buffer, xSize, ySize, bitsPerPixel, compressionLevel, threadCount)) {
 		ofstream file(filename, std::ios::out | std::ios::binary);
 		if(file.good()) {
 			file << stream.rdbuf();
@@ -53,7 +166,7 @@ bool PNGHelper::WritePNG(string filename, uint32_t* buffer, uint32_t xSize, uint
 	return false;
 }
 
-bool PNGHelper::ReadPNG(vector<uint8_t> input, vector<uint8_t> &output, uint32_t &pngWidth, uint32_t &pngHeight)
+bool PNGHelper::ReadPNG(const vector<uint8_t> &input, vector<uint8_t> &output, uint32_t &pngWidth, uint32_t &pngHeight)
 {
 	unsigned long width = 0;
 	unsigned long height = 0;
@@ -76,6 +189,24 @@ bool PNGHelper::ReadPNG(vector<uint8_t> input, vector<uint8_t> &output, uint32_t
 	}
 } 
 
+bool PNGHelper::ReadPNGHeader(const vector<uint8_t> &input, uint32_t &pngWidth, uint32_t &pngHeight)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+
+	pngWidth = 0;
+	pngHeight = 0;
+
+	//The IHDR chunk must come first, right after the signature
+	if(input.size() < 29 || memcmp(input.data(), signature, 8) != 0 || memcmp(input.data() + 12, "IHDR", 4) != 0) {
+		return false;
+	}
+
+	const uint8_t* ihdr = input.data() + 16;
+	pngWidth = (ihdr[0] << 24) | (ihdr[1] << 16) | (ihdr[2] << 8) | ihdr[3];
+	pngHeight = (ihdr[4] << 24) | (ihdr[5] << 16) | (ihdr[6] << 8) | ihdr[7];
+	return pngWidth > 0 && pngHeight > 0;
+}
+
 bool PNGHelper::ReadPNG(string filename, vector<uint8_t> &pngData, uint32_t &pngWidth, uint32_t &pngHeight)
 {
 	pngWidth = 0;
@@ -95,6 +226,150 @@ bool PNGHelper::ReadPNG(string filename, vector<uint8_t> &pngData, uint32_t &png
 	return false;
 }
 
+#if defined(PNG_HELPER_SSE2) || defined(PNG_HELPER_NEON)
+//Loads/stores the bytes of a RGB or RGBA pixel
+static inline uint32_t LoadPixel(const uint8_t* src, size_t bytewidth)
+{
+	uint32_t value = 0;
+	memcpy(&value, src, bytewidth);
+	return value;
+}
+
+static inline void StorePixel(uint8_t* dst, uint32_t value, size_t bytewidth)
+{
+	memcpy(dst, &value, bytewidth);
+}
+#endif
+
+static bool _simdUnfilterEnabled = true;
+
+//Reverses a scanline's filter with SIMD instructions, returns false if the scanline must be processed by the scalar code instead
+//Up is processed 16 bytes at a time. Sub, Average and Paeth depend on the pixel to the left, so all the channels of 1 pixel (RGB or RGBA) are processed at once.
+static bool UnfilterScanlineSimd(uint8_t* recon, const uint8_t* scanline, const uint8_t* precon, size_t bytewidth, unsigned long filterType, size_t length)
+{
+#if defined(PNG_HELPER_SSE2) || defined(PNG_HELPER_NEON)
+	if(!_simdUnfilterEnabled) {
+		return false;
+	}
+
+	if(filterType == 2 && precon) {
+		size_t i = 0;
+		for(; i + 16 <= length; i += 16) {
+		#if defined(PNG_HELPER_SSE2)
+			_mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(_mm_loadu_si128((__m128i*)(scanline + i)), _mm_loadu_si128((__m128i*)(precon + i))));
+		#else
+			vst1q_u8(recon + i, vaddq_u8(vld1q_u8(scanline + i), vld1q_u8(precon + i)));
+		#endif
+		}
+		for(; i < length; i++) {
+			recon[i] = scanline[i] + precon[i];
+		}
+		return true;
+	}
+
+	if((bytewidth != 3 && bytewidth != 4) || length % bytewidth != 0 || (filterType != 1 && !precon)) {
+		return false;
+	}
+
+#if defined(PNG_HELPER_SSE2)
+	#define PNG_LOAD(ptr) _mm_cvtsi32_si128((int)LoadPixel(ptr, bytewidth))
+	#define PNG_STORE(ptr, value) StorePixel(ptr, (uint32_t)_mm_cvtsi128_si32(value), bytewidth)
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero;
+	switch(filterType) {
+		case 1:
+			for(size_t i = 0; i < length; i += bytewidth) {
+				a = _mm_add_epi8(a, PNG_LOAD(scanline + i));
+				PNG_STORE(recon + i, a);
+			}
+			return true;
+
+		case 3: {
+			//_mm_avg_epu8 rounds up, subtract the lowest bit of a^b to round down like the PNG filter does
+			const __m128i one = _mm_set1_epi8(1);
+			for(size_t i = 0; i < length; i += bytewidth) {
+				__m128i b = PNG_LOAD(precon + i);
+				__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+				a = _mm_add_epi8(average, PNG_LOAD(scanline + i));
+				PNG_STORE(recon + i, a);
+			}
+			return true;
+		}
+
+		case 4: {
+			//Computed with 16-bit values: pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|, ties favor a, then b
+			__m128i c = zero;
+			for(size_t i = 0; i < length; i += bytewidth) {
+				__m128i b = _mm_unpacklo_epi8(PNG_LOAD(precon + i), zero);
+				__m128i bc = _mm_sub_epi16(b, c);
+				__m128i ac = _mm_sub_epi16(a, c);
+				__m128i abc = _mm_add_epi16(bc, ac);
+				__m128i pa = _mm_max_epi16(bc, _mm_sub_epi16(zero, bc));
+				__m128i pb = _mm_max_epi16(ac, _mm_sub_epi16(zero, ac));
+				__m128i pc = _mm_max_epi16(abc, _mm_sub_epi16(zero, abc));
+				__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+				__m128i useA = _mm_cmpeq_epi16(smallest, pa);
+				__m128i useB = _mm_cmpeq_epi16(smallest, pb);
+				__m128i nearest = _mm_or_si128(_mm_and_si128(useB, b), _mm_andnot_si128(useB, c));
+				nearest = _mm_or_si128(_mm_and_si128(useA, a), _mm_andnot_si128(useA, nearest));
+
+				//8-bit add so each channel wraps around, the high bytes stay 0
+				a = _mm_add_epi8(nearest, _mm_unpacklo_epi8(PNG_LOAD(scanline + i), zero));
+				PNG_STORE(recon + i, _mm_packus_epi16(a, a));
+				c = b;
+			}
+			return true;
+		}
+	}
+	#undef PNG_LOAD
+	#undef PNG_STORE
+#else
+	#define PNG_LOAD(ptr) vcreate_u8((uint64_t)LoadPixel(ptr, bytewidth))
+	#define PNG_STORE(ptr, value) StorePixel(ptr, vget_lane_u32(vreinterpret_u32_u8(value), 0), bytewidth)
+	uint8x8_t a = vdup_n_u8(0);
+	switch(filterType) {
+		case 1:
+			for(size_t i = 0; i < length; i += bytewidth) {
+				a = vadd_u8(a, PNG_LOAD(scanline + i));
+				PNG_STORE(recon + i, a);
+			}
+			return true;
+
+		case 3:
+			for(size_t i = 0; i < length; i += bytewidth) {
+				a = vadd_u8(vhadd_u8(a, PNG_LOAD(precon + i)), PNG_LOAD(scanline + i));
+				PNG_STORE(recon + i, a);
+			}
+			return true;
+
+		case 4: {
+			//pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|, ties favor a, then b
+			uint8x8_t c = vdup_n_u8(0);
+			for(size_t i = 0; i < length; i += bytewidth) {
+				uint8x8_t b = PNG_LOAD(precon + i);
+				uint16x8_t pa = vabdl_u8(b, c);
+				uint16x8_t pb = vabdl_u8(a, c);
+				uint16x8_t pc = vabdq_u16(vaddl_u8(a, b), vaddl_u8(c, c));
+
+				uint8x8_t useA = vmovn_u16(vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc)));
+				uint8x8_t useB = vmovn_u16(vcleq_u16(pb, pc));
+				uint8x8_t nearest = vbsl_u8(useA, a, vbsl_u8(useB, b, c));
+
+				a = vadd_u8(nearest, PNG_LOAD(scanline + i));
+				PNG_STORE(recon + i, a);
+				c = b;
+			}
+			return true;
+		}
+	}
+	#undef PNG_LOAD
+	#undef PNG_STORE
+#endif
+#endif
+	return false;
+}
+
 /*
 decodePNG: The picoPNG function, decodes a PNG file buffer in memory, into a raw pixel buffer.
 out_image: output parameter, this will contain the raw pixels after decoding.
@@ -116,6 +391,11 @@ convert_to_rgba32: optional parameter, true by default.
   works for trusted PNG files. Use LodePNG instead of picoPNG if you need this information.
 return: 0 if success, not 0 if some error occured.
 */
+void PNGHelper::SetSimdUnfilterEnabled(bool enabled)
+{
+	_simdUnfilterEnabled = enabled;
+}
+
 int PNGHelper::DecodePNG(vector<unsigned char>& out_image, unsigned long& image_width, unsigned long& image_height, const unsigned char* in_png, size_t in_size, bool convert_to_rgba32)
 {
   // picoPNG version 20101224
@@ -144,199 +424,19 @@ int PNGHelper::DecodePNG(vector<unsigned char>& out_image, unsigned long& image_
   // is available: LodePNG (lodepng.c(pp)), which is a single source and header file.
   // Apologies for the compact code style, it's to make this tiny.
   
-  static const unsigned long LENBASE[29] =  {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
-  static const unsigned long LENEXTRA[29] = {0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0};
-  static const unsigned long DISTBASE[30] =  {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
-  static const unsigned long DISTEXTRA[30] = {0,0,0,0,1,1,2, 2, 3, 3, 4, 4, 5, 5,  6,  6,  7,  7,  8,  8,   9,   9,  10,  10,  11,  11,  12,   12,   13,   13};
-  static const unsigned long CLCL[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15}; //code length code lengths
-  struct Zlib //nested functions for zlib decompression
+  struct Zlib //zlib decompression, the deflate stream is inflated by miniz
   {
-    static unsigned long readBitFromStream(size_t& bitp, const unsigned char* bits) { unsigned long result = (bits[bitp >> 3] >> (bitp & 0x7)) & 1; bitp++; return result;}
-    static unsigned long readBitsFromStream(size_t& bitp, const unsigned char* bits, size_t nbits)
-    {
-      unsigned long result = 0;
-      for(size_t i = 0; i < nbits; i++) result += (readBitFromStream(bitp, bits)) << i;
-      return result;
-    }
-    struct HuffmanTree
-    {
-      int makeFromLengths(const std::vector<unsigned long>& bitlen, unsigned long maxbitlen)
-      { //make tree given the lengths
-        unsigned long numcodes = (unsigned long)(bitlen.size()), treepos = 0, nodefilled = 0;
-        std::vector<unsigned long> tree1d(numcodes), blcount(maxbitlen + 1, 0), nextcode(maxbitlen + 1, 0);
-        for(unsigned long bits = 0; bits < numcodes; bits++) blcount[bitlen[bits]]++; //count number of instances of each code length
-        for(unsigned long bits = 1; bits <= maxbitlen; bits++) nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
-        for(unsigned long n = 0; n < numcodes; n++) if(bitlen[n] != 0) tree1d[n] = nextcode[bitlen[n]]++; //generate all the codes
-        tree2d.clear(); tree2d.resize(numcodes * 2, 32767); //32767 here means the tree2d isn't filled there yet
-        for(unsigned long n = 0; n < numcodes; n++) //the codes
-        for(unsigned long i = 0; i < bitlen[n]; i++) //the bits for this code
-        {
-          unsigned long bit = (tree1d[n] >> (bitlen[n] - i - 1)) & 1;
-          if(treepos > numcodes - 2) return 55;
-          if(tree2d[2 * treepos + bit] == 32767) //not yet filled in
-          {
-            if(i + 1 == bitlen[n]) { tree2d[2 * treepos + bit] = n; treepos = 0; } //last bit
-            else { tree2d[2 * treepos + bit] = ++nodefilled + numcodes; treepos = nodefilled; } //addresses are encoded as values > numcodes
-          }
-          else treepos = tree2d[2 * treepos + bit] - numcodes; //subtract numcodes from address to get address value
-        }
-        return 0;
-      }
-      int decode(bool& decoded, unsigned long& result, size_t& treepos, unsigned long bit) const
-      { //Decodes a symbol from the tree
-        unsigned long numcodes = (unsigned long)tree2d.size() / 2;
-        if(treepos >= numcodes) return 11; //error: you appeared outside the codetree
-        result = tree2d[2 * treepos + bit];
-        decoded = (result < numcodes);
-        treepos = decoded ? 0 : result - numcodes;
-        return 0;
-      }
-      std::vector<unsigned long> tree2d; //2D representation of a huffman tree: The one dimension is "0" or "1", the other contains all nodes and leaves of the tree.
-    };
-    struct Inflator
-    {
-      int error;
-      void inflate(std::vector<unsigned char>& out, const std::vector<unsigned char>& in, size_t inpos = 0)
-      {
-        size_t bp = 0, pos = 0; //bit pointer and byte pointer
-        error = 0;
-        unsigned long BFINAL = 0;
-        while(!BFINAL && !error)
-        {
-          if(bp >> 3 >= in.size()) { error = 52; return; } //error, bit pointer will jump past memory
-          BFINAL = readBitFromStream(bp, &in[inpos]);
-          unsigned long BTYPE = readBitFromStream(bp, &in[inpos]); BTYPE += 2 * readBitFromStream(bp, &in[inpos]);
-          if(BTYPE == 3) { error = 20; return; } //error: invalid BTYPE
-          else if(BTYPE == 0) inflateNoCompression(out, &in[inpos], bp, pos, in.size());
-          else inflateHuffmanBlock(out, &in[inpos], bp, pos, in.size(), BTYPE);
-        }
-        if(!error) out.resize(pos); //Only now we know the true size of out, resize it to that
-      }
-      void generateFixedTrees(HuffmanTree& tree, HuffmanTree& treeD) //get the tree of a deflated block with fixed tree
-      {
-        std::vector<unsigned long> bitlen(288, 8), bitlenD(32, 5);;
-        for(size_t i = 144; i <= 255; i++) bitlen[i] = 9;
-        for(size_t i = 256; i <= 279; i++) bitlen[i] = 7;
-        tree.makeFromLengths(bitlen, 15);
-        treeD.makeFromLengths(bitlenD, 15);
-      }
-      HuffmanTree codetree, codetreeD, codelengthcodetree; //the code tree for Huffman codes, dist codes, and code length codes
-      unsigned long huffmanDecodeSymbol(const unsigned char* in, size_t& bp, const HuffmanTree& codetree, size_t inlength)
-      { //decode a single symbol from given list of bits with given code tree. return value is the symbol
-        bool decoded; unsigned long ct;
-        for(size_t treepos = 0;;)
-        {
-          if((bp & 0x07) == 0 && (bp >> 3) > inlength) { error = 10; return 0; } //error: end reached without endcode
-          error = codetree.decode(decoded, ct, treepos, readBitFromStream(bp, in)); if(error) return 0; //stop, an error happened
-          if(decoded) return ct;
-        }
-      }
-      void getTreeInflateDynamic(HuffmanTree& tree, HuffmanTree& treeD, const unsigned char* in, size_t& bp, size_t inlength)
-      { //get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree
-        std::vector<unsigned long> bitlen(288, 0), bitlenD(32, 0);
-        if(bp >> 3 >= inlength - 2) { error = 49; return; } //the bit pointer is or will go past the memory
-        size_t HLIT =  readBitsFromStream(bp, in, 5) + 257; //number of literal/length codes + 257
-        size_t HDIST = readBitsFromStream(bp, in, 5) + 1; //number of dist codes + 1
-        size_t HCLEN = readBitsFromStream(bp, in, 4) + 4; //number of code length codes + 4
-        std::vector<unsigned long> codelengthcode(19); //lengths of tree to decode the lengths of the dynamic tree
-        for(size_t i = 0; i < 19; i++) codelengthcode[CLCL[i]] = (i < HCLEN) ? readBitsFromStream(bp, in, 3) : 0;
-        error = codelengthcodetree.makeFromLengths(codelengthcode, 7); if(error) return;
-        size_t i = 0, replength;
-        while(i < HLIT + HDIST)
-        {
-          unsigned long code = huffmanDecodeSymbol(in, bp, codelengthcodetree, inlength); if(error) return;
-          if(code <= 15)  { if(i < HLIT) bitlen[i++] = code; else bitlenD[i++ - HLIT] = code; } //a length code
-          else if(code == 16) //repeat previous
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 3 + readBitsFromStream(bp, in, 2);
-            unsigned long value; //set value to the previous code
-            if((i - 1) < HLIT) value = bitlen[i - 1];
-            else value = bitlenD[i - HLIT - 1];
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 13; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = value; else bitlenD[i++ - HLIT] = value;
-            }
-          }
-          else if(code == 17) //repeat "0" 3-10 times
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 3 + readBitsFromStream(bp, in, 3);
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 14; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = 0; else bitlenD[i++ - HLIT] = 0;
-            }
-          }
-          else if(code == 18) //repeat "0" 11-138 times
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 11 + readBitsFromStream(bp, in, 7);
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 15; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = 0; else bitlenD[i++ - HLIT] = 0;
-            }
-          }
-          else { error = 16; return; } //error: somehow an unexisting code appeared. This can never happen.
-        }
-        if(bitlen[256] == 0) { error = 64; return; } //the length of the end code 256 must be larger than 0
-        error = tree.makeFromLengths(bitlen, 15); if(error) return; //now we've finally got HLIT and HDIST, so generate the code trees, and the function is done
-        error = treeD.makeFromLengths(bitlenD, 15); if(error) return;
-      }
-      void inflateHuffmanBlock(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength, unsigned long btype) 
-      {
-        if(btype == 1) { generateFixedTrees(codetree, codetreeD); }
-        else if(btype == 2) { getTreeInflateDynamic(codetree, codetreeD, in, bp, inlength); if(error) return; }
-        for(;;)
-        {
-          unsigned long code = huffmanDecodeSymbol(in, bp, codetree, inlength); if(error) return;
-          if(code == 256) return; //end code
-          else if(code <= 255) //literal symbol
-          {
-            if(pos >= out.size()) out.resize((pos + 1) * 2); //reserve more room
-            out[pos++] = (unsigned char)(code);
-          }
-          else if(code >= 257 && code <= 285) //length code
-          {
-            size_t length = LENBASE[code - 257], numextrabits = LENEXTRA[code - 257];
-            if((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-            length += readBitsFromStream(bp, in, numextrabits);
-            unsigned long codeD = huffmanDecodeSymbol(in, bp, codetreeD, inlength); if(error) return;
-            if(codeD > 29) { error = 18; return; } //error: invalid dist code (30-31 are never used)
-            unsigned long dist = DISTBASE[codeD], numextrabitsD = DISTEXTRA[codeD];
-            if((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-            dist += readBitsFromStream(bp, in, numextrabitsD);
-            size_t start = pos, back = start - dist; //backwards
-            if(pos + length >= out.size()) out.resize((pos + length) * 2); //reserve more room
-            for(size_t i = 0; i < length; i++) { out[pos++] = out[back++]; if(back >= start) back = start - dist; }
-          }
-        }
-      }
-      void inflateNoCompression(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength)
-      {
-        while((bp & 0x7) != 0) bp++; //go to first boundary of byte
-        size_t p = bp / 8;
-        if(p >= inlength - 4) { error = 52; return; } //error, bit pointer will jump past memory
-        unsigned long LEN = in[p] + 256 * in[p + 1], NLEN = in[p + 2] + 256 * in[p + 3]; p += 4;
-        if(LEN + NLEN != 65535) { error = 21; return; } //error: NLEN is not one's complement of LEN
-        if(pos + LEN >= out.size()) out.resize(pos + LEN);
-        if(p + LEN > inlength) { error = 23; return; } //error: reading outside of in buffer
-        for(unsigned long n = 0; n < LEN; n++) out[pos++] = in[p++]; //read LEN bytes of literal data
-        bp = p * 8;
-      }
-    };
     int decompress(std::vector<unsigned char>& out, const std::vector<unsigned char>& in) //returns error value
     {
-      Inflator inflator;
       if(in.size() < 2) { return 53; } //error, size of zlib data too small
       if((in[0] * 256 + in[1]) % 31 != 0) { return 24; } //error: 256 * in[0] + in[1] must be a multiple of 31, the FCHECK value is supposed to be made that way
       unsigned long CM = in[0] & 15, CINFO = (in[0] >> 4) & 15, FDICT = (in[1] >> 5) & 1;
       if(CM != 8 || CINFO > 7) { return 25; } //error: only compression method 8: inflate with sliding window of 32k is supported by the PNG spec
       if(FDICT != 0) { return 26; } //error: the specification of PNG says about the zlib stream: "The additional flags shall not specify a preset dictionary."
-      inflator.inflate(out, in, 2);
-      return inflator.error; //note: adler32 checksum was skipped and ignored
+      //the raw deflate stream follows the 2-byte header (note: adler32 checksum is skipped and ignored)
+      size_t size = tinfl_decompress_mem_to_mem(out.data(), out.size(), &in[2], in.size() - 2, 0);
+      if(size == TINFL_DECOMPRESS_MEM_TO_MEM_FAILED) { return 10; } //error: invalid deflate stream, or it doesn't fit in the image's size
+      return 0;
     }
   };
   struct PNG //nested functions for PNG decoding
@@ -411,7 +511,15 @@ int PNGHelper::DecodePNG(vector<unsigned char>& out_image, unsigned long& image_
         pos += 4; //step over CRC (which is ignored)
       }
       unsigned long bpp = getBpp(info);
-      std::vector<unsigned char> scanlines(((info.width * (info.height * bpp + 7)) / 8) + info.height); //now the out buffer will be filled
+      size_t scanlinesSize = info.height * (1 + (info.width * bpp + 7) / 8);
+      if(info.interlaceMethod == 1) //the 7 passes each have their own filter bytes and padding
+      {
+        size_t passw[7] = { (info.width + 7) / 8, (info.width + 3) / 8, (info.width + 3) / 4, (info.width + 1) / 4, (info.width + 1) / 2, (info.width + 0) / 2, (info.width + 0) / 1 };
+        size_t passh[7] = { (info.height + 7) / 8, (info.height + 7) / 8, (info.height + 3) / 8, (info.height + 3) / 4, (info.height + 1) / 4, (info.height + 1) / 2, (info.height + 0) / 2 };
+        scanlinesSize = 0;
+        for(int i = 0; i < 7; i++) scanlinesSize += passh[i] * ((passw[i] ? 1 : 0) + (passw[i] * bpp + 7) / 8);
+      }
+      std::vector<unsigned char> scanlines(std::max(scanlinesSize, ((info.width * (info.height * bpp + 7)) / 8) + info.height)); //now the out buffer will be filled
       Zlib zlib; //decompress with the Zlib decompressor
       error = zlib.decompress(scanlines, idat); if(error) return; //stop if the zlib decompressor returned an error
       size_t bytewidth = (bpp + 7) / 8, outlength = (info.height * info.width * bpp + 7) / 8;
@@ -430,13 +538,14 @@ int PNGHelper::DecodePNG(vector<unsigned char>& out_image, unsigned long& image_
         }
         else //less than 8 bits per pixel, so fill it up bit per bit
         {
-          std::vector<unsigned char> templine((info.width * bpp + 7) >> 3); //only used if bpp < 8
+          std::vector<unsigned char> templine((info.width * bpp + 7) >> 3), prevtempline(templine.size()); //only used if bpp < 8
           for(size_t y = 0, obp = 0; y < info.height; y++)
           {
             unsigned long filterType = scanlines[linestart];
-            const unsigned char* prevline = (y == 0) ? 0 : &out_[(y - 1) * info.width * bytewidth];
+            const unsigned char* prevline = (y == 0) ? 0 : &prevtempline[0]; //the previous scanline, before its bits were unpacked
             unFilterScanline(&templine[0], &scanlines[linestart + 1], prevline, bytewidth, filterType, linelength); if(error) return;
             for(size_t bp = 0; bp < info.width * bpp;) setBitOfReversedStream(obp, out_, readBitFromReversedStream(bp, &templine[0]));
+            templine.swap(prevtempline);
             linestart += (1 + linelength); //go to start of next scanline
           }
         }
@@ -472,6 +581,7 @@ int PNGHelper::DecodePNG(vector<unsigned char>& out_image, unsigned long& image_
     }
     void unFilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, unsigned long filterType, size_t length)
     {
+      if(UnfilterScanlineSimd(recon, scanline, precon, bytewidth, filterType, length)) return;
       switch(filterType)
       {
         case 0: for(size_t i = 0; i < length; i++) recon[i] = scanline[i]; break;
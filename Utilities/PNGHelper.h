@@ -4,11 +4,25 @@
 class PNGHelper
 {
 private:
+	//Images are only split into bands when each band has at least this many rows
+	static constexpr uint32_t MinRowsPerBand = 32;
+
 	static int DecodePNG(vector<unsigned char>& out_image, unsigned long& image_width, unsigned long& image_height, const unsigned char* in_png, size_t in_size, bool convert_to_rgba32 = true);
+	static bool WritePNGBands(std::stringstream &stream, uint8_t* pixels, uint32_t xSize, uint32_t ySize, uint32_t bytesPerPixel, int compressionLevel, uint32_t bandCount);
 
 public:
-	static bool WritePNG(std::stringstream &stream, uint32_t* buffer, uint32_t xSize, uint32_t ySize, uint32_t bitsPerPixel = 24);
-	static bool WritePNG(string filename, uint32_t* buffer, uint32_t xSize, uint32_t ySize, uint32_t bitsPerPixel = 24);
+	static constexpr int DefaultCompression = 6;
+	static constexpr int FastCompression = 1; //Much faster, for images that are written while emulating (e.g HD pack recording)
+
+	//When threadCount is more than 1, the image's rows are compressed in parallel bands
+	static bool WritePNG(std::stringstream &stream, uint32_t* buffer, uint32_t xSize, uint32_t ySize, uint32_t bitsPerPixel = 24, int compressionLevel = DefaultCompression, uint32_t threadCount = 1);
+	static bool WritePNG(string filename, uint32_t* buffer, uint32_t xSize, uint32_t ySize, uint32_t bitsPerPixel = 24, int compressionLevel = DefaultCompression, uint32_t threadCount = 1);
 	static bool ReadPNG(string filename, vector<uint8_t> &pngData, uint32_t &pngWidth, uint32_t &pngHeight);
-	static bool ReadPNG(vector<uint8_t> input, vector<uint8_t> &output, uint32_t &pngWidth, uint32_t &pngHeight);
+	static bool ReadPNG(const vector<uint8_t> &input, vector<uint8_t> &output, uint32_t &pngWidth, uint32_t &pngHeight);
+
+	//Reads the image's size from its header, without decoding it
+	static bool ReadPNGHeader(const vector<uint8_t> &input, uint32_t &pngWidth, uint32_t &pngHeight);
+
+	//Allows the benchmark to compare the SIMD unfilter code with the scalar code (enabled by default)
+	static void SetSimdUnfilterEnabled(bool enabled);
 };
\ No newline at end of file